@@ -94,9 +94,19 @@ typedef uint4  uvec4;
 #define RM_LOCAL __shared__
 #define RM_CONST __constant__
 #define RM_PRIVATE
+// Global pointer parameter
+#define RM_GLOBAL_PTR(T) T *
+// Scalar float
+#define RM_FLOAT float
+// Instrumented branch condition
+#define RM_BRANCH(c) (c)
 
 #define RM_STATIC_CAST(t, x) (t)(x)
 
+// Atomics(returns the old value) and memory fence
+#define RM_ATOMIC_ADD(p, v) atomicAdd(p, v)
+#define RM_MEM_FENCE() __threadfence()
+
 RM_DEVICE static inline uvec3 GlobalId() {
   return make_uint3(blockDim.x * blockIdx.x + threadIdx.x,
                blockDim.y * blockIdx.y + threadIdx.y,
@@ -156,9 +166,21 @@ RM_DEVICE static inline vec4 make_vec4(float a, float b, float c, float d) {
 #define RM_LOCAL __local
 #define RM_CONST __constant
 #define RM_PRIVATE __private
+// Global pointer parameter
+#define RM_GLOBAL_PTR(T) __global T *
+// Scalar float
+#define RM_FLOAT float
+// Instrumented branch condition
+#define RM_BRANCH(c) (c)
 
 #define RM_STATIC_CAST(t, x) (t)(x)
 
+// Atomics(returns the old value) and memory fence
+// NOTE(LTE): OpenCL 1.2 has no device scope fence. `mem_fence` + atomics on
+// `volatile` data works on major implementations.
+#define RM_ATOMIC_ADD(p, v) atomic_add(p, v)
+#define RM_MEM_FENCE() mem_fence(CLK_GLOBAL_MEM_FENCE)
+
 typedef float2 vec2;
 typedef float3 vec3;
 typedef float4 vec4;
@@ -204,7 +226,24 @@ static inline vec4 make_vec4(float a, float b, float c, float d) {
 #define RAINBOWMIST_USE_GLM (0)
 #endif
 
-#if RAINBOWMIST_USE_GLM
+#if defined(RAINBOWMIST_COUNT_FLOPS)
+
+// Counting vector types, for FLOP counting builds.
+#ifndef RAINBOWMIST_FLOPS_TYPES_
+#error "RAINBOWMIST_COUNT_FLOPS: include rainbowmist_flops.h first."
+#endif
+
+typedef rainbowmist::CountedVector<rainbowmist::CountedFloat, 2> vec2;
+typedef rainbowmist::CountedVector<rainbowmist::CountedFloat, 3> vec3;
+typedef rainbowmist::CountedVector<rainbowmist::CountedFloat, 4> vec4;
+typedef rainbowmist::CountedVector<int, 2> ivec2;
+typedef rainbowmist::CountedVector<int, 3> ivec3;
+typedef rainbowmist::CountedVector<int, 4> ivec4;
+typedef rainbowmist::CountedVector<unsigned int, 2> uvec2;
+typedef rainbowmist::CountedVector<unsigned int, 3> uvec3;
+typedef rainbowmist::CountedVector<unsigned int, 4> uvec4;
+
+#elif RAINBOWMIST_USE_GLM
 
 #ifndef GLM_FORCE_SWIZZLE
 #define GLM_FORCE_SWIZZLE
@@ -277,18 +316,85 @@ typedef swizzle::glsl::vector<unsigned int, 4> uvec4;
 #define RM_LOCAL
 #define RM_CONST const
 #define RM_PRIVATE
+// Global pointer parameter. With RAINBOWMIST_TRACE_MEMORY, accesses through it
+// are recorded; include rainbowmist_memtrace.h before the kernels then.
+// With RAINBOWMIST_COUNT_FLOPS, loaded and stored bytes are counted.
+#if defined(RAINBOWMIST_TRACE_MEMORY) && defined(RAINBOWMIST_COUNT_FLOPS)
+#error "RAINBOWMIST_TRACE_MEMORY and RAINBOWMIST_COUNT_FLOPS are exclusive."
+#elif defined(RAINBOWMIST_TRACE_MEMORY)
+#define RM_GLOBAL_PTR(T) rainbowmist::Traced<T>
+#elif defined(RAINBOWMIST_COUNT_FLOPS)
+#define RM_GLOBAL_PTR(T) rainbowmist::CountedPtr<T>
+#else
+#define RM_GLOBAL_PTR(T) T *
+#endif
+// Scalar float. Counts its arithmetic with RAINBOWMIST_COUNT_FLOPS.
+#if defined(RAINBOWMIST_COUNT_FLOPS)
+#define RM_FLOAT rainbowmist::CountedFloat
+#else
+#define RM_FLOAT float
+#endif
+// Instrumented branch condition, e.g. `if (RM_BRANCH(t < t_max))`. With
+// RAINBOWMIST_PROFILE_DIVERGENCE, records whether the lanes of a simulated
+// warp agree; include rainbowmist_divergence.h before the kernels then.
+#if defined(RAINBOWMIST_PROFILE_DIVERGENCE)
+#define RM_BRANCH(c) rainbowmist::RecordBranch(__FILE__, __LINE__, (c))
+#else
+#define RM_BRANCH(c) (c)
+#endif
 
 #define RM_STATIC_CAST(t, x) static_cast<t>(x)
 
-// Global id mechanism for C++11 mode.
-// In c++ mode, a kernel function must be called in a loop.
+#include <algorithm>
 #include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Atomics(returns the old value) and memory fence
+template <typename T>
+inline T rainbowmist_atomic_add(T *p, T v) {
+#if defined(_MSC_VER)
+  static_assert(sizeof(T) == sizeof(long), "32bit type only");
+  return static_cast<T>(_InterlockedExchangeAdd(
+      reinterpret_cast<volatile long *>(p), static_cast<long>(v)));
+#else
+  return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST);
+#endif
+}
+
+#define RM_ATOMIC_ADD(p, v) rainbowmist_atomic_add(p, v)
+#define RM_MEM_FENCE() std::atomic_thread_fence(std::memory_order_seq_cst)
+
+// Global id mechanism for C++11 mode.
+// In c++ mode, a kernel function must be called in a loop, or launched with
+// `rainbowmist::LaunchKernel`.
 static std::atomic<unsigned int> rainbowmist_gobal_id;
 static unsigned int rainbowmist_global_x_size = 0;
 static unsigned int rainbowmist_global_y_size = 0;
 static unsigned int rainbowmist_global_z_size = 0;
 
-static void SetupGlobalId(unsigned int xs, unsigned int ys = 1,
+// Set by `rainbowmist::LaunchKernel` for each worker thread. Returned from an
+// inline function so that all translation units share one instance per thread.
+struct RainbowmistThreadGlobalId {
+  bool valid;
+  unsigned int id[3];
+};
+
+inline RainbowmistThreadGlobalId &rainbowmist_tls_global_id() {
+  static thread_local RainbowmistThreadGlobalId tls = {false, {0, 0, 0}};
+  return tls;
+}
+
+static inline void SetupGlobalId(unsigned int xs, unsigned int ys = 1,
                           unsigned int zs = 1) {
   rainbowmist_gobal_id = 0;
   rainbowmist_global_x_size = xs;
@@ -297,6 +403,11 @@ static void SetupGlobalId(unsigned int xs, unsigned int ys = 1,
 }
 
 static inline uvec3 GlobalId() {
+  const RainbowmistThreadGlobalId &tls = rainbowmist_tls_global_id();
+  if (tls.valid) {
+    return uvec3(tls.id[0], tls.id[1], tls.id[2]);
+  }
+
   unsigned int id = rainbowmist_gobal_id++;
   unsigned int x = id % rainbowmist_global_x_size;
   unsigned int y = (id / rainbowmist_global_x_size) % rainbowmist_global_y_size;
@@ -312,14 +423,14 @@ static inline uvec3 GlobalId() {
   return uvec3(x, y, z);
 }
 
-inline vec2 make_vec2(float a, float b) {
+inline vec2 make_vec2(RM_FLOAT a, RM_FLOAT b) {
   vec2 ret;
   ret.x = a;
   ret.y = b;
   return ret;
 }
 
-inline vec3 make_vec3(float a, float b, float c) {
+inline vec3 make_vec3(RM_FLOAT a, RM_FLOAT b, RM_FLOAT c) {
   vec3 ret;
   ret.x = a;
   ret.y = b;
@@ -327,7 +438,7 @@ inline vec3 make_vec3(float a, float b, float c) {
   return ret;
 }
 
-inline vec4 make_vec4(float a, float b, float c, float d) {
+inline vec4 make_vec4(RM_FLOAT a, RM_FLOAT b, RM_FLOAT c, RM_FLOAT d) {
   vec4 ret;
   ret.x = a;
   ret.y = b;
@@ -336,11 +447,289 @@ inline vec4 make_vec4(float a, float b, float c, float d) {
   return ret;
 }
 
-inline vec2 vmix(const vec2 x, const vec2 y, const float a)
+inline vec2 vmix(const vec2 x, const vec2 y, const RM_FLOAT a)
 {
   return x + (y - x) * a;
 }
 
+namespace rainbowmist {
+
+///
+/// Receives callbacks around each `LaunchKernel` made on the thread that
+/// installed it with `SetLaunchObserver`(e.g. to sample hardware counters, see
+/// rainbowmist_perf.h). `WorkerBegin`/`WorkerEnd` are called on each worker
+/// thread, possibly concurrently; `thread_index` is in [0, num_threads), and 0
+/// is the launching thread. `WorkerEnd` is called even when the kernel throws,
+/// with the items finished so far.
+///
+class LaunchObserver {
+ public:
+  virtual ~LaunchObserver() {}
+  virtual void LaunchBegin(unsigned int /* num_items */,
+                           unsigned int /* num_threads */) {}
+  virtual void WorkerBegin(unsigned int /* thread_index */) {}
+  virtual void WorkerEnd(unsigned int /* thread_index */,
+                         unsigned int /* num_items */) {}
+  virtual void LaunchEnd() {}
+};
+
+inline LaunchObserver *&CurrentLaunchObserver() {
+  static thread_local LaunchObserver *observer = nullptr;
+  return observer;
+}
+
+/// Installs `observer`(or nullptr) for launches from the calling thread.
+/// Returns the previous one.
+inline LaunchObserver *SetLaunchObserver(LaunchObserver *observer) {
+  LaunchObserver *prev = CurrentLaunchObserver();
+  CurrentLaunchObserver() = observer;
+  return prev;
+}
+
+///
+/// Installs `observer` for the lifetime of the guard, and restores the
+/// previous one afterwards, also when a launch throws.
+///
+class ScopedLaunchObserver {
+ public:
+  explicit ScopedLaunchObserver(LaunchObserver *observer)
+      : prev_(SetLaunchObserver(observer)) {}
+  ~ScopedLaunchObserver() { SetLaunchObserver(prev_); }
+
+ private:
+  ScopedLaunchObserver(const ScopedLaunchObserver &) = delete;
+  ScopedLaunchObserver &operator=(const ScopedLaunchObserver &) = delete;
+
+  LaunchObserver *prev_;
+};
+
+namespace detail {
+
+///
+/// Worker threads shared by all `LaunchKernel` calls of the process, so a
+/// launch does not pay for creating threads. Threads are created on demand,
+/// up to the largest launch seen so far.
+///
+/// NOTE(LTE): The pool serves one launch at a time. A launch made while it
+/// is busy(from another thread, or from inside a kernel) gets threads of its
+/// own instead. The pool is never destroyed, so launches from static
+/// destructors still work; its threads just block until the process exits.
+///
+class LaunchThreadPool {
+ public:
+  typedef std::function<void(unsigned int)> Job;
+
+  static LaunchThreadPool &Get() {
+    static LaunchThreadPool *pool = new LaunchThreadPool();
+    return *pool;
+  }
+
+  /// Claims the pool, with at least `num_workers` threads. Returns false if
+  /// it is busy. Throws(with the pool released) if threads cannot be created.
+  bool TryAcquire(unsigned int num_workers) {
+    bool expected = false;
+    if (!busy_.compare_exchange_strong(expected, true)) {
+      return false;
+    }
+    try {
+      std::lock_guard<std::mutex> lock(mutex_);
+      while (threads_.size() < num_workers) {
+        threads_.emplace_back(&LaunchThreadPool::Loop, this,
+                              unsigned(threads_.size()) + 1, generation_);
+      }
+    } catch (...) {
+      busy_ = false;
+      throw;
+    }
+    return true;
+  }
+
+  /// Runs `job(t)` for t in [1, num_threads) on the pool and `job(0)` on the
+  /// calling thread, then releases the pool. `job` must not throw.
+  void Run(unsigned int num_threads, const Job &job) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      job_ = &job;
+      num_threads_ = num_threads;
+      pending_ = num_threads - 1;
+      generation_++;
+    }
+    work_cv_.notify_all();
+    job(0);
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      done_cv_.wait(lock, [this]() { return pending_ == 0; });
+      job_ = nullptr;
+    }
+    busy_ = false;
+  }
+
+ private:
+  LaunchThreadPool() {}
+
+  // `seen`: the last launch this thread has looked at; a new thread only
+  // joins launches started after it.
+  void Loop(unsigned int thread_index, uint64_t seen) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      work_cv_.wait(lock, [&]() { return generation_ != seen; });
+      seen = generation_;
+      if (thread_index >= num_threads_) {
+        continue;
+      }
+      const Job *job = job_;
+      lock.unlock();
+      (*job)(thread_index);
+      lock.lock();
+      if (--pending_ == 0) {
+        done_cv_.notify_one();
+      }
+    }
+  }
+
+  std::atomic<bool> busy_{false};
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  std::vector<std::thread> threads_;
+  const Job *job_ = nullptr;
+  unsigned int num_threads_ = 0;
+  unsigned int pending_ = 0;
+  uint64_t generation_ = 0;
+};
+
+}  // namespace detail
+
+///
+/// Runs `kernel()` for each global id in [0, xs) x [0, ys) x [0, zs) with
+/// `num_threads` worker threads(0 = hardware concurrency), taken from a
+/// persistent pool. Work is handed out in chunks of consecutive ids. Returns
+/// after all invocations are finished, so consecutive launches are ordered
+/// like kernels in an in-order queue. Launches may be nested(a kernel may
+/// call `LaunchKernel`).
+/// If `kernel()` throws, remaining work is skipped and the exception is
+/// rethrown once all workers have stopped.
+///
+template <class F>
+inline void LaunchKernel(unsigned int xs, unsigned int ys, unsigned int zs,
+                         F kernel, unsigned int num_threads = 0) {
+  const uint64_t total = uint64_t(xs) * uint64_t(ys) * uint64_t(zs);
+  if (total == 0) {
+    return;
+  }
+
+  const uint64_t kChunk = 64;
+  uint64_t num_chunks = (total + kChunk - 1) / kChunk;
+
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  num_threads = unsigned(std::min(uint64_t(num_threads), num_chunks));
+
+  std::atomic<uint64_t> next_chunk(0);
+  LaunchObserver *observer = CurrentLaunchObserver();
+
+  // The first exception thrown by `kernel`(or the observer) on each worker.
+  // Remaining chunks are skipped and the exception is rethrown on the calling
+  // thread.
+  std::vector<std::exception_ptr> errors(num_threads);
+  std::atomic<bool> failed(false);
+
+  auto worker = [&](unsigned int thread_index) {
+    // Restored on exit: the calling thread may be running a kernel itself.
+    RainbowmistThreadGlobalId &tls = rainbowmist_tls_global_id();
+    const RainbowmistThreadGlobalId saved = tls;
+    uint64_t num_items = 0;
+    bool observed = false;  // WorkerEnd is owed
+    try {
+      if (observer) {
+        observer->WorkerBegin(thread_index);
+        observed = true;
+      }
+      tls.valid = true;
+      while (!failed) {
+        uint64_t chunk = next_chunk++;
+        if (chunk >= num_chunks) {
+          break;
+        }
+        uint64_t end = std::min(total, (chunk + 1) * kChunk);
+        for (uint64_t id = chunk * kChunk; id < end; id++) {
+          tls.id[0] = unsigned(id % xs);
+          tls.id[1] = unsigned((id / xs) % ys);
+          tls.id[2] = unsigned((id / xs) / ys);
+          kernel();
+        }
+        num_items += end - chunk * kChunk;
+      }
+      tls = saved;
+      if (observer) {
+        observed = false;
+        // NOTE(LTE): Observer counts are 32bit; saturate for huge launches.
+        observer->WorkerEnd(
+            thread_index, unsigned(std::min(num_items, uint64_t(0xffffffffu))));
+      }
+    } catch (...) {
+      tls = saved;
+      errors[thread_index] = std::current_exception();
+      failed = true;
+      if (observed) {
+        // Lets the observer reset its per-thread state; the worker threads
+        // outlive the launch.
+        const unsigned int done =
+            unsigned(std::min(num_items, uint64_t(0xffffffffu)));
+        try {
+          observer->WorkerEnd(thread_index, done);
+        } catch (...) {
+        }
+      }
+    }
+  };
+
+  detail::LaunchThreadPool &pool = detail::LaunchThreadPool::Get();
+  const bool pooled = num_threads > 1 && pool.TryAcquire(num_threads - 1);
+
+  if (observer) {
+    observer->LaunchBegin(unsigned(std::min(total, uint64_t(0xffffffffu))),
+                          num_threads);
+  }
+
+  if (num_threads == 1) {
+    worker(0);
+  } else if (pooled) {
+    pool.Run(num_threads, worker);
+  } else {
+    std::vector<std::thread> threads;
+    try {
+      for (unsigned int t = 1; t < num_threads; t++) {
+        threads.emplace_back(worker, t);
+      }
+    } catch (...) {
+      // Stop the workers already started; a joinable std::thread must not be
+      // destroyed.
+      failed = true;
+      for (auto &th : threads) {
+        th.join();
+      }
+      throw;
+    }
+    worker(0);  // Use the calling thread as well.
+    for (auto &th : threads) {
+      th.join();
+    }
+  }
+
+  if (observer) {
+    observer->LaunchEnd();
+  }
+
+  for (const std::exception_ptr &e : errors) {
+    if (e) {
+      std::rethrow_exception(e);
+    }
+  }
+}
+
+}  // namespace rainbowmist
 
 #endif
 
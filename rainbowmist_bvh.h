@@ -0,0 +1,889 @@
+#ifndef RAINBOWMIST_BVH_H_
+#define RAINBOWMIST_BVH_H_
+
+//
+// RainbowMist BVH traversal and watertight ray-triangle intersection.
+//
+// All structures use plain float arrays, so they have the same size and layout
+// on CUDA/OpenCL/C++11(no vec3 padding issue. See `tests/alignment.kernel`).
+//
+//   RMRay       : 32 bytes
+//   RMHit       : 16 bytes
+//   RMBVHNode   : 32 bytes(binary BVH)
+//   RMBVH4Node  : 128 bytes(4-wide BVH, SoA child bounds)
+//
+// Triangles are given as `vertices`(xyz float triplets) and `faces`(3 vertex
+// indices per triangle). BVH leaves refer to a range of `prim_ids`, which maps
+// to the triangle index(`prim_ids` can be `nullptr` for identity mapping).
+//
+// For the C++11 backend, there is also a host side BVH builder and an 8 ray
+// packet traversal.
+//
+// Traversal stacks have a fixed size, so trees must be at most
+// RM_BVH_STACK_SIZE deep(leaves of the root are at depth 1). `BuildBVH` and
+// the LBVH builder(rainbowmist_lbvh.h, 64 with the default size) stay within
+// it; check trees from elsewhere with `rainbowmist::BVHDepth()`.
+//
+
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 - 2020 Light Transport Entertainment, Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "rainbowmist.h"
+
+#ifndef RM_BVH_STACK_SIZE
+#define RM_BVH_STACK_SIZE (64)
+#endif
+
+// A 4-wide node may push 3 children besides the one visited next.
+#define RM_BVH4_STACK_SIZE (3 * RM_BVH_STACK_SIZE + 1)
+
+#define RM_BVH_INF (1.0e30f)
+
+// No hit
+#define RM_BVH_INVALID_PRIM (-1)
+
+typedef struct _RMRay {
+  float org[3];
+  float tmin;
+  float dir[3];
+  float tmax;
+} RMRay;
+
+typedef struct _RMHit {
+  float t;
+  float u;  // barycentric weight of v1
+  float v;  // barycentric weight of v2
+  int prim_id;
+} RMHit;
+
+// Binary BVH node.
+//   internal : child0 = left node index(>= 0), child1 = right node index
+//   leaf     : child0 = ~(first index in prim_ids)(< 0), child1 = # of prims
+typedef struct _RMBVHNode {
+  float bmin[3];
+  int child0;
+  float bmax[3];
+  int child1;
+} RMBVHNode;
+
+// 4-wide BVH node. For each child slot i:
+//   count[i] == 0 : internal child, child[i] = node index
+//   count[i] > 0  : leaf, child[i] = first index in prim_ids
+//   count[i] < 0  : empty slot
+typedef struct _RMBVH4Node {
+  float bmin_x[4];
+  float bmin_y[4];
+  float bmin_z[4];
+  float bmax_x[4];
+  float bmax_y[4];
+  float bmax_z[4];
+  int child[4];
+  int count[4];
+} RMBVH4Node;
+
+// Per-ray constants of the watertight test(Woop, Benthin and Wald 2013,
+// "Watertight Ray/Triangle Intersection").
+typedef struct _RMWatertightRay {
+  float org[3];
+  float inv_dir[3];
+  int kx, ky, kz;
+  float sx, sy, sz;
+} RMWatertightRay;
+
+RM_DEVICE static inline float rm_bvh_minf(float a, float b) {
+  return (a < b) ? a : b;
+}
+
+RM_DEVICE static inline float rm_bvh_maxf(float a, float b) {
+  return (a > b) ? a : b;
+}
+
+RM_DEVICE static inline float rm_bvh_absf(float a) {
+  return (a < 0.0f) ? -a : a;
+}
+
+RM_DEVICE static inline RMRay rm_make_ray(vec3 org, vec3 dir, float tmin,
+                                          float tmax) {
+  RMRay ray;
+  ray.org[0] = org.x;
+  ray.org[1] = org.y;
+  ray.org[2] = org.z;
+  ray.dir[0] = dir.x;
+  ray.dir[1] = dir.y;
+  ray.dir[2] = dir.z;
+  ray.tmin = tmin;
+  ray.tmax = tmax;
+  return ray;
+}
+
+RM_DEVICE static inline vec3 rm_bvh_load_vertex(RM_GLOBAL const float *vertices,
+                                                unsigned int idx) {
+  return make_vec3(vertices[3 * idx + 0], vertices[3 * idx + 1],
+                   vertices[3 * idx + 2]);
+}
+
+RM_DEVICE static inline float rm_vec3_component(vec3 v, int i) {
+  return (i == 0) ? v.x : ((i == 1) ? v.y : v.z);
+}
+
+RM_DEVICE static inline void rm_setup_watertight_ray(const RMRay *ray,
+                                                     RMWatertightRay *wr) {
+  float ax = rm_bvh_absf(ray->dir[0]);
+  float ay = rm_bvh_absf(ray->dir[1]);
+  float az = rm_bvh_absf(ray->dir[2]);
+
+  int kz = (ax > ay) ? ((ax > az) ? 0 : 2) : ((ay > az) ? 1 : 2);
+  int kx = (kz + 1 == 3) ? 0 : (kz + 1);
+  int ky = (kx + 1 == 3) ? 0 : (kx + 1);
+
+  // Swap kx and ky to preserve the winding direction.
+  if (ray->dir[kz] < 0.0f) {
+    int tmp = kx;
+    kx = ky;
+    ky = tmp;
+  }
+
+  wr->kx = kx;
+  wr->ky = ky;
+  wr->kz = kz;
+  wr->sx = ray->dir[kx] / ray->dir[kz];
+  wr->sy = ray->dir[ky] / ray->dir[kz];
+  wr->sz = 1.0f / ray->dir[kz];
+
+  for (int i = 0; i < 3; i++) {
+    wr->org[i] = ray->org[i];
+    // Avoid inf * 0 = NaN in the slab test for axis aligned rays.
+    float d = (rm_bvh_absf(ray->dir[i]) < 1.0e-20f)
+                  ? ((ray->dir[i] < 0.0f) ? -1.0e-20f : 1.0e-20f)
+                  : ray->dir[i];
+    wr->inv_dir[i] = 1.0f / d;
+  }
+}
+
+// Watertight ray-triangle test. Returns 1 and updates `hit` when the triangle
+// is hit in (tmin, hit->t).
+RM_DEVICE static inline int rm_intersect_triangle_watertight(
+    const RMWatertightRay *wr, vec3 v0, vec3 v1, vec3 v2, float tmin,
+    RMHit *hit) {
+  vec3 org = make_vec3(wr->org[0], wr->org[1], wr->org[2]);
+  vec3 a = v0 - org;
+  vec3 b = v1 - org;
+  vec3 c = v2 - org;
+
+  float a_kz = rm_vec3_component(a, wr->kz);
+  float b_kz = rm_vec3_component(b, wr->kz);
+  float c_kz = rm_vec3_component(c, wr->kz);
+
+  float ax = rm_vec3_component(a, wr->kx) - wr->sx * a_kz;
+  float ay = rm_vec3_component(a, wr->ky) - wr->sy * a_kz;
+  float bx = rm_vec3_component(b, wr->kx) - wr->sx * b_kz;
+  float by = rm_vec3_component(b, wr->ky) - wr->sy * b_kz;
+  float cx = rm_vec3_component(c, wr->kx) - wr->sx * c_kz;
+  float cy = rm_vec3_component(c, wr->ky) - wr->sy * c_kz;
+
+  // Scaled barycentric coordinates.
+  // NOTE(LTE): The paper falls back to double precision when an edge function
+  // is exactly zero. We don't, since double is optional in OpenCL 1.2.
+  float u = cx * by - cy * bx;
+  float v = ax * cy - ay * cx;
+  float w = bx * ay - by * ax;
+
+  if (((u < 0.0f) || (v < 0.0f) || (w < 0.0f)) &&
+      ((u > 0.0f) || (v > 0.0f) || (w > 0.0f))) {
+    return 0;
+  }
+
+  float det = u + v + w;
+  if (det == 0.0f) {
+    return 0;
+  }
+
+  float az = wr->sz * a_kz;
+  float bz = wr->sz * b_kz;
+  float cz = wr->sz * c_kz;
+  float t_scaled = u * az + v * bz + w * cz;
+
+  if (det < 0.0f) {
+    det = -det;
+    t_scaled = -t_scaled;
+    u = -u;
+    v = -v;
+    w = -w;
+  }
+
+  if ((t_scaled <= tmin * det) || (t_scaled >= hit->t * det)) {
+    return 0;
+  }
+
+  float inv_det = 1.0f / det;
+  hit->t = t_scaled * inv_det;
+  hit->u = v * inv_det;
+  hit->v = w * inv_det;
+  return 1;
+}
+
+// Robust slab test(Ize 2013, "Robust BVH Ray Traversal"). Returns the entry
+// distance or RM_BVH_INF when the box is missed.
+RM_DEVICE static inline float rm_intersect_box(const RMWatertightRay *wr,
+                                               float bmin_x, float bmin_y,
+                                               float bmin_z, float bmax_x,
+                                               float bmax_y, float bmax_z,
+                                               float tmin, float tmax) {
+  float tx0 = (bmin_x - wr->org[0]) * wr->inv_dir[0];
+  float tx1 = (bmax_x - wr->org[0]) * wr->inv_dir[0];
+  float ty0 = (bmin_y - wr->org[1]) * wr->inv_dir[1];
+  float ty1 = (bmax_y - wr->org[1]) * wr->inv_dir[1];
+  float tz0 = (bmin_z - wr->org[2]) * wr->inv_dir[2];
+  float tz1 = (bmax_z - wr->org[2]) * wr->inv_dir[2];
+
+  float t0 = rm_bvh_maxf(
+      tmin, rm_bvh_maxf(rm_bvh_minf(tx0, tx1),
+                        rm_bvh_maxf(rm_bvh_minf(ty0, ty1), rm_bvh_minf(tz0, tz1))));
+  float t1 = rm_bvh_minf(
+      tmax, rm_bvh_minf(rm_bvh_maxf(tx0, tx1),
+                        rm_bvh_minf(rm_bvh_maxf(ty0, ty1), rm_bvh_maxf(tz0, tz1))));
+
+  // 1 + 2 * gamma(3)
+  t1 *= 1.00000024f;
+
+  return (t0 <= t1) ? t0 : RM_BVH_INF;
+}
+
+RM_DEVICE static inline int rm_bvh_intersect_leaf(
+    const RMWatertightRay *wr, RM_GLOBAL const float *vertices,
+    RM_GLOBAL const unsigned int *faces, RM_GLOBAL const unsigned int *prim_ids,
+    int first, int count, float tmin, int any_hit, RMHit *hit) {
+  int found = 0;
+  for (int i = first; i < first + count; i++) {
+    unsigned int prim = prim_ids ? prim_ids[i] : RM_STATIC_CAST(unsigned int, i);
+    vec3 v0 = rm_bvh_load_vertex(vertices, faces[3 * prim + 0]);
+    vec3 v1 = rm_bvh_load_vertex(vertices, faces[3 * prim + 1]);
+    vec3 v2 = rm_bvh_load_vertex(vertices, faces[3 * prim + 2]);
+    if (rm_intersect_triangle_watertight(wr, v0, v1, v2, tmin, hit)) {
+      hit->prim_id = RM_STATIC_CAST(int, prim);
+      found = 1;
+      if (any_hit) {
+        return 1;
+      }
+    }
+  }
+  return found;
+}
+
+// Closest hit(or any hit when `any_hit` is 1) traversal of a binary BVH.
+// Returns 1 when the ray hits a triangle. `nodes` is 0 for an empty tree(the
+// builders give no nodes for no triangles), which nothing hits.
+RM_DEVICE static inline int rm_bvh_traverse(
+    RM_GLOBAL const RMBVHNode *nodes, RM_GLOBAL const float *vertices,
+    RM_GLOBAL const unsigned int *faces, RM_GLOBAL const unsigned int *prim_ids,
+    const RMRay *ray, int any_hit, RMHit *hit) {
+  RMWatertightRay wr;
+  rm_setup_watertight_ray(ray, &wr);
+
+  hit->t = ray->tmax;
+  hit->u = 0.0f;
+  hit->v = 0.0f;
+  hit->prim_id = RM_BVH_INVALID_PRIM;
+
+  if (!nodes) {
+    return 0;
+  }
+
+  int stack[RM_BVH_STACK_SIZE];
+  int sp = 0;
+  int node_idx = 0;
+
+  if (rm_intersect_box(&wr, nodes[0].bmin[0], nodes[0].bmin[1],
+                       nodes[0].bmin[2], nodes[0].bmax[0], nodes[0].bmax[1],
+                       nodes[0].bmax[2], ray->tmin, hit->t) >= RM_BVH_INF) {
+    return 0;
+  }
+
+  for (;;) {
+    RMBVHNode node = nodes[node_idx];
+    if (node.child0 < 0) {
+      if (rm_bvh_intersect_leaf(&wr, vertices, faces, prim_ids, ~node.child0,
+                                node.child1, ray->tmin, any_hit, hit) &&
+          any_hit) {
+        return 1;
+      }
+    } else {
+      RMBVHNode c0 = nodes[node.child0];
+      RMBVHNode c1 = nodes[node.child1];
+      float t0 = rm_intersect_box(&wr, c0.bmin[0], c0.bmin[1], c0.bmin[2],
+                                  c0.bmax[0], c0.bmax[1], c0.bmax[2],
+                                  ray->tmin, hit->t);
+      float t1 = rm_intersect_box(&wr, c1.bmin[0], c1.bmin[1], c1.bmin[2],
+                                  c1.bmax[0], c1.bmax[1], c1.bmax[2],
+                                  ray->tmin, hit->t);
+      if ((t0 < RM_BVH_INF) && (t1 < RM_BVH_INF)) {
+        int near_idx = (t0 <= t1) ? node.child0 : node.child1;
+        int far_idx = (t0 <= t1) ? node.child1 : node.child0;
+        // One entry per level above `near_idx`, so this fits for trees within
+        // RM_BVH_STACK_SIZE.
+        stack[sp++] = far_idx;
+        node_idx = near_idx;
+        continue;
+      } else if (t0 < RM_BVH_INF) {
+        node_idx = node.child0;
+        continue;
+      } else if (t1 < RM_BVH_INF) {
+        node_idx = node.child1;
+        continue;
+      }
+    }
+
+    if (sp == 0) {
+      break;
+    }
+    node_idx = stack[--sp];
+  }
+
+  return (hit->prim_id != RM_BVH_INVALID_PRIM) ? 1 : 0;
+}
+
+// Closest hit traversal of a 4-wide BVH. `nodes` is 0 for an empty tree.
+RM_DEVICE static inline int rm_bvh4_traverse(
+    RM_GLOBAL const RMBVH4Node *nodes, RM_GLOBAL const float *vertices,
+    RM_GLOBAL const unsigned int *faces, RM_GLOBAL const unsigned int *prim_ids,
+    const RMRay *ray, RMHit *hit) {
+  RMWatertightRay wr;
+  rm_setup_watertight_ray(ray, &wr);
+
+  hit->t = ray->tmax;
+  hit->u = 0.0f;
+  hit->v = 0.0f;
+  hit->prim_id = RM_BVH_INVALID_PRIM;
+
+  if (!nodes) {
+    return 0;
+  }
+
+  // Stack entries are (index, count) pairs so that leaves can be deferred too.
+  int stack_idx[RM_BVH4_STACK_SIZE];
+  int stack_count[RM_BVH4_STACK_SIZE];
+  float stack_t[RM_BVH4_STACK_SIZE];
+  int sp = 0;
+
+  stack_idx[0] = 0;
+  stack_count[0] = 0;
+  stack_t[0] = ray->tmin;
+  sp = 1;
+
+  while (sp > 0) {
+    sp--;
+    int idx = stack_idx[sp];
+    int count = stack_count[sp];
+    if (stack_t[sp] >= hit->t) {
+      continue;  // culled by a closer hit found after this entry was pushed
+    }
+
+    if (count > 0) {
+      rm_bvh_intersect_leaf(&wr, vertices, faces, prim_ids, idx, count,
+                            ray->tmin, 0, hit);
+      continue;
+    }
+
+    RM_GLOBAL const RMBVH4Node *node = &nodes[idx];
+
+    // Push hit children far to near, so that the nearest one is popped first.
+    float ts[4];
+    int order[4];
+    int num_hits = 0;
+    for (int i = 0; i < 4; i++) {
+      if (node->count[i] < 0) {
+        continue;
+      }
+      float t = rm_intersect_box(&wr, node->bmin_x[i], node->bmin_y[i],
+                                 node->bmin_z[i], node->bmax_x[i],
+                                 node->bmax_y[i], node->bmax_z[i], ray->tmin,
+                                 hit->t);
+      if (t < RM_BVH_INF) {
+        // insertion sort, descending t
+        int j = num_hits;
+        while ((j > 0) && (ts[j - 1] < t)) {
+          ts[j] = ts[j - 1];
+          order[j] = order[j - 1];
+          j--;
+        }
+        ts[j] = t;
+        order[j] = i;
+        num_hits++;
+      }
+    }
+
+    // At most 3 entries per level remain, so this fits for trees collapsed
+    // from a binary BVH within RM_BVH_STACK_SIZE.
+    for (int k = 0; k < num_hits; k++) {
+      stack_idx[sp] = node->child[order[k]];
+      stack_count[sp] = node->count[order[k]];
+      stack_t[sp] = ts[k];
+      sp++;
+    }
+  }
+
+  return (hit->prim_id != RM_BVH_INVALID_PRIM) ? 1 : 0;
+}
+
+#if defined(RAINBOWMIST_CPP11)
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace rainbowmist {
+
+// Top-down median split builder for the C++11 backend. Mainly used for
+// testing and for small/static meshes. See `rainbowmist_lbvh.h` for a parallel
+// builder which also runs on GPU.
+inline void BuildBVH(const float *vertices, const unsigned int *faces,
+                     size_t num_faces, std::vector<RMBVHNode> *nodes,
+                     std::vector<unsigned int> *prim_ids,
+                     int max_leaf_size = 4) {
+  nodes->clear();
+  prim_ids->resize(num_faces);
+  if (num_faces == 0) {
+    return;
+  }
+
+  std::vector<float> centroids(num_faces * 3);
+  std::vector<float> prim_bounds(num_faces * 6);
+  for (size_t i = 0; i < num_faces; i++) {
+    (*prim_ids)[i] = static_cast<unsigned int>(i);
+    for (size_t k = 0; k < 3; k++) {
+      float a = vertices[3 * faces[3 * i + 0] + k];
+      float b = vertices[3 * faces[3 * i + 1] + k];
+      float c = vertices[3 * faces[3 * i + 2] + k];
+      prim_bounds[6 * i + k] = std::min(a, std::min(b, c));
+      prim_bounds[6 * i + 3 + k] = std::max(a, std::max(b, c));
+      centroids[3 * i + k] =
+          0.5f * (prim_bounds[6 * i + k] + prim_bounds[6 * i + 3 + k]);
+    }
+  }
+
+  struct Task {
+    int node;
+    size_t begin, end;
+    int depth;
+  };
+
+  nodes->reserve(2 * num_faces / size_t(std::max(1, max_leaf_size)) + 1);
+  nodes->push_back(RMBVHNode());
+
+  std::vector<Task> tasks;
+  tasks.push_back(Task{0, 0, num_faces, 0});
+
+  while (!tasks.empty()) {
+    Task task = tasks.back();
+    tasks.pop_back();
+
+    float bmin[3] = {RM_BVH_INF, RM_BVH_INF, RM_BVH_INF};
+    float bmax[3] = {-RM_BVH_INF, -RM_BVH_INF, -RM_BVH_INF};
+    float cmin[3] = {RM_BVH_INF, RM_BVH_INF, RM_BVH_INF};
+    float cmax[3] = {-RM_BVH_INF, -RM_BVH_INF, -RM_BVH_INF};
+    for (size_t i = task.begin; i < task.end; i++) {
+      unsigned int p = (*prim_ids)[i];
+      for (size_t k = 0; k < 3; k++) {
+        bmin[k] = std::min(bmin[k], prim_bounds[6 * p + k]);
+        bmax[k] = std::max(bmax[k], prim_bounds[6 * p + 3 + k]);
+        cmin[k] = std::min(cmin[k], centroids[3 * p + k]);
+        cmax[k] = std::max(cmax[k], centroids[3 * p + k]);
+      }
+    }
+
+    RMBVHNode &node = (*nodes)[size_t(task.node)];
+    for (int k = 0; k < 3; k++) {
+      node.bmin[k] = bmin[k];
+      node.bmax[k] = bmax[k];
+    }
+
+    size_t n = task.end - task.begin;
+    int axis = 0;
+    for (int k = 1; k < 3; k++) {
+      if ((cmax[k] - cmin[k]) > (cmax[axis] - cmin[axis])) axis = k;
+    }
+
+    // NOTE(LTE): Median splits are balanced, so the depth limit is only there
+    // to guarantee traversal stacks(RM_BVH_STACK_SIZE) never overflow.
+    if ((n <= size_t(max_leaf_size)) || (cmax[axis] <= cmin[axis]) ||
+        (task.depth >= RM_BVH_STACK_SIZE)) {
+      node.child0 = ~int(task.begin);
+      node.child1 = int(n);
+      continue;
+    }
+
+    size_t mid = task.begin + n / 2;
+    std::nth_element(prim_ids->begin() + std::ptrdiff_t(task.begin),
+                     prim_ids->begin() + std::ptrdiff_t(mid),
+                     prim_ids->begin() + std::ptrdiff_t(task.end),
+                     [&centroids, axis](unsigned int a, unsigned int b) {
+                       return centroids[3 * a + size_t(axis)] <
+                              centroids[3 * b + size_t(axis)];
+                     });
+
+    int left = int(nodes->size());
+    nodes->push_back(RMBVHNode());
+    nodes->push_back(RMBVHNode());
+    (*nodes)[size_t(task.node)].child0 = left;
+    (*nodes)[size_t(task.node)].child1 = left + 1;
+
+    tasks.push_back(Task{left + 1, mid, task.end, task.depth + 1});
+    tasks.push_back(Task{left, task.begin, mid, task.depth + 1});
+  }
+}
+
+// Depth of the deepest leaf of a binary BVH(1 for leaves of the root, 0 for a
+// single leaf). Traversal needs it to be at most RM_BVH_STACK_SIZE.
+inline int BVHDepth(const std::vector<RMBVHNode> &nodes) {
+  if (nodes.empty()) {
+    return 0;
+  }
+  int max_depth = 0;
+  std::vector<std::pair<int, int>> todo(1, std::make_pair(0, 0));
+  while (!todo.empty()) {
+    std::pair<int, int> item = todo.back();
+    todo.pop_back();
+    const RMBVHNode &node = nodes[size_t(item.first)];
+    if (node.child0 < 0) {
+      max_depth = std::max(max_depth, item.second);
+      continue;
+    }
+    todo.push_back(std::make_pair(node.child0, item.second + 1));
+    todo.push_back(std::make_pair(node.child1, item.second + 1));
+  }
+  return max_depth;
+}
+
+// Collapses a binary BVH into a 4-wide BVH. Leaves are kept as is.
+inline void CollapseBVH4(const std::vector<RMBVHNode> &nodes2,
+                         std::vector<RMBVH4Node> *nodes4) {
+  nodes4->clear();
+  if (nodes2.empty()) {
+    return;
+  }
+
+  struct Item {
+    int node2;   // source node
+    int node4;   // destination node
+  };
+
+  std::vector<Item> items;
+  nodes4->push_back(RMBVH4Node());
+
+  if (nodes2[0].child0 < 0) {
+    // Single leaf. Wrap it in a node with one child.
+    RMBVH4Node &n = (*nodes4)[0];
+    for (int i = 0; i < 4; i++) {
+      n.count[i] = -1;
+      n.child[i] = 0;
+      n.bmin_x[i] = n.bmin_y[i] = n.bmin_z[i] = RM_BVH_INF;
+      n.bmax_x[i] = n.bmax_y[i] = n.bmax_z[i] = -RM_BVH_INF;
+    }
+    n.bmin_x[0] = nodes2[0].bmin[0];
+    n.bmin_y[0] = nodes2[0].bmin[1];
+    n.bmin_z[0] = nodes2[0].bmin[2];
+    n.bmax_x[0] = nodes2[0].bmax[0];
+    n.bmax_y[0] = nodes2[0].bmax[1];
+    n.bmax_z[0] = nodes2[0].bmax[2];
+    n.child[0] = ~nodes2[0].child0;
+    n.count[0] = nodes2[0].child1;
+    return;
+  }
+
+  items.push_back(Item{0, 0});
+
+  while (!items.empty()) {
+    Item item = items.back();
+    items.pop_back();
+
+    // Open the child with the largest surface area until we have 4 children.
+    int children[4] = {nodes2[size_t(item.node2)].child0,
+                       nodes2[size_t(item.node2)].child1, -1, -1};
+    int num_children = 2;
+    while (num_children < 4) {
+      int best = -1;
+      float best_area = -1.0f;
+      for (int i = 0; i < num_children; i++) {
+        const RMBVHNode &c = nodes2[size_t(children[i])];
+        if (c.child0 < 0) continue;
+        float dx = c.bmax[0] - c.bmin[0];
+        float dy = c.bmax[1] - c.bmin[1];
+        float dz = c.bmax[2] - c.bmin[2];
+        float area = dx * dy + dy * dz + dz * dx;
+        if (area > best_area) {
+          best_area = area;
+          best = i;
+        }
+      }
+      if (best < 0) break;
+      const RMBVHNode &c = nodes2[size_t(children[best])];
+      children[best] = c.child0;
+      children[num_children++] = c.child1;
+    }
+
+    RMBVH4Node n;
+    for (int i = 0; i < 4; i++) {
+      if (i >= num_children) {
+        n.count[i] = -1;
+        n.child[i] = 0;
+        n.bmin_x[i] = n.bmin_y[i] = n.bmin_z[i] = RM_BVH_INF;
+        n.bmax_x[i] = n.bmax_y[i] = n.bmax_z[i] = -RM_BVH_INF;
+        continue;
+      }
+      const RMBVHNode &c = nodes2[size_t(children[i])];
+      n.bmin_x[i] = c.bmin[0];
+      n.bmin_y[i] = c.bmin[1];
+      n.bmin_z[i] = c.bmin[2];
+      n.bmax_x[i] = c.bmax[0];
+      n.bmax_y[i] = c.bmax[1];
+      n.bmax_z[i] = c.bmax[2];
+      if (c.child0 < 0) {
+        n.child[i] = ~c.child0;
+        n.count[i] = c.child1;
+      } else {
+        n.child[i] = int(nodes4->size());
+        n.count[i] = 0;
+        nodes4->push_back(RMBVH4Node());
+        items.push_back(Item{children[i], n.child[i]});
+      }
+    }
+    (*nodes4)[size_t(item.node4)] = n;
+  }
+}
+
+// ----------------------------------------------------------------------------
+// 8 ray packet traversal for the C++11 backend.
+// Rays are stored in SoA layout so that each lane loop maps to one 8-wide SIMD
+// operation(AVX) or two 4-wide ones(SSE/NEON) when vectorized.
+
+static const int kPacketSize = 8;
+
+struct RayPacket8 {
+  alignas(32) float org[3][kPacketSize];
+  alignas(32) float dir[3][kPacketSize];
+  alignas(32) float tmin[kPacketSize];
+  alignas(32) float tmax[kPacketSize];
+};
+
+struct HitPacket8 {
+  alignas(32) float t[kPacketSize];
+  alignas(32) float u[kPacketSize];
+  alignas(32) float v[kPacketSize];
+  alignas(32) int prim_id[kPacketSize];
+};
+
+namespace bvh_detail {
+
+struct PacketConstants {
+  alignas(32) float inv_dir[3][kPacketSize];
+  alignas(32) float org_inv[3][kPacketSize];  // org * inv_dir
+};
+
+// Returns a bit mask of lanes which hit the box before their current `t`.
+inline unsigned int IntersectBoxPacket(const PacketConstants &pc,
+                                       const RayPacket8 &rays,
+                                       const HitPacket8 &hits,
+                                       const float bmin[3],
+                                       const float bmax[3], float *tnear) {
+#if defined(__AVX__)
+  __m256 t0 = _mm256_load_ps(rays.tmin);
+  __m256 t1 = _mm256_load_ps(hits.t);
+  for (int k = 0; k < 3; k++) {
+    __m256 inv = _mm256_load_ps(pc.inv_dir[k]);
+    __m256 oi = _mm256_load_ps(pc.org_inv[k]);
+    __m256 a = _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(bmin[k]), inv), oi);
+    __m256 b = _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(bmax[k]), inv), oi);
+    t0 = _mm256_max_ps(t0, _mm256_min_ps(a, b));
+    t1 = _mm256_min_ps(t1, _mm256_max_ps(a, b));
+  }
+  t1 = _mm256_mul_ps(t1, _mm256_set1_ps(1.00000024f));
+  __m256 mask = _mm256_cmp_ps(t0, t1, _CMP_LE_OQ);
+  _mm256_storeu_ps(tnear, _mm256_blendv_ps(_mm256_set1_ps(RM_BVH_INF), t0, mask));
+  return static_cast<unsigned int>(_mm256_movemask_ps(mask));
+#elif defined(__SSE2__)
+  // Two 4-wide halves. SSE2 is always available on x86-64.
+  unsigned int result = 0;
+  for (int h = 0; h < kPacketSize; h += 4) {
+    __m128 t0 = _mm_load_ps(rays.tmin + h);
+    __m128 t1 = _mm_load_ps(hits.t + h);
+    for (int k = 0; k < 3; k++) {
+      __m128 inv = _mm_load_ps(pc.inv_dir[k] + h);
+      __m128 oi = _mm_load_ps(pc.org_inv[k] + h);
+      __m128 a = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(bmin[k]), inv), oi);
+      __m128 b = _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(bmax[k]), inv), oi);
+      t0 = _mm_max_ps(t0, _mm_min_ps(a, b));
+      t1 = _mm_min_ps(t1, _mm_max_ps(a, b));
+    }
+    t1 = _mm_mul_ps(t1, _mm_set1_ps(1.00000024f));
+    __m128 mask = _mm_cmple_ps(t0, t1);
+    _mm_storeu_ps(tnear + h,
+                  _mm_or_ps(_mm_and_ps(mask, t0),
+                            _mm_andnot_ps(mask, _mm_set1_ps(RM_BVH_INF))));
+    result |= static_cast<unsigned int>(_mm_movemask_ps(mask)) << h;
+  }
+  return result;
+#else
+  unsigned int mask = 0;
+  for (int i = 0; i < kPacketSize; i++) {
+    float t0 = rays.tmin[i];
+    float t1 = hits.t[i];
+    for (int k = 0; k < 3; k++) {
+      float a = bmin[k] * pc.inv_dir[k][i] - pc.org_inv[k][i];
+      float b = bmax[k] * pc.inv_dir[k][i] - pc.org_inv[k][i];
+      t0 = std::max(t0, std::min(a, b));
+      t1 = std::min(t1, std::max(a, b));
+    }
+    t1 *= 1.00000024f;
+    bool h = (t0 <= t1);
+    tnear[i] = h ? t0 : RM_BVH_INF;
+    mask |= (h ? 1u : 0u) << i;
+  }
+  return mask;
+#endif
+}
+
+}  // namespace bvh_detail
+
+// Closest hit traversal of 8 rays at once. All lanes share one traversal
+// stack; a node is visited when any active lane hits it. Works best for
+// coherent rays(e.g. primary rays of a 4x2 pixel block). `nodes` is nullptr
+// for an empty tree.
+inline void TraversePacket8(const RMBVHNode *nodes, const float *vertices,
+                            const unsigned int *faces,
+                            const unsigned int *prim_ids,
+                            const RayPacket8 &rays, HitPacket8 *hits) {
+  bvh_detail::PacketConstants pc;
+  RMWatertightRay wr[kPacketSize];
+  for (int i = 0; i < kPacketSize; i++) {
+    RMRay r;
+    for (int k = 0; k < 3; k++) {
+      r.org[k] = rays.org[k][i];
+      r.dir[k] = rays.dir[k][i];
+    }
+    r.tmin = rays.tmin[i];
+    r.tmax = rays.tmax[i];
+    rm_setup_watertight_ray(&r, &wr[i]);
+    for (int k = 0; k < 3; k++) {
+      pc.inv_dir[k][i] = wr[i].inv_dir[k];
+      pc.org_inv[k][i] = wr[i].org[k] * wr[i].inv_dir[k];
+    }
+    hits->t[i] = rays.tmax[i];
+    hits->u[i] = 0.0f;
+    hits->v[i] = 0.0f;
+    hits->prim_id[i] = RM_BVH_INVALID_PRIM;
+  }
+  if (!nodes) {
+    return;
+  }
+
+  // Each stack entry carries the mask of lanes which reached the node. Only
+  // the far child is pushed, so there is one entry per level at most, as in
+  // `rm_bvh_traverse`.
+  int stack[RM_BVH_STACK_SIZE];
+  unsigned int stack_mask[RM_BVH_STACK_SIZE];
+  int sp = 0;
+  int node_idx = 0;
+  unsigned int active = (1u << kPacketSize) - 1u;
+
+  float tnear0[kPacketSize], tnear1[kPacketSize];
+
+  for (;;) {
+    const RMBVHNode &node = nodes[node_idx];
+
+    if (node.child0 < 0) {
+      int first = ~node.child0;
+      for (int p = first; p < first + node.child1; p++) {
+        unsigned int prim = prim_ids ? prim_ids[p] : static_cast<unsigned int>(p);
+        vec3 v0 = rm_bvh_load_vertex(vertices, faces[3 * prim + 0]);
+        vec3 v1 = rm_bvh_load_vertex(vertices, faces[3 * prim + 1]);
+        vec3 v2 = rm_bvh_load_vertex(vertices, faces[3 * prim + 2]);
+        for (int i = 0; i < kPacketSize; i++) {
+          if (!(active & (1u << i))) continue;
+          RMHit h;
+          h.t = hits->t[i];
+          if (rm_intersect_triangle_watertight(&wr[i], v0, v1, v2,
+                                               rays.tmin[i], &h)) {
+            hits->t[i] = h.t;
+            hits->u[i] = h.u;
+            hits->v[i] = h.v;
+            hits->prim_id[i] = int(prim);
+          }
+        }
+      }
+      if (sp == 0) {
+        break;
+      }
+      sp--;
+      node_idx = stack[sp];
+      active = stack_mask[sp];
+      continue;
+    }
+
+    const RMBVHNode &c0 = nodes[node.child0];
+    const RMBVHNode &c1 = nodes[node.child1];
+    unsigned int m0 = active & bvh_detail::IntersectBoxPacket(
+                                   pc, rays, *hits, c0.bmin, c0.bmax, tnear0);
+    unsigned int m1 = active & bvh_detail::IntersectBoxPacket(
+                                   pc, rays, *hits, c1.bmin, c1.bmax, tnear1);
+
+    if (m0 && m1) {
+      // Visit the child which is nearer for the majority of lanes first.
+      int votes = 0;
+      for (int i = 0; i < kPacketSize; i++) {
+        votes += (tnear0[i] <= tnear1[i]) ? 1 : -1;
+      }
+      bool near0 = (votes >= 0);
+      assert((sp < RM_BVH_STACK_SIZE) && "BVH deeper than RM_BVH_STACK_SIZE");
+      stack[sp] = near0 ? node.child1 : node.child0;
+      stack_mask[sp] = near0 ? m1 : m0;
+      sp++;
+      node_idx = near0 ? node.child0 : node.child1;
+      active = near0 ? m0 : m1;
+    } else if (m0 || m1) {
+      node_idx = m0 ? node.child0 : node.child1;
+      active = m0 ? m0 : m1;
+    } else {
+      if (sp == 0) {
+        break;
+      }
+      sp--;
+      node_idx = stack[sp];
+      active = stack_mask[sp];
+    }
+  }
+}
+
+}  // namespace rainbowmist
+
+#endif  // RAINBOWMIST_CPP11
+
+#endif  // RAINBOWMIST_BVH_H_
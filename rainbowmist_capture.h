@@ -0,0 +1,708 @@
+#ifndef RAINBOWMIST_CAPTURE_H_
+#define RAINBOWMIST_CAPTURE_H_
+
+//
+// RainbowMist launch capture and replay.
+//
+// Records kernel launches(the kernel name and build options, the global
+// range, scalar arguments and the contents of every bound buffer) to a
+// capture file, so a launch seen in a running program can be benchmarked
+// again offline(tests/replay.cc), on any backend.
+//
+//   rainbowmist::LaunchCapture capture;
+//   capture.Open("frame.rmcap");
+//
+//   // C++11 backend: a kernel from the registry(rainbowmist_registry.h).
+//   // Buffer sizes(bytes) come from the host; scalars' are ignored.
+//   const void *args[] = {&out, &in, &s};
+//   size_t sizes[] = {n * sizeof(float), n * sizeof(float), 0};
+//   capture.Launch(*info, args, sizes, n);
+//
+//   // OpenCL/CUDA: record the host copies of the buffers before launching,
+//   // and the work-group(block) width, which replay launches with.
+//   capture.Record("scale", options, {rainbowmist::CaptureBuffer(host_out, n),
+//                                     rainbowmist::CaptureBuffer(host_in, n),
+//                                     rainbowmist::CaptureScalar(s)},
+//                  n, 1, 1, 64);
+//
+//   capture.Close();
+//
+// File layout(native byte order): a 64 byte header, the buffer and scalar
+// contents, each 64 byte aligned, then the tables written by `Close`.
+// Identical contents are stored once, however many launches bind them, so
+// capturing a loop over mostly unchanged data stays small. `CaptureFile`
+// maps the file and hands out pointers into it; `HostReplay` runs read-only
+// buffers straight from the mapping.
+//
+// NOTE(LTE): A capture holds the inputs of each launch only. Launches are
+// replayed independently, each from its own captured state.
+//
+// NOTE(LTE): Nothing is captured behind the program's back: only launches
+// made through `LaunchCapture::Launch`, or described with `Record`, end up
+// in the file. EasyCL, CLCudaAPI and plain `LaunchKernel` launches are not
+// intercepted.
+//
+
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 - 2020 Light Transport Entertainment, Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "rainbowmist.h"
+#include "rainbowmist_registry.h"
+
+#if defined(RAINBOWMIST_CPP11)
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace rainbowmist {
+
+// On-disk records. Offsets are from the start of the file.
+struct CaptureFileHeader {
+  char magic[8];  // kCaptureMagic; zero until `LaunchCapture::Close`
+  uint32_t num_launches;
+  uint32_t num_args;
+  uint32_t num_blobs;
+  uint32_t strings_size;
+  uint64_t launches_offset;  // CaptureLaunchRecord[num_launches]
+  uint64_t args_offset;      // CaptureArgRecord[num_args]
+  uint64_t blobs_offset;     // CaptureBlobRecord[num_blobs]
+  uint64_t strings_offset;   // NUL terminated strings
+  uint64_t reserved;
+};
+
+struct CaptureLaunchRecord {
+  uint32_t name;     // Offset in the strings
+  uint32_t options;  // Offset in the strings
+  uint32_t global[3];
+  uint32_t first_arg;
+  uint32_t num_args;
+  uint32_t local_x;  // Work-group(block) width; 0 if not recorded
+};
+
+struct CaptureArgRecord {
+  uint32_t kind;  // KernelArgKind
+  uint32_t blob;
+  uint64_t element_size;
+};
+
+struct CaptureBlobRecord {
+  uint64_t offset;
+  uint64_t size;
+};
+
+static_assert(sizeof(CaptureFileHeader) == 64, "");
+static_assert(sizeof(CaptureLaunchRecord) == 32, "");
+static_assert(sizeof(CaptureArgRecord) == 16, "");
+
+static const char kCaptureMagic[8] = {'R', 'M', 'C', 'A', 'P', 'T', '0', '1'};
+static const uint64_t kCaptureAlignment = 64;
+
+///
+/// An argument of a captured launch: the value of a scalar, or the contents
+/// of a buffer.
+///
+struct CaptureArg {
+  KernelArgKind kind;
+  size_t element_size;  // sizeof(T) of a buffer's elements, else `size`
+  const void *data;
+  size_t size;  // Bytes
+};
+
+template <class T>
+inline CaptureArg CaptureBuffer(const T *data, size_t count) {
+  return CaptureArg{kKernelArgBuffer, sizeof(T), data, count * sizeof(T)};
+}
+
+template <class T>
+inline CaptureArg CaptureScalar(const T &value) {
+  return CaptureArg{kKernelArgScalar, sizeof(T), &value, sizeof(T)};
+}
+
+struct CapturedLaunch {
+  std::string name;
+  std::string options;
+  unsigned int global[3];
+  unsigned int local_x;             // 0 if not recorded
+  std::vector<CaptureArg> args;     // Pointing into the `CaptureFile`
+  std::vector<uint32_t> arg_blobs;  // Blob index of each argument
+};
+
+namespace detail {
+
+// 64 bit FNV-1a over 8 byte words. Only used to find candidates for
+// deduplication, which compares the bytes as well.
+inline uint64_t HashCaptureBlob(const void *data, size_t size) {
+  const unsigned char *p = static_cast<const unsigned char *>(data);
+  uint64_t h = 14695981039346656037ULL ^ size;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t w;
+    memcpy(&w, p + i, 8);
+    h = (h ^ w) * 1099511628211ULL;
+    h ^= h >> 32;
+  }
+  for (; i < size; i++) {
+    h = (h ^ p[i]) * 1099511628211ULL;
+  }
+  return h;
+}
+
+inline bool SeekCapture(FILE *fp, uint64_t offset) {
+#if defined(_WIN32)
+  return _fseeki64(fp, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+  return fseeko(fp, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+}
+
+}  // namespace detail
+
+///
+/// Writes launches to a capture file.
+///
+/// NOTE(LTE): Not thread safe; record from one thread(or lock around it).
+///
+class LaunchCapture {
+ public:
+  LaunchCapture() {}
+  ~LaunchCapture() { Close(); }
+
+  LaunchCapture(const LaunchCapture &) = delete;
+  LaunchCapture &operator=(const LaunchCapture &) = delete;
+
+  bool Open(const std::string &filename) {
+    Close();
+    fp_ = fopen(filename.c_str(), "w+b");
+    if (!fp_) {
+      return false;
+    }
+    ok_ = true;
+    offset_ = 0;
+    bytes_recorded_ = 0;
+    bytes_stored_ = 0;
+    // Placeholder header; `Close` writes the real one.
+    CaptureFileHeader header;
+    memset(&header, 0, sizeof(header));
+    Write(&header, sizeof(header));
+    Pad(kCaptureAlignment);
+    return ok_;
+  }
+
+  bool is_open() const { return fp_ != nullptr; }
+
+  ///
+  /// Records a launch of kernel `name`, built with `options`, over
+  /// [0, xs) x [0, ys) x [0, zs), in work-groups(blocks) `local_x` wide(0
+  /// if unknown). The contents of `args` are copied to the file before
+  /// returning. Returns false on a write error.
+  ///
+  bool Record(const std::string &name, const std::string &options,
+              const std::vector<CaptureArg> &args, unsigned int xs,
+              unsigned int ys = 1, unsigned int zs = 1,
+              unsigned int local_x = 0) {
+    if (!fp_) {
+      return false;
+    }
+    CaptureLaunchRecord launch;
+    memset(&launch, 0, sizeof(launch));
+    launch.name = AddString(name);
+    launch.options = AddString(options);
+    launch.global[0] = xs;
+    launch.global[1] = ys;
+    launch.global[2] = zs;
+    launch.local_x = local_x;
+    launch.first_arg = static_cast<uint32_t>(args_.size());
+    launch.num_args = static_cast<uint32_t>(args.size());
+    for (const CaptureArg &arg : args) {
+      CaptureArgRecord rec;
+      rec.kind = static_cast<uint32_t>(arg.kind);
+      rec.blob = AddBlob(arg.data, arg.size);
+      rec.element_size = arg.element_size;
+      args_.push_back(rec);
+    }
+    launches_.push_back(launch);
+    return ok_;
+  }
+
+  ///
+  /// Records a launch of the registered kernel `info`(see
+  /// `KernelInfo::Launch`), then runs it. `buffer_sizes[i]` is the size in
+  /// bytes of buffer argument i; entries for scalars are ignored.
+  ///
+  void Launch(const KernelInfo &info, const void *const *arg_values,
+              const size_t *buffer_sizes, unsigned int xs,
+              unsigned int ys = 1, unsigned int zs = 1,
+              unsigned int num_threads = 0) {
+    if (fp_) {
+      std::vector<CaptureArg> args(info.args.size());
+      for (size_t i = 0; i < info.args.size(); i++) {
+        const KernelArgInfo &a = info.args[i];
+        args[i].kind = a.kind;
+        args[i].element_size = a.element_size;
+        if (a.kind == kKernelArgBuffer) {
+          memcpy(&args[i].data, arg_values[i], sizeof(void *));
+          args[i].size = buffer_sizes[i];
+        } else {
+          args[i].data = arg_values[i];
+          args[i].size = a.size;
+        }
+      }
+      Record(info.name, info.options, args, xs, ys, zs);
+    }
+    info.Launch(arg_values, xs, ys, zs, num_threads);
+  }
+
+  /// Writes the tables and the header. Returns false if any write failed.
+  bool Close() {
+    if (!fp_) {
+      return false;
+    }
+    CaptureFileHeader header;
+    memset(&header, 0, sizeof(header));
+    header.num_launches = static_cast<uint32_t>(launches_.size());
+    header.num_args = static_cast<uint32_t>(args_.size());
+    header.num_blobs = static_cast<uint32_t>(blobs_.size());
+    header.strings_size = static_cast<uint32_t>(strings_.size());
+    Pad(8);
+    header.launches_offset = offset_;
+    Write(launches_.data(), launches_.size() * sizeof(CaptureLaunchRecord));
+    header.args_offset = offset_;
+    Write(args_.data(), args_.size() * sizeof(CaptureArgRecord));
+    header.blobs_offset = offset_;
+    Write(blobs_.data(), blobs_.size() * sizeof(CaptureBlobRecord));
+    header.strings_offset = offset_;
+    Write(strings_.data(), strings_.size());
+    memcpy(header.magic, kCaptureMagic, sizeof(header.magic));
+    if (!detail::SeekCapture(fp_, 0)) {
+      ok_ = false;
+    }
+    Write(&header, sizeof(header));
+    if (fclose(fp_) != 0) {
+      ok_ = false;
+    }
+    fp_ = nullptr;
+
+    launches_.clear();
+    args_.clear();
+    blobs_.clear();
+    strings_.clear();
+    blob_index_.clear();
+    string_index_.clear();
+    return ok_;
+  }
+
+  size_t num_launches() const { return launches_.size(); }
+  size_t num_blobs() const { return blobs_.size(); }
+
+  /// Bytes of buffer and scalar contents recorded, and of those written(the
+  /// rest were found in the file already).
+  uint64_t bytes_recorded() const { return bytes_recorded_; }
+  uint64_t bytes_stored() const { return bytes_stored_; }
+
+ private:
+  void Write(const void *data, size_t size) {
+    if (size > 0 && fwrite(data, 1, size, fp_) != size) {
+      ok_ = false;
+    }
+    offset_ += size;
+  }
+
+  void Pad(uint64_t alignment) {
+    static const char kZeros[kCaptureAlignment] = {};
+    Write(kZeros, static_cast<size_t>((alignment - offset_ % alignment) %
+                                      alignment));
+  }
+
+  uint32_t AddString(const std::string &s) {
+    auto it = string_index_.find(s);
+    if (it != string_index_.end()) {
+      return it->second;
+    }
+    uint32_t offset = static_cast<uint32_t>(strings_.size());
+    strings_.insert(strings_.end(), s.c_str(), s.c_str() + s.size() + 1);
+    string_index_[s] = offset;
+    return offset;
+  }
+
+  // Compares `size` bytes at `offset` in the file with `data`.
+  bool SameAsStored(uint64_t offset, const void *data, size_t size) {
+    char chunk[4096];
+    const char *p = static_cast<const char *>(data);
+    bool same = detail::SeekCapture(fp_, offset);
+    while (same && size > 0) {
+      size_t n = size < sizeof(chunk) ? size : sizeof(chunk);
+      same = fread(chunk, 1, n, fp_) == n && memcmp(chunk, p, n) == 0;
+      p += n;
+      size -= n;
+    }
+    // Back to the end for the next write.
+    if (fseek(fp_, 0, SEEK_END) != 0) {
+      ok_ = false;
+    }
+    return same;
+  }
+
+  uint32_t AddBlob(const void *data, size_t size) {
+    bytes_recorded_ += size;
+    uint64_t hash = detail::HashCaptureBlob(data, size);
+    auto range = blob_index_.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      const CaptureBlobRecord &b = blobs_[it->second];
+      if (b.size == size && SameAsStored(b.offset, data, size)) {
+        return it->second;
+      }
+    }
+    CaptureBlobRecord blob;
+    blob.offset = offset_;
+    blob.size = size;
+    Write(data, size);
+    Pad(kCaptureAlignment);
+    bytes_stored_ += size;
+    uint32_t index = static_cast<uint32_t>(blobs_.size());
+    blobs_.push_back(blob);
+    blob_index_.insert(std::make_pair(hash, index));
+    return index;
+  }
+
+  FILE *fp_ = nullptr;
+  bool ok_ = false;
+  uint64_t offset_ = 0;
+  uint64_t bytes_recorded_ = 0;
+  uint64_t bytes_stored_ = 0;
+  std::vector<CaptureLaunchRecord> launches_;
+  std::vector<CaptureArgRecord> args_;
+  std::vector<CaptureBlobRecord> blobs_;
+  std::vector<char> strings_;
+  std::unordered_multimap<uint64_t, uint32_t> blob_index_;
+  std::unordered_map<std::string, uint32_t> string_index_;
+};
+
+///
+/// A capture file, mapped into memory(read into it where mmap is not
+/// available). Captured contents are read in place.
+///
+class CaptureFile {
+ public:
+  CaptureFile() {}
+  ~CaptureFile() { Close(); }
+
+  CaptureFile(const CaptureFile &) = delete;
+  CaptureFile &operator=(const CaptureFile &) = delete;
+
+  bool Open(const std::string &filename, std::string *err = nullptr) {
+    Close();
+    if (!Map(filename)) {
+      return Fail("failed to read " + filename, err);
+    }
+    if (size_ < sizeof(CaptureFileHeader)) {
+      return Fail(filename + " is not a capture file", err);
+    }
+    memcpy(&header_, data_, sizeof(header_));
+    if (memcmp(header_.magic, kCaptureMagic, sizeof(kCaptureMagic)) != 0) {
+      return Fail(filename + " is not a capture file(or was not closed)", err);
+    }
+    if (!Validate()) {
+      return Fail(filename + " is truncated or corrupt", err);
+    }
+    return true;
+  }
+
+  void Close() {
+#if defined(__unix__) || defined(__APPLE__)
+    if (data_ && size_ > 0) {
+      munmap(const_cast<unsigned char *>(data_), size_);
+    }
+#endif
+    data_ = nullptr;
+    size_ = 0;
+    copy_.clear();
+    memset(&header_, 0, sizeof(header_));
+  }
+
+  /// The number of launches.
+  size_t size() const { return header_.num_launches; }
+  size_t num_blobs() const { return header_.num_blobs; }
+
+  CapturedLaunch launch(size_t i) const {
+    const CaptureLaunchRecord &rec = Launches()[i];
+    CapturedLaunch launch;
+    launch.name = String(rec.name);
+    launch.options = String(rec.options);
+    for (int k = 0; k < 3; k++) {
+      launch.global[k] = rec.global[k];
+    }
+    launch.local_x = rec.local_x;
+    for (uint32_t a = 0; a < rec.num_args; a++) {
+      const CaptureArgRecord &arg = Args()[rec.first_arg + a];
+      const CaptureBlobRecord &blob = Blobs()[arg.blob];
+      launch.args.push_back(CaptureArg{static_cast<KernelArgKind>(arg.kind),
+                                       static_cast<size_t>(arg.element_size),
+                                       data_ + blob.offset,
+                                       static_cast<size_t>(blob.size)});
+      launch.arg_blobs.push_back(arg.blob);
+    }
+    return launch;
+  }
+
+ private:
+  static bool Fail(const std::string &message, std::string *err) {
+    if (err) {
+      *err = message;
+    }
+    return false;
+  }
+
+  bool Map(const std::string &filename) {
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0 && st.st_size > 0;
+    if (ok) {
+      void *p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                     MAP_PRIVATE, fd, 0);
+      ok = p != MAP_FAILED;
+      if (ok) {
+        data_ = static_cast<const unsigned char *>(p);
+        size_ = static_cast<size_t>(st.st_size);
+      }
+    }
+    close(fd);
+    return ok;
+#else
+    FILE *fp = fopen(filename.c_str(), "rb");
+    if (!fp) {
+      return false;
+    }
+    std::vector<unsigned char> buf;
+    unsigned char chunk[1 << 16];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+      buf.insert(buf.end(), chunk, chunk + n);
+    }
+    fclose(fp);
+    // NOTE(LTE): vector storage is only aligned for the largest scalar type,
+    // not to kCaptureAlignment.
+    copy_.swap(buf);
+    data_ = copy_.data();
+    size_ = copy_.size();
+    return true;
+#endif
+  }
+
+  bool InFile(uint64_t offset, uint64_t count, uint64_t size) const {
+    return offset <= size_ && (size == 0 || count <= (size_ - offset) / size);
+  }
+
+  bool Validate() const {
+    const CaptureFileHeader &h = header_;
+    if (!InFile(h.launches_offset, h.num_launches,
+                sizeof(CaptureLaunchRecord)) ||
+        !InFile(h.args_offset, h.num_args, sizeof(CaptureArgRecord)) ||
+        !InFile(h.blobs_offset, h.num_blobs, sizeof(CaptureBlobRecord)) ||
+        !InFile(h.strings_offset, h.strings_size, 1) ||
+        h.launches_offset % 8 != 0 || h.args_offset % 8 != 0 ||
+        h.blobs_offset % 8 != 0) {
+      return false;
+    }
+    if (h.strings_size > 0 && data_[h.strings_offset + h.strings_size - 1]) {
+      return false;  // The last string must be terminated.
+    }
+    for (uint32_t i = 0; i < h.num_blobs; i++) {
+      if (!InFile(Blobs()[i].offset, Blobs()[i].size, 1)) {
+        return false;
+      }
+    }
+    for (uint32_t i = 0; i < h.num_args; i++) {
+      const CaptureArgRecord &a = Args()[i];
+      if (a.blob >= h.num_blobs ||
+          (a.kind != kKernelArgBuffer && a.kind != kKernelArgScalar)) {
+        return false;
+      }
+    }
+    for (uint32_t i = 0; i < h.num_launches; i++) {
+      const CaptureLaunchRecord &l = Launches()[i];
+      if (l.name >= h.strings_size || l.options >= h.strings_size ||
+          l.first_arg > h.num_args || l.num_args > h.num_args - l.first_arg) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  const CaptureLaunchRecord *Launches() const {
+    return reinterpret_cast<const CaptureLaunchRecord *>(
+        data_ + header_.launches_offset);
+  }
+  const CaptureArgRecord *Args() const {
+    return reinterpret_cast<const CaptureArgRecord *>(data_ +
+                                                      header_.args_offset);
+  }
+  const CaptureBlobRecord *Blobs() const {
+    return reinterpret_cast<const CaptureBlobRecord *>(data_ +
+                                                       header_.blobs_offset);
+  }
+  const char *String(uint32_t offset) const {
+    return reinterpret_cast<const char *>(data_ + header_.strings_offset +
+                                          offset);
+  }
+
+  const unsigned char *data_ = nullptr;
+  size_t size_ = 0;
+  std::vector<unsigned char> copy_;
+  CaptureFileHeader header_ = {};
+};
+
+///
+/// Replays a capture on the C++11 backend with the kernels of
+/// `KernelRegistry`(picked by name and the captured build options).
+///
+///   rainbowmist::HostReplay replay;
+///   replay.Init(file, &err);
+///   for (...) {
+///     replay.Reset();
+///     for (size_t i = 0; i < file.size(); i++) replay.Run(i);  // time this
+///   }
+///
+class HostReplay {
+ public:
+  ///
+  /// Finds each launch's kernel and checks the captured arguments against
+  /// its parameters. Writable buffers get a copy of their contents; the
+  /// others are used from the file. `file` must outlive the replay.
+  ///
+  bool Init(const CaptureFile &file, std::string *err = nullptr) {
+    launches_.clear();
+    for (size_t i = 0; i < file.size(); i++) {
+      Launch l;
+      l.captured = file.launch(i);
+      l.info = KernelRegistry::Get().Find(l.captured.name,
+                                          l.captured.options);
+      if (!l.info) {
+        return Fail("kernel `" + l.captured.name + "` is not registered", err);
+      }
+      if (l.info->args.size() != l.captured.args.size()) {
+        return Fail("argument count of `" + l.captured.name +
+                        "` does not match the capture",
+                    err);
+      }
+      for (size_t a = 0; a < l.captured.args.size(); a++) {
+        const KernelArgInfo &param = l.info->args[a];
+        const CaptureArg &arg = l.captured.args[a];
+        if (param.kind != arg.kind ||
+            (arg.kind == kKernelArgScalar && param.size != arg.size)) {
+          return Fail("argument " + std::to_string(a) + " of `" +
+                          l.captured.name + "` does not match the capture",
+                      err);
+        }
+      }
+      launches_.push_back(std::move(l));
+    }
+    for (Launch &l : launches_) {
+      l.copies.resize(l.captured.args.size());
+      l.pointers.resize(l.captured.args.size());
+      l.values.resize(l.captured.args.size());
+      for (size_t a = 0; a < l.captured.args.size(); a++) {
+        const CaptureArg &arg = l.captured.args[a];
+        if (arg.kind == kKernelArgScalar) {
+          l.values[a] = arg.data;
+          continue;
+        }
+        if (l.info->args[a].read_only) {
+          l.pointers[a] = const_cast<void *>(arg.data);
+        } else {
+          l.copies[a].resize(arg.size);
+          l.pointers[a] = l.copies[a].data();
+        }
+        l.values[a] = &l.pointers[a];
+      }
+    }
+    Reset();
+    return true;
+  }
+
+  /// Restores the captured contents of the writable buffers.
+  void Reset() {
+    for (Launch &l : launches_) {
+      for (size_t a = 0; a < l.copies.size(); a++) {
+        if (!l.copies[a].empty()) {
+          memcpy(l.copies[a].data(), l.captured.args[a].data,
+                 l.copies[a].size());
+        }
+      }
+    }
+  }
+
+  /// Runs launch `i` as captured.
+  void Run(size_t i, unsigned int num_threads = 0) {
+    const Launch &l = launches_[i];
+    l.info->Launch(l.values.data(), l.captured.global[0], l.captured.global[1],
+                   l.captured.global[2], num_threads);
+  }
+
+  size_t size() const { return launches_.size(); }
+
+  /// Buffer argument `arg` of launch `i`(its contents after `Run`).
+  const void *buffer(size_t i, size_t arg) const {
+    return launches_[i].pointers[arg];
+  }
+
+ private:
+  struct Launch {
+    CapturedLaunch captured;
+    const KernelInfo *info = nullptr;
+    std::vector<std::vector<char>> copies;
+    std::vector<void *> pointers;
+    std::vector<const void *> values;
+  };
+
+  static bool Fail(const std::string &message, std::string *err) {
+    if (err) {
+      *err = message;
+    }
+    return false;
+  }
+
+  std::vector<Launch> launches_;
+};
+
+}  // namespace rainbowmist
+
+#endif  // RAINBOWMIST_CPP11
+
+#endif  // RAINBOWMIST_CAPTURE_H_
@@ -0,0 +1,419 @@
+#ifndef RAINBOWMIST_DIRTY_H_
+#define RAINBOWMIST_DIRTY_H_
+
+//
+// RainbowMist dirty range tracking, for partial buffer uploads.
+//
+// `rainbowmist::DirtyRangeTracker` records which blocks(4KB by default) of a
+// host buffer were modified, and returns them as merged (offset, size) byte
+// ranges, which can be passed as is to CLCudaAPI's `Buffer::WriteRanges()`:
+//
+//   rainbowmist::DirtyRangeTracker dirty(scene_bytes);
+//   for (...) {  // update a few instances
+//     instances[i] = ...;
+//     dirty.MarkDirty(i * sizeof(Instance), sizeof(Instance));
+//   }
+//   std::vector<std::pair<size_t, size_t>> ranges;
+//   dirty.Ranges(&ranges, /* max_gap */ 64 * 1024);
+//   buffer.WriteRangesAsync(queue, instances, ranges);
+//   dirty.Clear();
+//
+// `max_gap` also merges ranges separated by at most that many clean bytes,
+// trading a few redundant bytes for fewer copy commands.
+//
+// `rainbowmist::WriteWatch`(C++11 backend, POSIX only) finds the modified
+// pages without any `MarkDirty()` call: it write protects the region with
+// `mprotect()`, and the first write to each page is caught by a SIGSEGV
+// handler, which marks the page dirty and makes it writable again. So each
+// modified page costs one fault per `Arm()`, and untouched pages nothing.
+//
+
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 - 2020 Light Transport Entertainment, Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "rainbowmist.h"
+
+#if defined(RAINBOWMIST_CPP11)
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RAINBOWMIST_HAS_WRITE_WATCH 1
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace rainbowmist {
+
+// One bit per block, so a 2GB buffer with 4KB blocks needs 64KB, and finding
+// the dirty ranges skips 64 clean blocks at a time.
+class DirtyRangeTracker {
+ public:
+  explicit DirtyRangeTracker(size_t size, size_t block_size = 4096)
+      : size_(size),
+        block_size_(block_size > 0 ? block_size : 1),
+        num_blocks_((size + block_size_ - 1) / block_size_),
+        bits_((num_blocks_ + 63) / 64, 0) {}
+
+  // Marks bytes [offset, offset + size) modified. Clamped to the buffer.
+  void MarkDirty(size_t offset, size_t size) {
+    if (size == 0 || offset >= size_) {
+      return;
+    }
+    const size_t end = (size > size_ - offset) ? size_ : offset + size;
+    SetBits(offset / block_size_, (end - 1) / block_size_ + 1);
+  }
+
+  void MarkAllDirty() { SetBits(0, num_blocks_); }
+
+  void Clear() { std::fill(bits_.begin(), bits_.end(), uint64_t(0)); }
+
+  bool Empty() const {
+    for (const uint64_t word : bits_) {
+      if (word != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // True if any block overlapping bytes [offset, offset + size) is dirty.
+  bool IsDirty(size_t offset, size_t size) const {
+    if (size == 0 || offset >= size_) {
+      return false;
+    }
+    const size_t end = (size > size_ - offset) ? size_ : offset + size;
+    const size_t block = NextDirty(offset / block_size_);
+    return block <= (end - 1) / block_size_;
+  }
+
+  // Dirty blocks as ascending (offset, size) byte ranges. Adjacent blocks
+  // are merged, as are ranges at most `max_gap` bytes apart.
+  void Ranges(std::vector<std::pair<size_t, size_t>> *ranges,
+              size_t max_gap = 0) const {
+    ranges->clear();
+    size_t block = NextDirty(0);
+    while (block < num_blocks_) {
+      const size_t end = NextClean(block);
+      const size_t offset = block * block_size_;
+      const size_t end_offset = std::min(end * block_size_, size_);
+      if (!ranges->empty() &&
+          offset - (ranges->back().first + ranges->back().second) <= max_gap) {
+        ranges->back().second = end_offset - ranges->back().first;
+      } else {
+        ranges->emplace_back(offset, end_offset - offset);
+      }
+      block = NextDirty(end);
+    }
+  }
+
+  size_t DirtyBytes() const {
+    std::vector<std::pair<size_t, size_t>> ranges;
+    Ranges(&ranges);
+    size_t bytes = 0;
+    for (const auto &range : ranges) {
+      bytes += range.second;
+    }
+    return bytes;
+  }
+
+  // Calls `upload(offset, size)` for each range, then clears. Returns the
+  // number of bytes uploaded.
+  template <typename Upload>
+  size_t Flush(Upload upload, size_t max_gap = 0) {
+    std::vector<std::pair<size_t, size_t>> ranges;
+    Ranges(&ranges, max_gap);
+    size_t bytes = 0;
+    for (const auto &range : ranges) {
+      upload(range.first, range.second);
+      bytes += range.second;
+    }
+    Clear();
+    return bytes;
+  }
+
+  size_t size() const { return size_; }
+  size_t block_size() const { return block_size_; }
+  size_t num_blocks() const { return num_blocks_; }
+
+ private:
+  friend class WriteWatch;
+
+  static size_t CountTrailingZeros(uint64_t word) {
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<size_t>(__builtin_ctzll(word));
+#else
+    size_t n = 0;
+    while ((word & 1) == 0) {
+      word >>= 1;
+      n++;
+    }
+    return n;
+#endif
+  }
+
+  static uint64_t Mask(size_t bit, size_t count) {
+    return (count == 64) ? ~uint64_t(0) : (((uint64_t(1) << count) - 1) << bit);
+  }
+
+  // Sets blocks [first, end).
+  void SetBits(size_t first, size_t end) {
+    size_t block = first;
+    while (block < end) {
+      const size_t bit = block % 64;
+      const size_t count = std::min(64 - bit, end - block);
+      bits_[block / 64] |= Mask(bit, count);
+      block += count;
+    }
+  }
+
+  // First dirty block at or after `block`, or `num_blocks_`.
+  size_t NextDirty(size_t block) const { return Next(block, uint64_t(0)); }
+
+  // First clean block at or after `block`, or `num_blocks_`.
+  size_t NextClean(size_t block) const { return Next(block, ~uint64_t(0)); }
+
+  // `invert` flips the bits, to search for clean blocks.
+  size_t Next(size_t block, uint64_t invert) const {
+    if (block >= num_blocks_) {
+      return num_blocks_;
+    }
+    size_t w = block / 64;
+    uint64_t word = (bits_[w] ^ invert) & (~uint64_t(0) << (block % 64));
+    for (;;) {
+      if (word != 0) {
+        return std::min(w * 64 + CountTrailingZeros(word), num_blocks_);
+      }
+      if (++w >= bits_.size()) {
+        return num_blocks_;
+      }
+      word = bits_[w] ^ invert;
+    }
+  }
+
+  size_t size_;
+  size_t block_size_;
+  size_t num_blocks_;
+  std::vector<uint64_t> bits_;
+};
+
+#if defined(RAINBOWMIST_HAS_WRITE_WATCH)
+
+// Tracks writes to a page aligned memory region with `mprotect()`.
+//
+//   char *scene = static_cast<char *>(rainbowmist::WriteWatch::AllocatePages(bytes));
+//   rainbowmist::WriteWatch watch(scene, bytes);
+//   watch.Arm();
+//   // ... the application writes to `scene` as usual ...
+//   watch.Ranges(&ranges);  // the modified pages
+//   buffer.WriteRangesAsync(queue, scene, ranges);
+//   watch.Arm();  // forget them, and watch again
+//
+// Writes from any thread are caught. `Arm()` itself must not race with
+// writes to the region.
+//
+// The SIGSEGV(and SIGBUS) handler is installed on the first `Arm()`, and
+// passes faults outside any watched region to the handler it replaced. If
+// another handler is installed later, the next `Arm()` installs it again.
+//
+// NOTE(LTE): At most 64 regions can be watched at the same time.
+class WriteWatch {
+ public:
+  static size_t PageSize() { return static_cast<size_t>(sysconf(_SC_PAGESIZE)); }
+
+  // Page aligned, zero filled memory. nullptr on failure.
+  static void *AllocatePages(size_t size) {
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return (p == MAP_FAILED) ? nullptr : p;
+  }
+
+  static void FreePages(void *p, size_t size) {
+    if (p) {
+      munmap(p, size);
+    }
+  }
+
+  // `base` must be page aligned. Not armed until `Arm()`.
+  WriteWatch(void *base, size_t size)
+      : base_(static_cast<char *>(base)), size_(size), dirty_(size, PageSize()) {}
+
+  ~WriteWatch() { Disarm(); }
+
+  WriteWatch(const WriteWatch &) = delete;
+  WriteWatch &operator=(const WriteWatch &) = delete;
+
+  // Forgets the modified pages, and write protects the region. Returns false
+  // if it can't be protected, or too many regions are watched.
+  bool Arm() {
+    if (!InstallHandler(SIGSEGV, 0) || !InstallHandler(SIGBUS, 1)) {
+      return false;
+    }
+    if (armed_) {
+      // Clean pages are still protected, only the modified ones need it again.
+      std::vector<std::pair<size_t, size_t>> ranges;
+      dirty_.Ranges(&ranges);
+      for (const auto &range : ranges) {
+        if (mprotect(base_ + range.first, range.second, PROT_READ) != 0) {
+          return false;
+        }
+      }
+    } else {
+      if (!Register()) {
+        return false;
+      }
+      if (mprotect(base_, size_, PROT_READ) != 0) {
+        Unregister();
+        return false;
+      }
+      armed_ = true;
+    }
+    dirty_.Clear();
+    return true;
+  }
+
+  // Makes the whole region writable again, and stops tracking. The pages
+  // modified so far are kept.
+  void Disarm() {
+    if (!armed_) {
+      return;
+    }
+    mprotect(base_, size_, PROT_READ | PROT_WRITE);
+    Unregister();
+    armed_ = false;
+  }
+
+  bool armed() const { return armed_; }
+
+  const DirtyRangeTracker &dirty() const { return dirty_; }
+
+  void Ranges(std::vector<std::pair<size_t, size_t>> *ranges,
+              size_t max_gap = 0) const {
+    dirty_.Ranges(ranges, max_gap);
+  }
+
+ private:
+  static const size_t kMaxWatches = 64;
+
+  static std::atomic<WriteWatch *> *Registry() {
+    static std::atomic<WriteWatch *> registry[kMaxWatches];
+    return registry;
+  }
+
+  // The handlers replaced for SIGSEGV(0) and SIGBUS(1).
+  static struct sigaction *PreviousAction(size_t index) {
+    static struct sigaction previous[2];
+    return &previous[index];
+  }
+
+  static bool InstallHandler(int sig, size_t index) {
+    struct sigaction current;
+    if (sigaction(sig, nullptr, &current) != 0) {
+      return false;
+    }
+    if ((current.sa_flags & SA_SIGINFO) &&
+        current.sa_sigaction == &WriteWatch::HandleSignal) {
+      return true;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = &WriteWatch::HandleSignal;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    return sigaction(sig, &action, PreviousAction(index)) == 0;
+  }
+
+  static void HandleSignal(int sig, siginfo_t *info, void *context) {
+    char *addr = static_cast<char *>(info->si_addr);
+    std::atomic<WriteWatch *> *registry = Registry();
+    for (size_t i = 0; i < kMaxWatches; i++) {
+      WriteWatch *watch = registry[i].load(std::memory_order_acquire);
+      if (watch && addr >= watch->base_ && addr < watch->base_ + watch->size_) {
+        const size_t page_size = watch->dirty_.block_size();
+        const size_t page = static_cast<size_t>(addr - watch->base_) / page_size;
+        // Several threads may fault at once.
+        __atomic_fetch_or(&watch->dirty_.bits_[page / 64],
+                          uint64_t(1) << (page % 64), __ATOMIC_RELAXED);
+        if (mprotect(watch->base_ + page * page_size, page_size,
+                     PROT_READ | PROT_WRITE) == 0) {
+          return;  // The write is retried, and succeeds.
+        }
+        break;
+      }
+    }
+
+    // Not a watched page.
+    struct sigaction *previous = PreviousAction(sig == SIGSEGV ? 0 : 1);
+    if (previous->sa_flags & SA_SIGINFO) {
+      previous->sa_sigaction(sig, info, context);
+    } else if (previous->sa_handler == SIG_DFL ||
+               previous->sa_handler == SIG_IGN) {
+      // Fault again with the default action.
+      signal(sig, SIG_DFL);
+    } else {
+      previous->sa_handler(sig);
+    }
+  }
+
+  bool Register() {
+    std::atomic<WriteWatch *> *registry = Registry();
+    for (size_t i = 0; i < kMaxWatches; i++) {
+      WriteWatch *expected = nullptr;
+      if (registry[i].compare_exchange_strong(expected, this)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void Unregister() {
+    std::atomic<WriteWatch *> *registry = Registry();
+    for (size_t i = 0; i < kMaxWatches; i++) {
+      WriteWatch *expected = this;
+      if (registry[i].compare_exchange_strong(expected, nullptr)) {
+        return;
+      }
+    }
+  }
+
+  char *base_;
+  size_t size_;
+  DirtyRangeTracker dirty_;
+  bool armed_ = false;
+};
+
+#endif  // RAINBOWMIST_HAS_WRITE_WATCH
+
+}  // namespace rainbowmist
+
+#endif  // RAINBOWMIST_CPP11
+
+#endif  // RAINBOWMIST_DIRTY_H_
@@ -0,0 +1,375 @@
+#ifndef RAINBOWMIST_DIVERGENCE_H_
+#define RAINBOWMIST_DIVERGENCE_H_
+
+//
+// RainbowMist branch divergence profiler for the C++11 backend.
+//
+// A GPU runs the work-items of a warp(32 lanes, or a 64 lane wavefront) in
+// lock step, so when lanes disagree at a branch, both paths run one after the
+// other with part of the lanes masked off. Compiled with
+// RAINBOWMIST_PROFILE_DIVERGENCE, each `RM_BRANCH(cond)` records its outcome
+// per work-item, and `rainbowmist::DivergenceProfiler` groups work-items into
+// simulated warps by their linear global id(like `GlobalId()` hands them out)
+// and reports:
+//
+//   * per kernel, the SIMT efficiency: active lanes / lane slots, summed over
+//     all warp-wide evaluations of instrumented branches(1 = no divergence)
+//   * the branch sites(file:line) which waste the most lane slots
+//
+//   // kernel.h
+//   while (RM_BRANCH(depth < max_depth)) {
+//     if (RM_BRANCH(Hit(ray))) { ... }
+//   }
+//
+//   // host, compiled with -DRAINBOWMIST_PROFILE_DIVERGENCE
+//   #include "rainbowmist_divergence.h"  // before the kernels
+//   #include "kernel.h"
+//
+//   rainbowmist::DivergenceProfiler prof;  // 32 lanes
+//   prof.Launch("trace", width, height, 1, [&]() { Trace(...); });
+//   prof.Print();
+//
+// NOTE(LTE): Work-items still run one after another. The k-th evaluation of
+// a branch site by each lane of a warp is taken as one warp-wide evaluation,
+// so a loop condition wrapped with `RM_BRANCH` also shows lanes which left the
+// loop early as inactive. Records take 24 bytes per evaluation until the end
+// of each launch, so profile a small launch.
+//
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 - 2020 Light Transport Entertainment, Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "rainbowmist.h"
+
+#if defined(RAINBOWMIST_CPP11)
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace rainbowmist {
+
+struct BranchRecord {
+  const char *file;
+  uint32_t line;
+  uint64_t item;  // Linear global id
+  uint32_t taken;
+  uint32_t seq;   // Index of the record within the worker thread
+};
+
+// Records of one worker thread of a profiled launch.
+struct BranchTraceThread {
+  unsigned int xs = 1, ys = 1;
+  std::vector<BranchRecord> records;
+};
+
+inline BranchTraceThread *&CurrentBranchTraceThread() {
+  static thread_local BranchTraceThread *thread = nullptr;
+  return thread;
+}
+
+/// What `RM_BRANCH(cond)` calls with RAINBOWMIST_PROFILE_DIVERGENCE. Returns
+/// `cond`.
+inline bool RecordBranch(const char *file, int line, bool cond) {
+  BranchTraceThread *thread = CurrentBranchTraceThread();
+  if (thread) {
+    BranchRecord r;
+    r.file = file;
+    r.line = uint32_t(line);
+    const unsigned int *id = rainbowmist_tls_global_id().id;
+    r.item =
+        id[0] + uint64_t(thread->xs) * (id[1] + uint64_t(thread->ys) * id[2]);
+    r.taken = cond ? 1 : 0;
+    r.seq = uint32_t(thread->records.size());
+    thread->records.push_back(r);
+  }
+  return cond;
+}
+
+struct KernelDivergence {
+  std::string name;
+  uint64_t num_launches = 0;
+  uint64_t num_evaluations = 0;  // Warp-wide
+  uint64_t num_divergent = 0;    // Evaluations where lanes disagreed
+  uint64_t active_lanes = 0;
+  uint64_t lane_slots = 0;       // Lanes of the warp x paths run
+
+  /// Active lanes / lane slots; 1 when no instrumented branch diverges.
+  double SimtEfficiency() const {
+    return lane_slots ? double(active_lanes) / double(lane_slots) : 1.0;
+  }
+};
+
+struct BranchSiteStats {
+  std::string kernel;
+  std::string file;
+  int line = 0;
+  uint64_t num_lane_evaluations = 0;
+  uint64_t num_taken = 0;
+  uint64_t num_evaluations = 0;  // Warp-wide
+  uint64_t num_divergent = 0;
+  uint64_t active_lanes = 0;
+  uint64_t lane_slots = 0;
+
+  double DivergenceRate() const {
+    return num_evaluations ? double(num_divergent) / double(num_evaluations)
+                           : 0.0;
+  }
+  double SimtEfficiency() const {
+    return lane_slots ? double(active_lanes) / double(lane_slots) : 1.0;
+  }
+  uint64_t WastedLanes() const { return lane_slots - active_lanes; }
+};
+
+class DivergenceProfiler : public LaunchObserver {
+ public:
+  explicit DivergenceProfiler(unsigned int warp_size = 32)
+      : warp_size_(warp_size ? warp_size : 1) {}
+
+  /// `rainbowmist::LaunchKernel`, profiled under `name`.
+  template <class F>
+  void Launch(const std::string &name, unsigned int xs, unsigned int ys,
+              unsigned int zs, F kernel, unsigned int num_threads = 0) {
+    xs_ = xs;
+    ys_ = ys;
+    num_items_ = uint64_t(xs) * ys * zs;
+    {
+      ScopedLaunchObserver observe(this);
+      try {
+        LaunchKernel(xs, ys, zs, kernel, num_threads);
+      } catch (...) {
+        // Not profiled; drop the branches recorded so far.
+        threads_.clear();
+        throw;
+      }
+    }
+
+    std::vector<BranchRecord> records;
+    for (auto &thread : threads_) {
+      records.insert(records.end(), thread.records.begin(),
+                     thread.records.end());
+    }
+    threads_.clear();
+    std::lock_guard<std::mutex> lock(mutex_);
+    Analyze(name, &records);
+  }
+
+  void LaunchBegin(unsigned int, unsigned int num_threads) {
+    threads_.assign(num_threads, BranchTraceThread());
+    for (auto &thread : threads_) {
+      thread.xs = xs_;
+      thread.ys = ys_;
+    }
+  }
+  void WorkerBegin(unsigned int thread_index) {
+    CurrentBranchTraceThread() = &threads_[thread_index];
+  }
+  void WorkerEnd(unsigned int, unsigned int) {
+    CurrentBranchTraceThread() = nullptr;
+  }
+
+  std::vector<KernelDivergence> kernels() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return kernels_;
+  }
+
+  /// Branch sites, most wasted lane slots first.
+  std::vector<BranchSiteStats> WorstSites() const {
+    std::vector<BranchSiteStats> sites;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (const auto &it : sites_) {
+        sites.push_back(it.second);
+      }
+    }
+    std::stable_sort(sites.begin(), sites.end(),
+                     [](const BranchSiteStats &a, const BranchSiteStats &b) {
+                       return a.WastedLanes() > b.WastedLanes();
+                     });
+    return sites;
+  }
+
+  void Print(FILE *fp = stdout, size_t max_sites = 10) const {
+    fprintf(fp, "%-20s %8s %12s %10s   (warp size %u)\n", "kernel",
+            "SIMT eff", "evaluations", "divergent", warp_size_);
+    for (const auto &k : kernels()) {
+      fprintf(fp, "%-20s %7.1f%% %12llu %9.1f%%\n", k.name.c_str(),
+              100.0 * k.SimtEfficiency(),
+              static_cast<unsigned long long>(k.num_evaluations),
+              k.num_evaluations ? 100.0 * double(k.num_divergent) /
+                                      double(k.num_evaluations)
+                                : 0.0);
+    }
+    std::vector<BranchSiteStats> sites = WorstSites();
+    fprintf(fp, "\n%-32s %-20s %8s %10s %8s %12s\n", "branch", "kernel",
+            "taken", "divergent", "SIMT eff", "wasted lanes");
+    for (size_t i = 0; i < sites.size() && i < max_sites; i++) {
+      const BranchSiteStats &s = sites[i];
+      char where[512];
+      snprintf(where, sizeof(where), "%s:%d", s.file.c_str(), s.line);
+      fprintf(fp, "%-32s %-20s %7.1f%% %9.1f%% %7.1f%% %12llu\n", where,
+              s.kernel.c_str(),
+              s.num_lane_evaluations ? 100.0 * double(s.num_taken) /
+                                           double(s.num_lane_evaluations)
+                                     : 0.0,
+              100.0 * s.DivergenceRate(), 100.0 * s.SimtEfficiency(),
+              static_cast<unsigned long long>(s.WastedLanes()));
+    }
+  }
+
+  void Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    kernels_.clear();
+    sites_.clear();
+  }
+
+  unsigned int warp_size() const { return warp_size_; }
+
+ private:
+  typedef std::pair<std::string, std::pair<std::string, int>> SiteKey;
+
+  void Analyze(const std::string &name, std::vector<BranchRecord> *records) {
+    KernelDivergence *kernel = nullptr;
+    for (auto &k : kernels_) {
+      if (k.name == name) {
+        kernel = &k;
+      }
+    }
+    if (!kernel) {
+      kernels_.push_back(KernelDivergence());
+      kernels_.back().name = name;
+      kernel = &kernels_.back();
+    }
+    kernel->num_launches++;
+
+    // A file can come through several `__FILE__` pointers(one per
+    // translation unit, say), so map each to the first pointer seen for its
+    // name. From here on, equal pointers mean the same file, as in `sites_`.
+    std::map<std::string, const char *> files;
+    std::map<const char *, const char *> canonical;
+    for (auto &r : *records) {
+      auto it = canonical.find(r.file);
+      if (it == canonical.end()) {
+        const char *&file = files[std::string(r.file)];
+        if (!file) {
+          file = r.file;
+        }
+        it = canonical.insert(std::make_pair(r.file, file)).first;
+      }
+      r.file = it->second;
+    }
+
+    // Work-items run in order within a thread, so sorting by (item, seq)
+    // gives each work-item's evaluations in program order. Then number the
+    // evaluations of each site per work-item.
+    std::sort(records->begin(), records->end(),
+              [](const BranchRecord &a, const BranchRecord &b) {
+                return a.item != b.item ? a.item < b.item : a.seq < b.seq;
+              });
+    std::map<std::pair<const char *, uint32_t>, uint32_t> occurrences;
+    for (size_t i = 0; i < records->size(); i++) {
+      BranchRecord &r = (*records)[i];
+      if (i == 0 || (*records)[i - 1].item != r.item) {
+        occurrences.clear();
+      }
+      r.seq = occurrences[std::make_pair(r.file, r.line)]++;
+    }
+
+    // Warp-wide evaluation: (warp, site, occurrence).
+    const uint64_t warp = warp_size_;
+    std::sort(records->begin(), records->end(),
+              [warp](const BranchRecord &a, const BranchRecord &b) {
+                if (a.item / warp != b.item / warp) {
+                  return a.item / warp < b.item / warp;
+                }
+                if (a.file != b.file) {
+                  return std::less<const char *>()(a.file, b.file);
+                }
+                if (a.line != b.line) {
+                  return a.line < b.line;
+                }
+                return a.seq < b.seq;
+              });
+
+    size_t begin = 0;
+    while (begin < records->size()) {
+      const BranchRecord &first = (*records)[begin];
+      size_t end = begin + 1;
+      uint64_t taken = first.taken;
+      while (end < records->size() &&
+             (*records)[end].item / warp == first.item / warp &&
+             (*records)[end].file == first.file &&
+             (*records)[end].line == first.line &&
+             (*records)[end].seq == first.seq) {
+        taken += (*records)[end].taken;
+        end++;
+      }
+      const uint64_t active = end - begin;
+      const uint64_t warp_begin = first.item / warp * warp;
+      const uint64_t lanes =
+          std::min<uint64_t>(warp, num_items_ - warp_begin);
+      const uint64_t paths = (taken > 0 ? 1 : 0) + (taken < active ? 1 : 0);
+      const bool divergent = (paths == 2);
+
+      BranchSiteStats &site = sites_[SiteKey(
+          name, std::make_pair(std::string(first.file), int(first.line)))];
+      if (site.file.empty()) {
+        site.kernel = name;
+        site.file = first.file;
+        site.line = int(first.line);
+      }
+      site.num_lane_evaluations += active;
+      site.num_taken += taken;
+      site.num_evaluations++;
+      site.num_divergent += divergent ? 1 : 0;
+      site.active_lanes += active;
+      site.lane_slots += lanes * paths;
+
+      kernel->num_evaluations++;
+      kernel->num_divergent += divergent ? 1 : 0;
+      kernel->active_lanes += active;
+      kernel->lane_slots += lanes * paths;
+      begin = end;
+    }
+  }
+
+  unsigned int warp_size_;
+  unsigned int xs_ = 1, ys_ = 1;
+  uint64_t num_items_ = 0;
+  std::vector<BranchTraceThread> threads_;
+  mutable std::mutex mutex_;
+  std::vector<KernelDivergence> kernels_;
+  std::map<SiteKey, BranchSiteStats> sites_;
+};
+
+}  // namespace rainbowmist
+
+#endif  // RAINBOWMIST_CPP11
+
+#endif  // RAINBOWMIST_DIVERGENCE_H_
@@ -0,0 +1,767 @@
+#ifndef RAINBOWMIST_FLOPS_H_
+#define RAINBOWMIST_FLOPS_H_
+
+//
+// RainbowMist FLOP and byte counting for roofline reports(C++11 backend).
+//
+// Compiled with RAINBOWMIST_COUNT_FLOPS, `RM_FLOAT` and the vector types
+// (vec2 ... uvec4) are counting wrappers, and `RM_GLOBAL_PTR(T)` counts the
+// bytes loaded and stored. `rainbowmist::FlopProfiler` runs a kernel, and
+// reports per work-item arithmetic ops, transcendental calls and global
+// bytes, so with the machine's peak FLOPS and bandwidth(measured by
+// `MeasureRooflineMachine()`, a STREAM triad and an FMA loop), each kernel
+// can be placed on a roofline:
+//
+//   // kernel.h: use RM_FLOAT for float variables
+//   RM_KERNEL void saxpy(RM_GLOBAL_PTR(float) y, RM_GLOBAL_PTR(const float) x,
+//                        RM_FLOAT a);
+//
+//   // host, compiled with -DRAINBOWMIST_COUNT_FLOPS
+//   #include "rainbowmist_flops.h"  // before rainbowmist.h and the kernels
+//   #include "kernel.h"
+//
+//   rainbowmist::FlopProfiler prof;
+//   prof.Launch("saxpy", n, 1, 1, [&]() { saxpy(y, x, 2.0f); });
+//   prof.Print(stdout, rainbowmist::MeasureRooflineMachine());
+//
+// A kernel left of the ridge point(flops / bytes < peak FLOPS / bandwidth)
+// is memory bound; make it move fewer bytes before tuning its arithmetic.
+//
+// NOTE(LTE): Counting makes kernels several times slower, so the GFLOPS in
+// the report are pessimistic; pass the time measured in a normal build to
+// `SetTime()` for the real position. Plain `float` variables(and swizzles,
+// which the counting vectors do not have) are not counted. Without
+// RAINBOWMIST_COUNT_FLOPS this header can still be used for the machine
+// probes.
+//
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 - 2020 Light Transport Entertainment, Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// NOTE(LTE): The counting types come before rainbowmist.h, which uses them
+// for vec2 ... uvec4 with RAINBOWMIST_COUNT_FLOPS.
+#define RAINBOWMIST_FLOPS_TYPES_ (1)
+
+namespace rainbowmist {
+
+enum FlopCategory {
+  kFlopAdd = 0,         // add, sub
+  kFlopMul,
+  kFlopDiv,
+  kFlopFma,             // counts as 2 FLOPs
+  kFlopCompare,         // compare, min, max, abs, floor, ...
+  kFlopTranscendental,  // sqrt, exp, log, pow, sin, ...
+  kNumFlopCategories
+};
+
+struct FlopCounts {
+  uint64_t ops[kNumFlopCategories];
+  uint64_t load_bytes = 0;
+  uint64_t store_bytes = 0;
+
+  FlopCounts() {
+    for (int i = 0; i < kNumFlopCategories; i++) {
+      ops[i] = 0;
+    }
+  }
+
+  void Add(const FlopCounts &other) {
+    for (int i = 0; i < kNumFlopCategories; i++) {
+      ops[i] += other.ops[i];
+    }
+    load_bytes += other.load_bytes;
+    store_bytes += other.store_bytes;
+  }
+
+  /// Floating point operations, as counted for a roofline(transcendentals
+  /// and compares are reported separately).
+  uint64_t Flops() const {
+    return ops[kFlopAdd] + ops[kFlopMul] + ops[kFlopDiv] + 2 * ops[kFlopFma];
+  }
+  uint64_t Bytes() const { return load_bytes + store_bytes; }
+};
+
+// Counts of the worker thread, during `FlopProfiler::Launch()` only.
+inline FlopCounts *&CurrentFlopCounts() {
+  static thread_local FlopCounts *counts = nullptr;
+  return counts;
+}
+
+inline void CountFlop(int category) {
+  FlopCounts *counts = CurrentFlopCounts();
+  if (counts) {
+    counts->ops[category]++;
+  }
+}
+
+namespace counted {
+
+///
+/// `float` which counts its arithmetic.
+///
+class CountedFloat {
+ public:
+  CountedFloat() : v_(0.0f) {}
+  CountedFloat(float v) : v_(v) {}
+  operator float() const { return v_; }
+
+  CountedFloat operator-() const { return CountedFloat(-v_); }
+  CountedFloat operator+() const { return *this; }
+
+  CountedFloat &operator+=(CountedFloat b) {
+    CountFlop(kFlopAdd);
+    v_ += b.v_;
+    return *this;
+  }
+  CountedFloat &operator-=(CountedFloat b) {
+    CountFlop(kFlopAdd);
+    v_ -= b.v_;
+    return *this;
+  }
+  CountedFloat &operator*=(CountedFloat b) {
+    CountFlop(kFlopMul);
+    v_ *= b.v_;
+    return *this;
+  }
+  CountedFloat &operator/=(CountedFloat b) {
+    CountFlop(kFlopDiv);
+    v_ /= b.v_;
+    return *this;
+  }
+
+ private:
+  float v_;
+};
+
+// Arithmetic types other than CountedFloat, which mix with it without
+// being ambiguous with the built-in operators.
+template <typename S>
+struct IsPlainArithmetic
+    : std::integral_constant<bool, std::is_arithmetic<S>::value> {};
+
+#define RM_COUNTED_BINARY_OP(op, category, R)                               \
+  inline R operator op(CountedFloat a, CountedFloat b) {                    \
+    CountFlop(category);                                                    \
+    return R(float(a) op float(b));                                         \
+  }                                                                         \
+  template <typename S, typename = typename std::enable_if<                 \
+                            IsPlainArithmetic<S>::value>::type>             \
+  inline R operator op(CountedFloat a, S b) {                               \
+    CountFlop(category);                                                    \
+    return R(float(a) op float(b));                                         \
+  }                                                                         \
+  template <typename S, typename = typename std::enable_if<                 \
+                            IsPlainArithmetic<S>::value>::type>             \
+  inline R operator op(S a, CountedFloat b) {                               \
+    CountFlop(category);                                                    \
+    return R(float(a) op float(b));                                         \
+  }
+
+RM_COUNTED_BINARY_OP(+, kFlopAdd, CountedFloat)
+RM_COUNTED_BINARY_OP(-, kFlopAdd, CountedFloat)
+RM_COUNTED_BINARY_OP(*, kFlopMul, CountedFloat)
+RM_COUNTED_BINARY_OP(/, kFlopDiv, CountedFloat)
+RM_COUNTED_BINARY_OP(<, kFlopCompare, bool)
+RM_COUNTED_BINARY_OP(<=, kFlopCompare, bool)
+RM_COUNTED_BINARY_OP(>, kFlopCompare, bool)
+RM_COUNTED_BINARY_OP(>=, kFlopCompare, bool)
+RM_COUNTED_BINARY_OP(==, kFlopCompare, bool)
+RM_COUNTED_BINARY_OP(!=, kFlopCompare, bool)
+
+#undef RM_COUNTED_BINARY_OP
+
+// Math functions, found by argument dependent lookup, so `sqrt(x)` and
+// `sqrtf(x)` in a kernel are counted when `x` is a CountedFloat.
+#define RM_COUNTED_UNARY_FUNC(name, category, expr) \
+  inline CountedFloat name(CountedFloat x) {       \
+    CountFlop(category);                           \
+    const float v = float(x);                      \
+    return CountedFloat(expr);                     \
+  }
+
+#define RM_COUNTED_BINARY_FUNC(name, category, expr)                  \
+  inline CountedFloat name(CountedFloat x, CountedFloat y) {          \
+    CountFlop(category);                                              \
+    const float a = float(x), b = float(y);                           \
+    return CountedFloat(expr);                                        \
+  }                                                                   \
+  template <typename S, typename = typename std::enable_if<           \
+                            IsPlainArithmetic<S>::value>::type>       \
+  inline CountedFloat name(CountedFloat x, S y) {                     \
+    return name(x, CountedFloat(float(y)));                           \
+  }                                                                   \
+  template <typename S, typename = typename std::enable_if<           \
+                            IsPlainArithmetic<S>::value>::type>       \
+  inline CountedFloat name(S x, CountedFloat y) {                     \
+    return name(CountedFloat(float(x)), y);                           \
+  }
+
+RM_COUNTED_UNARY_FUNC(sqrt, kFlopTranscendental, std::sqrt(v))
+RM_COUNTED_UNARY_FUNC(sqrtf, kFlopTranscendental, std::sqrt(v))
+RM_COUNTED_UNARY_FUNC(rsqrt, kFlopTranscendental, 1.0f / std::sqrt(v))
+RM_COUNTED_UNARY_FUNC(exp, kFlopTranscendental, std::exp(v))
+RM_COUNTED_UNARY_FUNC(expf, kFlopTranscendental, std::exp(v))
+RM_COUNTED_UNARY_FUNC(exp2, kFlopTranscendental, std::exp2(v))
+RM_COUNTED_UNARY_FUNC(log, kFlopTranscendental, std::log(v))
+RM_COUNTED_UNARY_FUNC(logf, kFlopTranscendental, std::log(v))
+RM_COUNTED_UNARY_FUNC(log2, kFlopTranscendental, std::log2(v))
+RM_COUNTED_UNARY_FUNC(sin, kFlopTranscendental, std::sin(v))
+RM_COUNTED_UNARY_FUNC(sinf, kFlopTranscendental, std::sin(v))
+RM_COUNTED_UNARY_FUNC(cos, kFlopTranscendental, std::cos(v))
+RM_COUNTED_UNARY_FUNC(cosf, kFlopTranscendental, std::cos(v))
+RM_COUNTED_UNARY_FUNC(tan, kFlopTranscendental, std::tan(v))
+RM_COUNTED_UNARY_FUNC(tanf, kFlopTranscendental, std::tan(v))
+RM_COUNTED_UNARY_FUNC(asin, kFlopTranscendental, std::asin(v))
+RM_COUNTED_UNARY_FUNC(acos, kFlopTranscendental, std::acos(v))
+RM_COUNTED_UNARY_FUNC(atan, kFlopTranscendental, std::atan(v))
+RM_COUNTED_UNARY_FUNC(abs, kFlopCompare, std::fabs(v))
+RM_COUNTED_UNARY_FUNC(fabs, kFlopCompare, std::fabs(v))
+RM_COUNTED_UNARY_FUNC(fabsf, kFlopCompare, std::fabs(v))
+RM_COUNTED_UNARY_FUNC(floor, kFlopCompare, std::floor(v))
+RM_COUNTED_UNARY_FUNC(floorf, kFlopCompare, std::floor(v))
+RM_COUNTED_UNARY_FUNC(ceil, kFlopCompare, std::ceil(v))
+RM_COUNTED_UNARY_FUNC(ceilf, kFlopCompare, std::ceil(v))
+RM_COUNTED_UNARY_FUNC(fract, kFlopCompare, v - std::floor(v))
+
+RM_COUNTED_BINARY_FUNC(pow, kFlopTranscendental, std::pow(a, b))
+RM_COUNTED_BINARY_FUNC(powf, kFlopTranscendental, std::pow(a, b))
+RM_COUNTED_BINARY_FUNC(atan2, kFlopTranscendental, std::atan2(a, b))
+RM_COUNTED_BINARY_FUNC(atan2f, kFlopTranscendental, std::atan2(a, b))
+RM_COUNTED_BINARY_FUNC(min, kFlopCompare, (b < a) ? b : a)
+RM_COUNTED_BINARY_FUNC(max, kFlopCompare, (a < b) ? b : a)
+RM_COUNTED_BINARY_FUNC(fmin, kFlopCompare, (b < a) ? b : a)
+RM_COUNTED_BINARY_FUNC(fmax, kFlopCompare, (a < b) ? b : a)
+RM_COUNTED_BINARY_FUNC(fminf, kFlopCompare, (b < a) ? b : a)
+RM_COUNTED_BINARY_FUNC(fmaxf, kFlopCompare, (a < b) ? b : a)
+
+#undef RM_COUNTED_UNARY_FUNC
+#undef RM_COUNTED_BINARY_FUNC
+
+inline CountedFloat fma(CountedFloat a, CountedFloat b, CountedFloat c) {
+  CountFlop(kFlopFma);
+  return CountedFloat(std::fma(float(a), float(b), float(c)));
+}
+
+inline CountedFloat clamp(CountedFloat x, CountedFloat lo, CountedFloat hi) {
+  return min(max(x, lo), hi);
+}
+
+inline CountedFloat mix(CountedFloat a, CountedFloat b, CountedFloat t) {
+  return a + (b - a) * t;
+}
+
+template <typename T, int N>
+struct VectorStorage;
+
+template <typename T>
+struct VectorStorage<T, 2> {
+  VectorStorage() : x(), y() {}
+  VectorStorage(T x_, T y_) : x(x_), y(y_) {}
+  T x, y;
+};
+
+template <typename T>
+struct VectorStorage<T, 3> {
+  VectorStorage() : x(), y(), z() {}
+  VectorStorage(T x_, T y_, T z_) : x(x_), y(y_), z(z_) {}
+  VectorStorage(const VectorStorage<T, 2> &v, T z_) : x(v.x), y(v.y), z(z_) {}
+  T x, y, z;
+};
+
+template <typename T>
+struct VectorStorage<T, 4> {
+  VectorStorage() : x(), y(), z(), w() {}
+  VectorStorage(T x_, T y_, T z_, T w_) : x(x_), y(y_), z(z_), w(w_) {}
+  VectorStorage(const VectorStorage<T, 3> &v, T w_)
+      : x(v.x), y(v.y), z(v.z), w(w_) {}
+  T x, y, z, w;
+};
+
+///
+/// vec2 ... uvec4 for counting builds: component-wise operators and the
+/// common GLSL functions, counted through the component type. No swizzles.
+///
+template <typename T, int N>
+class CountedVector : public VectorStorage<T, N> {
+ public:
+  typedef VectorStorage<T, N> Base;
+
+  CountedVector() {}
+  CountedVector(const Base &b) : Base(b) {}
+  template <typename... Args>
+  CountedVector(T a, T b, Args... rest) : Base(a, b, T(rest)...) {}
+  // vec3(vec2, z), vec4(vec3, w)
+  template <int M, typename = typename std::enable_if<M + 1 == N>::type>
+  CountedVector(const CountedVector<T, M> &v, T last) : Base(v, last) {}
+  explicit CountedVector(T s) {
+    for (int i = 0; i < N; i++) {
+      (*this)[i] = s;
+    }
+  }
+
+  T &operator[](int i) { return (&this->x)[i]; }
+  const T &operator[](int i) const { return (&this->x)[i]; }
+
+#define RM_COUNTED_VECTOR_OP(op)                                             \
+  friend CountedVector operator op(const CountedVector &a,                   \
+                                   const CountedVector &b) {                 \
+    CountedVector r;                                                         \
+    for (int i = 0; i < N; i++) r[i] = a[i] op b[i];                         \
+    return r;                                                                \
+  }                                                                          \
+  friend CountedVector operator op(const CountedVector &a, const T &s) {     \
+    CountedVector r;                                                         \
+    for (int i = 0; i < N; i++) r[i] = a[i] op s;                            \
+    return r;                                                                \
+  }                                                                          \
+  friend CountedVector operator op(const T &s, const CountedVector &b) {     \
+    CountedVector r;                                                         \
+    for (int i = 0; i < N; i++) r[i] = s op b[i];                            \
+    return r;                                                                \
+  }                                                                          \
+  CountedVector &operator op##=(const CountedVector &b) {                    \
+    return *this = *this op b;                                               \
+  }                                                                          \
+  CountedVector &operator op##=(const T &s) { return *this = *this op s; }
+
+  RM_COUNTED_VECTOR_OP(+)
+  RM_COUNTED_VECTOR_OP(-)
+  RM_COUNTED_VECTOR_OP(*)
+  RM_COUNTED_VECTOR_OP(/)
+
+#undef RM_COUNTED_VECTOR_OP
+
+  friend CountedVector operator-(const CountedVector &a) {
+    CountedVector r;
+    for (int i = 0; i < N; i++) r[i] = -a[i];
+    return r;
+  }
+
+  friend T dot(const CountedVector &a, const CountedVector &b) {
+    T r = a[0] * b[0];
+    for (int i = 1; i < N; i++) r = r + a[i] * b[i];
+    return r;
+  }
+  friend CountedVector cross(const CountedVector &a, const CountedVector &b) {
+    static_assert(N == 3, "cross() of 3 component vectors only");
+    CountedVector r;
+    r[0] = a[1] * b[2] - a[2] * b[1];
+    r[1] = a[2] * b[0] - a[0] * b[2];
+    r[2] = a[0] * b[1] - a[1] * b[0];
+    return r;
+  }
+  friend T length(const CountedVector &a) { return sqrt(dot(a, a)); }
+  friend T distance(const CountedVector &a, const CountedVector &b) {
+    return length(a - b);
+  }
+  friend CountedVector normalize(const CountedVector &a) {
+    return a / length(a);
+  }
+  friend CountedVector min(const CountedVector &a, const CountedVector &b) {
+    CountedVector r;
+    for (int i = 0; i < N; i++) r[i] = (b[i] < a[i]) ? b[i] : a[i];
+    return r;
+  }
+  friend CountedVector max(const CountedVector &a, const CountedVector &b) {
+    CountedVector r;
+    for (int i = 0; i < N; i++) r[i] = (a[i] < b[i]) ? b[i] : a[i];
+    return r;
+  }
+  friend CountedVector clamp(const CountedVector &x, const CountedVector &lo,
+                             const CountedVector &hi) {
+    return min(max(x, lo), hi);
+  }
+  friend CountedVector mix(const CountedVector &a, const CountedVector &b,
+                           const T &t) {
+    return a + (b - a) * t;
+  }
+  friend CountedVector abs(const CountedVector &a) {
+    CountedVector r;
+    for (int i = 0; i < N; i++) r[i] = (a[i] < T(0)) ? -a[i] : a[i];
+    return r;
+  }
+  friend CountedVector floor(const CountedVector &a) {
+    CountedVector r;
+    for (int i = 0; i < N; i++) r[i] = floor(a[i]);
+    return r;
+  }
+};
+
+template <typename T>
+struct CountedValue {
+  typedef T type;
+};
+template <>
+struct CountedValue<float> {
+  typedef CountedFloat type;
+};
+
+///
+/// What `CountedPtr<T>::operator[]` returns: counts a load when read, and a
+/// store when assigned. Use `T v = p[i];` to access members of a struct.
+///
+template <typename T>
+class CountedRef {
+ public:
+  typedef typename std::remove_const<T>::type Plain;
+  typedef typename CountedValue<Plain>::type Value;
+
+  explicit CountedRef(T *p) : p_(p) {}
+
+  operator Value() const {
+    FlopCounts *counts = CurrentFlopCounts();
+    if (counts) {
+      counts->load_bytes += sizeof(T);
+    }
+    return Value(*p_);
+  }
+
+  const CountedRef &operator=(const Value &v) const {
+    FlopCounts *counts = CurrentFlopCounts();
+    if (counts) {
+      counts->store_bytes += sizeof(T);
+    }
+    *p_ = Plain(v);
+    return *this;
+  }
+  const CountedRef &operator=(const CountedRef &other) const {
+    return *this = Value(other);
+  }
+
+  template <typename U>
+  const CountedRef &operator+=(const U &v) const {
+    return *this = Value(Value(*this) + v);
+  }
+  template <typename U>
+  const CountedRef &operator-=(const U &v) const {
+    return *this = Value(Value(*this) - v);
+  }
+  template <typename U>
+  const CountedRef &operator*=(const U &v) const {
+    return *this = Value(Value(*this) * v);
+  }
+  template <typename U>
+  const CountedRef &operator/=(const U &v) const {
+    return *this = Value(Value(*this) / v);
+  }
+
+ private:
+  T *p_;
+};
+
+///
+/// Global pointer which counts the bytes loaded and stored through it.
+///
+template <typename T>
+class CountedPtr {
+ public:
+  CountedPtr(T *p = nullptr) : p_(p) {}
+  template <typename U>
+  CountedPtr(const CountedPtr<U> &other) : p_(other.get()) {}
+
+  CountedRef<T> operator[](ptrdiff_t i) const { return CountedRef<T>(p_ + i); }
+  CountedRef<T> operator*() const { return CountedRef<T>(p_); }
+
+  CountedPtr operator+(ptrdiff_t i) const { return CountedPtr(p_ + i); }
+  CountedPtr operator-(ptrdiff_t i) const { return CountedPtr(p_ - i); }
+  CountedPtr &operator+=(ptrdiff_t i) {
+    p_ += i;
+    return *this;
+  }
+  CountedPtr &operator++() {
+    ++p_;
+    return *this;
+  }
+
+  T *get() const { return p_; }
+
+ private:
+  T *p_;
+};
+
+}  // namespace counted
+
+using counted::CountedFloat;
+using counted::CountedPtr;
+using counted::CountedVector;
+
+}  // namespace rainbowmist
+
+#include "rainbowmist.h"
+
+#if defined(RAINBOWMIST_CPP11)
+
+#include <mutex>
+
+namespace rainbowmist {
+
+struct KernelFlops {
+  std::string name;
+  uint64_t num_launches = 0;
+  uint64_t num_items = 0;
+  double seconds = 0.0;  // Sum over launches
+  FlopCounts counts;
+
+  double FlopsPerItem() const {
+    return num_items ? double(counts.Flops()) / double(num_items) : 0.0;
+  }
+  double OpsPerItem(int category) const {
+    return num_items ? double(counts.ops[category]) / double(num_items) : 0.0;
+  }
+  double BytesPerItem() const {
+    return num_items ? double(counts.Bytes()) / double(num_items) : 0.0;
+  }
+  /// FLOPs per byte of global memory traffic.
+  double ArithmeticIntensity() const {
+    return counts.Bytes() ? double(counts.Flops()) / double(counts.Bytes())
+                          : 0.0;
+  }
+  double Gflops() const {
+    return seconds > 0.0 ? double(counts.Flops()) / seconds * 1.0e-9 : 0.0;
+  }
+};
+
+struct RooflineMachine {
+  double gflops = 0.0;          // Peak
+  double gbytes_per_sec = 0.0;  // Memory bandwidth
+
+  /// Upper bound of GFLOPS for a kernel of `intensity` FLOPs per byte.
+  double Attainable(double intensity) const {
+    return std::min(gflops, intensity * gbytes_per_sec);
+  }
+  /// Intensity above which kernels are compute bound.
+  double Ridge() const {
+    return gbytes_per_sec > 0.0 ? gflops / gbytes_per_sec : 0.0;
+  }
+};
+
+class FlopProfiler : public LaunchObserver {
+ public:
+  /// `rainbowmist::LaunchKernel`, counted under `name`.
+  template <class F>
+  void Launch(const std::string &name, unsigned int xs, unsigned int ys,
+              unsigned int zs, F kernel, unsigned int num_threads = 0) {
+    double seconds = 0.0;
+    {
+      ScopedLaunchObserver observe(this);
+      auto start = std::chrono::steady_clock::now();
+      try {
+        LaunchKernel(xs, ys, zs, kernel, num_threads);
+      } catch (...) {
+        // Not counted. The workers have stopped counting into `threads_`.
+        threads_.clear();
+        throw;
+      }
+      seconds = std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    KernelFlops &k = Find(name);
+    k.num_launches++;
+    k.num_items += uint64_t(xs) * ys * zs;
+    k.seconds += seconds;
+    for (const auto &c : threads_) {
+      k.counts.Add(c);
+    }
+  }
+
+  void LaunchBegin(unsigned int, unsigned int num_threads) {
+    threads_.assign(num_threads, FlopCounts());
+  }
+  void WorkerBegin(unsigned int thread_index) {
+    CurrentFlopCounts() = &threads_[thread_index];
+  }
+  void WorkerEnd(unsigned int, unsigned int) { CurrentFlopCounts() = nullptr; }
+
+  /// Replaces the time of kernel `name` with the time of one launch measured
+  /// without counting, for all launches so far.
+  void SetTime(const std::string &name, double seconds_per_launch) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    KernelFlops &k = Find(name);
+    k.seconds = seconds_per_launch * double(k.num_launches);
+  }
+
+  std::vector<KernelFlops> kernels() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return kernels_;
+  }
+
+  /// Per kernel: ops and bytes per work-item, intensity, and with `machine`
+  /// the attainable GFLOPS and whether the kernel is memory bound.
+  void Print(FILE *fp = stdout,
+             const RooflineMachine &machine = RooflineMachine()) const {
+    fprintf(fp, "%-20s %10s %8s %8s %8s %8s %8s %9s %9s %9s  %s\n", "kernel",
+            "items", "flop/it", "fma/it", "cmp/it", "trans/it", "byte/it",
+            "flop/byte", "GFLOPS", "attain", "bound");
+    for (const auto &k : kernels()) {
+      double intensity = k.ArithmeticIntensity();
+      fprintf(fp, "%-20s %10llu %8.2f %8.2f %8.2f %8.2f %8.2f %9.3f %9.3f",
+              k.name.c_str(), static_cast<unsigned long long>(k.num_items),
+              k.FlopsPerItem(), k.OpsPerItem(kFlopFma),
+              k.OpsPerItem(kFlopCompare), k.OpsPerItem(kFlopTranscendental),
+              k.BytesPerItem(), intensity, k.Gflops());
+      if (machine.gflops > 0.0) {
+        fprintf(fp, " %9.3f  %s\n", machine.Attainable(intensity),
+                intensity < machine.Ridge() ? "memory" : "compute");
+      } else {
+        fprintf(fp, " %9s  %s\n", "-", "-");
+      }
+    }
+    if (machine.gflops > 0.0) {
+      fprintf(fp, "peak %.1f GFLOPS, %.1f GB/s, ridge %.2f flop/byte\n",
+              machine.gflops, machine.gbytes_per_sec, machine.Ridge());
+    }
+  }
+
+  void Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    kernels_.clear();
+  }
+
+ private:
+  KernelFlops &Find(const std::string &name) {
+    for (auto &k : kernels_) {
+      if (k.name == name) {
+        return k;
+      }
+    }
+    kernels_.push_back(KernelFlops());
+    kernels_.back().name = name;
+    return kernels_.back();
+  }
+
+  mutable std::mutex mutex_;
+  std::vector<FlopCounts> threads_;
+  std::vector<KernelFlops> kernels_;
+};
+
+namespace flops_detail {
+
+inline unsigned int ProbeThreads(unsigned int num_threads) {
+  return num_threads ? num_threads
+                     : std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Runs `fn(thread_index)` on `num_threads` threads, and returns the seconds.
+template <class F>
+inline double TimeThreads(unsigned int num_threads, F fn) {
+  auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (unsigned int t = 1; t < num_threads; t++) {
+    threads.emplace_back(fn, t);
+  }
+  fn(0u);
+  for (auto &th : threads) {
+    th.join();
+  }
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+}  // namespace flops_detail
+
+///
+/// STREAM triad `a[i] = b[i] + s * c[i]` over three arrays of `bytes` in
+/// total(make it well above the last level cache), best of `repeat` runs.
+/// Returns GB/s, counting 3 x 4 bytes per element like STREAM.
+///
+inline double MeasureBandwidth(size_t bytes = size_t(192) << 20,
+                               unsigned int num_threads = 0,
+                               int repeat = 5) {
+  num_threads = flops_detail::ProbeThreads(num_threads);
+  const size_t n = std::max(size_t(num_threads), bytes / (3 * sizeof(float)));
+  std::vector<float> a(n), b(n, 1.0f), c(n, 2.0f);
+  const float s = 3.0f;
+  auto triad = [&](unsigned int t) {
+    size_t begin = n * t / num_threads, end = n * (t + 1) / num_threads;
+    for (size_t i = begin; i < end; i++) {
+      a[i] = b[i] + s * c[i];
+    }
+  };
+  flops_detail::TimeThreads(num_threads, triad);  // Page in, per thread
+  double best = 1.0e30;
+  for (int r = 0; r < repeat; r++) {
+    best = std::min(best, flops_detail::TimeThreads(num_threads, triad));
+  }
+  return double(3 * sizeof(float) * n) / best * 1.0e-9;
+}
+
+///
+/// Peak GFLOPS the compiler reaches for plain C++ kernels: independent
+/// multiply-add chains, which it can vectorize, on each thread.
+///
+inline double MeasurePeakGflops(unsigned int num_threads = 0,
+                                int iterations = 1 << 20) {
+  num_threads = flops_detail::ProbeThreads(num_threads);
+  const int kChains = 64;
+  std::vector<float> sink(num_threads);
+  auto fma_loop = [&](unsigned int t) {
+    float acc[kChains];
+    for (int j = 0; j < kChains; j++) {
+      acc[j] = float(j + t);
+    }
+    const float m = 0.999999f, a = 1.0e-6f;
+    for (int i = 0; i < iterations; i++) {
+      for (int j = 0; j < kChains; j++) {
+        acc[j] = acc[j] * m + a;
+      }
+    }
+    float sum = 0.0f;
+    for (int j = 0; j < kChains; j++) {
+      sum += acc[j];
+    }
+    sink[t] = sum;  // Keep the loop.
+  };
+  double best = 1.0e30;
+  for (int r = 0; r < 3; r++) {
+    best = std::min(best, flops_detail::TimeThreads(num_threads, fma_loop));
+  }
+  return 2.0 * kChains * double(iterations) * num_threads / best * 1.0e-9;
+}
+
+inline RooflineMachine MeasureRooflineMachine(unsigned int num_threads = 0) {
+  RooflineMachine machine;
+  machine.gflops = MeasurePeakGflops(num_threads);
+  machine.gbytes_per_sec = MeasureBandwidth(size_t(192) << 20, num_threads);
+  return machine;
+}
+
+}  // namespace rainbowmist
+
+#endif  // RAINBOWMIST_CPP11
+
+#endif  // RAINBOWMIST_FLOPS_H_
@@ -0,0 +1,613 @@
+#ifndef RAINBOWMIST_LBVH_H_
+#define RAINBOWMIST_LBVH_H_
+
+//
+// RainbowMist linear BVH(LBVH) builder.
+//
+// Builds a binary BVH(`RMBVHNode`, see `rainbowmist_bvh.h`) for N triangles
+// from 30bit Morton codes in parallel:
+//
+//   1. rm_lbvh_centroid_bounds  (num_chunks items) + rm_lbvh_reduce_bounds(1)
+//   2. rm_lbvh_morton_codes     (N)
+//   3. Stable LSD radix sort, 4bit digit x 8 passes. For each pass:
+//      rm_lbvh_radix_histogram(num_blocks),
+//      rm_lbvh_radix_scan_blocks(num_scan_blocks), rm_lbvh_radix_scan(1),
+//      rm_lbvh_radix_scan_add(16 * num_blocks),
+//      rm_lbvh_radix_scatter(num_blocks)
+//   4. rm_lbvh_build_hierarchy  (N - 1)  Karras 2012
+//   5. rm_lbvh_update_leaves    (N)
+//   6. rm_lbvh_clear_flags      (N - 1) + rm_lbvh_refit(N)
+//
+// Node layout: internal nodes are [0, N - 1)(root is 0), leaves are
+// [N - 1, 2N - 1). Each leaf has one triangle.
+//
+// For deforming meshes with fixed topology, only run step 5 and 6(refit).
+//
+// None of the kernels use local memory or barriers, so they run on
+// CUDA/OpenCL and with `rainbowmist::LaunchKernel` on the C++11 backend.
+// `rainbowmist::LBVH` drives the whole build on the C++11 backend.
+//
+
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 - 2020 Light Transport Entertainment, Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "rainbowmist.h"
+#include "rainbowmist_bvh.h"
+
+// # of keys processed by one work item in the radix sort.
+#ifndef RM_LBVH_SORT_BLOCK
+#define RM_LBVH_SORT_BLOCK (256)
+#endif
+
+// # of histogram entries scanned by one work item in the first level of the
+// scan.
+#ifndef RM_LBVH_SCAN_BLOCK
+#define RM_LBVH_SCAN_BLOCK (256)
+#endif
+
+#define RM_LBVH_RADIX_BITS (4)
+#define RM_LBVH_RADIX_SIZE (16)
+#define RM_LBVH_RADIX_PASSES (8)
+
+// Kernels are defined in this header, so make them inline in C++ mode to
+// allow including it from multiple translation units.
+#if defined(RAINBOWMIST_CPP11)
+#define RM_LBVH_KERNEL inline
+#else
+#define RM_LBVH_KERNEL RM_KERNEL
+#endif
+
+RM_DEVICE static inline int rm_clz(unsigned int x) {
+#if defined(RAINBOWMIST_CUDA)
+  return __clz(RM_STATIC_CAST(int, x));
+#elif defined(RAINBOWMIST_OPENCL)
+  return RM_STATIC_CAST(int, clz(x));
+#elif defined(_MSC_VER)
+  unsigned long idx;
+  return _BitScanReverse(&idx, x) ? (31 - static_cast<int>(idx)) : 32;
+#else
+  return (x == 0) ? 32 : __builtin_clz(x);
+#endif
+}
+
+// Inserts two 0 bits after each of the 10 low bits of x.
+RM_DEVICE static inline unsigned int rm_lbvh_expand_bits(unsigned int x) {
+  x = (x * 0x00010001u) & 0xFF0000FFu;
+  x = (x * 0x00000101u) & 0x0F00F00Fu;
+  x = (x * 0x00000011u) & 0xC30C30C3u;
+  x = (x * 0x00000005u) & 0x49249249u;
+  return x;
+}
+
+RM_DEVICE static inline unsigned int rm_lbvh_morton3d(float x, float y,
+                                                      float z) {
+  x = rm_bvh_minf(rm_bvh_maxf(x * 1024.0f, 0.0f), 1023.0f);
+  y = rm_bvh_minf(rm_bvh_maxf(y * 1024.0f, 0.0f), 1023.0f);
+  z = rm_bvh_minf(rm_bvh_maxf(z * 1024.0f, 0.0f), 1023.0f);
+  unsigned int xx = rm_lbvh_expand_bits(RM_STATIC_CAST(unsigned int, x));
+  unsigned int yy = rm_lbvh_expand_bits(RM_STATIC_CAST(unsigned int, y));
+  unsigned int zz = rm_lbvh_expand_bits(RM_STATIC_CAST(unsigned int, z));
+  return xx * 4 + yy * 2 + zz;
+}
+
+RM_DEVICE static inline void rm_lbvh_triangle_bounds(
+    RM_GLOBAL const float *vertices, RM_GLOBAL const unsigned int *faces,
+    unsigned int prim, float bmin[3], float bmax[3]) {
+  for (unsigned int k = 0; k < 3; k++) {
+    float a = vertices[3 * faces[3 * prim + 0] + k];
+    float b = vertices[3 * faces[3 * prim + 1] + k];
+    float c = vertices[3 * faces[3 * prim + 2] + k];
+    bmin[k] = rm_bvh_minf(a, rm_bvh_minf(b, c));
+    bmax[k] = rm_bvh_maxf(a, rm_bvh_maxf(b, c));
+  }
+}
+
+// Length of the common prefix of keys i and j. Duplicated keys are made
+// unique by appending the index.
+RM_DEVICE static inline int rm_lbvh_delta(RM_GLOBAL const unsigned int *keys,
+                                          int n, int i, int j) {
+  if ((j < 0) || (j >= n)) {
+    return -1;
+  }
+  unsigned int ki = keys[i];
+  unsigned int kj = keys[j];
+  if (ki == kj) {
+    return 32 + rm_clz(RM_STATIC_CAST(unsigned int, i ^ j));
+  }
+  return rm_clz(ki ^ kj);
+}
+
+// --------------------------------------------------------------------------
+// 1. Scene bounds of triangle centroids.
+// partial_bounds[6 * b] : (min xyz, max xyz) of triangles [b * chunk, (b + 1) * chunk)
+
+RM_LBVH_KERNEL void rm_lbvh_centroid_bounds(
+    RM_GLOBAL float *partial_bounds, RM_GLOBAL const float *vertices,
+    RM_GLOBAL const unsigned int *faces, unsigned int num_faces,
+    unsigned int chunk) {
+  unsigned int b = GlobalId().x;
+  unsigned int begin = b * chunk;
+  if (begin >= num_faces) {
+    return;
+  }
+  unsigned int end = (begin + chunk < num_faces) ? (begin + chunk) : num_faces;
+
+  float cmin[3] = {RM_BVH_INF, RM_BVH_INF, RM_BVH_INF};
+  float cmax[3] = {-RM_BVH_INF, -RM_BVH_INF, -RM_BVH_INF};
+  for (unsigned int i = begin; i < end; i++) {
+    float bmin[3], bmax[3];
+    rm_lbvh_triangle_bounds(vertices, faces, i, bmin, bmax);
+    for (unsigned int k = 0; k < 3; k++) {
+      float c = 0.5f * (bmin[k] + bmax[k]);
+      cmin[k] = rm_bvh_minf(cmin[k], c);
+      cmax[k] = rm_bvh_maxf(cmax[k], c);
+    }
+  }
+  for (unsigned int k = 0; k < 3; k++) {
+    partial_bounds[6 * b + k] = cmin[k];
+    partial_bounds[6 * b + 3 + k] = cmax[k];
+  }
+}
+
+// Run with 1 work item.
+RM_LBVH_KERNEL void rm_lbvh_reduce_bounds(RM_GLOBAL float *bounds,
+                                          RM_GLOBAL const float *partial_bounds,
+                                          unsigned int num_partials) {
+  if (GlobalId().x != 0) {
+    return;
+  }
+  for (unsigned int k = 0; k < 3; k++) {
+    bounds[k] = RM_BVH_INF;
+    bounds[3 + k] = -RM_BVH_INF;
+  }
+  for (unsigned int b = 0; b < num_partials; b++) {
+    for (unsigned int k = 0; k < 3; k++) {
+      bounds[k] = rm_bvh_minf(bounds[k], partial_bounds[6 * b + k]);
+      bounds[3 + k] = rm_bvh_maxf(bounds[3 + k], partial_bounds[6 * b + 3 + k]);
+    }
+  }
+}
+
+// --------------------------------------------------------------------------
+// 2. Morton codes of triangle centroids. values[i] = i
+
+RM_LBVH_KERNEL void rm_lbvh_morton_codes(RM_GLOBAL unsigned int *keys,
+                                         RM_GLOBAL unsigned int *values,
+                                         RM_GLOBAL const float *vertices,
+                                         RM_GLOBAL const unsigned int *faces,
+                                         RM_GLOBAL const float *bounds,
+                                         unsigned int num_faces) {
+  unsigned int i = GlobalId().x;
+  if (i >= num_faces) {
+    return;
+  }
+
+  float bmin[3], bmax[3];
+  rm_lbvh_triangle_bounds(vertices, faces, i, bmin, bmax);
+
+  float p[3];
+  for (int k = 0; k < 3; k++) {
+    float extent = bounds[3 + k] - bounds[k];
+    float c = 0.5f * (bmin[k] + bmax[k]);
+    p[k] = (extent > 0.0f) ? ((c - bounds[k]) / extent) : 0.5f;
+  }
+
+  keys[i] = rm_lbvh_morton3d(p[0], p[1], p[2]);
+  values[i] = i;
+}
+
+// --------------------------------------------------------------------------
+// 3. Stable LSD radix sort.
+// hist[digit * num_blocks + b] : # of `digit` in keys of block b.
+
+RM_LBVH_KERNEL void rm_lbvh_radix_histogram(RM_GLOBAL unsigned int *hist,
+                                            RM_GLOBAL const unsigned int *keys,
+                                            unsigned int n, unsigned int shift,
+                                            unsigned int num_blocks) {
+  unsigned int b = GlobalId().x;
+  if (b >= num_blocks) {
+    return;
+  }
+
+  unsigned int counts[RM_LBVH_RADIX_SIZE];
+  for (int d = 0; d < RM_LBVH_RADIX_SIZE; d++) {
+    counts[d] = 0;
+  }
+
+  unsigned int begin = b * RM_LBVH_SORT_BLOCK;
+  unsigned int end =
+      (begin + RM_LBVH_SORT_BLOCK < n) ? (begin + RM_LBVH_SORT_BLOCK) : n;
+  for (unsigned int i = begin; i < end; i++) {
+    counts[(keys[i] >> shift) & (RM_LBVH_RADIX_SIZE - 1)]++;
+  }
+
+  for (unsigned int d = 0; d < RM_LBVH_RADIX_SIZE; d++) {
+    hist[d * num_blocks + b] = counts[d];
+  }
+}
+
+// In-place exclusive scan of hist in two levels. Each block of
+// RM_LBVH_SCAN_BLOCK entries is scanned in parallel and its total is stored in
+// block_sums, block_sums is scanned by rm_lbvh_radix_scan, then the scanned
+// totals are added back to each entry.
+
+RM_LBVH_KERNEL void rm_lbvh_radix_scan_blocks(
+    RM_GLOBAL unsigned int *hist, RM_GLOBAL unsigned int *block_sums,
+    unsigned int count) {
+  unsigned int b = GlobalId().x;
+  unsigned int begin = b * RM_LBVH_SCAN_BLOCK;
+  if (begin >= count) {
+    return;
+  }
+  unsigned int end = (begin + RM_LBVH_SCAN_BLOCK < count)
+                         ? (begin + RM_LBVH_SCAN_BLOCK)
+                         : count;
+  unsigned int sum = 0;
+  for (unsigned int i = begin; i < end; i++) {
+    unsigned int c = hist[i];
+    hist[i] = sum;
+    sum += c;
+  }
+  block_sums[b] = sum;
+}
+
+// Exclusive scan. Run with 1 work item. Only used for block sums, which have
+// count / RM_LBVH_SCAN_BLOCK entries.
+RM_LBVH_KERNEL void rm_lbvh_radix_scan(RM_GLOBAL unsigned int *hist,
+                                       unsigned int count) {
+  if (GlobalId().x != 0) {
+    return;
+  }
+  unsigned int sum = 0;
+  for (unsigned int i = 0; i < count; i++) {
+    unsigned int c = hist[i];
+    hist[i] = sum;
+    sum += c;
+  }
+}
+
+RM_LBVH_KERNEL void rm_lbvh_radix_scan_add(
+    RM_GLOBAL unsigned int *hist, RM_GLOBAL const unsigned int *block_sums,
+    unsigned int count) {
+  unsigned int i = GlobalId().x;
+  if (i >= count) {
+    return;
+  }
+  hist[i] += block_sums[i / RM_LBVH_SCAN_BLOCK];
+}
+
+RM_LBVH_KERNEL void rm_lbvh_radix_scatter(
+    RM_GLOBAL unsigned int *keys_out, RM_GLOBAL unsigned int *values_out,
+    RM_GLOBAL const unsigned int *keys_in,
+    RM_GLOBAL const unsigned int *values_in,
+    RM_GLOBAL const unsigned int *hist, unsigned int n, unsigned int shift,
+    unsigned int num_blocks) {
+  unsigned int b = GlobalId().x;
+  if (b >= num_blocks) {
+    return;
+  }
+
+  unsigned int offsets[RM_LBVH_RADIX_SIZE];
+  for (unsigned int d = 0; d < RM_LBVH_RADIX_SIZE; d++) {
+    offsets[d] = hist[d * num_blocks + b];
+  }
+
+  unsigned int begin = b * RM_LBVH_SORT_BLOCK;
+  unsigned int end =
+      (begin + RM_LBVH_SORT_BLOCK < n) ? (begin + RM_LBVH_SORT_BLOCK) : n;
+  for (unsigned int i = begin; i < end; i++) {
+    unsigned int key = keys_in[i];
+    unsigned int dst = offsets[(key >> shift) & (RM_LBVH_RADIX_SIZE - 1)]++;
+    keys_out[dst] = key;
+    values_out[dst] = values_in[i];
+  }
+}
+
+// --------------------------------------------------------------------------
+// 4. Hierarchy emission(Karras 2012, "Maximizing Parallelism in the
+// Construction of BVHs, Octrees, and k-d Trees"). One work item per internal
+// node. parents[0] = -1
+
+RM_LBVH_KERNEL void rm_lbvh_build_hierarchy(RM_GLOBAL RMBVHNode *nodes,
+                                            RM_GLOBAL int *parents,
+                                            RM_GLOBAL const unsigned int *keys,
+                                            unsigned int num_faces) {
+  int n = RM_STATIC_CAST(int, num_faces);
+  int i = RM_STATIC_CAST(int, GlobalId().x);
+  if (i >= n - 1) {
+    return;
+  }
+
+  // Direction of the range.
+  int d = (rm_lbvh_delta(keys, n, i, i + 1) - rm_lbvh_delta(keys, n, i, i - 1)) >= 0
+              ? 1
+              : -1;
+
+  // Upper bound of the range length.
+  int delta_min = rm_lbvh_delta(keys, n, i, i - d);
+  int lmax = 2;
+  while (rm_lbvh_delta(keys, n, i, i + lmax * d) > delta_min) {
+    lmax *= 2;
+  }
+
+  // Binary search the other end.
+  int l = 0;
+  for (int t = lmax / 2; t >= 1; t /= 2) {
+    if (rm_lbvh_delta(keys, n, i, i + (l + t) * d) > delta_min) {
+      l += t;
+    }
+  }
+  int j = i + l * d;
+
+  // Binary search the split position.
+  int delta_node = rm_lbvh_delta(keys, n, i, j);
+  int s = 0;
+  int t = l;
+  do {
+    t = (t + 1) >> 1;
+    if (rm_lbvh_delta(keys, n, i, i + (s + t) * d) > delta_node) {
+      s += t;
+    }
+  } while (t > 1);
+  int gamma = i + s * d + ((d < 0) ? d : 0);
+
+  int first = (i < j) ? i : j;
+  int last = (i < j) ? j : i;
+
+  int left = (first == gamma) ? (n - 1 + gamma) : gamma;
+  int right = (last == gamma + 1) ? (n - 1 + gamma + 1) : (gamma + 1);
+
+  nodes[i].child0 = left;
+  nodes[i].child1 = right;
+  parents[left] = i;
+  parents[right] = i;
+  if (i == 0) {
+    parents[0] = -1;
+  }
+}
+
+// --------------------------------------------------------------------------
+// 5. Leaf nodes. Also used for refit.
+
+RM_LBVH_KERNEL void rm_lbvh_update_leaves(RM_GLOBAL RMBVHNode *nodes,
+                                          RM_GLOBAL const unsigned int *prim_ids,
+                                          RM_GLOBAL const float *vertices,
+                                          RM_GLOBAL const unsigned int *faces,
+                                          unsigned int num_faces) {
+  unsigned int j = GlobalId().x;
+  if (j >= num_faces) {
+    return;
+  }
+
+  float bmin[3], bmax[3];
+  rm_lbvh_triangle_bounds(vertices, faces, prim_ids[j], bmin, bmax);
+
+  unsigned int idx = num_faces - 1 + j;
+  for (int k = 0; k < 3; k++) {
+    nodes[idx].bmin[k] = bmin[k];
+    nodes[idx].bmax[k] = bmax[k];
+  }
+  nodes[idx].child0 = ~RM_STATIC_CAST(int, j);
+  nodes[idx].child1 = 1;
+}
+
+// --------------------------------------------------------------------------
+// 6. Bottom-up bounding box refit. The second work item arriving at a node
+// computes its bounds, so each internal node is written exactly once.
+
+RM_LBVH_KERNEL void rm_lbvh_clear_flags(RM_GLOBAL int *flags,
+                                        unsigned int count) {
+  unsigned int i = GlobalId().x;
+  if (i < count) {
+    flags[i] = 0;
+  }
+}
+
+RM_LBVH_KERNEL void rm_lbvh_refit(RM_GLOBAL volatile RMBVHNode *nodes,
+                                  RM_GLOBAL const int *parents,
+                                  RM_GLOBAL int *flags, unsigned int num_faces) {
+  unsigned int j = GlobalId().x;
+  if (j >= num_faces) {
+    return;
+  }
+
+  int node = RM_STATIC_CAST(int, num_faces - 1 + j);
+  int parent = parents[node];
+  while (parent >= 0) {
+    // Publish the bounds of `node` before signaling.
+    RM_MEM_FENCE();
+    if (RM_ATOMIC_ADD(&flags[parent], 1) == 0) {
+      return;  // The sibling is not ready yet. It will continue.
+    }
+    RM_MEM_FENCE();
+
+    int c0 = nodes[parent].child0;
+    int c1 = nodes[parent].child1;
+    for (int k = 0; k < 3; k++) {
+      nodes[parent].bmin[k] =
+          rm_bvh_minf(nodes[c0].bmin[k], nodes[c1].bmin[k]);
+      nodes[parent].bmax[k] =
+          rm_bvh_maxf(nodes[c0].bmax[k], nodes[c1].bmax[k]);
+    }
+
+    node = parent;
+    parent = parents[node];
+  }
+}
+
+#if defined(RAINBOWMIST_CPP11)
+
+#include <vector>
+
+namespace rainbowmist {
+
+///
+/// LBVH builder for the C++11 backend. Runs the kernels above with
+/// `LaunchKernel`.
+///
+class LBVH {
+ public:
+  explicit LBVH(unsigned int num_threads = 0) : num_threads_(num_threads) {}
+
+  ///
+  /// Builds BVH from scratch.
+  ///
+  void Build(const float *vertices, const unsigned int *faces,
+             size_t num_faces) {
+    unsigned int n = static_cast<unsigned int>(num_faces);
+    num_faces_ = n;
+    nodes_.clear();
+    prim_ids_.clear();
+    if (n == 0) {
+      return;
+    }
+
+    nodes_.resize(2 * n - 1);
+    parents_.resize(2 * n - 1);
+    flags_.resize(n - 1);
+    prim_ids_.resize(n);
+    keys_[0].resize(n);
+    keys_[1].resize(n);
+    values_tmp_.resize(n);
+
+    // 1. Bounds
+    const unsigned int kChunk = 1024;
+    unsigned int num_chunks = (n + kChunk - 1) / kChunk;
+    partial_bounds_.resize(6 * num_chunks);
+    float *partial_bounds = partial_bounds_.data();
+    float *bounds = bounds_;
+    Launch(num_chunks, [=]() {
+      rm_lbvh_centroid_bounds(partial_bounds, vertices, faces, n, kChunk);
+    });
+    Launch(1, [=]() {
+      rm_lbvh_reduce_bounds(bounds, partial_bounds, num_chunks);
+    });
+
+    // 2. Morton codes
+    unsigned int *keys = keys_[0].data();
+    unsigned int *values = prim_ids_.data();
+    Launch(n, [=]() {
+      rm_lbvh_morton_codes(keys, values, vertices, faces, bounds, n);
+    });
+
+    // 3. Sort. Even # of passes, so the result ends up in keys_[0] and
+    // prim_ids_.
+    unsigned int num_blocks = (n + RM_LBVH_SORT_BLOCK - 1) / RM_LBVH_SORT_BLOCK;
+    unsigned int hist_count = RM_LBVH_RADIX_SIZE * num_blocks;
+    unsigned int num_scan_blocks =
+        (hist_count + RM_LBVH_SCAN_BLOCK - 1) / RM_LBVH_SCAN_BLOCK;
+    hist_.resize(hist_count);
+    scan_sums_.resize(num_scan_blocks);
+    unsigned int *hist = hist_.data();
+    unsigned int *scan_sums = scan_sums_.data();
+    unsigned int *kbuf[2] = {keys_[0].data(), keys_[1].data()};
+    unsigned int *vbuf[2] = {prim_ids_.data(), values_tmp_.data()};
+    for (unsigned int pass = 0; pass < RM_LBVH_RADIX_PASSES; pass++) {
+      unsigned int shift = pass * RM_LBVH_RADIX_BITS;
+      unsigned int *kin = kbuf[pass & 1], *kout = kbuf[(pass + 1) & 1];
+      unsigned int *vin = vbuf[pass & 1], *vout = vbuf[(pass + 1) & 1];
+      Launch(num_blocks, [=]() {
+        rm_lbvh_radix_histogram(hist, kin, n, shift, num_blocks);
+      });
+      Launch(num_scan_blocks, [=]() {
+        rm_lbvh_radix_scan_blocks(hist, scan_sums, hist_count);
+      });
+      Launch(1, [=]() { rm_lbvh_radix_scan(scan_sums, num_scan_blocks); });
+      Launch(hist_count, [=]() {
+        rm_lbvh_radix_scan_add(hist, scan_sums, hist_count);
+      });
+      Launch(num_blocks, [=]() {
+        rm_lbvh_radix_scatter(kout, vout, kin, vin, hist, n, shift, num_blocks);
+      });
+    }
+
+    // 4. Hierarchy
+    RMBVHNode *nodes = nodes_.data();
+    int *parents = parents_.data();
+    parents[0] = -1;
+    Launch(n - 1, [=]() { rm_lbvh_build_hierarchy(nodes, parents, keys, n); });
+
+    // 5, 6
+    Refit(vertices, faces);
+  }
+
+  ///
+  /// Updates bounding boxes for new vertex positions. Topology(faces) must be
+  /// same as the one given to `Build`.
+  ///
+  void Refit(const float *vertices, const unsigned int *faces) {
+    unsigned int n = num_faces_;
+    if (n == 0) {
+      return;
+    }
+
+    RMBVHNode *nodes = nodes_.data();
+    const int *parents = parents_.data();
+    int *flags = flags_.data();
+    const unsigned int *prim_ids = prim_ids_.data();
+
+    Launch(n, [=]() {
+      rm_lbvh_update_leaves(nodes, prim_ids, vertices, faces, n);
+    });
+    if (n == 1) {
+      return;
+    }
+    Launch(n - 1, [=]() { rm_lbvh_clear_flags(flags, n - 1); });
+    Launch(n, [=]() { rm_lbvh_refit(nodes, parents, flags, n); });
+  }
+
+  const std::vector<RMBVHNode> &nodes() const { return nodes_; }
+  const std::vector<unsigned int> &prim_ids() const { return prim_ids_; }
+
+  // Sorted Morton codes(valid after `Build`).
+  const std::vector<unsigned int> &morton_codes() const { return keys_[0]; }
+
+ private:
+  template <class F>
+  void Launch(unsigned int count, F kernel) {
+    LaunchKernel(count, 1, 1, kernel, num_threads_);
+  }
+
+  unsigned int num_threads_ = 0;
+  unsigned int num_faces_ = 0;
+
+  std::vector<RMBVHNode> nodes_;
+  std::vector<unsigned int> prim_ids_;
+  std::vector<int> parents_;
+  std::vector<int> flags_;
+
+  // scratch
+  std::vector<unsigned int> keys_[2];
+  std::vector<unsigned int> values_tmp_;
+  std::vector<unsigned int> hist_;
+  std::vector<unsigned int> scan_sums_;
+  std::vector<float> partial_bounds_;
+  float bounds_[6];
+};
+
+}  // namespace rainbowmist
+
+#endif  // RAINBOWMIST_CPP11
+
+#endif  // RAINBOWMIST_LBVH_H_
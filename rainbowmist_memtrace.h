@@ -0,0 +1,432 @@
+#ifndef RAINBOWMIST_MEMTRACE_H_
+#define RAINBOWMIST_MEMTRACE_H_
+
+//
+// RainbowMist memory access tracing for the C++11 backend.
+//
+// Since C++11 kernels are plain C++, each global memory access can be
+// recorded, and grouped like a GPU would: work-items are split into warps
+// (wavefronts) by their linear global id, and the k-th access of each lane
+// of a warp forms one request. For each request, we count the 32 byte
+// sectors and 128 byte cache lines it touches, so the report tells how well
+// a kernel's accesses would coalesce on a GPU, without a GPU:
+//
+//   // kernel.h
+//   RM_KERNEL void gather(RM_GLOBAL_PTR(float) out,
+//                         RM_GLOBAL_PTR(const float) in,
+//                         RM_GLOBAL_PTR(const int) index);
+//
+//   // host, compiled with -DRAINBOWMIST_TRACE_MEMORY
+//   #include "rainbowmist_memtrace.h"  // before the kernels
+//   #include "kernel.h"
+//
+//   rainbowmist::MemoryTrace trace;  // 32 lanes per warp
+//   trace.Launch(n, 1, 1, [&]() {
+//     gather(rainbowmist::Traced<float>(out, "out"),
+//            rainbowmist::Traced<const float>(in, "in"), index);
+//   });
+//   trace.Print();  // per buffer: efficiency, sectors and lines per request
+//
+// `RM_GLOBAL_PTR(T)` is `RM_GLOBAL T *` on OpenCL and CUDA, and on the C++11
+// backend without RAINBOWMIST_TRACE_MEMORY.
+//
+// Local(shared) memory can be wrapped with `Traced<T>(p, "tile",
+// rainbowmist::kLocalMemory)`, which reports bank conflicts per request
+// instead(32 banks of 4 bytes by default).
+//
+// NOTE(LTE): Each `[]`, `*` or `->` through a `Traced` counts as one access,
+// read or write. Offsets are relative to the pointer the `Traced` was made
+// from, which is assumed to be aligned like a device allocation. Records take
+// 32 bytes per access until the end of each launch, so trace a small launch.
+//
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 - 2020 Light Transport Entertainment, Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "rainbowmist.h"
+
+#if defined(RAINBOWMIST_CPP11)
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace rainbowmist {
+
+enum MemorySpace { kGlobalMemory = 0, kLocalMemory = 1 };
+
+struct MemoryAccessRecord {
+  const char *name;
+  uint64_t offset;  // From the base pointer of the `Traced`
+  uint32_t item;    // Linear global id
+  uint32_t seq;     // Index of the access within the work-item
+  uint32_t size;
+  uint32_t space;
+};
+
+// Records of one worker thread of a traced launch.
+struct MemoryTraceThread {
+  unsigned int xs = 1, ys = 1;
+  uint32_t last_item = 0xffffffffu;
+  uint32_t seq = 0;
+  std::vector<MemoryAccessRecord> records;
+
+  void Record(const char *name, MemorySpace space, uint64_t offset,
+              uint32_t size) {
+    const unsigned int *id = rainbowmist_tls_global_id().id;
+    uint32_t item = id[0] + xs * (id[1] + ys * id[2]);
+    if (item != last_item) {
+      last_item = item;
+      seq = 0;
+    }
+    MemoryAccessRecord r;
+    r.name = name;
+    r.offset = offset;
+    r.item = item;
+    r.seq = seq++;
+    r.size = size;
+    r.space = uint32_t(space);
+    records.push_back(r);
+  }
+};
+
+inline MemoryTraceThread *&CurrentMemoryTraceThread() {
+  static thread_local MemoryTraceThread *thread = nullptr;
+  return thread;
+}
+
+///
+/// Pointer which records its accesses during `MemoryTrace::Launch()`, and
+/// behaves like `T *` otherwise.
+///
+template <typename T>
+class Traced {
+ public:
+  Traced(T *p = nullptr, const char *name = "",
+         MemorySpace space = kGlobalMemory)
+      : p_(p), base_(p), name_(name), space_(space) {}
+
+  // Traced<T> -> Traced<const T>
+  template <typename U>
+  Traced(const Traced<U> &other)
+      : p_(other.get()),
+        base_(other.base()),
+        name_(other.name()),
+        space_(other.space()) {}
+
+  T &operator[](ptrdiff_t i) const {
+    Touch(p_ + i);
+    return p_[i];
+  }
+  T &operator*() const {
+    Touch(p_);
+    return *p_;
+  }
+  T *operator->() const {
+    Touch(p_);
+    return p_;
+  }
+
+  Traced operator+(ptrdiff_t i) const { return Traced(*this, p_ + i); }
+  Traced operator-(ptrdiff_t i) const { return Traced(*this, p_ - i); }
+  Traced &operator+=(ptrdiff_t i) {
+    p_ += i;
+    return *this;
+  }
+  Traced &operator-=(ptrdiff_t i) {
+    p_ -= i;
+    return *this;
+  }
+  Traced &operator++() {
+    ++p_;
+    return *this;
+  }
+
+  T *get() const { return p_; }
+  const void *base() const { return base_; }
+  const char *name() const { return name_; }
+  MemorySpace space() const { return space_; }
+
+ private:
+  Traced(const Traced &other, T *p)
+      : p_(p), base_(other.base_), name_(other.name_), space_(other.space_) {}
+
+  void Touch(const T *p) const {
+    MemoryTraceThread *thread = CurrentMemoryTraceThread();
+    if (thread) {
+      thread->Record(name_, space_,
+                     uint64_t(reinterpret_cast<const char *>(p) -
+                              static_cast<const char *>(base_)),
+                     uint32_t(sizeof(T)));
+    }
+  }
+
+  T *p_;
+  const void *base_;
+  const char *name_;
+  MemorySpace space_;
+};
+
+struct MemoryTraceOptions {
+  unsigned int warp_size = 32;   // 64 for AMD wavefronts
+  unsigned int sector_size = 32;
+  unsigned int line_size = 128;
+  unsigned int num_banks = 32;   // Local memory
+  unsigned int bank_width = 4;
+};
+
+///
+/// Statistics of the accesses through `Traced` pointers of one name.
+///
+struct MemoryAccessStats {
+  std::string name;
+  MemorySpace space = kGlobalMemory;
+  uint64_t num_requests = 0;      // Warp-wide accesses
+  uint64_t num_accesses = 0;      // Per work-item accesses
+  uint64_t requested_bytes = 0;   // Distinct bytes, per request
+  // Global memory
+  uint64_t num_sectors = 0;
+  uint64_t num_lines = 0;
+  uint64_t transferred_bytes = 0;  // num_sectors * sector_size
+  // Local memory: a request with an n-way bank conflict takes n wavefronts.
+  uint64_t num_wavefronts = 0;
+  unsigned int max_conflict = 0;
+
+  /// Requested / transferred bytes; 1 when fully coalesced.
+  double Efficiency() const {
+    return transferred_bytes ? double(requested_bytes) /
+                                   double(transferred_bytes)
+                             : 0.0;
+  }
+  double SectorsPerRequest() const {
+    return num_requests ? double(num_sectors) / double(num_requests) : 0.0;
+  }
+  double LinesPerRequest() const {
+    return num_requests ? double(num_lines) / double(num_requests) : 0.0;
+  }
+  /// Extra wavefronts per request; 0 when conflict free.
+  double BankConflictsPerRequest() const {
+    return num_requests ? double(num_wavefronts - num_requests) /
+                              double(num_requests)
+                        : 0.0;
+  }
+};
+
+class MemoryTrace : public LaunchObserver {
+ public:
+  explicit MemoryTrace(const MemoryTraceOptions &options = MemoryTraceOptions())
+      : options_(options) {
+    if (options_.warp_size == 0) options_.warp_size = 1;
+    if (options_.sector_size == 0) options_.sector_size = 1;
+    if (options_.line_size == 0) options_.line_size = 1;
+    if (options_.num_banks == 0) options_.num_banks = 1;
+    if (options_.bank_width == 0) options_.bank_width = 1;
+  }
+
+  /// `rainbowmist::LaunchKernel`, recording accesses through `Traced`
+  /// pointers. Statistics accumulate over launches until `Clear()`.
+  template <class F>
+  void Launch(unsigned int xs, unsigned int ys, unsigned int zs, F kernel,
+              unsigned int num_threads = 0) {
+    xs_ = xs;
+    ys_ = ys;
+    ScopedLaunchObserver observe(this);
+    LaunchKernel(xs, ys, zs, kernel, num_threads);
+  }
+
+  void LaunchBegin(unsigned int, unsigned int num_threads) {
+    threads_.assign(num_threads, MemoryTraceThread());
+    for (auto &thread : threads_) {
+      thread.xs = xs_;
+      thread.ys = ys_;
+    }
+  }
+  void WorkerBegin(unsigned int thread_index) {
+    CurrentMemoryTraceThread() = &threads_[thread_index];
+  }
+  void WorkerEnd(unsigned int, unsigned int) {
+    CurrentMemoryTraceThread() = nullptr;
+  }
+  void LaunchEnd() {
+    std::vector<MemoryAccessRecord> records;
+    for (auto &thread : threads_) {
+      records.insert(records.end(), thread.records.begin(),
+                     thread.records.end());
+    }
+    threads_.clear();
+    Analyze(&records);
+  }
+
+  /// Statistics per buffer name(and memory space), in order of first access.
+  const std::vector<MemoryAccessStats> &stats() const { return stats_; }
+
+  const MemoryAccessStats *Find(const std::string &name) const {
+    for (const auto &s : stats_) {
+      if (s.name == name) {
+        return &s;
+      }
+    }
+    return nullptr;
+  }
+
+  void Print(FILE *fp = stdout) const {
+    fprintf(fp, "%-16s %6s %10s %10s %10s %10s %10s\n", "buffer", "space",
+            "requests", "efficiency", "sectors/rq", "lines/rq",
+            "conflicts");
+    for (const auto &s : stats_) {
+      if (s.space == kGlobalMemory) {
+        fprintf(fp, "%-16s %6s %10llu %9.1f%% %10.2f %10.2f %10s\n",
+                s.name.c_str(), "global",
+                static_cast<unsigned long long>(s.num_requests),
+                100.0 * s.Efficiency(), s.SectorsPerRequest(),
+                s.LinesPerRequest(), "-");
+      } else {
+        fprintf(fp, "%-16s %6s %10llu %10s %10s %10s %10.2f\n",
+                s.name.c_str(), "local",
+                static_cast<unsigned long long>(s.num_requests), "-", "-",
+                "-", s.BankConflictsPerRequest());
+      }
+    }
+  }
+
+  void Clear() { stats_.clear(); }
+
+  const MemoryTraceOptions &options() const { return options_; }
+
+ private:
+  void Analyze(std::vector<MemoryAccessRecord> *records) {
+    const uint32_t warp = options_.warp_size;
+    std::sort(records->begin(), records->end(),
+              [warp](const MemoryAccessRecord &a, const MemoryAccessRecord &b) {
+                if (a.item / warp != b.item / warp) {
+                  return a.item / warp < b.item / warp;
+                }
+                if (a.seq != b.seq) {
+                  return a.seq < b.seq;
+                }
+                return a.item < b.item;
+              });
+
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    std::vector<uint64_t> ids;
+    size_t begin = 0;
+    while (begin < records->size()) {
+      const MemoryAccessRecord &first = (*records)[begin];
+      size_t end = begin + 1;
+      while (end < records->size() &&
+             (*records)[end].item / warp == first.item / warp &&
+             (*records)[end].seq == first.seq) {
+        end++;
+      }
+
+      // NOTE(LTE): A request is attributed to the buffer of its first lane;
+      // lanes which diverged into another access are counted there too.
+      MemoryAccessStats &s =
+          StatsFor(first.name ? first.name : "", MemorySpace(first.space));
+      s.num_requests++;
+      s.num_accesses += end - begin;
+
+      // Distinct bytes
+      ranges.clear();
+      for (size_t i = begin; i < end; i++) {
+        const MemoryAccessRecord &r = (*records)[i];
+        ranges.push_back(std::make_pair(r.offset, r.offset + r.size));
+      }
+      std::sort(ranges.begin(), ranges.end());
+      uint64_t covered = 0;
+      for (size_t i = 0; i < ranges.size(); i++) {
+        uint64_t lo = std::max(ranges[i].first, covered);
+        if (ranges[i].second > lo) {
+          s.requested_bytes += ranges[i].second - lo;
+        }
+        covered = std::max(covered, ranges[i].second);
+      }
+
+      if (s.space == kGlobalMemory) {
+        uint64_t sectors = CountBlocks(*records, begin, end,
+                                       options_.sector_size, &ids);
+        s.num_sectors += sectors;
+        s.transferred_bytes += sectors * options_.sector_size;
+        s.num_lines += CountBlocks(*records, begin, end, options_.line_size,
+                                   &ids);
+      } else {
+        // Distinct words per bank; the same word is broadcast.
+        CountBlocks(*records, begin, end, options_.bank_width, &ids);
+        std::map<uint64_t, unsigned int> per_bank;
+        unsigned int conflict = 1;
+        for (uint64_t word : ids) {
+          conflict = std::max(conflict, ++per_bank[word % options_.num_banks]);
+        }
+        s.num_wavefronts += conflict;
+        s.max_conflict = std::max(s.max_conflict, conflict);
+      }
+      begin = end;
+    }
+  }
+
+  // Number of distinct `block_size` blocks touched by records [begin, end),
+  // which are left in `ids`.
+  static uint64_t CountBlocks(const std::vector<MemoryAccessRecord> &records,
+                              size_t begin, size_t end, uint64_t block_size,
+                              std::vector<uint64_t> *ids) {
+    ids->clear();
+    for (size_t i = begin; i < end; i++) {
+      const MemoryAccessRecord &r = records[i];
+      uint64_t last = (r.offset + (r.size ? r.size : 1) - 1) / block_size;
+      for (uint64_t b = r.offset / block_size; b <= last; b++) {
+        ids->push_back(b);
+      }
+    }
+    std::sort(ids->begin(), ids->end());
+    ids->erase(std::unique(ids->begin(), ids->end()), ids->end());
+    return ids->size();
+  }
+
+  MemoryAccessStats &StatsFor(const std::string &name, MemorySpace space) {
+    for (auto &s : stats_) {
+      if (s.name == name && s.space == space) {
+        return s;
+      }
+    }
+    stats_.push_back(MemoryAccessStats());
+    stats_.back().name = name;
+    stats_.back().space = space;
+    return stats_.back();
+  }
+
+  MemoryTraceOptions options_;
+  unsigned int xs_ = 1, ys_ = 1;
+  std::vector<MemoryTraceThread> threads_;
+  std::vector<MemoryAccessStats> stats_;
+};
+
+}  // namespace rainbowmist
+
+#endif  // RAINBOWMIST_CPP11
+
+#endif  // RAINBOWMIST_MEMTRACE_H_
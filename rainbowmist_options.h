@@ -0,0 +1,84 @@
+#ifndef RAINBOWMIST_OPTIONS_H_
+#define RAINBOWMIST_OPTIONS_H_
+
+//
+// Build option handling shared by the kernel registry(rainbowmist_registry.h)
+// and the mock runtimes(tests/mock), so a variant registered with
+// "-D TILE=4 -D SQUARE=1" matches a program built with "-DSQUARE=1 -DTILE=4",
+// and the same variant is picked, on both sides.
+//
+// Plain C++98; it does not need `rainbowmist.h`.
+//
+
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 - 2020 Light Transport Entertainment, Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace rainbowmist {
+
+// Splits build options into words, joining "-D NAME" into "-DNAME", sorted,
+// so "-D TILE=4 -D SQUARE=1" and "-DSQUARE=1 -DTILE=4" compare equal.
+inline std::vector<std::string> NormalizeBuildOptions(
+    const std::string &options) {
+  std::vector<std::string> words;
+  std::istringstream ss(options);
+  std::string w;
+  while (ss >> w) {
+    if ((w == "-D" || w == "-I") && (ss >> std::ws).good()) {
+      std::string value;
+      ss >> value;
+      w += value;
+    }
+    words.push_back(w);
+  }
+  std::sort(words.begin(), words.end());
+  return words;
+}
+
+// Of the variants in [first, last), the one whose options(`words(*it)`, a
+// normalized list) are all in `have`(normalized), preferring the one with the
+// most. `last` when none matches. A variant without options matches any
+// build.
+template <class Iterator, class Words>
+inline Iterator BestMatchingBuildOptions(Iterator first, Iterator last,
+                                         const std::vector<std::string> &have,
+                                         Words words) {
+  Iterator best = last;
+  for (Iterator it = first; it != last; ++it) {
+    const std::vector<std::string> &w = words(*it);
+    if (std::includes(have.begin(), have.end(), w.begin(), w.end()) &&
+        (best == last || w.size() > words(*best).size())) {
+      best = it;
+    }
+  }
+  return best;
+}
+
+}  // namespace rainbowmist
+
+#endif  // RAINBOWMIST_OPTIONS_H_
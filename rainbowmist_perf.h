@@ -0,0 +1,420 @@
+#ifndef RAINBOWMIST_PERF_H_
+#define RAINBOWMIST_PERF_H_
+
+//
+// RainbowMist per-kernel hardware counters for the C++11 backend.
+//
+// `rainbowmist::KernelPerf` samples cycles, instructions, L1D and LLC misses,
+// branch mispredicts and CPU time on each worker thread of a
+// `rainbowmist::LaunchKernel`, through Linux `perf_event_open`:
+//
+//   rainbowmist::KernelPerf perf;
+//   perf.Launch("shade", width, height, 1, [&]() { Shade(...); });
+//
+//   {  // or, for launches made elsewhere
+//     rainbowmist::KernelPerf::Scope scope(&perf, "trace");
+//     Render(...);  // calls rainbowmist::LaunchKernel
+//   }
+//   perf.Print();  // IPC and per work-item counts, per kernel name
+//
+// Low IPC with many LLC misses per work-item means the kernel waits on
+// memory; high IPC means it is compute bound.
+//
+// Counters only count user space of the worker thread itself, and are opened
+// for each launch(a few syscalls per thread), so this is opt-in: launches
+// without a `Scope` are not affected. Counters the kernel or CPU does not
+// provide(e.g. hardware counters in most VMs, or `perf_event_paranoid` > 2)
+// are reported as unavailable, and other platforms get none at all.
+//
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 - 2020 Light Transport Entertainment, Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "rainbowmist.h"
+
+#if defined(RAINBOWMIST_CPP11)
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#define RAINBOWMIST_HAS_PERF_EVENT 1
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace rainbowmist {
+
+enum PerfEvent {
+  kPerfCycles = 0,
+  kPerfInstructions,
+  kPerfL1DMisses,    // L1 data cache read misses
+  kPerfLLCMisses,    // Last level cache misses
+  kPerfBranchMisses,
+  kPerfTaskClock,    // CPU time of the thread in ns(software counter)
+  kNumPerfEvents
+};
+
+inline const char *PerfEventName(int event) {
+  static const char *kNames[kNumPerfEvents] = {
+      "cycles", "instructions", "L1D misses", "LLC misses", "branch misses",
+      "cpu ns"};
+  return (event >= 0 && event < kNumPerfEvents) ? kNames[event] : "";
+}
+
+///
+/// Counter values of one worker thread, or a sum of them.
+///
+struct PerfSample {
+  uint64_t value[kNumPerfEvents];
+  bool valid[kNumPerfEvents];  // false: counter not available
+  uint64_t num_items = 0;      // Work-items run
+  uint64_t wall_ns = 0;
+
+  PerfSample() {
+    for (int i = 0; i < kNumPerfEvents; i++) {
+      value[i] = 0;
+      valid[i] = false;
+    }
+  }
+
+  // A counter stays valid only if it is valid in both.
+  void Add(const PerfSample &other, bool first) {
+    for (int i = 0; i < kNumPerfEvents; i++) {
+      valid[i] = (first || valid[i]) && other.valid[i];
+      value[i] += other.value[i];
+    }
+    num_items += other.num_items;
+    wall_ns += other.wall_ns;
+  }
+
+  /// Instructions per cycle, or 0 if not available.
+  double Ipc() const {
+    if (!valid[kPerfCycles] || !valid[kPerfInstructions] ||
+        value[kPerfCycles] == 0) {
+      return 0.0;
+    }
+    return double(value[kPerfInstructions]) / double(value[kPerfCycles]);
+  }
+
+  /// Counts per work-item, or 0 if not available.
+  double PerItem(int event) const {
+    if (!valid[event] || num_items == 0) {
+      return 0.0;
+    }
+    return double(value[event]) / double(num_items);
+  }
+};
+
+///
+/// Counters of the calling thread. Open on construction, and count between
+/// `Start()` and `Stop()`.
+///
+class PerfCounters {
+ public:
+  PerfCounters() {
+    for (int i = 0; i < kNumPerfEvents; i++) {
+      fd_[i] = -1;
+    }
+#if defined(RAINBOWMIST_HAS_PERF_EVENT)
+    static const uint64_t kL1DReadMiss =
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    fd_[kPerfCycles] = Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    fd_[kPerfInstructions] =
+        Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    fd_[kPerfL1DMisses] = Open(PERF_TYPE_HW_CACHE, kL1DReadMiss);
+    fd_[kPerfLLCMisses] = Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    fd_[kPerfBranchMisses] =
+        Open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    fd_[kPerfTaskClock] = Open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+#endif
+  }
+
+  ~PerfCounters() {
+#if defined(RAINBOWMIST_HAS_PERF_EVENT)
+    for (int i = 0; i < kNumPerfEvents; i++) {
+      if (fd_[i] >= 0) {
+        close(fd_[i]);
+      }
+    }
+#endif
+  }
+
+  bool available(int event) const { return fd_[event] >= 0; }
+
+  void Start() {
+#if defined(RAINBOWMIST_HAS_PERF_EVENT)
+    for (int i = 0; i < kNumPerfEvents; i++) {
+      if (fd_[i] >= 0) {
+        ioctl(fd_[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd_[i], PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+#endif
+    start_ = std::chrono::steady_clock::now();
+  }
+
+  /// Stops counting, and stores the counts into `sample`.
+  void Stop(PerfSample *sample) {
+    sample->wall_ns =
+        uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     std::chrono::steady_clock::now() - start_)
+                     .count());
+#if defined(RAINBOWMIST_HAS_PERF_EVENT)
+    for (int i = 0; i < kNumPerfEvents; i++) {
+      if (fd_[i] >= 0) {
+        ioctl(fd_[i], PERF_EVENT_IOC_DISABLE, 0);
+      }
+    }
+    for (int i = 0; i < kNumPerfEvents; i++) {
+      sample->valid[i] = false;
+      sample->value[i] = 0;
+      if (fd_[i] < 0) {
+        continue;
+      }
+      // value, time enabled, time running
+      uint64_t data[3];
+      if (read(fd_[i], data, sizeof(data)) != ssize_t(sizeof(data)) ||
+          data[2] == 0) {
+        continue;  // Never scheduled.
+      }
+      // NOTE(LTE): More events than PMU registers are multiplexed; scale up
+      // by the fraction of time each one was counting.
+      double scale = (data[2] < data[1]) ? double(data[1]) / double(data[2])
+                                         : 1.0;
+      sample->value[i] = uint64_t(double(data[0]) * scale);
+      sample->valid[i] = true;
+    }
+#endif
+  }
+
+ private:
+  PerfCounters(const PerfCounters &) = delete;
+  PerfCounters &operator=(const PerfCounters &) = delete;
+
+#if defined(RAINBOWMIST_HAS_PERF_EVENT)
+  static int Open(uint32_t type, uint64_t config) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // This thread only, on any CPU.
+    return int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+  }
+#endif
+
+  int fd_[kNumPerfEvents];
+  std::chrono::steady_clock::time_point start_;
+};
+
+struct KernelPerfLaunch {
+  std::string name;
+  uint64_t wall_ns = 0;
+  std::vector<PerfSample> threads;  // Indexed by worker thread
+  PerfSample total;                 // Sum over `threads`
+};
+
+struct KernelPerfSummary {
+  std::string name;
+  uint64_t num_launches = 0;
+  uint64_t wall_ns = 0;
+  PerfSample total;  // Sum over all launches and threads
+};
+
+class KernelPerf {
+ public:
+  ///
+  /// Samples each `LaunchKernel` made by the calling thread during its
+  /// lifetime, under `name`. Scopes nest; the innermost one samples.
+  ///
+  class Scope : public LaunchObserver {
+   public:
+    Scope(KernelPerf *perf, const std::string &name)
+        : perf_(perf), name_(name), observe_(this) {}
+
+    void LaunchBegin(unsigned int, unsigned int num_threads) {
+      launch_ = KernelPerfLaunch();
+      launch_.name = name_;
+      launch_.threads.resize(num_threads);
+      counters_.clear();
+      counters_.resize(num_threads);
+      start_ = std::chrono::steady_clock::now();
+    }
+
+    void WorkerBegin(unsigned int thread_index) {
+      counters_[thread_index].reset(new PerfCounters());
+      counters_[thread_index]->Start();
+    }
+
+    void WorkerEnd(unsigned int thread_index, unsigned int num_items) {
+      PerfSample &sample = launch_.threads[thread_index];
+      counters_[thread_index]->Stop(&sample);
+      sample.num_items = num_items;
+      counters_[thread_index].reset();
+    }
+
+    void LaunchEnd() {
+      launch_.wall_ns =
+          uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::steady_clock::now() - start_)
+                       .count());
+      for (size_t i = 0; i < launch_.threads.size(); i++) {
+        launch_.total.Add(launch_.threads[i], i == 0);
+      }
+      perf_->Record(launch_);
+    }
+
+   private:
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+    KernelPerf *perf_;
+    std::string name_;
+    ScopedLaunchObserver observe_;
+    KernelPerfLaunch launch_;
+    std::vector<std::unique_ptr<PerfCounters>> counters_;
+    std::chrono::steady_clock::time_point start_;
+  };
+
+  /// `rainbowmist::LaunchKernel`, sampled under `name`.
+  template <class F>
+  void Launch(const std::string &name, unsigned int xs, unsigned int ys,
+              unsigned int zs, F kernel, unsigned int num_threads = 0) {
+    Scope scope(this, name);
+    LaunchKernel(xs, ys, zs, kernel, num_threads);
+  }
+
+  /// True if the calling thread can open hardware counters.
+  static bool Available() {
+    PerfCounters counters;
+    return counters.available(kPerfCycles) &&
+           counters.available(kPerfInstructions);
+  }
+
+  std::vector<KernelPerfLaunch> launches() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return launches_;
+  }
+
+  /// Sums launches by name, in order of first launch.
+  std::vector<KernelPerfSummary> Summarize() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<KernelPerfSummary> summaries;
+    std::map<std::string, size_t> index;
+    for (const auto &launch : launches_) {
+      auto it = index.find(launch.name);
+      if (it == index.end()) {
+        it = index.insert(std::make_pair(launch.name, summaries.size())).first;
+        summaries.push_back(KernelPerfSummary());
+        summaries.back().name = launch.name;
+      }
+      KernelPerfSummary &summary = summaries[it->second];
+      summary.total.Add(launch.total, summary.num_launches == 0);
+      summary.num_launches++;
+      summary.wall_ns += launch.wall_ns;
+    }
+    return summaries;
+  }
+
+  /// Prints a line per kernel name; with `per_thread`, also a line per worker
+  /// thread of each launch, to spot load imbalance.
+  void Print(FILE *fp = stdout, bool per_thread = false) const {
+    fprintf(fp, "%-20s %8s %10s %10s %6s", "kernel", "launches", "items",
+            "ms", "IPC");
+    for (int e = 0; e < kNumPerfEvents; e++) {
+      fprintf(fp, " %14s", PerfEventName(e));
+    }
+    fprintf(fp, "   (per work-item)\n");
+    for (const auto &summary : Summarize()) {
+      fprintf(fp, "%-20s %8llu", summary.name.c_str(),
+              static_cast<unsigned long long>(summary.num_launches));
+      PrintSample(fp, summary.total, summary.wall_ns);
+    }
+    if (!per_thread) {
+      return;
+    }
+    for (const auto &launch : launches()) {
+      for (size_t t = 0; t < launch.threads.size(); t++) {
+        fprintf(fp, "%-20s %8llu", launch.name.c_str(),
+                static_cast<unsigned long long>(t));
+        PrintSample(fp, launch.threads[t], launch.threads[t].wall_ns);
+      }
+    }
+  }
+
+  void Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    launches_.clear();
+  }
+
+ private:
+  void Record(const KernelPerfLaunch &launch) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    launches_.push_back(launch);
+  }
+
+  static void PrintSample(FILE *fp, const PerfSample &sample,
+                          uint64_t wall_ns) {
+    fprintf(fp, " %10llu %10.3f",
+            static_cast<unsigned long long>(sample.num_items),
+            double(wall_ns) / 1.0e6);
+    if (sample.valid[kPerfCycles] && sample.valid[kPerfInstructions]) {
+      fprintf(fp, " %6.2f", sample.Ipc());
+    } else {
+      fprintf(fp, " %6s", "n/a");
+    }
+    for (int e = 0; e < kNumPerfEvents; e++) {
+      if (sample.valid[e]) {
+        fprintf(fp, " %14.3f", sample.PerItem(e));
+      } else {
+        fprintf(fp, " %14s", "n/a");
+      }
+    }
+    fprintf(fp, "\n");
+  }
+
+  mutable std::mutex mutex_;
+  std::vector<KernelPerfLaunch> launches_;
+};
+
+}  // namespace rainbowmist
+
+#endif  // RAINBOWMIST_CPP11
+
+#endif  // RAINBOWMIST_PERF_H_
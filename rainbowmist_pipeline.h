@@ -0,0 +1,445 @@
+#ifndef RAINBOWMIST_PIPELINE_H_
+#define RAINBOWMIST_PIPELINE_H_
+
+//
+// RainbowMist chunked streaming pipeline.
+//
+// For inputs larger than device memory: the input is split into chunks, and
+// chunk n + 1 is uploaded while chunk n is computed and chunk n - 1 is
+// downloaded, each stage on its own queue(stream).
+//
+//   rainbowmist::CLPipelineQueues queues(upload_queue, compute_queue, download_queue);
+//   rainbowmist::StreamPipeline<rainbowmist::CLPipelineQueues> pipeline(&queues, 2);
+//   pipeline.Run(num_chunks,
+//       [&](size_t n, size_t slot) { /* host: read chunk n into host_in[slot] */ },
+//       [&](size_t n, size_t slot, rainbowmist::CLPipelineStage *s) { /* host_in[slot] -> dev_in[slot] */ },
+//       [&](size_t n, size_t slot, rainbowmist::CLPipelineStage *s) { /* dev_in[slot] -> dev_out[slot] */ },
+//       [&](size_t n, size_t slot, rainbowmist::CLPipelineStage *s) { /* dev_out[slot] -> host_out[slot] */ },
+//       [&](size_t n, size_t slot) { /* host: write host_out[slot] */ });
+//
+// Each stage callback only enqueues non-blocking commands to its queue;
+// `StreamPipeline` adds the event dependencies between the queues, so a
+// slot(device buffers and host buffers) is reused only once the previous
+// chunk is done with it. The host callbacks run while the device is busy.
+//
+// `CLPipelineQueues` passes the dependencies as event wait lists(see
+// `CLPipelineStage`), `CUDAPipelineStreams` with `cuStreamWaitEvent`.
+//
+// On the C++11 backend, `rainbowmist::ThreadPipeline` runs load, compute and
+// store on their own threads instead, eg to overlap file I/O with compute.
+//
+
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 - 2020 Light Transport Entertainment, Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "rainbowmist.h"
+
+#if defined(RAINBOWMIST_CPP11) || defined(__CUEW_H__) || \
+    defined(CLEW_HPP_INCLUDED) || defined(__OPENCL_CL_H)
+
+#include <cstddef>
+#include <vector>
+
+namespace rainbowmist {
+
+// `Queues` provides
+//
+//   typedef ... Queue, Event;
+//   // Starts a stage(kUpload, kCompute or kDownload) after `deps`, and
+//   // returns what is passed to the stage callback.
+//   Queue Begin(int stage, const Event *deps, size_t num_deps);
+//   // Returns an event which completes with the stage, and flushes.
+//   Event End(int stage);
+//   void HostWait(Event e);
+//   void Release(Event e);
+//
+// NOTE(LTE): `num_slots` is at least 2. With 2, upload(n + 1), compute(n) and
+// download(n - 1) can already run at the same time; 3 give more slack when
+// the stages take uneven time.
+template <typename Queues>
+class StreamPipeline {
+ public:
+  enum Stage { kUpload = 0, kCompute = 1, kDownload = 2 };
+
+  typedef typename Queues::Queue Queue;
+  typedef typename Queues::Event Event;
+
+  explicit StreamPipeline(Queues *queues, size_t num_slots = 2)
+      : queues_(queues), num_slots_(num_slots < 2 ? 2 : num_slots) {}
+
+  // For chunk n, in slot `n % num_slots`:
+  //
+  //   prepare(n, slot)          host: fills the host input(eg reads a file)
+  //   upload(n, slot, queue)    enqueues host input -> device input
+  //   compute(n, slot, queue)   enqueues kernels, device input -> output
+  //   download(n, slot, queue)  enqueues device output -> host output
+  //   finish(n, slot)           host: uses the host output
+  //
+  // Returns once `finish()` has been called for all chunks.
+  template <typename Prepare, typename Upload, typename Compute,
+            typename Download, typename Finish>
+  void Run(size_t num_chunks, Prepare prepare, Upload upload, Compute compute,
+           Download download, Finish finish) {
+    const size_t S = num_slots_;
+    // Latest event of each stage, per slot.
+    std::vector<Event> events[3];
+    std::vector<unsigned char> valid[3];
+    for (int i = 0; i < 3; i++) {
+      events[i].resize(S);
+      valid[i].assign(S, 0);
+    }
+    // Chunk waiting for `finish()`, per slot.
+    std::vector<size_t> unfinished(S, num_chunks);
+
+    auto begin = [&](int stage, size_t slot, int dep0, int dep1) -> Queue {
+      Event deps[2];
+      size_t n = 0;
+      if (valid[dep0][slot]) {
+        deps[n++] = events[dep0][slot];
+      }
+      if (dep1 >= 0 && valid[dep1][slot]) {
+        deps[n++] = events[dep1][slot];
+      }
+      return queues_->Begin(stage, deps, n);
+    };
+    auto end = [&](int stage, size_t slot) {
+      Event e = queues_->End(stage);
+      if (valid[stage][slot]) {
+        queues_->Release(events[stage][slot]);
+      }
+      events[stage][slot] = e;
+      valid[stage][slot] = 1;
+    };
+    auto finish_slot = [&](size_t slot) {
+      if (unfinished[slot] < num_chunks) {
+        queues_->HostWait(events[kDownload][slot]);
+        finish(unfinished[slot], slot);
+        unfinished[slot] = num_chunks;
+      }
+    };
+
+    for (size_t t = 0; t < num_chunks + 2; t++) {
+      if (t < num_chunks) {
+        const size_t n = t, slot = n % S;
+        // The host input is free once upload(n - S) is done.
+        if (valid[kUpload][slot]) {
+          queues_->HostWait(events[kUpload][slot]);
+        }
+        prepare(n, slot);
+        // The device input is free once compute(n - S) is done.
+        upload(n, slot, begin(kUpload, slot, kCompute, -1));
+        end(kUpload, slot);
+      }
+      if (t >= 1 && t - 1 < num_chunks) {
+        const size_t n = t - 1, slot = n % S;
+        // Needs its input, and the device output free from download(n - S).
+        compute(n, slot, begin(kCompute, slot, kUpload, kDownload));
+        end(kCompute, slot);
+      }
+      if (t >= 2) {
+        const size_t n = t - 2, slot = n % S;
+        // The host output still holds chunk n - S.
+        finish_slot(slot);
+        download(n, slot, begin(kDownload, slot, kCompute, -1));
+        end(kDownload, slot);
+        unfinished[slot] = n;
+      }
+    }
+
+    // The last chunks, in order.
+    if (num_chunks > 0) {
+      for (size_t i = 0; i < S; i++) {
+        finish_slot((num_chunks + i) % S);
+      }
+    }
+    for (int stage = 0; stage < 3; stage++) {
+      for (size_t slot = 0; slot < S; slot++) {
+        if (valid[stage][slot]) {
+          queues_->Release(events[stage][slot]);
+        }
+      }
+    }
+  }
+
+  size_t num_slots() const { return num_slots_; }
+
+ private:
+  Queues *queues_;
+  size_t num_slots_;
+};
+
+#if defined(CLEW_HPP_INCLUDED) || defined(__OPENCL_CL_H)
+// What an OpenCL stage callback gets. The first command must wait for
+// `wait_list`, and the last one must signal `done()`:
+//
+//   clEnqueueWriteBuffer(s->queue, buf, CL_FALSE, 0, bytes, p,
+//                        s->num_waits(), s->wait_list(), s->done());
+//
+// (Both can be the same command.) Commands in between are ordered by the
+// in-order queue.
+struct CLPipelineStage {
+  cl_command_queue queue = nullptr;
+  std::vector<cl_event> waits;
+  cl_event event = nullptr;
+
+  cl_uint num_waits() const { return static_cast<cl_uint>(waits.size()); }
+  const cl_event *wait_list() const {
+    return waits.empty() ? nullptr : waits.data();
+  }
+  // Releases the event of an earlier command, if `done()` is called again.
+  cl_event *done() {
+    if (event) {
+      clReleaseEvent(event);
+      event = nullptr;
+    }
+    return &event;
+  }
+};
+
+// Three in-order command queues of the same context, eg from
+// `EasyCL::newQueue()`. Stage callbacks get a `CLPipelineStage *`. The first
+// error is kept in `error()`.
+class CLPipelineQueues {
+ public:
+  typedef CLPipelineStage *Queue;
+  typedef cl_event Event;
+
+  CLPipelineQueues(cl_command_queue upload, cl_command_queue compute,
+                   cl_command_queue download) {
+    stages_[0].queue = upload;
+    stages_[1].queue = compute;
+    stages_[2].queue = download;
+  }
+
+  Queue Begin(int stage, const Event *deps, size_t num_deps) {
+    CLPipelineStage &s = stages_[stage];
+    s.waits.assign(deps, deps + num_deps);
+    s.event = nullptr;
+    return &s;
+  }
+
+  Event End(int stage) {
+    CLPipelineStage &s = stages_[stage];
+    Check(clFlush(s.queue));
+    if (!s.event) {
+      // The stage didn't signal `done()`; complete right away.
+      cl_context context = nullptr;
+      Check(clGetCommandQueueInfo(s.queue, CL_QUEUE_CONTEXT, sizeof(context),
+                                  &context, nullptr));
+      cl_int err = CL_SUCCESS;
+      s.event = clCreateUserEvent(context, &err);
+      Check(err);
+      if (s.event) {
+        Check(clSetUserEventStatus(s.event, CL_COMPLETE));
+      }
+    }
+    Event e = s.event;
+    s.event = nullptr;
+    return e;
+  }
+
+  void HostWait(Event e) {
+    if (e) {
+      Check(clWaitForEvents(1, &e));
+    }
+  }
+
+  void Release(Event e) {
+    if (e) {
+      clReleaseEvent(e);
+    }
+  }
+
+  cl_int error() const { return error_; }
+
+ private:
+  void Check(cl_int err) {
+    if (error_ == CL_SUCCESS) {
+      error_ = err;
+    }
+  }
+
+  CLPipelineStage stages_[3];
+  cl_int error_ = CL_SUCCESS;
+};
+#endif
+
+#if defined(__CUEW_H__)
+// Three streams of the current context(eg `CU_STREAM_NON_BLOCKING`). Stage
+// callbacks get the `CUstream`, and dependencies are added with
+// `cuStreamWaitEvent`. The first error is kept in `error()`.
+class CUDAPipelineStreams {
+ public:
+  typedef CUstream Queue;
+  typedef CUevent Event;
+
+  CUDAPipelineStreams(CUstream upload, CUstream compute, CUstream download) {
+    streams_[0] = upload;
+    streams_[1] = compute;
+    streams_[2] = download;
+  }
+
+  Queue Begin(int stage, const Event *deps, size_t num_deps) {
+    for (size_t i = 0; i < num_deps; i++) {
+      Check(cuStreamWaitEvent(streams_[stage], deps[i], 0));
+    }
+    return streams_[stage];
+  }
+
+  Event End(int stage) {
+    CUevent e = nullptr;
+    Check(cuEventCreate(&e, CU_EVENT_DISABLE_TIMING));
+    Check(cuEventRecord(e, streams_[stage]));
+    return e;
+  }
+
+  void HostWait(Event e) { Check(cuEventSynchronize(e)); }
+
+  void Release(Event e) {
+    if (e) {
+      cuEventDestroy(e);
+    }
+  }
+
+  CUresult error() const { return error_; }
+
+ private:
+  void Check(CUresult err) {
+    if (error_ == CUDA_SUCCESS) {
+      error_ = err;
+    }
+  }
+
+  CUstream streams_[3];
+  CUresult error_ = CUDA_SUCCESS;
+};
+#endif
+
+}  // namespace rainbowmist
+
+#endif
+
+#if defined(RAINBOWMIST_CPP11)
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace rainbowmist {
+
+// Runs load(n, slot) -> compute(n, slot) -> store(n, slot) for all chunks,
+// with each stage on its own thread(compute on the calling one), so eg
+// reading chunk n + 1 and writing chunk n - 1 overlap computing chunk n. At
+// most `num_slots` chunks are in flight.
+//
+// If a stage throws for chunk n, the chunks before n are still stored, no
+// stage runs for the later ones, and the exception is rethrown from `Run()`.
+class ThreadPipeline {
+ public:
+  explicit ThreadPipeline(size_t num_slots = 2)
+      : num_slots_(num_slots < 1 ? 1 : num_slots) {}
+
+  template <typename Load, typename Compute, typename Store>
+  void Run(size_t num_chunks, Load load, Compute compute, Store store) {
+    enum { kFree, kLoaded, kComputed };
+    std::vector<int> state(num_slots_, kFree);
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::exception_ptr error;
+    size_t abort_at = num_chunks;  // First chunk that failed in some stage
+
+    const std::function<void(size_t, size_t)> load_fn(load), compute_fn(compute),
+        store_fn(store);
+
+    // Waits until `slot` is in `from`, runs `fn`, then moves it to `to`.
+    // NOTE(LTE): After a failure, chunks before the failed one still go
+    // through all stages(they are already loaded, or computed), so the
+    // chunks stored are always exactly those before it.
+    auto stage = [&](size_t n, int from, int to,
+                     const std::function<void(size_t, size_t)> &fn) -> bool {
+      const size_t slot = n % num_slots_;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&] { return n >= abort_at || state[slot] == from; });
+        if (n >= abort_at) {
+          return false;
+        }
+      }
+      try {
+        fn(n, slot);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (n < abort_at) {
+          error = std::current_exception();
+          abort_at = n;
+        }
+        cond.notify_all();
+        return false;
+      }
+      std::lock_guard<std::mutex> lock(mutex);
+      state[slot] = to;
+      cond.notify_all();
+      return true;
+    };
+
+    std::thread loader([&] {
+      for (size_t n = 0; n < num_chunks; n++) {
+        if (!stage(n, kFree, kLoaded, load_fn)) {
+          return;
+        }
+      }
+    });
+    std::thread storer([&] {
+      for (size_t n = 0; n < num_chunks; n++) {
+        if (!stage(n, kComputed, kFree, store_fn)) {
+          return;
+        }
+      }
+    });
+    for (size_t n = 0; n < num_chunks; n++) {
+      if (!stage(n, kLoaded, kComputed, compute_fn)) {
+        break;
+      }
+    }
+    loader.join();
+    storer.join();
+
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+  size_t num_slots() const { return num_slots_; }
+
+ private:
+  size_t num_slots_;
+};
+
+}  // namespace rainbowmist
+
+#endif  // RAINBOWMIST_CPP11
+
+#endif  // RAINBOWMIST_PIPELINE_H_
@@ -0,0 +1,332 @@
+#ifndef RAINBOWMIST_REGISTRY_H_
+#define RAINBOWMIST_REGISTRY_H_
+
+//
+// RainbowMist kernel registry.
+//
+// Kernel side:
+//
+//   #include "rainbowmist_registry.h"
+//
+//   RM_KERNEL void scale(RM_GLOBAL float *out, RM_GLOBAL const float *in,
+//                        float s) { ... }
+//   RM_REGISTER_KERNEL(scale)
+//
+//   // A specialization(rainbowmist_spec.h), for the same build options as
+//   // its `-D` build on the GPU.
+//   RM_REGISTER_KERNEL_VARIANT(blur, "-D TILE=8 -D USE_ALPHA=1", blur<8, true>)
+//
+// On OpenCL and CUDA these expand to nothing. On C++11 they record the
+// kernel's name, parameters and a launcher in `rainbowmist::KernelRegistry`
+// during static initialization, so host code can find kernels by name as
+// with `clCreateKernel` or `cuModuleGetFunction`:
+//
+//   const rainbowmist::KernelInfo *k =
+//       rainbowmist::KernelRegistry::Get().Find("scale");
+//   float s = 2.0f;
+//   const void *args[] = {&out, &in, &s};  // out, in: float *
+//   k->Launch(args, n);
+//
+// Arguments are passed like `cuLaunchKernel`'s `kernelParams`: `args[i]`
+// points to the value of parameter i, which is the pointer itself for a
+// buffer.
+//
+
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 - 2020 Light Transport Entertainment, Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "rainbowmist.h"
+
+#if defined(RAINBOWMIST_CPP11)
+
+#define RM_REGISTRY_CONCAT_(a, b) a##b
+#define RM_REGISTRY_CONCAT(a, b) RM_REGISTRY_CONCAT_(a, b)
+
+#if defined(__COUNTER__)
+#define RM_REGISTRY_UNIQUE(prefix) RM_REGISTRY_CONCAT(prefix, __COUNTER__)
+#else
+#define RM_REGISTRY_UNIQUE(prefix) RM_REGISTRY_CONCAT(prefix, __LINE__)
+#endif
+
+#define RM_REGISTER_KERNEL_VARIANT(name, options, ...)          \
+  static const rainbowmist::KernelInfo *const RM_REGISTRY_UNIQUE( \
+      rainbowmist_registered_kernel_) =                          \
+      rainbowmist::RegisterKernel(#name, options, __VA_ARGS__);
+#define RM_REGISTER_KERNEL(name) RM_REGISTER_KERNEL_VARIANT(name, "", name)
+
+#else
+#define RM_REGISTER_KERNEL_VARIANT(name, options, ...)
+#define RM_REGISTER_KERNEL(name)
+#endif
+
+#if defined(RAINBOWMIST_CPP11)
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "rainbowmist_options.h"
+
+namespace rainbowmist {
+
+enum KernelArgKind {
+  kKernelArgBuffer,  // Pointer parameter(`T *`, `RM_GLOBAL_PTR(T)`)
+  kKernelArgScalar   // Anything else, passed by value
+};
+
+struct KernelArgInfo {
+  KernelArgKind kind;
+  size_t size;          // Argument value bytes(`sizeof(T *)` for a buffer)
+  size_t element_size;  // `sizeof(T)` for a buffer, else `size`
+  bool read_only;       // Buffer of const elements(always true for scalars)
+};
+
+// Launches `function` with `args`(see `KernelInfo::Launch`).
+typedef void (*KernelInvoker)(void (*function)(), const void *const *args,
+                              unsigned int xs, unsigned int ys,
+                              unsigned int zs, unsigned int num_threads);
+
+struct KernelInfo {
+  std::string name;
+  std::string options;                    // As registered
+  std::vector<std::string> option_words;  // `NormalizeBuildOptions(options)`
+  std::vector<KernelArgInfo> args;
+  void (*function)();  // The kernel, cast to a common function pointer type.
+  KernelInvoker invoker;
+
+  ///
+  /// Runs the kernel for each global id in [0, xs) x [0, ys) x [0, zs) with
+  /// `rainbowmist::LaunchKernel`. `args[i]` points to the value of parameter
+  /// i(for a buffer, to the pointer); each is copied once per launch.
+  ///
+  void Launch(const void *const *arg_values, unsigned int xs,
+              unsigned int ys = 1, unsigned int zs = 1,
+              unsigned int num_threads = 0) const {
+    invoker(function, arg_values, xs, ys, zs, num_threads);
+  }
+};
+
+///
+/// Kernels registered with `RM_REGISTER_KERNEL`, by name. Each name may have
+/// several variants, told apart by their build options.
+///
+/// NOTE(LTE): Registration is not synchronized with lookups. Register during
+/// static initialization(or before other threads look kernels up).
+///
+class KernelRegistry {
+ public:
+  static KernelRegistry &Get() {
+    static KernelRegistry *registry = new KernelRegistry();  // never destroyed
+    return *registry;
+  }
+
+  /// Adds `info`, replacing a variant with the same name and options. The
+  /// returned pointer stays valid for the life of the process.
+  const KernelInfo *Add(KernelInfo info) {
+    info.option_words = NormalizeBuildOptions(info.options);
+    std::vector<std::unique_ptr<KernelInfo>> &variants = kernels_[info.name];
+    for (auto &v : variants) {
+      if (v->option_words == info.option_words) {
+        *v = std::move(info);
+        return v.get();
+      }
+    }
+    variants.emplace_back(new KernelInfo(std::move(info)));
+    order_.push_back(variants.back().get());
+    return variants.back().get();
+  }
+
+  /// The variant registered without options, or the first one. nullptr when
+  /// there is no kernel `name`.
+  const KernelInfo *Find(const std::string &name) const {
+    auto it = kernels_.find(name);
+    if (it == kernels_.end()) {
+      return nullptr;
+    }
+    for (const auto &v : it->second) {
+      if (v->option_words.empty()) {
+        return v.get();
+      }
+    }
+    return it->second.front().get();
+  }
+
+  /// The variant whose options are all in `options`(e.g. the program's build
+  /// options), preferring the one with the most. nullptr when none matches.
+  const KernelInfo *Find(const std::string &name,
+                         const std::string &options) const {
+    auto it = kernels_.find(name);
+    if (it == kernels_.end()) {
+      return nullptr;
+    }
+    const auto &variants = it->second;
+    auto best = BestMatchingBuildOptions(
+        variants.begin(), variants.end(), NormalizeBuildOptions(options),
+        [](const std::unique_ptr<KernelInfo> &v)
+            -> const std::vector<std::string> & { return v->option_words; });
+    return best == variants.end() ? nullptr : best->get();
+  }
+
+  /// Every variant, in registration order.
+  const std::vector<const KernelInfo *> &Kernels() const { return order_; }
+
+  size_t size() const { return order_.size(); }
+
+ private:
+  KernelRegistry() {}
+
+  std::unordered_map<std::string, std::vector<std::unique_ptr<KernelInfo>>>
+      kernels_;
+  std::vector<const KernelInfo *> order_;
+};
+
+namespace detail {
+
+template <size_t... I>
+struct KernelIndices {};
+
+template <size_t N, size_t... I>
+struct MakeKernelIndices : MakeKernelIndices<N - 1, N - 1, I...> {};
+
+template <size_t... I>
+struct MakeKernelIndices<0, I...> {
+  typedef KernelIndices<I...> type;
+};
+
+template <class P>
+struct PointerWrapperElement {
+  typedef typename std::remove_pointer<decltype(
+      std::declval<const P &>().get())>::type type;
+};
+
+// How a parameter of type `P` is described and loaded from its argument
+// value. Scalars are copied as is.
+template <class P, class Enable = void>
+struct KernelParam {
+  static KernelArgInfo Info() {
+    return KernelArgInfo{kKernelArgScalar, sizeof(P), sizeof(P), true};
+  }
+  static void Load(const void *src, P &out) { memcpy(&out, src, sizeof(P)); }
+};
+
+template <class T>
+struct KernelParam<T *> {
+  static KernelArgInfo Info() {
+    return KernelArgInfo{kKernelArgBuffer, sizeof(T *), sizeof(T),
+                         std::is_const<T>::value};
+  }
+  static void Load(const void *src, T *&out) {
+    void *p;
+    memcpy(&p, src, sizeof(void *));
+    out = static_cast<T *>(p);
+  }
+};
+
+// Pointer wrappers(`Traced<T>`, `CountedPtr<T>`) are built from the pointer.
+template <class P>
+struct KernelParam<
+    P, typename std::enable_if<std::is_pointer<decltype(
+           std::declval<const P &>().get())>::value>::type> {
+  typedef typename PointerWrapperElement<P>::type T;
+
+  static KernelArgInfo Info() {
+    return KernelArgInfo{kKernelArgBuffer, sizeof(T *), sizeof(T),
+                         std::is_const<T>::value};
+  }
+  static void Load(const void *src, P &out) {
+    T *p;
+    KernelParam<T *>::Load(src, p);
+    out = P(p);
+  }
+};
+
+template <class... Args>
+struct KernelTrampoline {
+  typedef void (*Function)(Args...);
+  typedef std::tuple<typename std::decay<Args>::type...> Values;
+  typedef typename MakeKernelIndices<sizeof...(Args)>::type Seq;
+
+  template <size_t... I>
+  static void Load(const void *const *args, Values &values,
+                   KernelIndices<I...>) {
+    (void)args;
+    int dummy[] = {
+        0, (KernelParam<typename std::tuple_element<I, Values>::type>::Load(
+                args[I], std::get<I>(values)),
+            0)...};
+    (void)dummy;
+  }
+
+  template <size_t... I>
+  static void Call(Function kernel, Values &values, KernelIndices<I...>) {
+    kernel(std::get<I>(values)...);
+  }
+
+  static void Invoke(void (*function)(), const void *const *args,
+                     unsigned int xs, unsigned int ys, unsigned int zs,
+                     unsigned int num_threads) {
+    Values values;
+    Load(args, values, Seq());
+    Function kernel = reinterpret_cast<Function>(function);
+    LaunchKernel(xs, ys, zs, [&]() { Call(kernel, values, Seq()); },
+                 num_threads);
+  }
+
+  static std::vector<KernelArgInfo> ArgInfo() {
+    return std::vector<KernelArgInfo>{
+        KernelParam<typename std::decay<Args>::type>::Info()...};
+  }
+};
+
+}  // namespace detail
+
+///
+/// Registers `kernel` as `name` for programs built with `options`(see
+/// `KernelRegistry`). Usually called through `RM_REGISTER_KERNEL`.
+///
+template <class... Args>
+inline const KernelInfo *RegisterKernel(const char *name, const char *options,
+                                        void (*kernel)(Args...)) {
+  typedef detail::KernelTrampoline<Args...> Trampoline;
+
+  KernelInfo info;
+  info.name = name;
+  info.options = options;
+  info.args = Trampoline::ArgInfo();
+  info.function = reinterpret_cast<void (*)()>(kernel);
+  info.invoker = &Trampoline::Invoke;
+  return KernelRegistry::Get().Add(std::move(info));
+}
+
+}  // namespace rainbowmist
+
+#endif  // RAINBOWMIST_CPP11
+
+#endif  // RAINBOWMIST_REGISTRY_H_
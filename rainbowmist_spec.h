@@ -0,0 +1,241 @@
+#ifndef RAINBOWMIST_SPEC_H_
+#define RAINBOWMIST_SPEC_H_
+
+//
+// RainbowMist specialization constants.
+//
+// Kernel side:
+//
+//   RM_SPECIALIZE(int TILE, bool USE_ALPHA)
+//   RM_KERNEL void blur(RM_GLOBAL float *out, RM_GLOBAL const float *in) {
+//     for (int i = 0; i < TILE; i++) { ... }
+//   }
+//
+// `RM_SPECIALIZE(...)` expands to
+//
+//   C++11       : `template <int TILE, bool USE_ALPHA>`, call as `blur<8, true>(...)`
+//   CUDA/OpenCL : nothing. Each constant must be given as a `-D` option, eg
+//                 `rainbowmist::SpecConstants().Set("TILE", 8).Set("USE_ALPHA", true)`
+//
+// so a single declaration gives a template instantiation on the CPU and a
+// specialized build on the GPU. Use the constants as plain values; with the
+// `-D` build, `bool` becomes `1`/`0`.
+//
+// NOTE(LTE): `RM_SPECIALIZE` takes integral constants only(`int`,
+// `unsigned int`, `bool`): a `float` template parameter is ill-formed before
+// C++20. `SpecConstants::Set(name, float)` is for kernels that read a `-D`
+// macro on the GPU path only; on C++11, pass such a value as an argument.
+//
+// Host side, `rainbowmist::VariantCache` keeps built variants(programs,
+// kernels) keyed by `SpecConstants::Key()` in a LRU, so switching between
+// configurations doesn't rebuild.
+//
+
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 - 2020 Light Transport Entertainment, Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "rainbowmist.h"
+
+#if defined(RAINBOWMIST_CPP11)
+#define RM_SPECIALIZE(...) template <__VA_ARGS__>
+#else
+#define RM_SPECIALIZE(...)
+#endif
+
+#if defined(RAINBOWMIST_CPP11)
+
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <functional>
+#include <list>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace rainbowmist {
+
+// Values of specialization constants, for the `-D` build. Constants are kept
+// sorted by name, so `Key()` and `Options()` don't depend on the order of
+// `Set()` calls.
+class SpecConstants {
+ public:
+  SpecConstants &Set(const std::string &name, int value) {
+    values_[name] = std::to_string(value);
+    return *this;
+  }
+
+  SpecConstants &Set(const std::string &name, unsigned int value) {
+    values_[name] = std::to_string(value) + "u";
+    return *this;
+  }
+
+  SpecConstants &Set(const std::string &name, bool value) {
+    values_[name] = value ? "1" : "0";
+    return *this;
+  }
+
+  // `-D` build only; not usable with `RM_SPECIALIZE`(see above). Written
+  // with 9 significant digits, which round-trips any float. Hex float
+  // literals would be exact too, but they are not C++11(NVRTC).
+  SpecConstants &Set(const std::string &name, float value) {
+    if (std::isnan(value)) {
+      values_[name] = "(0.0f / 0.0f)";
+      return *this;
+    }
+    if (std::isinf(value)) {
+      values_[name] = (value > 0.0f) ? "(1.0f / 0.0f)" : "(-1.0f / 0.0f)";
+      return *this;
+    }
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.9g", static_cast<double>(value));
+    std::string literal = buf;
+    if (literal.find_first_of(".e") == std::string::npos) {
+      literal += ".0";  // "1f" is not a float literal.
+    }
+    values_[name] = literal + "f";
+    return *this;
+  }
+
+  // OpenCL build options, eg "-D TILE=8 -D USE_ALPHA=1".
+  std::string Options() const {
+    std::string options;
+    for (const auto &it : values_) {
+      if (!options.empty()) {
+        options += " ";
+      }
+      options += "-D " + it.first + "=" + it.second;
+    }
+    return options;
+  }
+
+  // NVRTC options, eg {"-DTILE=8", "-DUSE_ALPHA=1"}.
+  std::vector<std::string> OptionList() const {
+    std::vector<std::string> options;
+    for (const auto &it : values_) {
+      options.push_back("-D" + it.first + "=" + it.second);
+    }
+    return options;
+  }
+
+  // Identifies the variant, eg "TILE=8;USE_ALPHA=1".
+  std::string Key() const {
+    std::string key;
+    for (const auto &it : values_) {
+      key += it.first + "=" + it.second + ";";
+    }
+    return key;
+  }
+
+ private:
+  std::map<std::string, std::string> values_;
+};
+
+// LRU cache of built variants. `Get()` returns the cached value for `key`, or
+// calls `build()` and caches its result. When more than `capacity` variants
+// are cached, the least recently used one is passed to `on_evict`(eg to
+// delete it) and dropped.
+//
+// NOTE(LTE): Not thread safe. References returned by `Get()` are valid until
+// the entry is evicted.
+template <typename T>
+class VariantCache {
+ public:
+  explicit VariantCache(size_t capacity,
+                        std::function<void(T &)> on_evict = nullptr)
+      : capacity_(capacity > 0 ? capacity : 1), on_evict_(on_evict) {}
+
+  ~VariantCache() { Clear(); }
+
+  VariantCache(const VariantCache &) = delete;
+  VariantCache &operator=(const VariantCache &) = delete;
+
+  template <typename Builder>
+  T &Get(const std::string &key, Builder build) {
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+      hits_++;
+      // Move to the front(most recently used).
+      entries_.splice(entries_.begin(), entries_, it->second);
+      return it->second->second;
+    }
+
+    misses_++;
+    // Build first, so a throwing `build()` leaves the cache unchanged.
+    T value = build();
+    entries_.emplace_front(key, std::move(value));
+    index_[key] = entries_.begin();
+
+    while (entries_.size() > capacity_) {
+      auto &last = entries_.back();
+      if (on_evict_) {
+        on_evict_(last.second);
+      }
+      index_.erase(last.first);
+      entries_.pop_back();
+      evictions_++;
+    }
+
+    return entries_.front().second;
+  }
+
+  bool Contains(const std::string &key) const {
+    return index_.find(key) != index_.end();
+  }
+
+  void Clear() {
+    if (on_evict_) {
+      for (auto &entry : entries_) {
+        on_evict_(entry.second);
+      }
+    }
+    entries_.clear();
+    index_.clear();
+  }
+
+  size_t size() const { return entries_.size(); }
+  size_t capacity() const { return capacity_; }
+  size_t hits() const { return hits_; }
+  size_t misses() const { return misses_; }
+  size_t evictions() const { return evictions_; }
+
+ private:
+  size_t capacity_;
+  std::function<void(T &)> on_evict_;
+  std::list<std::pair<std::string, T>> entries_;  // front = most recently used
+  std::unordered_map<std::string,
+                     typename std::list<std::pair<std::string, T>>::iterator>
+      index_;
+  size_t hits_ = 0;
+  size_t misses_ = 0;
+  size_t evictions_ = 0;
+};
+
+}  // namespace rainbowmist
+
+#endif  // RAINBOWMIST_CPP11
+
+#endif  // RAINBOWMIST_SPEC_H_
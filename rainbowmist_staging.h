@@ -0,0 +1,427 @@
+#ifndef RAINBOWMIST_STAGING_H_
+#define RAINBOWMIST_STAGING_H_
+
+//
+// RainbowMist pinned host memory and staging ring buffer.
+//
+// Copies from ordinary(pageable) host memory can't be DMAed directly, so the
+// driver first copies them into its own pinned buffer, and
+// `clEnqueueWriteBuffer(CL_FALSE)`/`cuMemcpyHtoDAsync` aren't really
+// asynchronous.
+//
+// `rainbowmist::PinnedAllocator<T, Source>` is a `std::allocator` adapter
+// over a source of page-locked memory:
+//
+//   CUDA   : `rainbowmist::CUDAPinnedSource`(`cuMemHostAlloc`)
+//   OpenCL : `rainbowmist::CLPinnedSource`(mapped `CL_MEM_ALLOC_HOST_PTR`
+//            buffers)
+//   C++11  : `rainbowmist::HostPinnedSource`(page aligned heap memory, for
+//            testing)
+//
+//   rainbowmist::CUDAPinnedSource source;
+//   rainbowmist::PinnedVector<float, rainbowmist::CUDAPinnedSource> v(
+//       n, rainbowmist::PinnedAllocator<float, rainbowmist::CUDAPinnedSource>(&source));
+//   buffer.WriteAsync(queue, n, v.data());  // CLCudaAPI
+//
+// `rainbowmist::StagingRing` streams large uploads from pageable memory
+// through a few pinned chunks, so the `memcpy` into one chunk overlaps the
+// DMA of the previous ones. `StagingUploadCL()`/`StagingUploadCUDA()` drive
+// it with OpenCL events/CUDA events.
+//
+
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 - 2020 Light Transport Entertainment, Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "rainbowmist.h"
+
+#if defined(RAINBOWMIST_CPP11) || defined(__CUEW_H__) || \
+    defined(CLEW_HPP_INCLUDED) || defined(__OPENCL_CL_H)
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <new>
+#include <vector>
+
+namespace rainbowmist {
+
+// A `Source` has `void *Allocate(size_t bytes)`(nullptr on failure) and
+// `void Deallocate(void *p, size_t bytes)`. The allocator only keeps a
+// pointer to it, so the source must outlive the containers.
+template <typename T, typename Source>
+class PinnedAllocator {
+ public:
+  typedef T value_type;
+
+  explicit PinnedAllocator(Source *source) : source_(source) {}
+
+  template <typename U>
+  PinnedAllocator(const PinnedAllocator<U, Source> &other)
+      : source_(other.source()) {}
+
+  T *allocate(size_t n) {
+    void *p = source_->Allocate(n * sizeof(T));
+    if (!p) {
+      throw std::bad_alloc();
+    }
+    return static_cast<T *>(p);
+  }
+
+  void deallocate(T *p, size_t n) { source_->Deallocate(p, n * sizeof(T)); }
+
+  Source *source() const { return source_; }
+
+ private:
+  Source *source_;
+};
+
+template <typename T, typename U, typename Source>
+bool operator==(const PinnedAllocator<T, Source> &a,
+                const PinnedAllocator<U, Source> &b) {
+  return a.source() == b.source();
+}
+
+template <typename T, typename U, typename Source>
+bool operator!=(const PinnedAllocator<T, Source> &a,
+                const PinnedAllocator<U, Source> &b) {
+  return a.source() != b.source();
+}
+
+template <typename T, typename Source>
+using PinnedVector = std::vector<T, PinnedAllocator<T, Source>>;
+
+// Page aligned heap memory. Nothing is page-locked; used on the C++11
+// backend, and to test code written for the other sources.
+class HostPinnedSource {
+ public:
+  static const size_t kAlignment = 4096;
+
+  void *Allocate(size_t bytes) {
+    // Keep the original pointer just before the aligned one.
+    void *raw = malloc(bytes + kAlignment + sizeof(void *));
+    if (!raw) {
+      return nullptr;
+    }
+    uintptr_t aligned = (reinterpret_cast<uintptr_t>(raw) + sizeof(void *) +
+                         kAlignment - 1) &
+                        ~uintptr_t(kAlignment - 1);
+    void **p = reinterpret_cast<void **>(aligned);
+    p[-1] = raw;
+    allocated_bytes_ += bytes;
+    num_allocations_++;
+    return p;
+  }
+
+  void Deallocate(void *p, size_t bytes) {
+    if (p) {
+      free(static_cast<void **>(p)[-1]);
+      allocated_bytes_ -= bytes;
+    }
+  }
+
+  size_t allocated_bytes() const { return allocated_bytes_; }
+  size_t num_allocations() const { return num_allocations_; }
+
+ private:
+  size_t allocated_bytes_ = 0;
+  size_t num_allocations_ = 0;
+};
+
+#if defined(__CUEW_H__)
+// `cuMemHostAlloc()`. A CUDA context must be current when allocating and
+// freeing. Use `CU_MEMHOSTALLOC_PORTABLE` to use the memory from other
+// contexts.
+class CUDAPinnedSource {
+ public:
+  explicit CUDAPinnedSource(unsigned int flags = 0) : flags_(flags) {}
+
+  void *Allocate(size_t bytes) {
+    void *p = nullptr;
+    if (cuMemHostAlloc(&p, bytes, flags_) != CUDA_SUCCESS) {
+      return nullptr;
+    }
+    allocated_bytes_ += bytes;
+    return p;
+  }
+
+  void Deallocate(void *p, size_t bytes) {
+    if (p) {
+      cuMemFreeHost(p);
+      allocated_bytes_ -= bytes;
+    }
+  }
+
+  size_t allocated_bytes() const { return allocated_bytes_; }
+
+ private:
+  unsigned int flags_;
+  size_t allocated_bytes_ = 0;
+};
+#endif
+
+#if defined(CLEW_HPP_INCLUDED) || defined(__OPENCL_CL_H)
+// OpenCL has no pinned allocation call; a `CL_MEM_ALLOC_HOST_PTR` buffer,
+// mapped once for its lifetime, is pinned on most implementations.
+//
+// NOTE(LTE): `queue` is only used for map/unmap, and must outlive the
+// allocations.
+class CLPinnedSource {
+ public:
+  CLPinnedSource(cl_context context, cl_command_queue queue)
+      : context_(context), queue_(queue) {}
+
+  ~CLPinnedSource() {
+    for (auto &it : buffers_) {
+      clEnqueueUnmapMemObject(queue_, it.second, it.first, 0, nullptr, nullptr);
+      clReleaseMemObject(it.second);
+    }
+  }
+
+  CLPinnedSource(const CLPinnedSource &) = delete;
+  CLPinnedSource &operator=(const CLPinnedSource &) = delete;
+
+  void *Allocate(size_t bytes) {
+    cl_int err = CL_SUCCESS;
+    cl_mem mem = clCreateBuffer(context_, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                                bytes, nullptr, &err);
+    if (err != CL_SUCCESS) {
+      return nullptr;
+    }
+    void *p = clEnqueueMapBuffer(queue_, mem, CL_TRUE,
+                                 CL_MAP_READ | CL_MAP_WRITE, 0, bytes, 0,
+                                 nullptr, nullptr, &err);
+    if (err != CL_SUCCESS) {
+      clReleaseMemObject(mem);
+      return nullptr;
+    }
+    buffers_[p] = mem;
+    allocated_bytes_ += bytes;
+    return p;
+  }
+
+  void Deallocate(void *p, size_t bytes) {
+    auto it = buffers_.find(p);
+    if (it == buffers_.end()) {
+      return;
+    }
+    // The buffer is freed once the unmap completes.
+    clEnqueueUnmapMemObject(queue_, it->second, p, 0, nullptr, nullptr);
+    clReleaseMemObject(it->second);
+    buffers_.erase(it);
+    allocated_bytes_ -= bytes;
+  }
+
+  // The buffer behind an allocation, eg for `clEnqueueCopyBuffer`. nullptr
+  // if `p` wasn't allocated here.
+  cl_mem GetMemObject(const void *p) const {
+    auto it = buffers_.find(const_cast<void *>(p));
+    return (it == buffers_.end()) ? nullptr : it->second;
+  }
+
+  size_t allocated_bytes() const { return allocated_bytes_; }
+
+ private:
+  cl_context context_;
+  cl_command_queue queue_;
+  std::map<void *, cl_mem> buffers_;
+  size_t allocated_bytes_ = 0;
+};
+#endif
+
+// Ring of `num_chunks` staging chunks of `chunk_bytes` each, in pinned memory
+// owned by the caller(eg from one of the sources above).
+//
+// `Upload()` copies the source into the next chunk, and hands it to `copy`,
+// which enqueues an asynchronous copy to the device. A chunk is reused only
+// after `wait(slot)` reports its previous copy done, so with 3 or more chunks
+// the `memcpy` and the DMA overlap. The ring position carries over between
+// uploads.
+//
+// NOTE(LTE): Not thread safe.
+class StagingRing {
+ public:
+  StagingRing(void *memory, size_t chunk_bytes, size_t num_chunks)
+      : memory_(static_cast<char *>(memory)),
+        chunk_bytes_(chunk_bytes > 0 ? chunk_bytes : 1),
+        num_chunks_(num_chunks > 0 ? num_chunks : 1),
+        pending_(num_chunks_, 0) {}
+
+  // Copies `size` bytes from `src` to device offset `dst_offset` onwards.
+  //
+  //   copy(const void *staging, size_t dst_offset, size_t size, size_t slot)
+  //     enqueues an asynchronous copy of `size` bytes from `staging`.
+  //   wait(size_t slot)
+  //     blocks until the last copy enqueued for `slot` has completed.
+  //
+  // Returns once the last chunk is enqueued; `src` can be reused right away,
+  // but the device data is only complete after `Drain()`.
+  template <typename Copy, typename Wait>
+  void Upload(const void *src, size_t size, size_t dst_offset, Copy copy,
+              Wait wait) {
+    const char *bytes = static_cast<const char *>(src);
+    size_t done = 0;
+    while (done < size) {
+      const size_t n = std::min(chunk_bytes_, size - done);
+      const size_t slot = next_;
+      if (pending_[slot]) {
+        wait(slot);
+        pending_[slot] = 0;
+        num_waits_++;
+      }
+      char *staging = memory_ + slot * chunk_bytes_;
+      memcpy(staging, bytes + done, n);
+      copy(static_cast<const void *>(staging), dst_offset + done, n, slot);
+      pending_[slot] = 1;
+      next_ = (slot + 1) % num_chunks_;
+      done += n;
+      bytes_staged_ += n;
+      num_chunks_copied_++;
+    }
+  }
+
+  // Waits for all enqueued copies, oldest first.
+  template <typename Wait>
+  void Drain(Wait wait) {
+    for (size_t i = 0; i < num_chunks_; i++) {
+      const size_t slot = (next_ + i) % num_chunks_;
+      if (pending_[slot]) {
+        wait(slot);
+        pending_[slot] = 0;
+      }
+    }
+  }
+
+  size_t num_pending() const {
+    return static_cast<size_t>(
+        std::count(pending_.begin(), pending_.end(), 1));
+  }
+
+  void *chunk(size_t slot) const { return memory_ + slot * chunk_bytes_; }
+  size_t chunk_bytes() const { return chunk_bytes_; }
+  size_t num_chunks() const { return num_chunks_; }
+
+  size_t bytes_staged() const { return bytes_staged_; }
+  size_t num_chunks_copied() const { return num_chunks_copied_; }
+  // Times `Upload()` had to wait for a chunk, ie the DMA was the bottleneck.
+  size_t num_waits() const { return num_waits_; }
+
+ private:
+  char *memory_;
+  size_t chunk_bytes_;
+  size_t num_chunks_;
+  std::vector<unsigned char> pending_;
+  size_t next_ = 0;
+  size_t bytes_staged_ = 0;
+  size_t num_chunks_copied_ = 0;
+  size_t num_waits_ = 0;
+};
+
+#if defined(CLEW_HPP_INCLUDED) || defined(__OPENCL_CL_H)
+// Uploads `size` bytes from pageable `src` to `dst` through `ring`. `events`
+// holds one `cl_event` per chunk across calls(initially empty). Call with
+// `size` 0 to just wait for all pending copies. Returns the first error.
+inline cl_int StagingUploadCL(StagingRing *ring, std::vector<cl_event> *events,
+                              cl_command_queue queue, cl_mem dst,
+                              size_t dst_offset, const void *src, size_t size) {
+  events->resize(ring->num_chunks(), nullptr);
+  cl_int result = CL_SUCCESS;
+  auto wait = [&](size_t slot) {
+    cl_event &event = (*events)[slot];
+    if (event) {
+      cl_int err = clWaitForEvents(1, &event);
+      if (result == CL_SUCCESS) {
+        result = err;
+      }
+      clReleaseEvent(event);
+      event = nullptr;
+    }
+  };
+  auto copy = [&](const void *staging, size_t offset, size_t n, size_t slot) {
+    // After an error the rest of the upload is skipped; the slots are left
+    // without events, so waiting on them is a no-op.
+    if (result != CL_SUCCESS) {
+      return;
+    }
+    result = clEnqueueWriteBuffer(queue, dst, CL_FALSE, offset, n, staging, 0,
+                                  nullptr, &(*events)[slot]);
+    // Submit each chunk right away, so its DMA overlaps the next memcpy
+    // instead of waiting for the first clWaitForEvents.
+    if (result == CL_SUCCESS) {
+      result = clFlush(queue);
+    }
+  };
+  if (size == 0) {
+    ring->Drain(wait);
+  } else {
+    ring->Upload(src, size, dst_offset, copy, wait);
+  }
+  return result;
+}
+#endif
+
+#if defined(__CUEW_H__)
+// Uploads `size` bytes from pageable `src` to `dst` through `ring` on
+// `stream`. `events` must hold `ring->num_chunks()` events created with
+// `cuEventCreate(CU_EVENT_DISABLE_TIMING)`. Call with `size` 0 to just wait
+// for all pending copies. Returns the first error.
+inline CUresult StagingUploadCUDA(StagingRing *ring,
+                                  const std::vector<CUevent> &events,
+                                  CUstream stream, CUdeviceptr dst,
+                                  size_t dst_offset, const void *src,
+                                  size_t size) {
+  CUresult result = CUDA_SUCCESS;
+  auto wait = [&](size_t slot) {
+    CUresult err = cuEventSynchronize(events[slot]);
+    if (result == CUDA_SUCCESS) {
+      result = err;
+    }
+  };
+  auto copy = [&](const void *staging, size_t offset, size_t n, size_t slot) {
+    // After an error the rest of the upload is skipped; the slots keep their
+    // last recorded event, which has completed or will.
+    if (result != CUDA_SUCCESS) {
+      return;
+    }
+    result = cuMemcpyHtoDAsync(dst + offset, staging, n, stream);
+    if (result == CUDA_SUCCESS) {
+      result = cuEventRecord(events[slot], stream);
+    }
+  };
+  if (size == 0) {
+    ring->Drain(wait);
+  } else {
+    ring->Upload(src, size, dst_offset, copy, wait);
+  }
+  return result;
+}
+#endif
+
+}  // namespace rainbowmist
+
+#endif
+
+#endif  // RAINBOWMIST_STAGING_H_
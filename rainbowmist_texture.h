@@ -0,0 +1,513 @@
+#ifndef RAINBOWMIST_TEXTURE_H_
+#define RAINBOWMIST_TEXTURE_H_
+
+//
+// RainbowMist texture and sampler abstraction.
+//
+// Kernel side:
+//
+//   RM_KERNEL void shade(RM_GLOBAL vec4 *out, RM_TEXTURE2D(albedo)) {
+//     out[0] = RM_TEX2D(albedo, make_vec2(0.5f, 0.5f));
+//   }
+//
+// `RM_TEXTURE2D(name)` expands to
+//
+//   CUDA   : `cudaTextureObject_t name`
+//   OpenCL : `__read_only image2d_t name, sampler_t name_sampler`
+//   C++11  : `const rainbowmist::Texture2D *name`(software sampler)
+//
+// so OpenCL host code must set two kernel arguments(image, then sampler) per texture.
+//
+// Texel format is RGBA float32 on every backend. Texture coordinates are normalized([0, 1)).
+//
+
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 - 2020 Light Transport Entertainment, Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include "rainbowmist.h"
+
+// Sampler state values. Plain integers so that they can also be used from OpenCL C.
+#define RM_FILTER_NEAREST (0)
+#define RM_FILTER_LINEAR (1)
+
+// Mipmap filter. `NONE` always samples level 0.
+#define RM_MIPFILTER_NONE (0)
+#define RM_MIPFILTER_NEAREST (1)
+#define RM_MIPFILTER_LINEAR (2)
+
+#define RM_ADDRESS_REPEAT (0)
+#define RM_ADDRESS_CLAMP (1)   // clamp to edge
+#define RM_ADDRESS_MIRROR (2)  // mirrored repeat
+#define RM_ADDRESS_BORDER (3)  // out of range texels are (0, 0, 0, 0)
+
+#if defined(RAINBOWMIST_CUDA)
+
+#define RM_TEXTURE2D(name) cudaTextureObject_t name
+#define RM_TEXTURE3D(name) cudaTextureObject_t name
+
+#define RM_TEX2D(t, uv) tex2D<float4>(t, (uv).x, (uv).y)
+#define RM_TEX2D_LOD(t, uv, lod) tex2DLod<float4>(t, (uv).x, (uv).y, lod)
+#define RM_TEX3D(t, uvw) tex3D<float4>(t, (uvw).x, (uvw).y, (uvw).z)
+#define RM_TEX3D_LOD(t, uvw, lod) \
+  tex3DLod<float4>(t, (uvw).x, (uvw).y, (uvw).z, lod)
+
+#elif defined(RAINBOWMIST_OPENCL)
+
+#define RM_TEXTURE2D(name) __read_only image2d_t name, sampler_t name##_sampler
+#define RM_TEXTURE3D(name) __read_only image3d_t name, sampler_t name##_sampler
+
+#define RM_TEX2D(t, uv) read_imagef(t, t##_sampler, uv)
+#define RM_TEX3D(t, uvw) \
+  read_imagef(t, t##_sampler, (float4)((uvw).x, (uvw).y, (uvw).z, 0.0f))
+
+// NOTE(LTE): OpenCL 1.2 core does not have mipmapped images(cl_khr_mipmap_image is
+// an extension), so LOD variants sample level 0.
+#define RM_TEX2D_LOD(t, uv, lod) RM_TEX2D(t, uv)
+#define RM_TEX3D_LOD(t, uvw, lod) RM_TEX3D(t, uvw)
+
+#else  // C++11
+
+#define RM_TEXTURE2D(name) const rainbowmist::Texture2D *name
+#define RM_TEXTURE3D(name) const rainbowmist::Texture3D *name
+
+#define RM_TEX2D(t, uv) (t)->Sample(uv)
+#define RM_TEX2D_LOD(t, uv, lod) (t)->SampleLod(uv, lod)
+#define RM_TEX3D(t, uvw) (t)->Sample(uvw)
+#define RM_TEX3D_LOD(t, uvw, lod) (t)->SampleLod(uvw, lod)
+
+#endif
+
+#if defined(RAINBOWMIST_CPP11) || defined(__CUEW_H__) || \
+    defined(CLEW_HPP_INCLUDED) || defined(__OPENCL_CL_H)
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace rainbowmist {
+
+// Host side description of sampler state. Mapped to `CUDA_TEXTURE_DESC`,
+// `cl_sampler` or used directly by the software sampler.
+struct TextureSampler {
+  int filter = RM_FILTER_LINEAR;
+  int mip_filter = RM_MIPFILTER_NONE;
+  int address[3] = {RM_ADDRESS_REPEAT, RM_ADDRESS_REPEAT, RM_ADDRESS_REPEAT};
+
+  TextureSampler() = default;
+  TextureSampler(int _filter, int _address, int _mip_filter = RM_MIPFILTER_NONE)
+      : filter(_filter), mip_filter(_mip_filter) {
+    address[0] = address[1] = address[2] = _address;
+  }
+};
+
+#if defined(__CUEW_H__)
+// Fills `CUDA_TEXTURE_DESC` for `cuTexObjectCreate`. The resource(CUarray or
+// CUmipmappedArray) must be RGBA float32 to match the other backends.
+inline CUDA_TEXTURE_DESC ToCUDATextureDesc(const TextureSampler &sampler) {
+  CUDA_TEXTURE_DESC desc;
+  memset(&desc, 0, sizeof(desc));
+  for (int i = 0; i < 3; i++) {
+    switch (sampler.address[i]) {
+      case RM_ADDRESS_CLAMP:
+        desc.addressMode[i] = CU_TR_ADDRESS_MODE_CLAMP;
+        break;
+      case RM_ADDRESS_MIRROR:
+        desc.addressMode[i] = CU_TR_ADDRESS_MODE_MIRROR;
+        break;
+      case RM_ADDRESS_BORDER:
+        desc.addressMode[i] = CU_TR_ADDRESS_MODE_BORDER;
+        break;
+      default:
+        desc.addressMode[i] = CU_TR_ADDRESS_MODE_WRAP;
+        break;
+    }
+  }
+  desc.filterMode = (sampler.filter == RM_FILTER_LINEAR)
+                        ? CU_TR_FILTER_MODE_LINEAR
+                        : CU_TR_FILTER_MODE_POINT;
+  desc.mipmapFilterMode = (sampler.mip_filter == RM_MIPFILTER_LINEAR)
+                              ? CU_TR_FILTER_MODE_LINEAR
+                              : CU_TR_FILTER_MODE_POINT;
+  desc.flags = CU_TRSF_NORMALIZED_COORDINATES;
+  desc.maxMipmapLevelClamp =
+      (sampler.mip_filter == RM_MIPFILTER_NONE) ? 0.0f : 1000.0f;
+  return desc;
+}
+#endif
+
+#if defined(CLEW_HPP_INCLUDED) || defined(__OPENCL_CL_H)
+// Creates `cl_sampler` for `RM_TEXTURE2D`/`RM_TEXTURE3D` kernel arguments.
+// OpenCL has a single addressing mode for all axes, so `address[0]` is used.
+inline cl_sampler CreateCLSampler(cl_context context,
+                                  const TextureSampler &sampler,
+                                  cl_int *err) {
+  cl_addressing_mode mode = CL_ADDRESS_REPEAT;
+  if (sampler.address[0] == RM_ADDRESS_CLAMP) {
+    mode = CL_ADDRESS_CLAMP_TO_EDGE;
+  } else if (sampler.address[0] == RM_ADDRESS_MIRROR) {
+    mode = CL_ADDRESS_MIRRORED_REPEAT;
+  } else if (sampler.address[0] == RM_ADDRESS_BORDER) {
+    mode = CL_ADDRESS_CLAMP;
+  }
+  return clCreateSampler(
+      context, CL_TRUE, mode,
+      (sampler.filter == RM_FILTER_LINEAR) ? CL_FILTER_LINEAR
+                                           : CL_FILTER_NEAREST,
+      err);
+}
+#endif
+
+}  // namespace rainbowmist
+
+#endif
+
+#if defined(RAINBOWMIST_CPP11)
+
+namespace rainbowmist {
+
+namespace texture_detail {
+
+// Texels are stored in 4x4(2D) or 4x4x4(3D) tiles, and texels inside of a
+// tile are laid out in Morton(Z) order. A texel is 16 bytes(RGBA float), so the
+// 2x2 texel footprint of a bilinear fetch starting at an even coordinate is one
+// 64 byte cache line, and any footprint stays within at most 4 cache lines of
+// the same tile neighbourhood instead of two distant rows.
+static const int kTileShift = 2;
+static const int kTileSize = 1 << kTileShift;
+static const int kTileMask = kTileSize - 1;
+static const size_t kAlignment = 64;
+
+inline uint32_t Part1By1(uint32_t x) {
+  x &= 0x0000ffff;
+  x = (x ^ (x << 8)) & 0x00ff00ff;
+  x = (x ^ (x << 4)) & 0x0f0f0f0f;
+  x = (x ^ (x << 2)) & 0x33333333;
+  x = (x ^ (x << 1)) & 0x55555555;
+  return x;
+}
+
+inline uint32_t Part1By2(uint32_t x) {
+  x &= 0x000003ff;
+  x = (x ^ (x << 16)) & 0xff0000ff;
+  x = (x ^ (x << 8)) & 0x0300f00f;
+  x = (x ^ (x << 4)) & 0x030c30c3;
+  x = (x ^ (x << 2)) & 0x09249249;
+  return x;
+}
+
+// Returns -1 for `RM_ADDRESS_BORDER` when `i` is out of range.
+inline int ApplyAddressMode(int i, int n, int mode) {
+  if (mode == RM_ADDRESS_CLAMP) {
+    return (i < 0) ? 0 : ((i >= n) ? (n - 1) : i);
+  } else if (mode == RM_ADDRESS_BORDER) {
+    return ((i < 0) || (i >= n)) ? -1 : i;
+  } else if (mode == RM_ADDRESS_MIRROR) {
+    int period = 2 * n;
+    int m = i % period;
+    if (m < 0) m += period;
+    return (m < n) ? m : (period - 1 - m);
+  }
+  int m = i % n;
+  return (m < 0) ? (m + n) : m;
+}
+
+inline int NumLevels(int w, int h, int d) {
+  int levels = 1;
+  while ((w > 1) || (h > 1) || (d > 1)) {
+    w = (w > 1) ? (w / 2) : 1;
+    h = (h > 1) ? (h / 2) : 1;
+    d = (d > 1) ? (d / 2) : 1;
+    levels++;
+  }
+  return levels;
+}
+
+// One mip level of a tiled RGBA float texture. 2D textures have depth 1.
+class TiledLevel {
+ public:
+  TiledLevel(int w, int h, int d)
+      : width_(w),
+        height_(h),
+        depth_(d),
+        tiles_x_((w + kTileMask) >> kTileShift),
+        tiles_y_((h + kTileMask) >> kTileShift),
+        tile_texels_((d > 1) ? (kTileSize * kTileSize * kTileSize)
+                             : (kTileSize * kTileSize)) {
+    int tiles_z = (d > 1) ? ((d + kTileMask) >> kTileShift) : 1;
+    size_t n = size_t(tiles_x_) * size_t(tiles_y_) * size_t(tiles_z) *
+               size_t(tile_texels_) * 4;
+    storage_.resize(n + kAlignment / sizeof(float), 0.0f);
+  }
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  int depth() const { return depth_; }
+
+  const float *Texel(int x, int y, int z) const {
+    return Base() + Offset(x, y, z);
+  }
+
+  float *Texel(int x, int y, int z) {
+    return const_cast<float *>(Base()) + Offset(x, y, z);
+  }
+
+ private:
+  const float *Base() const {
+    uintptr_t p = reinterpret_cast<uintptr_t>(storage_.data());
+    p = (p + kAlignment - 1) & ~uintptr_t(kAlignment - 1);
+    return reinterpret_cast<const float *>(p);
+  }
+
+  size_t Offset(int x, int y, int z) const {
+    size_t tile = size_t(x >> kTileShift) +
+                  size_t(tiles_x_) * (size_t(y >> kTileShift) +
+                                      size_t(tiles_y_) * size_t(z >> kTileShift));
+    uint32_t m;
+    if (depth_ > 1) {
+      m = Part1By2(uint32_t(x & kTileMask)) |
+          (Part1By2(uint32_t(y & kTileMask)) << 1) |
+          (Part1By2(uint32_t(z & kTileMask)) << 2);
+    } else {
+      m = Part1By1(uint32_t(x & kTileMask)) |
+          (Part1By1(uint32_t(y & kTileMask)) << 1);
+    }
+    return (tile * size_t(tile_texels_) + m) * 4;
+  }
+
+  int width_, height_, depth_;
+  int tiles_x_, tiles_y_;
+  int tile_texels_;
+  std::vector<float> storage_;
+};
+
+// Shared implementation of 2D and 3D software textures.
+class TiledTexture {
+ public:
+  TiledTexture(int w, int h, int d, const TextureSampler &sampler)
+      : sampler_(sampler) {
+    levels_.push_back(TiledLevel(w, h, d));
+  }
+
+  // Non-copyable since texel addresses depend on the alignment of the storage.
+  TiledTexture(const TiledTexture &) = delete;
+  TiledTexture &operator=(const TiledTexture &) = delete;
+  TiledTexture(TiledTexture &&) = default;
+  TiledTexture &operator=(TiledTexture &&) = default;
+
+  int width(int level = 0) const { return levels_[size_t(level)].width(); }
+  int height(int level = 0) const { return levels_[size_t(level)].height(); }
+  int depth(int level = 0) const { return levels_[size_t(level)].depth(); }
+  int num_levels() const { return int(levels_.size()); }
+
+  const TextureSampler &sampler() const { return sampler_; }
+  void SetSampler(const TextureSampler &sampler) { sampler_ = sampler; }
+
+  // Copies row-major texels with `channels`(1 - 4) components into level 0.
+  // Missing components are filled with (0, 0, 0, 1). Existing mip levels are
+  // discarded.
+  void SetTexels(const float *src, int channels) {
+    levels_.erase(levels_.begin() + 1, levels_.end());
+    TiledLevel &l = levels_[0];
+    for (int z = 0; z < l.depth(); z++) {
+      for (int y = 0; y < l.height(); y++) {
+        for (int x = 0; x < l.width(); x++) {
+          const float *s =
+              src + ((size_t(z) * size_t(l.height()) + size_t(y)) *
+                         size_t(l.width()) +
+                     size_t(x)) *
+                        size_t(channels);
+          float *t = l.Texel(x, y, z);
+          for (int c = 0; c < 4; c++) {
+            t[c] = (c < channels) ? s[c] : ((c == 3) ? 1.0f : 0.0f);
+          }
+        }
+      }
+    }
+  }
+
+  // Builds the full mip chain with a box filter.
+  void GenerateMipmaps() {
+    levels_.erase(levels_.begin() + 1, levels_.end());
+    int n = NumLevels(width(), height(), depth());
+    for (int i = 1; i < n; i++) {
+      const TiledLevel &src = levels_[size_t(i - 1)];
+      int w = (src.width() > 1) ? (src.width() / 2) : 1;
+      int h = (src.height() > 1) ? (src.height() / 2) : 1;
+      int d = (src.depth() > 1) ? (src.depth() / 2) : 1;
+      TiledLevel dst(w, h, d);
+      for (int z = 0; z < dst.depth(); z++) {
+        for (int y = 0; y < h; y++) {
+          for (int x = 0; x < w; x++) {
+            float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+            int count = 0;
+            for (int dz = 0; dz < ((src.depth() > 1) ? 2 : 1); dz++) {
+              for (int dy = 0; dy < ((src.height() > 1) ? 2 : 1); dy++) {
+                for (int dx = 0; dx < ((src.width() > 1) ? 2 : 1); dx++) {
+                  const float *t =
+                      src.Texel(2 * x + dx, 2 * y + dy,
+                                (src.depth() > 1) ? (2 * z + dz) : 0);
+                  for (int c = 0; c < 4; c++) sum[c] += t[c];
+                  count++;
+                }
+              }
+            }
+            float *t = dst.Texel(x, y, z);
+            for (int c = 0; c < 4; c++) t[c] = sum[c] / float(count);
+          }
+        }
+      }
+      levels_.push_back(std::move(dst));
+    }
+  }
+
+  // Address of a texel in the tiled storage. Mainly for tests and debugging.
+  const float *TexelAddress(int x, int y, int z = 0, int level = 0) const {
+    return levels_[size_t(level)].Texel(x, y, z);
+  }
+
+ protected:
+  // Filters level `level` at normalized coordinate (u, v, w).
+  void FilterLevel(int level, float u, float v, float w, float out[4]) const {
+    const TiledLevel &l = levels_[size_t(level)];
+    const bool is3d = (l.depth() > 1) || (depth() > 1);
+    float fx = u * float(l.width());
+    float fy = v * float(l.height());
+    float fz = w * float(l.depth());
+
+    if (sampler_.filter == RM_FILTER_NEAREST) {
+      int x = ApplyAddressMode(int(std::floor(fx)), l.width(), sampler_.address[0]);
+      int y = ApplyAddressMode(int(std::floor(fy)), l.height(), sampler_.address[1]);
+      int z = is3d ? ApplyAddressMode(int(std::floor(fz)), l.depth(),
+                                      sampler_.address[2])
+                   : 0;
+      if ((x < 0) || (y < 0) || (z < 0)) {
+        out[0] = out[1] = out[2] = out[3] = 0.0f;
+        return;
+      }
+      memcpy(out, l.Texel(x, y, z), sizeof(float) * 4);
+      return;
+    }
+
+    fx -= 0.5f;
+    fy -= 0.5f;
+    fz -= 0.5f;
+    float x0f = std::floor(fx), y0f = std::floor(fy), z0f = std::floor(fz);
+    float tx = fx - x0f, ty = fy - y0f, tz = fz - z0f;
+    int xs[2] = {ApplyAddressMode(int(x0f), l.width(), sampler_.address[0]),
+                 ApplyAddressMode(int(x0f) + 1, l.width(), sampler_.address[0])};
+    int ys[2] = {ApplyAddressMode(int(y0f), l.height(), sampler_.address[1]),
+                 ApplyAddressMode(int(y0f) + 1, l.height(), sampler_.address[1])};
+    int zs[2] = {0, 0};
+    int nz = 1;
+    if (is3d) {
+      zs[0] = ApplyAddressMode(int(z0f), l.depth(), sampler_.address[2]);
+      zs[1] = ApplyAddressMode(int(z0f) + 1, l.depth(), sampler_.address[2]);
+      nz = 2;
+    } else {
+      tz = 0.0f;
+    }
+
+    out[0] = out[1] = out[2] = out[3] = 0.0f;
+    for (int k = 0; k < nz; k++) {
+      float wz = (k == 0) ? (1.0f - tz) : tz;
+      for (int j = 0; j < 2; j++) {
+        float wy = (j == 0) ? (1.0f - ty) : ty;
+        for (int i = 0; i < 2; i++) {
+          float wx = (i == 0) ? (1.0f - tx) : tx;
+          if ((xs[i] < 0) || (ys[j] < 0) || (zs[k] < 0)) {
+            continue;  // border
+          }
+          const float *t = l.Texel(xs[i], ys[j], zs[k]);
+          float weight = wx * wy * wz;
+          for (int c = 0; c < 4; c++) out[c] += weight * t[c];
+        }
+      }
+    }
+  }
+
+  void FilterLod(float u, float v, float w, float lod, float out[4]) const {
+    int max_level = num_levels() - 1;
+    if ((sampler_.mip_filter == RM_MIPFILTER_NONE) || (max_level == 0)) {
+      FilterLevel(0, u, v, w, out);
+      return;
+    }
+    lod = (lod < 0.0f) ? 0.0f : ((lod > float(max_level)) ? float(max_level) : lod);
+    if (sampler_.mip_filter == RM_MIPFILTER_NEAREST) {
+      FilterLevel(int(lod + 0.5f), u, v, w, out);
+      return;
+    }
+    int l0 = int(lod);
+    int l1 = (l0 < max_level) ? (l0 + 1) : l0;
+    float t = lod - float(l0);
+    float a[4], b[4];
+    FilterLevel(l0, u, v, w, a);
+    FilterLevel(l1, u, v, w, b);
+    for (int c = 0; c < 4; c++) out[c] = a[c] + (b[c] - a[c]) * t;
+  }
+
+  std::vector<TiledLevel> levels_;
+  TextureSampler sampler_;
+};
+
+}  // namespace texture_detail
+
+// Software 2D texture for the C++11 backend. Counterpart of
+// `cudaTextureObject_t`(image + sampler state).
+class Texture2D : public texture_detail::TiledTexture {
+ public:
+  Texture2D(int w, int h, const TextureSampler &sampler = TextureSampler())
+      : texture_detail::TiledTexture(w, h, 1, sampler) {}
+
+  vec4 Sample(const vec2 &uv) const { return SampleLod(uv, 0.0f); }
+
+  vec4 SampleLod(const vec2 &uv, float lod) const {
+    float t[4];
+    FilterLod(uv.x, uv.y, 0.0f, lod, t);
+    return make_vec4(t[0], t[1], t[2], t[3]);
+  }
+};
+
+// Software 3D texture for the C++11 backend.
+class Texture3D : public texture_detail::TiledTexture {
+ public:
+  Texture3D(int w, int h, int d,
+            const TextureSampler &sampler = TextureSampler())
+      : texture_detail::TiledTexture(w, h, d, sampler) {}
+
+  vec4 Sample(const vec3 &uvw) const { return SampleLod(uvw, 0.0f); }
+
+  vec4 SampleLod(const vec3 &uvw, float lod) const {
+    float t[4];
+    FilterLod(uvw.x, uvw.y, uvw.z, lod, t);
+    return make_vec4(t[0], t[1], t[2], t[3]);
+  }
+};
+
+}  // namespace rainbowmist
+
+#endif  // RAINBOWMIST_CPP11
+
+#endif  // RAINBOWMIST_TEXTURE_H_
@@ -37,11 +37,14 @@
 
 // C++
 #include <algorithm> // std::copy
+#include <atomic>    // std::atomic
 #include <string>    // std::string
 #include <vector>    // std::vector
+#include <utility>   // std::pair
 #include <memory>    // std::shared_ptr
 #include <stdexcept> // std::runtime_error
 #include <numeric>   // std::accumulate
+#include <future>    // std::future, std::promise
 
 // OpenCL
 #if defined(__APPLE__) || defined(__MACOSX)
@@ -118,6 +121,48 @@ using EventPointer = cl_event*;
 
 // =================================================================================================
 
+// Observer of the commands this header enqueues onto a queue, e.g. for a timeline trace. 'Command'
+// is called just after a command is enqueued, with its event, which is released afterwards unless
+// the caller asked for it (retain it to keep it). The category is "kernel", "upload", "download"
+// or "copy". It may not throw.
+class CommandTracer {
+ public:
+  virtual ~CommandTracer() {}
+  virtual void Command(const std::string &name, const char* category,
+                       const cl_command_queue queue, const cl_event event) = 0;
+};
+
+// The tracer of all threads, or nullptr
+inline std::atomic<CommandTracer*>& CurrentCommandTracer() {
+  static std::atomic<CommandTracer*> tracer{nullptr};
+  return tracer;
+}
+
+// Installs a tracer (or nullptr to remove it) and returns the previous one
+inline CommandTracer* SetCommandTracer(CommandTracer* tracer) {
+  return CurrentCommandTracer().exchange(tracer);
+}
+
+// Enqueues a command onto a queue, with an event of its own if the caller passed none when there
+// is a tracer to report it to
+template <typename Enqueue>
+void TraceCommand(const cl_command_queue queue, const std::string &name, const char* category,
+                  EventPointer event, Enqueue enqueue) {
+  const auto tracer = CurrentCommandTracer().load();
+  if (tracer == nullptr) {
+    CheckError(enqueue(event));
+    return;
+  }
+  auto own_event = cl_event{nullptr};
+  const auto traced_event = (event != nullptr) ? event : &own_event;
+  const auto status = enqueue(traced_event);
+  if (status == CL_SUCCESS) { tracer->Command(name, category, queue, *traced_event); }
+  if (own_event != nullptr) { clReleaseEvent(own_event); }
+  CheckError(status);
+}
+
+// =================================================================================================
+
 // C++11 version of 'cl_platform_id'
 class Platform {
  public:
@@ -370,6 +415,32 @@ class Program {
     }
   }
 
+  // As above, but returns immediately with a future of the build status. This passes a callback
+  // ('pfn_notify') to clBuildProgram: drivers that support it compile in the background, others
+  // compile before returning, in which case the future is already ready. Don't build the same
+  // program twice at the same time.
+  std::future<BuildStatus> BuildAsync(const Device &device, std::vector<std::string> &options) {
+    auto options_string = std::accumulate(options.begin(), options.end(), std::string{" "});
+    const cl_device_id dev = device();
+    auto notify = new BuildNotify{std::promise<BuildStatus>(), dev}; // deleted by the callback
+    auto future = notify->promise.get_future();
+    CheckError(clRetainProgram(*program_)); // released by the callback
+    auto status = clBuildProgram(*program_, 1, &dev, options_string.c_str(), BuildCallback, notify);
+    // The callback is only called once the build has started, otherwise clean-up here
+    if (status != CL_SUCCESS && status != CL_BUILD_PROGRAM_FAILURE) {
+      clReleaseProgram(*program_);
+      if (status == CL_INVALID_BINARY) {
+        notify->promise.set_value(BuildStatus::kInvalid);
+      }
+      else {
+        auto message = "Internal OpenCL error: "+std::to_string(status);
+        notify->promise.set_exception(std::make_exception_ptr(std::runtime_error(message)));
+      }
+      delete notify;
+    }
+    return future;
+  }
+
   // Retrieves the warning/error message from the compiler (if any)
   std::string GetBuildInfo(const Device &device) const {
     auto bytes = size_t{0};
@@ -399,6 +470,22 @@ class Program {
   size_t length_;
   std::string source_; // Note: the source can also be a binary or IR
   const char* source_ptr_;
+
+  // State passed to the 'pfn_notify' callback of BuildAsync
+  struct BuildNotify {
+    std::promise<BuildStatus> promise;
+    cl_device_id device;
+  };
+  static void CL_CALLBACK BuildCallback(cl_program program, void* user_data) {
+    auto notify = static_cast<BuildNotify*>(user_data);
+    auto build_status = cl_build_status{CL_BUILD_ERROR};
+    clGetProgramBuildInfo(program, notify->device, CL_PROGRAM_BUILD_STATUS,
+                          sizeof(cl_build_status), &build_status, nullptr);
+    notify->promise.set_value((build_status == CL_BUILD_SUCCESS) ? BuildStatus::kSuccess :
+                                                                   BuildStatus::kError);
+    clReleaseProgram(program);
+    delete notify;
+  }
 };
 
 // =================================================================================================
@@ -538,16 +625,20 @@ class Buffer {
     Buffer(context, BufferAccess::kReadWrite, static_cast<size_t>(end - start)) {
     auto size = static_cast<size_t>(end - start);
     auto pointer = &*start;
-    CheckError(clEnqueueWriteBuffer(queue(), *buffer_, CL_FALSE, 0, size*sizeof(T), pointer, 0,
-                                    nullptr, nullptr));
+    TraceCommand(queue(), "Buffer::Buffer", "upload", nullptr, [&](EventPointer event) {
+      return clEnqueueWriteBuffer(queue(), *buffer_, CL_FALSE, 0, size*sizeof(T), pointer, 0,
+                                  nullptr, event);
+    });
     queue.Finish();
   }
 
   // Copies from device to host: reading the device buffer a-synchronously
   void ReadAsync(const Queue &queue, const size_t size, T* host, const size_t offset = 0) const {
     if (access_ == BufferAccess::kWriteOnly) { Error("reading from a write-only buffer"); }
-    CheckError(clEnqueueReadBuffer(queue(), *buffer_, CL_FALSE, offset*sizeof(T), size*sizeof(T),
-                                   host, 0, nullptr, nullptr));
+    TraceCommand(queue(), "Buffer::ReadAsync", "download", nullptr, [&](EventPointer event) {
+      return clEnqueueReadBuffer(queue(), *buffer_, CL_FALSE, offset*sizeof(T), size*sizeof(T),
+                                 host, 0, nullptr, event);
+    });
   }
   void ReadAsync(const Queue &queue, const size_t size, std::vector<T> &host,
                  const size_t offset = 0) const {
@@ -578,8 +669,10 @@ class Buffer {
   void WriteAsync(const Queue &queue, const size_t size, const T* host, const size_t offset = 0) {
     if (access_ == BufferAccess::kReadOnly) { Error("writing to a read-only buffer"); }
     if (GetSize() < (offset+size)*sizeof(T)) { Error("target device buffer is too small"); }
-    CheckError(clEnqueueWriteBuffer(queue(), *buffer_, CL_FALSE, offset*sizeof(T), size*sizeof(T),
-                                    host, 0, nullptr, nullptr));
+    TraceCommand(queue(), "Buffer::WriteAsync", "upload", nullptr, [&](EventPointer event) {
+      return clEnqueueWriteBuffer(queue(), *buffer_, CL_FALSE, offset*sizeof(T), size*sizeof(T),
+                                  host, 0, nullptr, event);
+    });
   }
   void WriteAsync(const Queue &queue, const size_t size, const std::vector<T> &host,
                   const size_t offset = 0) {
@@ -604,10 +697,37 @@ class Buffer {
     Write(queue, size, host.data(), offset);
   }
 
+  // Copies a list of (offset, size) byte ranges from host to device, at the same offsets: one
+  // copy per range, all a-synchronous. Meant for uploading only the modified parts of a buffer.
+  void WriteRangesAsync(const Queue &queue, const T* host,
+                        const std::vector<std::pair<size_t, size_t>> &ranges) {
+    if (access_ == BufferAccess::kReadOnly) { Error("writing to a read-only buffer"); }
+    const auto buffer_size = GetSize();
+    const auto bytes = reinterpret_cast<const char*>(host);
+    for (const auto &range : ranges) {
+      if (buffer_size < range.first + range.second) { Error("target device buffer is too small"); }
+    }
+    for (const auto &range : ranges) {
+      if (range.second == 0) { continue; }
+      TraceCommand(queue(), "Buffer::WriteRangesAsync", "upload", nullptr,
+                   [&](EventPointer event) {
+        return clEnqueueWriteBuffer(queue(), *buffer_, CL_FALSE, range.first, range.second,
+                                    bytes + range.first, 0, nullptr, event);
+      });
+    }
+  }
+  void WriteRanges(const Queue &queue, const T* host,
+                   const std::vector<std::pair<size_t, size_t>> &ranges) {
+    WriteRangesAsync(queue, host, ranges);
+    queue.Finish();
+  }
+
   // Copies the contents of this buffer into another device buffer
   void CopyToAsync(const Queue &queue, const size_t size, const Buffer<T> &destination) const {
-    CheckError(clEnqueueCopyBuffer(queue(), *buffer_, destination(), 0, 0, size*sizeof(T), 0,
-                                   nullptr, nullptr));
+    TraceCommand(queue(), "Buffer::CopyToAsync", "copy", nullptr, [&](EventPointer event) {
+      return clEnqueueCopyBuffer(queue(), *buffer_, destination(), 0, 0, size*sizeof(T), 0,
+                                 nullptr, event);
+    });
   }
   void CopyTo(const Queue &queue, const size_t size, const Buffer<T> &destination) const {
     CopyToAsync(queue, size, destination);
@@ -637,22 +757,33 @@ class Kernel {
 
   // Constructor based on the regular OpenCL data-type: memory management is handled elsewhere
   explicit Kernel(const cl_kernel kernel):
-      kernel_(new cl_kernel) {
+      kernel_(new cl_kernel),
+      arguments_(std::make_shared<std::vector<std::string>>()) {
     *kernel_ = kernel;
   }
 
   // Regular constructor with memory management
   explicit Kernel(const Program &program, const std::string &name):
-      kernel_(new cl_kernel, [](cl_kernel* k) { CheckError(clReleaseKernel(*k)); delete k; }) {
+      kernel_(new cl_kernel, [](cl_kernel* k) { CheckError(clReleaseKernel(*k)); delete k; }),
+      arguments_(std::make_shared<std::vector<std::string>>()) {
     auto status = CL_SUCCESS;
     *kernel_ = clCreateKernel(program(), name.c_str(), &status);
     CheckError(status);
   }
 
-  // Sets a kernel argument at the indicated position
+  // Sets a kernel argument at the indicated position. Arguments stay set between launches, and
+  // setting an argument to the value it already has does not call 'clSetKernelArg' again, so a
+  // kernel launched many times only needs the arguments that changed to be set again.
   template <typename T>
   void SetArgument(const size_t index, const T &value) {
+    const auto bytes = reinterpret_cast<const char*>(&value);
+    if (index >= arguments_->size()) { arguments_->resize(index+1); }
+    auto &current = (*arguments_)[index];
+    if (current.size() == sizeof(T) && std::equal(bytes, bytes + sizeof(T), current.begin())) {
+      return;
+    }
     CheckError(clSetKernelArg(*kernel_, static_cast<cl_uint>(index), sizeof(T), &value));
+    current.assign(bytes, bytes + sizeof(T));
   }
   template <typename T>
   void SetArgument(const size_t index, Buffer<T> &value) {
@@ -688,9 +819,11 @@ class Kernel {
   // Launches a kernel onto the specified queue
   void Launch(const Queue &queue, const std::vector<size_t> &global,
               const std::vector<size_t> &local, EventPointer event) {
-    CheckError(clEnqueueNDRangeKernel(queue(), *kernel_, static_cast<cl_uint>(global.size()),
-                                      nullptr, global.data(), local.data(),
-                                      0, nullptr, event));
+    TraceCommand(queue(), TracedName(), "kernel", event, [&](EventPointer traced_event) {
+      return clEnqueueNDRangeKernel(queue(), *kernel_, static_cast<cl_uint>(global.size()),
+                                    nullptr, global.data(), local.data(),
+                                    0, nullptr, traced_event);
+    });
   }
 
   // As above, but with an event waiting list
@@ -698,6 +831,15 @@ class Kernel {
               const std::vector<size_t> &local, EventPointer event,
               const std::vector<Event> &waitForEvents) {
 
+    if (waitForEvents.empty()) {
+      TraceCommand(queue(), TracedName(), "kernel", event, [&](EventPointer traced_event) {
+        return clEnqueueNDRangeKernel(queue(), *kernel_, static_cast<cl_uint>(global.size()),
+                                      nullptr, global.data(), !local.empty() ? local.data() : nullptr,
+                                      0, nullptr, traced_event);
+      });
+      return;
+    }
+
     // Builds a plain version of the events waiting list
     auto waitForEventsPlain = std::vector<cl_event>();
     for (auto &waitEvent : waitForEvents) {
@@ -705,17 +847,25 @@ class Kernel {
     }
 
     // Launches the kernel while waiting for other events
-    CheckError(clEnqueueNDRangeKernel(queue(), *kernel_, static_cast<cl_uint>(global.size()),
-                                      nullptr, global.data(), !local.empty() ? local.data() : nullptr,
-                                      static_cast<cl_uint>(waitForEventsPlain.size()),
-                                      !waitForEventsPlain.empty() ? waitForEventsPlain.data() : nullptr,
-                                      event));
+    TraceCommand(queue(), TracedName(), "kernel", event, [&](EventPointer traced_event) {
+      return clEnqueueNDRangeKernel(queue(), *kernel_, static_cast<cl_uint>(global.size()),
+                                    nullptr, global.data(), !local.empty() ? local.data() : nullptr,
+                                    static_cast<cl_uint>(waitForEventsPlain.size()),
+                                    !waitForEventsPlain.empty() ? waitForEventsPlain.data() : nullptr,
+                                    traced_event);
+    });
   }
 
   // Accessor to the private data-member
   const cl_kernel& operator()() const { return *kernel_; }
  private:
   std::shared_ptr<cl_kernel> kernel_;
+  std::shared_ptr<std::vector<std::string>> arguments_; // Last value set per argument, as raw bytes
+
+  // The name to report to the command tracer: only queried when there is one
+  std::string TracedName() const {
+    return (CurrentCommandTracer().load() != nullptr) ? GetFunctionName() : std::string{};
+  }
 
   // Internal implementation for the recursive SetArguments function.
   template <typename T>
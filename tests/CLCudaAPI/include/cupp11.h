@@ -37,10 +37,13 @@
 
 // C++
 #include <algorithm> // std::copy
+#include <atomic>    // std::atomic
 #include <string>    // std::string
 #include <vector>    // std::vector
+#include <utility>   // std::pair
 #include <memory>    // std::shared_ptr
 #include <stdexcept> // std::runtime_error
+#include <future>    // std::future, std::async
 
 // CUDA
 #include "cuew.h"
@@ -82,6 +85,45 @@ inline void CheckError(const nvrtcResult status) {
 
 // =================================================================================================
 
+// Observer of the commands this header enqueues onto a stream, e.g. for a timeline trace. 'Begin'
+// is called just before a command is enqueued and returns a token, which is passed to 'End' just
+// after; 'enqueued' is false if the enqueue failed. The category is "kernel", "upload",
+// "download" or "copy". Neither may throw.
+class CommandTracer {
+ public:
+  virtual ~CommandTracer() {}
+  virtual void* Begin(const char* name, const char* category, const CUstream queue) = 0;
+  virtual void End(void* token, const CUstream queue, const bool enqueued) = 0;
+};
+
+// The tracer of all threads, or nullptr
+inline std::atomic<CommandTracer*>& CurrentCommandTracer() {
+  static std::atomic<CommandTracer*> tracer{nullptr};
+  return tracer;
+}
+
+// Installs a tracer (or nullptr to remove it) and returns the previous one
+inline CommandTracer* SetCommandTracer(CommandTracer* tracer) {
+  return CurrentCommandTracer().exchange(tracer);
+}
+
+// Enqueues a command onto a stream, reporting it to the tracer if there is one
+template <typename Enqueue>
+void TraceCommand(const CUstream queue, const char* name, const char* category,
+                  Enqueue enqueue) {
+  const auto tracer = CurrentCommandTracer().load();
+  if (tracer == nullptr) {
+    CheckError(enqueue());
+    return;
+  }
+  const auto token = tracer->Begin(name, category, queue);
+  const auto status = enqueue();
+  tracer->End(token, queue, status == CUDA_SUCCESS);
+  CheckError(status);
+}
+
+// =================================================================================================
+
 // C++11 version of two 'CUevent' pointers
 class Event {
  public:
@@ -319,6 +361,18 @@ class Program {
     }
   }
 
+  // As above, but returns immediately with a future of the build status. NVRTC has no completion
+  // callback, so this compiles on a separate thread. The thread holds a copy of this object, so it
+  // may go out of scope before the build completes. Don't build the same program twice at the same
+  // time.
+  std::future<BuildStatus> BuildAsync(const Device &device, std::vector<std::string> &options) {
+    auto program = *this;
+    auto options_copy = options;
+    return std::async(std::launch::async, [program, device, options_copy]() mutable {
+      return program.Build(device, options_copy);
+    });
+  }
+
   // Retrieves the warning/error message from the compiler (if any)
   std::string GetBuildInfo(const Device &) const {
     if (from_binary_) { return std::string{}; }
@@ -457,14 +511,18 @@ class Buffer {
     Buffer(context, BufferAccess::kReadWrite, static_cast<size_t>(end - start)) {
     auto size = static_cast<size_t>(end - start);
     auto pointer = &*start;
-    CheckError(cuMemcpyHtoDAsync(*buffer_, pointer, size*sizeof(T), queue()));
+    TraceCommand(queue(), "Buffer::Buffer", "upload", [&]() {
+      return cuMemcpyHtoDAsync(*buffer_, pointer, size*sizeof(T), queue());
+    });
     queue.Finish();
   }
 
   // Copies from device to host: reading the device buffer a-synchronously
   void ReadAsync(const Queue &queue, const size_t size, T* host, const size_t offset = 0) const {
     if (access_ == BufferAccess::kWriteOnly) { Error("reading from a write-only buffer"); }
-    CheckError(cuMemcpyDtoHAsync(host, *buffer_ + offset*sizeof(T), size*sizeof(T), queue()));
+    TraceCommand(queue(), "Buffer::ReadAsync", "download", [&]() {
+      return cuMemcpyDtoHAsync(host, *buffer_ + offset*sizeof(T), size*sizeof(T), queue());
+    });
   }
   void ReadAsync(const Queue &queue, const size_t size, std::vector<T> &host,
                  const size_t offset = 0) const {
@@ -495,7 +553,9 @@ class Buffer {
   void WriteAsync(const Queue &queue, const size_t size, const T* host, const size_t offset = 0) {
     if (access_ == BufferAccess::kReadOnly) { Error("writing to a read-only buffer"); }
     if (GetSize() < (offset+size)*sizeof(T)) { Error("target device buffer is too small"); }
-    CheckError(cuMemcpyHtoDAsync(*buffer_ + offset*sizeof(T), host, size*sizeof(T), queue()));
+    TraceCommand(queue(), "Buffer::WriteAsync", "upload", [&]() {
+      return cuMemcpyHtoDAsync(*buffer_ + offset*sizeof(T), host, size*sizeof(T), queue());
+    });
   }
   void WriteAsync(const Queue &queue, const size_t size, const std::vector<T> &host,
                   const size_t offset = 0) {
@@ -520,9 +580,35 @@ class Buffer {
     Write(queue, size, host.data(), offset);
   }
 
+  // Copies a list of (offset, size) byte ranges from host to device, at the same offsets: one
+  // copy per range, all a-synchronous. Meant for uploading only the modified parts of a buffer.
+  void WriteRangesAsync(const Queue &queue, const T* host,
+                        const std::vector<std::pair<size_t, size_t>> &ranges) {
+    if (access_ == BufferAccess::kReadOnly) { Error("writing to a read-only buffer"); }
+    const auto buffer_size = GetSize();
+    const auto bytes = reinterpret_cast<const char*>(host);
+    for (const auto &range : ranges) {
+      if (buffer_size < range.first + range.second) { Error("target device buffer is too small"); }
+    }
+    for (const auto &range : ranges) {
+      if (range.second == 0) { continue; }
+      TraceCommand(queue(), "Buffer::WriteRangesAsync", "upload", [&]() {
+        return cuMemcpyHtoDAsync(*buffer_ + range.first, bytes + range.first, range.second,
+                                 queue());
+      });
+    }
+  }
+  void WriteRanges(const Queue &queue, const T* host,
+                   const std::vector<std::pair<size_t, size_t>> &ranges) {
+    WriteRangesAsync(queue, host, ranges);
+    queue.Finish();
+  }
+
   // Copies the contents of this buffer into another device buffer
   void CopyToAsync(const Queue &queue, const size_t size, const Buffer<T> &destination) const {
-    CheckError(cuMemcpyDtoDAsync(destination(), *buffer_, size*sizeof(T), queue()));
+    TraceCommand(queue(), "Buffer::CopyToAsync", "copy", [&]() {
+      return cuMemcpyDtoDAsync(destination(), *buffer_, size*sizeof(T), queue());
+    });
   }
   void CopyTo(const Queue &queue, const size_t size, const Buffer<T> &destination) const {
     CopyToAsync(queue, size, destination);
@@ -557,20 +643,30 @@ class Kernel {
   }
 
   // Regular constructor with memory management
-  explicit Kernel(const Program &program, const std::string &name) {
+  explicit Kernel(const Program &program, const std::string &name):
+    name_(name) {
     CheckError(cuModuleLoadDataEx(&module_, program.GetIR().data(), 0, nullptr, nullptr));
     CheckError(cuModuleGetFunction(&kernel_, module_, name.c_str()));
   }
 
   // Sets a kernel argument at the indicated position. This stores both the value of the argument
   // (as raw bytes) and the index indicating where this value can be found.
+  // Setting an argument again with a value of the same size overwrites it in place.
   template <typename T>
   void SetArgument(const size_t index, const T &value) {
-    if (index >= arguments_indices_.size()) { arguments_indices_.resize(index+1); }
-    arguments_indices_[index] = arguments_data_.size();
-    for (auto j=size_t(0); j<sizeof(T); ++j) {
-      arguments_data_.push_back(reinterpret_cast<const char*>(&value)[j]);
+    const auto bytes = reinterpret_cast<const char*>(&value);
+    if (index < arguments_indices_.size() && arguments_sizes_[index] == sizeof(T)) {
+      std::copy(bytes, bytes + sizeof(T), arguments_data_.begin() + arguments_indices_[index]);
+      return;
     }
+    if (index >= arguments_indices_.size()) {
+      arguments_indices_.resize(index+1);
+      arguments_sizes_.resize(index+1);
+    }
+    arguments_indices_[index] = arguments_data_.size();
+    arguments_sizes_[index] = sizeof(T);
+    arguments_data_.insert(arguments_data_.end(), bytes, bytes + sizeof(T));
+    arguments_pointers_.clear(); // The data may have moved
   }
   template <typename T>
   void SetArgument(const size_t index, Buffer<T> &value) {
@@ -582,7 +678,9 @@ class Kernel {
   template <typename... Args>
   void SetArguments(Args&... args) {
     arguments_indices_.clear();
+    arguments_sizes_.clear();
     arguments_data_.clear();
+    arguments_pointers_.clear();
     SetArgumentsRecursive(0, args...);
   }
 
@@ -596,7 +694,8 @@ class Kernel {
 
   // Retrieves the name of the kernel
   std::string GetFunctionName() const {
-    return std::string{"unknown"}; // Not implemented for the CUDA backend
+    if (name_.empty()) { return std::string{"unknown"}; } // Constructed from a 'CUfunction'
+    return name_;
   }
 
   // Launches a kernel onto the specified queue
@@ -604,22 +703,30 @@ class Kernel {
               const std::vector<size_t> &local, EventPointer event) {
 
     // Creates the grid (number of threadblocks) and sets the block sizes (threads per block)
-    auto grid = std::vector<size_t>{1, 1, 1};
-    auto block = std::vector<size_t>{1, 1, 1};
-    if (global.size() != local.size()) { Error("invalid thread/workgroup dimensions"); }
+    size_t grid[3] = {1, 1, 1};
+    size_t block[3] = {1, 1, 1};
+    if (global.size() != local.size() || local.size() > 3) { Error("invalid thread/workgroup dimensions"); }
     for (auto i=size_t{0}; i<local.size(); ++i) { grid[i] = global[i]/local[i]; }
     for (auto i=size_t{0}; i<local.size(); ++i) { block[i] = local[i]; }
 
-    // Creates the array of pointers from the arrays of indices & data
-    std::vector<void*> pointers;
-    for (auto &index: arguments_indices_) {
-      pointers.push_back(&arguments_data_[index]);
+    // Creates the array of pointers from the arrays of indices & data. This is only redone after
+    // the arguments changed layout (or this kernel object was copied), so launching again with
+    // updated values allocates nothing.
+    if (arguments_pointers_.size() != arguments_indices_.size() ||
+        (!arguments_pointers_.empty() &&
+         arguments_pointers_[0] != &arguments_data_[arguments_indices_[0]])) {
+      arguments_pointers_.clear();
+      for (auto &index: arguments_indices_) {
+        arguments_pointers_.push_back(&arguments_data_[index]);
+      }
     }
 
     // Launches the kernel, its execution time is recorded by events
     CheckError(cuEventRecord(event->start(), queue()));
-    CheckError(cuLaunchKernel(kernel_, grid[0], grid[1], grid[2], block[0], block[1], block[2],
-                              0, queue(), pointers.data(), nullptr));
+    TraceCommand(queue(), name_.empty() ? "unknown" : name_.c_str(), "kernel", [&]() {
+      return cuLaunchKernel(kernel_, grid[0], grid[1], grid[2], block[0], block[1], block[2],
+                            0, queue(), arguments_pointers_.data(), nullptr);
+    });
     CheckError(cuEventRecord(event->end(), queue()));
   }
 
@@ -645,8 +752,11 @@ class Kernel {
  private:
   CUmodule module_;
   CUfunction kernel_;
+  std::string name_; // Empty when constructed from a 'CUfunction'
   std::vector<size_t> arguments_indices_; // Indices of the arguments
+  std::vector<size_t> arguments_sizes_; // Sizes of the arguments in bytes
   std::vector<char> arguments_data_; // The arguments data as raw bytes
+  std::vector<void*> arguments_pointers_; // Pointers into the data, as passed to cuLaunchKernel
 
   // Internal implementation for the recursive SetArguments function.
   template <typename T>
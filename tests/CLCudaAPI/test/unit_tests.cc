@@ -260,6 +260,14 @@ SCENARIO("programs can be created and used", "[Program][Context][Device][Platfor
         REQUIRE(new_build_result == CLCudaAPI::BuildStatus::kSuccess);
       }
     }
+    WHEN("another program is built asynchronously") {
+      auto async_program = CLCudaAPI::Program(context, source);
+      auto future = async_program.BuildAsync(device, options);
+      THEN("the future holds the build status") {
+        REQUIRE(future.get() == CLCudaAPI::BuildStatus::kSuccess);
+        REQUIRE(async_program.GetIR().size() > 0);
+      }
+    }
   }
 }
 
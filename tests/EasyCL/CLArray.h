@@ -1,6 +1,7 @@
 #pragma once
 
 #include "EasyCL_export.h"
+#include "CLTrace.h"
 
 namespace easycl {
 
@@ -61,8 +62,14 @@ public:
             allocateHostArray(N);
             onHost = true;                
         }
-        error = clEnqueueReadBuffer(*(cl->queue), devicearray, CL_TRUE, 0, getElementSize() * N, getHostArray(), 0, NULL, NULL);    
+        cl_event event = NULL;
+        bool traced = CLTrace::isEnabled();
+        error = clEnqueueReadBuffer(*(cl->queue), devicearray, CL_TRUE, 0, getElementSize() * N, getHostArray(), 0, NULL, traced ? &event : NULL);    
         cl->checkError(error);
+        if(traced) {
+            CLTrace::addCommand("CLArray::copyToHost", "download", *(cl->queue), event);
+            clReleaseEvent(event);
+        }
     }
     void deleteFromHost(){
         assert(onHost);
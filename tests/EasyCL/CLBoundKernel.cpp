@@ -0,0 +1,227 @@
+// Copyright Hugh Perkins 2013, 2014, 2015, 2016, 2017 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, 
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can 
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <cstring>
+#include <stdexcept>
+using namespace std;
+
+#include "EasyCL.h"
+#include "CLBoundKernel.h"
+#include "CLCoherentBuffer.h"
+
+namespace easycl {
+
+CLBoundKernel::CLBoundKernel(CLKernel *kernel) :
+        cl(kernel->cl),
+        clkernel(kernel),
+        numSetArgCalls(0),
+        numLaunches(0) {
+    cl_uint numArgs = 0;
+    cl->checkError(clGetKernelInfo(kernel->kernel, CL_KERNEL_NUM_ARGS, sizeof(numArgs), &numArgs, 0));
+    Slot empty;
+    memset(&empty, 0, sizeof(empty));
+    slots.resize(numArgs, empty);
+    numUnset = (int)numArgs;
+}
+CLBoundKernel::~CLBoundKernel() {
+    if(clkernel->argsOwner == this) {
+        clkernel->argsOwner = 0;
+    }
+}
+int CLBoundKernel::getNumArgs() {
+    return (int)slots.size();
+}
+void CLBoundKernel::setSlot(int index, size_t size, const void *value, bool isLocal, CLWrapper *wrapperToDirty) {
+    if(index < 0 || index >= (int)slots.size()) {
+        throw runtime_error("CLBoundKernel: argument index " + EasyCL::toString(index) + " out of range, kernel " +
+            clkernel->kernelName + " has " + EasyCL::toString(slots.size()) + " arguments");
+    }
+    Slot &slot = slots[index];
+    slot.wrapperToDirty = wrapperToDirty;
+    slot.coherent = 0;
+    if(slot.isSet && slot.isLocal == isLocal && slot.size == size &&
+            (isLocal || memcmp(slot.value, value, size) == 0)) {
+        return;
+    }
+    if(!slot.isSet) {
+        numUnset--;
+    }
+    slot.isSet = true;
+    slot.changed = true;
+    slot.isLocal = isLocal;
+    slot.size = size;
+    if(!isLocal) {
+        memcpy(slot.value, value, size);
+    }
+}
+CLBoundKernel *CLBoundKernel::input(int index, CLWrapper *wrapper) {
+    assert(wrapper != 0);
+    if(!wrapper->isOnDevice()) {
+        throw std::runtime_error("need to copyToDevice() before calling kernel->input");
+    }
+    setSlot(index, sizeof(cl_mem), wrapper->getDeviceArray(), false, 0);
+    return this;
+}
+CLBoundKernel *CLBoundKernel::output(int index, CLWrapper *wrapper) {
+    assert(wrapper != 0);
+    if(!wrapper->isOnDevice()) {
+        wrapper->createOnDevice();
+    }
+    setSlot(index, sizeof(cl_mem), wrapper->getDeviceArray(), false, wrapper);
+    return this;
+}
+CLBoundKernel *CLBoundKernel::inout(int index, CLWrapper *wrapper) {
+    assert(wrapper != 0);
+    if(!wrapper->isOnDevice()) {
+        throw std::runtime_error("need to copyToDevice() before calling kernel->input");
+    }
+    setSlot(index, sizeof(cl_mem), wrapper->getDeviceArray(), false, wrapper);
+    return this;
+}
+void CLBoundKernel::setCoherentSlot(int index, CLCoherentBuffer *buffer, bool read, bool write) {
+    assert(buffer != 0);
+    CLWrapper *wrapper = buffer->getWrapper();
+    if(!wrapper->isOnDevice()) {
+        wrapper->createOnDevice();
+    }
+    setSlot(index, sizeof(cl_mem), wrapper->getDeviceArray(), false, 0);
+    slots[index].coherent = buffer;
+    slots[index].coherentRead = read;
+    slots[index].coherentWrite = write;
+}
+CLBoundKernel *CLBoundKernel::input(int index, CLCoherentBuffer *buffer) {
+    setCoherentSlot(index, buffer, true, false);
+    return this;
+}
+CLBoundKernel *CLBoundKernel::output(int index, CLCoherentBuffer *buffer) {
+    setCoherentSlot(index, buffer, false, true);
+    return this;
+}
+CLBoundKernel *CLBoundKernel::inout(int index, CLCoherentBuffer *buffer) {
+    setCoherentSlot(index, buffer, true, true);
+    return this;
+}
+CLBoundKernel *CLBoundKernel::inout(int index, cl_mem *buf) {
+    setSlot(index, sizeof(cl_mem), buf, false, 0);
+    return this;
+}
+CLBoundKernel *CLBoundKernel::in_nullptr(int index) {
+    cl_mem null = 0;
+    setSlot(index, sizeof(cl_mem), &null, false, 0);
+    return this;
+}
+CLBoundKernel *CLBoundKernel::localFloats(int index, int count) {
+    setSlot(index, count * sizeof(cl_float), 0, true, 0);
+    return this;
+}
+CLBoundKernel *CLBoundKernel::localInts(int index, int count) {
+    setSlot(index, count * sizeof(cl_int), 0, true, 0);
+    return this;
+}
+CLBoundKernel *CLBoundKernel::in_int64(int index, int64_t value) {
+    setSlot(index, sizeof(value), &value, false, 0);
+    return this;
+}
+CLBoundKernel *CLBoundKernel::in_int32(int index, int32_t value) {
+    setSlot(index, sizeof(value), &value, false, 0);
+    return this;
+}
+CLBoundKernel *CLBoundKernel::in_uint64(int index, uint64_t value) {
+    setSlot(index, sizeof(value), &value, false, 0);
+    return this;
+}
+CLBoundKernel *CLBoundKernel::in_uint32(int index, uint32_t value) {
+    setSlot(index, sizeof(value), &value, false, 0);
+    return this;
+}
+CLBoundKernel *CLBoundKernel::in_char(int index, char value) {
+    setSlot(index, sizeof(value), &value, false, 0);
+    return this;
+}
+CLBoundKernel *CLBoundKernel::in_float(int index, float value) {
+    setSlot(index, sizeof(value), &value, false, 0);
+    return this;
+}
+// passes changed arguments to clSetKernelArg; all of them if the CLKernel, or
+// another binding, has set arguments since our last run
+void CLBoundKernel::applyArgs() {
+    if(numUnset > 0) {
+        for(int i = 0; i < (int)slots.size(); i++) {
+            if(!slots[i].isSet) {
+                throw runtime_error("CLBoundKernel: argument " + EasyCL::toString(i) + " of kernel " +
+                    clkernel->kernelName + " not set");
+            }
+        }
+    }
+    bool setAll = clkernel->argsOwner != this;
+    for(int i = 0; i < (int)slots.size(); i++) {
+        Slot &slot = slots[i];
+        if(!setAll && !slot.changed) {
+            continue;
+        }
+        cl_int error = clSetKernelArg(clkernel->kernel, i, slot.size, slot.isLocal ? 0 : slot.value);
+        cl->checkError(error);
+        slot.changed = false;
+        numSetArgCalls++;
+    }
+    clkernel->argsOwner = this;
+}
+void CLBoundKernel::launch(cl_command_queue *queue, int ND, const size_t *global_ws, const size_t *local_ws, bool wait) {
+    applyArgs();
+    for(int i = 0; i < (int)slots.size(); i++) {
+        if(slots[i].coherent != 0 && slots[i].coherentRead) {
+            slots[i].coherent->deviceRead();
+        }
+    }
+    cl_event event = clkernel->enqueue(queue, ND, global_ws, local_ws, wait);
+    numLaunches++;
+    for(int i = 0; i < (int)slots.size(); i++) {
+        if(slots[i].wrapperToDirty != 0) {
+            slots[i].wrapperToDirty->markDeviceDirty();
+        }
+        if(slots[i].coherent != 0 && slots[i].coherentWrite) {
+            slots[i].coherent->deviceWrote();
+        }
+    }
+    if(wait) {
+        cl_int error = clWaitForEvents(1, &event);
+        clReleaseEvent(event);
+        cl->checkError(error);
+    }
+}
+void CLBoundKernel::run_1d(int global_worksize, int local_worksize) {
+    size_t global_ws = global_worksize;
+    size_t local_ws = local_worksize;
+    launch(cl->queue, 1, &global_ws, &local_ws, true);
+}
+void CLBoundKernel::run_1d(CLQueue *queue, int global_worksize, int local_worksize) {
+    size_t global_ws = global_worksize;
+    size_t local_ws = local_worksize;
+    launch(&queue->queue, 1, &global_ws, &local_ws, true);
+}
+void CLBoundKernel::run(int ND, const size_t *global_ws, const size_t *local_ws) {
+    launch(cl->queue, ND, global_ws, local_ws, true);
+}
+void CLBoundKernel::run(CLQueue *queue, int ND, const size_t *global_ws, const size_t *local_ws) {
+    launch(&queue->queue, ND, global_ws, local_ws, true);
+}
+void CLBoundKernel::enqueue_1d(int global_worksize, int local_worksize) {
+    size_t global_ws = global_worksize;
+    size_t local_ws = local_worksize;
+    launch(cl->queue, 1, &global_ws, &local_ws, false);
+}
+void CLBoundKernel::enqueue_1d(CLQueue *queue, int global_worksize, int local_worksize) {
+    size_t global_ws = global_worksize;
+    size_t local_ws = local_worksize;
+    launch(&queue->queue, 1, &global_ws, &local_ws, false);
+}
+void CLBoundKernel::enqueue(int ND, const size_t *global_ws, const size_t *local_ws) {
+    launch(cl->queue, ND, global_ws, local_ws, false);
+}
+void CLBoundKernel::enqueue(CLQueue *queue, int ND, const size_t *global_ws, const size_t *local_ws) {
+    launch(&queue->queue, ND, global_ws, local_ws, false);
+}
+}
@@ -0,0 +1,129 @@
+// Copyright Hugh Perkins 2013, 2014, 2015, 2016, 2017 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, 
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can 
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+
+#pragma once
+
+#include <vector>
+
+#include "EasyCL_export.h"
+
+#include "mystdint.h"
+
+namespace easycl {
+
+class EasyCL;
+class CLKernel;
+class CLQueue;
+class CLWrapper;
+class CLCoherentBuffer;
+
+// For kernels that run many times with mostly the same arguments.  CLKernel
+// forgets its arguments after each run, so they have to be passed again,
+// every time.  A CLBoundKernel keeps them: set each argument once, by index,
+// then run as often as you like, changing only the arguments that change.
+//
+// Setting an argument to the value it already has does nothing, and running
+// only calls clSetKernelArg for arguments that changed since the last run,
+// so a launch does no host allocation, and no redundant clSetKernelArg.
+//
+//   CLBoundKernel bound(kernel);
+//   bound.in_int32(0, N)->inout(1, wrapper)->in_float(2, 0.0f);
+//   for(int it = 0; it < 1000; it++) {
+//       bound.in_float(2, it * 0.1f)->enqueue_1d(N, 64);
+//   }
+//   cl->finish();
+//
+// There is no host copy for `out` arguments, so only CLWrappers and cl_mems
+// can be bound; use CLKernel::out(N, data) for the one-off style
+//
+// The CLKernel is still usable as normal; the bound arguments are set again
+// in full on the next run after the CLKernel, or another CLBoundKernel of
+// the same CLKernel, has run.  Dont run a CLBoundKernel in the middle of
+// passing arguments to the CLKernel itself though
+class EasyCL_EXPORT CLBoundKernel {
+    EasyCL *cl; // NOT owned by this object
+    CLKernel *clkernel; // NOT owned by this object
+
+    struct Slot {
+        bool isSet;
+        bool changed; // not yet passed to clSetKernelArg
+        bool isLocal; // local memory of `size` bytes, no value
+        size_t size;
+        unsigned char value[8];
+        CLWrapper *wrapperToDirty; // for inout and out wrappers, else 0
+        CLCoherentBuffer *coherent; // 0 unless bound to a coherent buffer
+        bool coherentRead; // input, inout
+        bool coherentWrite; // output, inout
+    };
+#ifdef _WIN32
+#pragma warning(disable: 4251)
+#endif
+    std::vector<Slot> slots; // one per kernel argument
+#ifdef _WIN32
+#pragma warning(default: 4251)
+#endif
+    int numUnset;
+    int64_t numSetArgCalls;
+    int64_t numLaunches;
+
+    void setSlot(int index, size_t size, const void *value, bool isLocal, CLWrapper *wrapperToDirty);
+    void setCoherentSlot(int index, CLCoherentBuffer *buffer, bool read, bool write);
+    void applyArgs();
+    void launch(cl_command_queue *queue, int ND, const size_t *global_ws, const size_t *local_ws, bool wait);
+
+    CLBoundKernel(const CLBoundKernel &);
+    CLBoundKernel &operator=(const CLBoundKernel &);
+
+public:
+    CLBoundKernel(CLKernel *kernel); // kernel must outlive this object
+    ~CLBoundKernel();
+
+    int getNumArgs();
+
+    CLBoundKernel *input(int index, CLWrapper *wrapper); // wrapper must be on the device already
+    CLBoundKernel *output(int index, CLWrapper *wrapper); // marked dirty on each run
+    CLBoundKernel *inout(int index, CLWrapper *wrapper); // marked dirty on each run
+    CLBoundKernel *in(int index, CLWrapper *wrapper) { return input(index, wrapper); }
+    CLBoundKernel *out(int index, CLWrapper *wrapper) { return output(index, wrapper); }
+    // before each run, copies only what is stale on the device; `out` and
+    // `inout` mark the device copy newest after it
+    CLBoundKernel *input(int index, CLCoherentBuffer *buffer);
+    CLBoundKernel *output(int index, CLCoherentBuffer *buffer);
+    CLBoundKernel *inout(int index, CLCoherentBuffer *buffer);
+    CLBoundKernel *in(int index, CLCoherentBuffer *buffer) { return input(index, buffer); }
+    CLBoundKernel *out(int index, CLCoherentBuffer *buffer) { return output(index, buffer); }
+    CLBoundKernel *inout(int index, cl_mem *buf);
+    CLBoundKernel *in_nullptr(int index);
+
+    CLBoundKernel *localFloats(int index, int count);
+    CLBoundKernel *localInts(int index, int count);
+
+    CLBoundKernel *in_int64(int index, int64_t value);
+    CLBoundKernel *in_int32(int index, int32_t value);
+    CLBoundKernel *in_uint64(int index, uint64_t value);
+    CLBoundKernel *in_uint32(int index, uint32_t value);
+    CLBoundKernel *in_char(int index, char value);
+    CLBoundKernel *in_float(int index, float value);
+
+    // blocks until the kernel has finished, like CLKernel::run
+    void run_1d(int global_worksize, int local_worksize);
+    void run_1d(CLQueue *queue, int global_worksize, int local_worksize);
+    void run(int ND, const size_t *global_ws, const size_t *local_ws);
+    void run(CLQueue *queue, int ND, const size_t *global_ws, const size_t *local_ws);
+
+    // doesnt wait; the queue keeps launches in order.  Call cl->finish(), or
+    // clFinish() on the queue, before reading results
+    void enqueue_1d(int global_worksize, int local_worksize);
+    void enqueue_1d(CLQueue *queue, int global_worksize, int local_worksize);
+    void enqueue(int ND, const size_t *global_ws, const size_t *local_ws);
+    void enqueue(CLQueue *queue, int ND, const size_t *global_ws, const size_t *local_ws);
+
+    // how many times clSetKernelArg was called, and how many runs, so far
+    int64_t getNumSetArgCalls() { return numSetArgCalls; }
+    int64_t getNumLaunches() { return numLaunches; }
+};
+}
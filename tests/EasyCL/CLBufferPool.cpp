@@ -0,0 +1,191 @@
+// Copyright Hugh Perkins 2013, 2014, 2015, 2016, 2017 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, 
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can 
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <stdexcept>
+using namespace std;
+
+#include "EasyCL.h"
+#include "CLBufferPool.h"
+
+namespace easycl {
+
+const size_t CLBufferPool::MIN_BUCKET_BYTES;
+
+CLBufferPool::CLBufferPool(EasyCL *cl, size_t maxPooledBytes) :
+        cl(cl),
+        maxPooledBytes(maxPooledBytes),
+        pooledBytes(0),
+        inUseBytes(0),
+        highWaterMarkBytes(0),
+        hits(0),
+        misses(0) {
+}
+CLBufferPool::~CLBufferPool() {
+    clear();
+    // buffers still handed out are owned by whoever has them; just forget them
+}
+size_t CLBufferPool::getBucketSize(size_t bytes) {
+    size_t size = MIN_BUCKET_BYTES;
+    while(size < bytes) {
+        size <<= 1;
+    }
+    return size;
+}
+cl_mem CLBufferPool::acquire(size_t bytes, cl_mem_flags flags) {
+    if((flags & (CL_MEM_COPY_HOST_PTR | CL_MEM_USE_HOST_PTR)) != 0) {
+        throw runtime_error("CLBufferPool::acquire: host pointer flags cannot be pooled");
+    }
+    BucketKey key(static_cast<uint64_t>(flags), getBucketSize(bytes));
+    cl_mem buffer = 0;
+    cl_event event = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        map< BucketKey, vector<Entry> >::iterator it = freeByBucket.find(key);
+        if(it != freeByBucket.end() && it->second.size() > 0) {
+            vector<Entry> &entries = it->second;
+            // only take a buffer whose last user has finished; waiting here
+            // would serialize async runs
+            for(size_t i = 0; i < entries.size(); i++) {
+                cl_int status = CL_COMPLETE;
+                if(entries[i].event != 0) {
+                    clGetEventInfo(entries[i].event, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, 0);
+                }
+                if(status == CL_COMPLETE) {
+                    buffer = entries[i].buffer;
+                    event = entries[i].event;
+                    entries.erase(entries.begin() + i);
+                    pooledBytes -= key.second;
+                    break;
+                }
+            }
+        }
+        if(buffer != 0) {
+            hits++;
+        } else {
+            misses++;
+        }
+        if(buffer != 0) {
+            inUseBytes += key.second;
+            bucketByBuffer[buffer] = key;
+        }
+    }
+    if(event != 0) {
+        clReleaseEvent(event);
+    }
+    if(buffer != 0) {
+        return buffer;
+    }
+
+    // make room for the new buffer under maxPooledBytes
+    size_t budget;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        budget = idleBudget(key.second);
+    }
+    trim(budget);
+
+    cl_int error;
+    buffer = clCreateBuffer(*(cl->context), flags, key.second, 0, &error);
+    if(error == CL_MEM_OBJECT_ALLOCATION_FAILURE || error == CL_OUT_OF_RESOURCES) {
+        // give back idle memory, and try once more
+        clear();
+        buffer = clCreateBuffer(*(cl->context), flags, key.second, 0, &error);
+    }
+    cl->checkError(error);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    inUseBytes += key.second;
+    bucketByBuffer[buffer] = key;
+    highWaterMarkBytes = std::max(highWaterMarkBytes, inUseBytes + pooledBytes);
+    return buffer;
+}
+void CLBufferPool::release(cl_mem buffer, cl_event event) {
+    std::unique_lock<std::mutex> lock(mutex);
+    map< cl_mem, BucketKey >::iterator it = bucketByBuffer.find(buffer);
+    if(it == bucketByBuffer.end()) {
+        throw runtime_error("CLBufferPool::release: buffer was not acquired from this pool");
+    }
+    BucketKey key = it->second;
+    bucketByBuffer.erase(it);
+    inUseBytes -= key.second;
+
+    if(pooledBytes + key.second > idleBudget(0)) {
+        lock.unlock();
+        // clReleaseMemObject defers the actual free until queued commands using it are done
+        clReleaseMemObject(buffer);
+        return;
+    }
+    if(event != 0) {
+        clRetainEvent(event);
+    }
+    Entry entry;
+    entry.buffer = buffer;
+    entry.event = event;
+    freeByBucket[key].push_back(entry);
+    pooledBytes += key.second;
+}
+void CLBufferPool::trim(size_t targetBytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for(map< BucketKey, vector<Entry> >::iterator it = freeByBucket.begin(); it != freeByBucket.end() && pooledBytes > targetBytes; it++) {
+        vector<Entry> &entries = it->second;
+        while(entries.size() > 0 && pooledBytes > targetBytes) {
+            Entry &entry = entries.back();
+            if(entry.event != 0) {
+                clReleaseEvent(entry.event);
+            }
+            clReleaseMemObject(entry.buffer);
+            pooledBytes -= it->first.second;
+            entries.pop_back();
+        }
+    }
+}
+size_t CLBufferPool::idleBudget(size_t newBytes) const {
+    size_t used = inUseBytes + newBytes;
+    return used < maxPooledBytes ? maxPooledBytes - used : 0;
+}
+void CLBufferPool::clear() {
+    trim(0);
+}
+void CLBufferPool::setMaxPooledBytes(size_t maxPooledBytes) {
+    size_t budget;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        this->maxPooledBytes = maxPooledBytes;
+        budget = idleBudget(0);
+    }
+    trim(budget);
+}
+size_t CLBufferPool::getMaxPooledBytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return maxPooledBytes;
+}
+int64_t CLBufferPool::getHits() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return hits;
+}
+int64_t CLBufferPool::getMisses() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return misses;
+}
+size_t CLBufferPool::getPooledBytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return pooledBytes;
+}
+size_t CLBufferPool::getInUseBytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return inUseBytes;
+}
+size_t CLBufferPool::getHighWaterMarkBytes() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return highWaterMarkBytes;
+}
+void CLBufferPool::resetStats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    hits = 0;
+    misses = 0;
+    highWaterMarkBytes = inUseBytes + pooledBytes;
+}
+}
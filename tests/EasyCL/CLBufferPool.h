@@ -0,0 +1,95 @@
+// Copyright Hugh Perkins 2013, 2014, 2015, 2016, 2017 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, 
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can 
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "EasyCL_export.h"
+
+#include "mystdint.h"
+
+namespace easycl {
+
+class EasyCL;
+
+// Pool of cl_mem buffers, so that CLKernel::input/output/inout(int N, T *data)
+// dont need to call clCreateBuffer/clReleaseMemObject on every launch.
+//
+// Buffers are bucketed by (flags, size rounded up to a power of 2). A buffer
+// released with an event is only handed out again after that event has
+// completed, so buffers still in use by a queued kernel arent overwritten.
+// If no idle buffer in the bucket has completed yet, a new one is created.
+//
+// `maxPooledBytes` bounds everything the pool owns, idle plus in use. A new
+// allocation first frees idle buffers to stay under it, and a released buffer
+// that would go over it is freed immediately. Buffers in use are never taken
+// back, so acquire() still allocates when they alone exceed the limit.
+//
+// Owned by the EasyCL object, see EasyCL::getBufferPool()
+class EasyCL_EXPORT CLBufferPool {
+public:
+    static const size_t MIN_BUCKET_BYTES = 256;
+
+    CLBufferPool(EasyCL *cl, size_t maxPooledBytes = 256 * 1024 * 1024);
+    ~CLBufferPool();
+
+    // flags must not contain CL_MEM_COPY_HOST_PTR or CL_MEM_USE_HOST_PTR
+    cl_mem acquire(size_t bytes, cl_mem_flags flags);
+    // if event is non-zero, the pool retains it, and doesnt hand the buffer
+    // out again until it has completed
+    void release(cl_mem buffer, cl_event event = 0);
+    void clear(); // frees all idle buffers
+
+    void setMaxPooledBytes(size_t maxPooledBytes);
+    size_t getMaxPooledBytes() const;
+
+    static size_t getBucketSize(size_t bytes);
+
+    // statistics
+    int64_t getHits() const;
+    int64_t getMisses() const;
+    size_t getPooledBytes() const; // idle
+    size_t getInUseBytes() const;
+    size_t getHighWaterMarkBytes() const; // peak of idle + in use
+    void resetStats();
+
+private:
+    CLBufferPool(const CLBufferPool &);
+    CLBufferPool &operator=(const CLBufferPool &);
+
+    struct Entry {
+        cl_mem buffer;
+        cl_event event;
+    };
+    typedef std::pair<uint64_t, size_t> BucketKey; // (flags, bucket size)
+
+    void trim(size_t targetBytes); // frees idle buffers until pooledBytes <= targetBytes
+    size_t idleBudget(size_t newBytes) const; // idle bytes allowed besides newBytes more in use; mutex must be held
+
+    EasyCL *cl; // NOT owned by this object
+
+#ifdef _WIN32
+#pragma warning(disable: 4251)
+#endif
+    std::map< BucketKey, std::vector<Entry> > freeByBucket;
+    std::map< cl_mem, BucketKey > bucketByBuffer; // buffers handed out
+    mutable std::mutex mutex;
+#ifdef _WIN32
+#pragma warning(default: 4251)
+#endif
+
+    size_t maxPooledBytes;
+    size_t pooledBytes;
+    size_t inUseBytes;
+    size_t highWaterMarkBytes;
+    int64_t hits;
+    int64_t misses;
+};
+}
@@ -0,0 +1,80 @@
+// Copyright Hugh Perkins 2013, 2014, 2015, 2016, 2017 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, 
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can 
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include "CLBuildQueue.h"
+#include "util/Profiler.h"
+
+using namespace std;
+
+namespace easycl {
+
+CLBuildQueue::CLBuildQueue(int numThreads) :
+        numRunning(0),
+        stopping(false) {
+    if(numThreads <= 0) {
+        numThreads = (int)std::thread::hardware_concurrency();
+    }
+    if(numThreads <= 0) {
+        numThreads = 1;
+    }
+    for(int i = 0; i < numThreads; i++) {
+        workers.push_back(std::thread(&CLBuildQueue::workerLoop, this));
+    }
+}
+CLBuildQueue::~CLBuildQueue() {
+    {
+        unique_lock<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    taskAvailable.notify_all();
+    for(int i = 0; i < (int)workers.size(); i++) {
+        workers[i].join();
+    }
+}
+void CLBuildQueue::push(std::function<void()> task) {
+    {
+        unique_lock<std::mutex> lock(mutex);
+        tasks.push_back(task);
+    }
+    taskAvailable.notify_one();
+}
+void CLBuildQueue::waitAll() {
+    unique_lock<std::mutex> lock(mutex);
+    while(!tasks.empty() || numRunning > 0) {
+        allDone.wait(lock);
+    }
+}
+int CLBuildQueue::getNumThreads() {
+    return (int)workers.size();
+}
+void CLBuildQueue::workerLoop() {
+    Profiler::setThreadName("EasyCL build");
+    while(true) {
+        std::function<void()> task;
+        {
+            unique_lock<std::mutex> lock(mutex);
+            while(tasks.empty() && !stopping) {
+                taskAvailable.wait(lock);
+            }
+            // finish whatever is queued before stopping
+            if(tasks.empty()) {
+                return;
+            }
+            task = tasks.front();
+            tasks.pop_front();
+            numRunning++;
+        }
+        task(); // tasks catch their own exceptions
+        {
+            unique_lock<std::mutex> lock(mutex);
+            numRunning--;
+            if(tasks.empty() && numRunning == 0) {
+                allDone.notify_all();
+            }
+        }
+    }
+}
+}
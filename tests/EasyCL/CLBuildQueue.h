@@ -0,0 +1,53 @@
+// Copyright Hugh Perkins 2013, 2014, 2015, 2016, 2017 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, 
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can 
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "EasyCL_export.h"
+
+namespace easycl {
+
+// Small fixed-size thread pool, used by EasyCL::buildProgramAsync to run
+// clBuildProgram calls in parallel.  Tasks run in the order they are pushed.
+//
+// Owned by the EasyCL object.  Deleting it waits for queued tasks to finish
+class EasyCL_EXPORT CLBuildQueue {
+public:
+    CLBuildQueue(int numThreads); // 0 means std::thread::hardware_concurrency()
+    ~CLBuildQueue();
+
+    void push(std::function<void()> task);
+    void waitAll(); // blocks until the queue is empty and no task is running
+    int getNumThreads();
+
+private:
+#ifdef _WIN32
+#pragma warning(disable: 4251)
+#endif
+    std::vector<std::thread> workers;
+    std::deque< std::function<void()> > tasks;
+    std::mutex mutex;
+    std::condition_variable taskAvailable;
+    std::condition_variable allDone;
+#ifdef _WIN32
+#pragma warning(default: 4251)
+#endif
+    int numRunning;
+    bool stopping;
+
+    void workerLoop();
+
+    CLBuildQueue(const CLBuildQueue &);
+    CLBuildQueue &operator=(const CLBuildQueue &);
+};
+}
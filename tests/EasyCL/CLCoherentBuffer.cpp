@@ -0,0 +1,257 @@
+// Copyright Hugh Perkins 2013, 2014, 2015, 2016, 2017 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, 
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can 
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <stdexcept>
+using namespace std;
+
+#include "EasyCL.h"
+#include "CLCoherentBuffer.h"
+#include "util/Profiler.h"
+
+namespace easycl {
+
+CLCoherentBuffer::CLCoherentBuffer(CLWrapper *wrapper) {
+    init(wrapper, DEFAULT_CHUNK_BYTES);
+}
+CLCoherentBuffer::CLCoherentBuffer(CLWrapper *wrapper, int chunkBytes) {
+    init(wrapper, chunkBytes);
+}
+void CLCoherentBuffer::init(CLWrapper *wrapper, int chunkBytes) {
+    if(chunkBytes <= 0) {
+        throw runtime_error("CLCoherentBuffer: chunkBytes must be positive, got " + EasyCL::toString(chunkBytes));
+    }
+    this->cl = wrapper->getCl();
+    this->wrapper = wrapper;
+    this->chunkBytes = chunkBytes;
+    numBytes = (int64_t)wrapper->size() * wrapper->getElementSize();
+    numChunks = (int)((numBytes + chunkBytes - 1) / chunkBytes);
+    bool onDevice = wrapper->isOnDevice();
+    bool hostIsValid = !onDevice || !wrapper->isDeviceDirty();
+    hostValid.assign(numChunks, hostIsValid ? 1 : 0);
+    deviceValid.assign(numChunks, onDevice ? 1 : 0);
+    numHostStale = hostIsValid ? 0 : numChunks;
+    numDeviceStale = onDevice ? 0 : numChunks;
+    seenDeviceWrites = wrapper->deviceWrites;
+    resetStats();
+}
+CLCoherentBuffer::~CLCoherentBuffer() {
+}
+CLWrapper *CLCoherentBuffer::getWrapper() {
+    return wrapper;
+}
+void CLCoherentBuffer::hostWrote() {
+    wrote(true, 0, wrapper->size());
+}
+void CLCoherentBuffer::hostWrote(int offset, int count) {
+    wrote(true, offset, count);
+}
+void CLCoherentBuffer::hostRead() {
+    read(true, 0, wrapper->size());
+}
+void CLCoherentBuffer::hostRead(int offset, int count) {
+    read(true, offset, count);
+}
+void CLCoherentBuffer::deviceWrote() {
+    wrote(false, 0, wrapper->size());
+}
+void CLCoherentBuffer::deviceWrote(int offset, int count) {
+    wrote(false, offset, count);
+}
+void CLCoherentBuffer::deviceRead() {
+    read(false, 0, wrapper->size());
+}
+void CLCoherentBuffer::deviceRead(int offset, int count) {
+    read(false, offset, count);
+}
+bool CLCoherentBuffer::isHostValid() {
+    checkWrapperWrites();
+    return numHostStale == 0;
+}
+bool CLCoherentBuffer::isHostValid(int offset, int count) {
+    return isValid(true, offset, count);
+}
+bool CLCoherentBuffer::isDeviceValid() {
+    checkWrapperWrites();
+    return numDeviceStale == 0;
+}
+bool CLCoherentBuffer::isDeviceValid(int offset, int count) {
+    return isValid(false, offset, count);
+}
+int CLCoherentBuffer::getNumChunks() {
+    return numChunks;
+}
+int CLCoherentBuffer::getChunkBytes() {
+    return chunkBytes;
+}
+int64_t CLCoherentBuffer::getBytesToDevice() {
+    return bytesToDevice;
+}
+int64_t CLCoherentBuffer::getBytesToHost() {
+    return bytesToHost;
+}
+int64_t CLCoherentBuffer::getBytesSaved() {
+    return bytesSaved;
+}
+void CLCoherentBuffer::resetStats() {
+    bytesToDevice = 0;
+    bytesToHost = 0;
+    bytesSaved = 0;
+}
+// chunks [firstChunk, endChunk) overlapping elements [offset, offset + count)
+void CLCoherentBuffer::toChunks(int offset, int count, int *firstChunk, int *endChunk) {
+    if(offset < 0 || count < 0 || (int64_t)offset + count > wrapper->size()) {
+        throw runtime_error("CLCoherentBuffer: offset " + EasyCL::toString(offset) + " and count " +
+            EasyCL::toString(count) + " out of bounds, size " + EasyCL::toString(wrapper->size()));
+    }
+    int64_t beginByte = (int64_t)offset * wrapper->getElementSize();
+    int64_t endByte = (int64_t)(offset + count) * wrapper->getElementSize();
+    *firstChunk = (int)(beginByte / chunkBytes);
+    *endChunk = count == 0 ? *firstChunk : (int)((endByte + chunkBytes - 1) / chunkBytes);
+}
+bool CLCoherentBuffer::isValid(bool host, int offset, int count) {
+    checkWrapperWrites();
+    int firstChunk, endChunk;
+    toChunks(offset, count, &firstChunk, &endChunk);
+    vector<unsigned char> &valid = host ? hostValid : deviceValid;
+    for(int chunk = firstChunk; chunk < endChunk; chunk++) {
+        if(!valid[chunk]) {
+            return false;
+        }
+    }
+    return true;
+}
+void CLCoherentBuffer::wrote(bool host, int offset, int count) {
+    checkWrapperWrites();
+    int firstChunk, endChunk;
+    toChunks(offset, count, &firstChunk, &endChunk);
+    if(firstChunk == endChunk) {
+        return;
+    }
+    if(!host && !wrapper->isOnDevice()) {
+        throw runtime_error("CLCoherentBuffer: deviceWrote(), but wrapper not on device");
+    }
+    vector<unsigned char> &valid = host ? hostValid : deviceValid;
+    vector<unsigned char> &otherValid = host ? deviceValid : hostValid;
+    int &numStale = host ? numHostStale : numDeviceStale;
+    int &numOtherStale = host ? numDeviceStale : numHostStale;
+
+    // a chunk only partly written stays partly stale, so it must be valid already
+    int64_t beginByte = (int64_t)offset * wrapper->getElementSize();
+    int64_t endByte = (int64_t)(offset + count) * wrapper->getElementSize();
+    int64_t lastChunkEnd = (int64_t)endChunk * chunkBytes < numBytes ? (int64_t)endChunk * chunkBytes : numBytes;
+    bool firstPartial = beginByte > (int64_t)firstChunk * chunkBytes;
+    bool lastPartial = endByte < lastChunkEnd;
+    if((firstPartial && !valid[firstChunk]) || (lastPartial && !valid[endChunk - 1])) {
+        throw runtime_error(string("CLCoherentBuffer: ") + (host ? "hostWrote" : "deviceWrote") +
+            "() writes part of a chunk that is stale on that side; call " + (host ? "hostRead" : "deviceRead") +
+            "() on the range first");
+    }
+    for(int chunk = firstChunk; chunk < endChunk; chunk++) {
+        if(!valid[chunk]) {
+            valid[chunk] = 1;
+            numStale--;
+        }
+        if(otherValid[chunk]) {
+            otherValid[chunk] = 0;
+            numOtherStale++;
+        }
+    }
+    syncWrapperFlags();
+}
+void CLCoherentBuffer::read(bool host, int offset, int count) {
+    checkWrapperWrites();
+    int firstChunk, endChunk;
+    toChunks(offset, count, &firstChunk, &endChunk);
+    int64_t rangeEnd = (int64_t)endChunk * chunkBytes < numBytes ? (int64_t)endChunk * chunkBytes : numBytes;
+    int64_t rangeBytes = rangeEnd - (int64_t)firstChunk * chunkBytes;
+    if(!host && !wrapper->isOnDevice()) {
+        wrapper->createOnDevice();
+    }
+    if((host ? numHostStale : numDeviceStale) == 0) {
+        bytesSaved += rangeBytes;
+        return;
+    }
+    vector<unsigned char> &valid = host ? hostValid : deviceValid;
+    int &numStale = host ? numHostStale : numDeviceStale;
+
+    // each run of stale chunks is one copy; all but the last dont block, the
+    // queue is in order, so once the last one is done, so are the others
+    int64_t copiedBytes = 0;
+    int runStart = -1;
+    int pendingStart = -1;
+    int pendingEnd = -1;
+    for(int chunk = firstChunk; chunk <= endChunk; chunk++) {
+        bool stale = chunk < endChunk && !valid[chunk];
+        if(stale && runStart < 0) {
+            runStart = chunk;
+        } else if(!stale && runStart >= 0) {
+            if(pendingStart >= 0) {
+                copiedBytes += copyChunks(host, pendingStart, pendingEnd, false);
+            }
+            pendingStart = runStart;
+            pendingEnd = chunk;
+            runStart = -1;
+        }
+    }
+    if(pendingStart >= 0) {
+        copiedBytes += copyChunks(host, pendingStart, pendingEnd, true);
+    }
+    for(int chunk = firstChunk; chunk < endChunk; chunk++) {
+        if(!valid[chunk]) {
+            valid[chunk] = 1;
+            numStale--;
+        }
+    }
+    if(host) {
+        bytesToHost += copiedBytes;
+    } else {
+        bytesToDevice += copiedBytes;
+    }
+    bytesSaved += rangeBytes - copiedBytes;
+    syncWrapperFlags();
+}
+// copies chunks [firstChunk, endChunk) to the host, or to the device; returns bytes copied
+int64_t CLCoherentBuffer::copyChunks(bool toHost, int firstChunk, int endChunk, bool blocking) {
+    EASYCL_PROFILE_ZONE("CLCoherentBuffer::copyChunks");
+    int64_t begin = (int64_t)firstChunk * chunkBytes;
+    int64_t end = (int64_t)endChunk * chunkBytes < numBytes ? (int64_t)endChunk * chunkBytes : numBytes;
+    cl_bool blockingFlag = blocking ? CL_TRUE : CL_FALSE;
+    cl_int error = CL_SUCCESS;
+    cl_event event = NULL;
+    bool traced = CLTrace::isEnabled();
+    if(toHost) {
+        error = clEnqueueReadBuffer(*(cl->queue), wrapper->getBuffer(), blockingFlag, begin, end - begin,
+            (char *)wrapper->getHostArray() + begin, 0, NULL, traced ? &event : NULL);
+    } else {
+        error = clEnqueueWriteBuffer(*(cl->queue), wrapper->getBuffer(), blockingFlag, begin, end - begin,
+            (const char *)wrapper->getHostArrayConst() + begin, 0, NULL, traced ? &event : NULL);
+    }
+    cl->checkError(error);
+    if(traced) {
+        CLTrace::addCommand(toHost ? "CLCoherentBuffer download" : "CLCoherentBuffer upload",
+            toHost ? "download" : "upload", *(cl->queue), event);
+        clReleaseEvent(event);
+    }
+    return end - begin;
+}
+// a kernel that took the wrapper itself wrote all of the device copy; unless
+// it was copied back since, the host copy is stale everywhere
+void CLCoherentBuffer::checkWrapperWrites() {
+    if(wrapper->deviceWrites == seenDeviceWrites) {
+        return;
+    }
+    seenDeviceWrites = wrapper->deviceWrites;
+    bool hostIsValid = !wrapper->isDeviceDirty();
+    hostValid.assign(numChunks, hostIsValid ? 1 : 0);
+    deviceValid.assign(numChunks, 1);
+    numHostStale = hostIsValid ? 0 : numChunks;
+    numDeviceStale = 0;
+}
+// keeps isDeviceDirty() meaningful for code that only knows the wrapper
+void CLCoherentBuffer::syncWrapperFlags() {
+    wrapper->deviceDirty = numHostStale > 0;
+}
+}
@@ -0,0 +1,116 @@
+// Copyright Hugh Perkins 2013, 2014, 2015, 2016, 2017 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, 
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can 
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+
+#pragma once
+
+#include <vector>
+
+#include "EasyCL_export.h"
+
+#include "mystdint.h"
+
+namespace easycl {
+
+class EasyCL;
+class CLWrapper;
+
+// Tracks which parts of a CLWrapper are valid on the host, and which on the
+// device, so you dont need defensive copyToDevice()/copyToHost() calls.
+// Tell it when the host or a kernel writes, and when the host reads; it
+// copies only what is stale on the side about to read it, and only then.
+//
+// Validity is tracked per chunk of `chunkBytes` (1MB by default); a buffer
+// smaller than that is just one chunk.  Adjacent stale chunks are copied in
+// one go.
+//
+//   CLCoherentBuffer coherent(wrapper);
+//   data[3] = 1.0f;
+//   coherent.hostWrote(3, 1);                // only chunk 0 is now stale on the device
+//   kernel->inout(&coherent)->run_1d(N, 64); // uploads chunk 0, then device is newest everywhere
+//   coherent.hostRead(0, 16);                // downloads chunk 0 only
+//
+// Writing part of a chunk that is stale on the writing side would leave the
+// rest of the chunk stale, so hostWrote/deviceWrote throw in that case; call
+// hostRead/deviceRead on the range first.
+//
+// Starts out valid on the host only, or if the wrapper is on the device
+// already, valid on the device, and also on the host unless the wrapper is
+// device-dirty.
+//
+// Kernels may also take the wrapper itself, eg kernel->out(wrapper); the
+// wrapper is then marked device-dirty behind this object's back. That is
+// picked up on the next call, and makes the whole host copy stale.
+class EasyCL_EXPORT CLCoherentBuffer {
+public:
+    static const int DEFAULT_CHUNK_BYTES = 1024 * 1024;
+
+    CLCoherentBuffer(CLWrapper *wrapper); // wrapper must outlive this object
+    CLCoherentBuffer(CLWrapper *wrapper, int chunkBytes);
+    ~CLCoherentBuffer();
+
+    CLWrapper *getWrapper();
+
+    // offset and count are in elements, like CLWrapper::copyTo
+    void hostWrote();
+    void hostWrote(int offset, int count);
+    void hostRead(); // copies anything stale on the host back; blocks
+    void hostRead(int offset, int count);
+    void deviceWrote();
+    void deviceWrote(int offset, int count);
+    void deviceRead(); // copies anything stale on the device across; blocks
+    void deviceRead(int offset, int count);
+
+    bool isHostValid();
+    bool isHostValid(int offset, int count);
+    bool isDeviceValid();
+    bool isDeviceValid(int offset, int count);
+
+    int getNumChunks();
+    int getChunkBytes();
+
+    // statistics, in bytes.  `saved` counts bytes in the chunks asked for by
+    // hostRead/deviceRead that were valid already, so werent copied
+    int64_t getBytesToDevice();
+    int64_t getBytesToHost();
+    int64_t getBytesSaved();
+    void resetStats();
+
+private:
+    CLCoherentBuffer(const CLCoherentBuffer &);
+    CLCoherentBuffer &operator=(const CLCoherentBuffer &);
+
+    void init(CLWrapper *wrapper, int chunkBytes);
+    void toChunks(int offset, int count, int *firstChunk, int *endChunk);
+    void wrote(bool host, int offset, int count);
+    void read(bool host, int offset, int count);
+    bool isValid(bool host, int offset, int count);
+    int64_t copyChunks(bool toHost, int firstChunk, int endChunk, bool blocking);
+    void syncWrapperFlags();
+    void checkWrapperWrites();
+
+    EasyCL *cl; // NOT owned by this object
+    CLWrapper *wrapper; // NOT owned by this object
+    int64_t numBytes;
+    int chunkBytes;
+    int numChunks;
+#ifdef _WIN32
+#pragma warning(disable: 4251)
+#endif
+    std::vector<unsigned char> hostValid; // one per chunk
+    std::vector<unsigned char> deviceValid;
+#ifdef _WIN32
+#pragma warning(default: 4251)
+#endif
+    int numHostStale; // number of chunks with hostValid false, so the
+    int numDeviceStale; // common all-valid case doesnt scan
+    int seenDeviceWrites; // wrapper->deviceWrites we are up to date with
+
+    int64_t bytesToDevice;
+    int64_t bytesToHost;
+    int64_t bytesSaved;
+};
+}
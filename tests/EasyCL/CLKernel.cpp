@@ -11,7 +11,12 @@ using namespace std;
 #include "CLArrayFloat.h"
 #include "CLArrayInt.h"
 #include "CLArray.h"
+#include "CLBufferPool.h"
+#include "CLRunHandle.h"
+#include "CLCoherentBuffer.h"
 #include "util/easycl_stringhelper.h"
+#include "util/Profiler.h"
+#include "CLTrace.h"
 
 #include "EasyCL_export.h"
 
@@ -30,6 +35,7 @@ CLKernel::CLKernel(EasyCL *cl, std::string sourceFilename, std::string kernelNam
     this->source = source;
     this->cl = cl;
     nextArg = 0;
+    argsOwner = 0;
     error = CL_SUCCESS;
     this->program = program;
     this->kernel = kernel;
@@ -142,6 +148,38 @@ CLKernel *CLKernel::output(CLWrapper *wrapper) {
     return this;      
 }
 
+CLKernel *CLKernel::input(CLCoherentBuffer *buffer) {
+    assert(buffer != 0);
+    buffer->deviceRead();
+    error = clSetKernelArg(kernel, nextArg, sizeof(cl_mem), buffer->getWrapper()->getDeviceArray());
+    cl->checkError(error);
+    nextArg++;
+    return this;
+}
+
+CLKernel *CLKernel::inout(CLCoherentBuffer *buffer) {
+    assert(buffer != 0);
+    buffer->deviceRead();
+    error = clSetKernelArg(kernel, nextArg, sizeof(cl_mem), buffer->getWrapper()->getDeviceArray());
+    cl->checkError(error);
+    nextArg++;
+    coherentToWrite.push_back(buffer);
+    return this;
+}
+
+CLKernel *CLKernel::output(CLCoherentBuffer *buffer) {
+    assert(buffer != 0);
+    CLWrapper *wrapper = buffer->getWrapper();
+    if(!wrapper->isOnDevice()) {
+        wrapper->createOnDevice();
+    }
+    error = clSetKernelArg(kernel, nextArg, sizeof(cl_mem), wrapper->getDeviceArray());
+    cl->checkError(error);
+    nextArg++;
+    coherentToWrite.push_back(buffer);
+    return this;
+}
+
 CLKernel *CLKernel::localFloats(int count) {
     error = clSetKernelArg(kernel, nextArg, count * sizeof(cl_float), 0);
     cl->checkError(error);
@@ -252,10 +290,23 @@ CLKernel *CLKernel::in_uint32(uint32_t value) {
 
 #ifndef _CLKERNEL_STRUCTS_H
 template<typename T> CLKernel *CLKernel::input(int N, const T *data) {
-    cl_mem buffer = clCreateBuffer(*(cl->context), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(T) * N, (void *)data, &error);
-    cl->checkError(error);
-    error = clSetKernelArg(kernel, nextArg, sizeof(cl_mem), &buffer);
-    cl->checkError(error);
+    cl_mem buffer = cl->getBufferPool()->acquire(sizeof(T) * N, CL_MEM_READ_ONLY);
+    try {
+        cl_event event = NULL;
+        bool traced = CLTrace::isEnabled();
+        error = clEnqueueWriteBuffer(*(cl->queue), buffer, CL_TRUE, 0, sizeof(T) * N, data, 0, NULL, traced ? &event : NULL);
+        cl->checkError(error);
+        if(traced) {
+            CLTrace::addCommand(kernelName + " input", "upload", *(cl->queue), event);
+            clReleaseEvent(event);
+        }
+        error = clSetKernelArg(kernel, nextArg, sizeof(cl_mem), &buffer);
+        cl->checkError(error);
+    } catch(...) {
+        // the write blocks, so nothing is pending on the buffer
+        cl->getBufferPool()->release(buffer);
+        throw;
+    }
     buffers.push_back(buffer);
     nextArg++;
     return this;
@@ -266,8 +317,7 @@ CLKernel *CLKernel::in(int N, const T *data) {
 }
 template<typename T>
 CLKernel *CLKernel::output(int N, T *data) {
-    cl_mem buffer = clCreateBuffer(*(cl->context), CL_MEM_WRITE_ONLY, sizeof(T) * N, 0, &error);
-    cl->checkError(error);
+    cl_mem buffer = cl->getBufferPool()->acquire(sizeof(T) * N, CL_MEM_WRITE_ONLY);
     error = clSetKernelArg(kernel, nextArg, sizeof(cl_mem), &buffer);
     buffers.push_back(buffer);
     //outputArgNums.push_back(nextArg);
@@ -283,10 +333,23 @@ CLKernel *CLKernel::out(int N, T *data) {
 }
 template<typename T>
 CLKernel *CLKernel::inout(int N, T *data) {
-    cl_mem buffer = clCreateBuffer(*(cl->context), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(T) * N, (void *)data, &error);
-    cl->checkError(error);
-    error = clSetKernelArg(kernel, nextArg, sizeof(cl_mem), &buffer);
-    cl->checkError(error);
+    cl_mem buffer = cl->getBufferPool()->acquire(sizeof(T) * N, CL_MEM_READ_WRITE);
+    try {
+        cl_event event = NULL;
+        bool traced = CLTrace::isEnabled();
+        error = clEnqueueWriteBuffer(*(cl->queue), buffer, CL_TRUE, 0, sizeof(T) * N, data, 0, NULL, traced ? &event : NULL);
+        cl->checkError(error);
+        if(traced) {
+            CLTrace::addCommand(kernelName + " inout", "upload", *(cl->queue), event);
+            clReleaseEvent(event);
+        }
+        error = clSetKernelArg(kernel, nextArg, sizeof(cl_mem), &buffer);
+        cl->checkError(error);
+    } catch(...) {
+        // the write blocks, so nothing is pending on the buffer
+        cl->getBufferPool()->release(buffer);
+        throw;
+    }
     buffers.push_back(buffer);
     outputArgBuffers.push_back(buffer);
     outputArgPointers.push_back((void *)(data) );
@@ -323,19 +386,90 @@ void CLKernel::run_1d(cl_command_queue *queue, int global_worksize, int local_wo
 }
 
 void CLKernel::run(cl_command_queue *queue, int ND, const size_t *global_ws, const size_t *local_ws) {
-    //cout << "running kernel" << std::endl;
-    cl_event *event = 0;
-    if(cl->profilingOn) {
-        event = new cl_event();
-        cl->pushEvent(sourceFilename + "." + kernelName, event);
+    CLRunHandle *handle = run_async(queue, ND, global_ws, local_ws);
+    try {
+        handle->wait();
+    } catch(...) {
+        delete handle;
+        throw;
     }
-    error = clEnqueueNDRangeKernel(*(queue), kernel, ND, NULL, global_ws, local_ws, 0, NULL, event);
+    delete handle;
+}
+
+CLRunHandle *CLKernel::run_1d_async(int global_worksize, int local_worksize) {
+    size_t global_ws = global_worksize;
+    size_t local_ws = local_worksize;
+    return run_async(cl->queue, 1, &global_ws, &local_ws);
+}
+
+CLRunHandle *CLKernel::run_1d_async(CLQueue *clqueue, int global_worksize, int local_worksize) {
+    size_t global_ws = global_worksize;
+    size_t local_ws = local_worksize;
+    return run_async(&clqueue->queue, 1, &global_ws, &local_ws);
+}
+
+CLRunHandle *CLKernel::run_async(int ND, const size_t *global_ws, const size_t *local_ws) {
+    return run_async(cl->queue, ND, global_ws, local_ws);
+}
+
+CLRunHandle *CLKernel::run_async(CLQueue *clqueue, int ND, const size_t *global_ws, const size_t *local_ws) {
+    return run_async(&clqueue->queue, ND, global_ws, local_ws);
+}
+
+CLRunHandle *CLKernel::run_async(cl_command_queue *queue, int ND, const size_t *global_ws, const size_t *local_ws) {
+    CLRunHandle *handle = 0;
+    cl_event lastEvent = 0;
+    try {
+        lastEvent = enqueue(queue, ND, global_ws, local_ws, true);
+        handle = new CLRunHandle(cl);
+        handle->addEvent(lastEvent);
+
+        for (int i = 0; i < (int)outputArgBuffers.size(); i++) {
+            cl_event readEvent;
+            error = clEnqueueReadBuffer(*(queue), outputArgBuffers[i], CL_FALSE, 0, outputArgSizes[i], outputArgPointers[i], 0, NULL, &readEvent);
+            cl->checkError(error);
+            CLTrace::addCommand(kernelName + " output", "download", *queue, readEvent);
+            handle->addEvent(readEvent);
+            handle->addOutputPointer(outputArgPointers[i]);
+            lastEvent = readEvent;
+        }
+    } catch(...) {
+        // deleting the handle waits for whatever was queued, so the buffers
+        // can go straight back to the pool; the next run starts from fresh args
+        delete handle;
+        for (int i = 0; i < (int)buffers.size(); i++) {
+            cl->getBufferPool()->release(buffers[i]);
+        }
+        resetArgs();
+        throw;
+    }
+
+    // queue is in-order, so once the last command is done, the pool can hand
+    // the buffers out again
+    for (int i = 0; i < (int)buffers.size(); i++) {
+        cl->getBufferPool()->release(buffers[i], lastEvent);
+    }
+    // mark wrappers dirty:
+    for(int i = 0; i < (int)wrappersToDirty.size(); i++) {
+        wrappersToDirty[i]->markDeviceDirty();
+    }
+    for(int i = 0; i < (int)coherentToWrite.size(); i++) {
+        coherentToWrite[i]->deviceWrote();
+    }
+    resetArgs();
+    return handle;
+}
+
+// returns the kernel event; caller owns it.  Without wantEvent, returns 0,
+// and only creates an event if profiling needs one
+cl_event CLKernel::enqueue(cl_command_queue *queue, int ND, const size_t *global_ws, const size_t *local_ws, bool wantEvent) {
+    EASYCL_PROFILE_ZONE("CLKernel::enqueue");
+    //cout << "running kernel" << std::endl;
+    cl_event kernelEvent = 0;
+    bool needEvent = wantEvent || cl->profilingOn || CLTrace::isEnabled();
+    error = clEnqueueNDRangeKernel(*(queue), kernel, ND, NULL, global_ws, local_ws, 0, NULL, needEvent ? &kernelEvent : NULL);
     if(error != 0) {
-        cout << "kernel failed to run, saving to easycl-failedkernel.cl" << endl;
-        ofstream f;
-        f.open("easycl-failedkernel.cl", ios_base::out);
-        f << source << endl;
-        f.close();
+        cout << "kernel failed to run, saving to " << EasyCL::saveFailedKernel(source, "") << endl;
         switch (error) {
             case -4:
                 throw std::runtime_error("Memory object allocation failure, code -4");
@@ -360,23 +494,22 @@ void CLKernel::run(cl_command_queue *queue, int ND, const size_t *global_ws, con
       }
     }
     cl->checkError(error);
-    //        error = clFinish(cl->queue);
-    //        cl->checkError(error);
-    //}
-
-    //void retrieveresultsandcleanup() {
-    for (int i = 0; i < (int)outputArgBuffers.size(); i++) {
-        clEnqueueReadBuffer(*(queue), outputArgBuffers[i], CL_TRUE, 0, outputArgSizes[i], outputArgPointers[i], 0, NULL, NULL);
-    }
-    //        std::cout << "done" << std::endl;
-
-    for (int i = 0; i < (int)buffers.size(); i++) {
-        clReleaseMemObject(buffers[i]);
+    CLTrace::addCommand(kernelName, "kernel", *queue, kernelEvent);
+    if(cl->profilingOn) {
+        // EasyCL releases this one in dumpProfiling
+        cl_event *event = new cl_event();
+        *event = kernelEvent;
+        clRetainEvent(kernelEvent);
+        cl->pushEvent(sourceFilename + "." + kernelName, event);
     }
-    // mark wrappers dirty:
-    for(int i = 0; i < (int)wrappersToDirty.size(); i++) {
-        wrappersToDirty[i]->markDeviceDirty();
+    if(!wantEvent && kernelEvent != 0) {
+        clReleaseEvent(kernelEvent);
+        kernelEvent = 0;
     }
+    return kernelEvent;
+}
+
+void CLKernel::resetArgs() {
     buffers.clear();
     outputArgBuffers.clear();
     outputArgPointers.clear();
@@ -388,7 +521,9 @@ void CLKernel::run(cl_command_queue *queue, int ND, const size_t *global_ws, con
     inputArgFloats.clear();
     inputArgChars.clear();
     wrappersToDirty.clear();
+    coherentToWrite.clear();
     nextArg = 0;
+    argsOwner = 0;
 }
 
 // template class std::vector<cl_mem>;
@@ -16,6 +16,9 @@
 namespace easycl {
 
 class CLQueue;
+class CLRunHandle;
+class CLBoundKernel;
+class CLCoherentBuffer;
 
 class EasyCL_EXPORT CLKernel {
     EasyCL *cl; // NOT owned by this object, dont delete!
@@ -30,6 +33,7 @@ class EasyCL_EXPORT CLKernel {
     std::string source;
 
     int nextArg;
+    CLBoundKernel *argsOwner; // binding whose arguments are set on `kernel` right now, or 0
 
     std::vector<cl_mem> buffers;
 
@@ -53,6 +57,12 @@ class EasyCL_EXPORT CLKernel {
                                                 // only wrappers passed as `out` or
                                                 // or `inout` will be marked dirty
                                                 // on run
+    std::vector< CLCoherentBuffer * > coherentToWrite; // `out` and `inout`
+                                                       // coherent buffers, device
+                                                       // copy is newest after run
+
+    cl_event enqueue(cl_command_queue *queue, int ND, const size_t *global_ws, const size_t *local_ws, bool wantEvent);
+    void resetArgs();
 
       template<typename T>
       static std::string toString(T val);
@@ -60,6 +70,8 @@ class EasyCL_EXPORT CLKernel {
 #pragma warning(default: 4251)
 #endif
 
+    friend class CLBoundKernel;
+
 public:
     CLKernel(EasyCL *easycl, std::string sourceFilename, std::string kernelName, std::string source, cl_program program, cl_kernel kernel);
     CLKernel(const CLKernel &kernel);
@@ -85,6 +97,14 @@ public:
     CLKernel *in(CLWrapper *wrapper) { return input(wrapper); }
     CLKernel *out(CLWrapper *wrapper) { return output(wrapper); }
 
+    // copies only what is stale on the device before the run; `out` and
+    // `inout` mark the device copy newest after it.  See CLCoherentBuffer.h
+    CLKernel *input(CLCoherentBuffer *buffer);
+    CLKernel *output(CLCoherentBuffer *buffer);
+    CLKernel *inout(CLCoherentBuffer *buffer);
+    CLKernel *in(CLCoherentBuffer *buffer) { return input(buffer); }
+    CLKernel *out(CLCoherentBuffer *buffer) { return output(buffer); }
+
     CLKernel *localFloats(int count);
     CLKernel *localInts(int count);
     CLKernel *local(int N);
@@ -133,6 +153,15 @@ public:
     void run(cl_command_queue *queue, int ND, const size_t *global_ws, const size_t *local_ws);
     void run(CLQueue *queue, int ND, const size_t *global_ws, const size_t *local_ws);
 
+    // same as run, but doesnt wait for the kernel, or for the reads of `out`
+    // and `inout` arguments.  Call wait() on the returned handle before
+    // touching the output pointers.  You own the handle, should delete it
+    CLRunHandle *run_1d_async(int global_worksize, int local_worksize);
+    CLRunHandle *run_1d_async(CLQueue *queue, int global_worksize, int local_worksize);
+    CLRunHandle *run_async(int ND, const size_t *global_ws, const size_t *local_ws);
+    CLRunHandle *run_async(cl_command_queue *queue, int ND, const size_t *global_ws, const size_t *local_ws);
+    CLRunHandle *run_async(CLQueue *queue, int ND, const size_t *global_ws, const size_t *local_ws);
+
     std::string buildLog;
 };
 }
@@ -5,13 +5,27 @@
 #pragma once
 
 #include "CLKernel.h"
+#include "CLTrace.h"
 
 namespace easycl {
 template<typename T> CLKernel *CLKernel::input(int N, const T *data) {
-	cl_mem buffer = clCreateBuffer(*(cl->context), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(T) * N, (void *)data, &error);
-	cl->checkError(error);
-	error = clSetKernelArg(kernel, nextArg, sizeof(cl_mem), &buffer);
-	cl->checkError(error);
+	cl_mem buffer = cl->getBufferPool()->acquire(sizeof(T) * N, CL_MEM_READ_ONLY);
+	try {
+		cl_event event = NULL;
+		bool traced = CLTrace::isEnabled();
+		error = clEnqueueWriteBuffer(*(cl->queue), buffer, CL_TRUE, 0, sizeof(T) * N, data, 0, NULL, traced ? &event : NULL);
+		cl->checkError(error);
+		if(traced) {
+			CLTrace::addCommand(kernelName + " input", "upload", *(cl->queue), event);
+			clReleaseEvent(event);
+		}
+		error = clSetKernelArg(kernel, nextArg, sizeof(cl_mem), &buffer);
+		cl->checkError(error);
+	} catch(...) {
+		// the write blocks, so nothing is pending on the buffer
+		cl->getBufferPool()->release(buffer);
+		throw;
+	}
 	buffers.push_back(buffer);
 	nextArg++;
 	return this;
@@ -22,8 +36,7 @@ CLKernel *CLKernel::in(int N, const T *data) {
 }
 template<typename T>
 CLKernel *CLKernel::output(int N, T *data) {
-	cl_mem buffer = clCreateBuffer(*(cl->context), CL_MEM_WRITE_ONLY, sizeof(T) * N, 0, &error);
-	cl->checkError(error);
+	cl_mem buffer = cl->getBufferPool()->acquire(sizeof(T) * N, CL_MEM_WRITE_ONLY);
 	error = clSetKernelArg(kernel, nextArg, sizeof(cl_mem), &buffer);
 	buffers.push_back(buffer);
 	//outputArgNums.push_back(nextArg);
@@ -39,10 +52,23 @@ CLKernel *CLKernel::out(int N, T *data) {
 }
 template<typename T>
 CLKernel *CLKernel::inout(int N, T *data) {
-	cl_mem buffer = clCreateBuffer(*(cl->context), CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, sizeof(T) * N, (void *)data, &error);
-	cl->checkError(error);
-	error = clSetKernelArg(kernel, nextArg, sizeof(cl_mem), &buffer);
-	cl->checkError(error);
+	cl_mem buffer = cl->getBufferPool()->acquire(sizeof(T) * N, CL_MEM_READ_WRITE);
+	try {
+		cl_event event = NULL;
+		bool traced = CLTrace::isEnabled();
+		error = clEnqueueWriteBuffer(*(cl->queue), buffer, CL_TRUE, 0, sizeof(T) * N, data, 0, NULL, traced ? &event : NULL);
+		cl->checkError(error);
+		if(traced) {
+			CLTrace::addCommand(kernelName + " inout", "upload", *(cl->queue), event);
+			clReleaseEvent(event);
+		}
+		error = clSetKernelArg(kernel, nextArg, sizeof(cl_mem), &buffer);
+		cl->checkError(error);
+	} catch(...) {
+		// the write blocks, so nothing is pending on the buffer
+		cl->getBufferPool()->release(buffer);
+		throw;
+	}
 	buffers.push_back(buffer);
 	outputArgBuffers.push_back(buffer);
 	outputArgPointers.push_back((void *)(data) );
@@ -0,0 +1,107 @@
+// Copyright Hugh Perkins 2013, 2014, 2015, 2016, 2017 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, 
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can 
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+using namespace std;
+
+#include "EasyCL.h"
+#include "CLKernel.h"
+#include "CLProgram.h"
+
+namespace easycl {
+
+CLProgram::CLProgram(EasyCL *cl, cl_program program, std::string source, std::string options, std::string sourceFilename, std::string buildLog) :
+        cl(cl),
+        program(program),
+        source(source),
+        options(options),
+        sourceFilename(sourceFilename),
+        buildLog(buildLog),
+        kernelsCreated(false) {
+}
+CLProgram::~CLProgram() {
+    for(map< string, cl_kernel >::iterator it = unclaimedKernels.begin(); it != unclaimedKernels.end(); it++) {
+        clReleaseKernel(it->second);
+    }
+    clReleaseProgram(program);
+}
+void CLProgram::createKernels() {
+    if(kernelsCreated) {
+        return;
+    }
+    kernelsCreated = true;
+    cl_uint numKernels = 0;
+    cl_int error = clCreateKernelsInProgram(program, 0, 0, &numKernels);
+    cl->checkError(error);
+    if(numKernels == 0) {
+        return;
+    }
+    vector<cl_kernel> kernels(numKernels);
+    error = clCreateKernelsInProgram(program, numKernels, &kernels[0], 0);
+    cl->checkError(error);
+    for(int i = 0; i < (int)numKernels; i++) {
+        size_t nameSize = 0;
+        clGetKernelInfo(kernels[i], CL_KERNEL_FUNCTION_NAME, 0, 0, &nameSize);
+        vector<char> name(nameSize + 1, '\0');
+        clGetKernelInfo(kernels[i], CL_KERNEL_FUNCTION_NAME, nameSize, &name[0], 0);
+        string kernelName(&name[0]);
+        kernelNames.push_back(kernelName);
+        unclaimedKernels[kernelName] = kernels[i];
+    }
+}
+std::vector<std::string> CLProgram::getKernelNames() {
+    createKernels();
+    return kernelNames;
+}
+bool CLProgram::hasKernel(std::string kernelName) {
+    createKernels();
+    return std::find(kernelNames.begin(), kernelNames.end(), kernelName) != kernelNames.end();
+}
+CLKernel *CLProgram::getKernel(std::string kernelName) {
+    return getKernel(kernelName, sourceFilename);
+}
+CLKernel *CLProgram::getKernel(std::string kernelName, std::string sourceFilename) {
+    createKernels();
+    cl_kernel kernel = 0;
+    map< string, cl_kernel >::iterator it = unclaimedKernels.find(kernelName);
+    if(it != unclaimedKernels.end()) {
+        kernel = it->second;
+        unclaimedKernels.erase(it);
+    } else {
+        // already handed out, need another cl_kernel, so the args dont clash
+        cl_int error;
+        kernel = clCreateKernel(program, kernelName.c_str(), &error);
+        if(error != CL_SUCCESS) {
+            std::string exceptionMessage = "";
+            switch(error) {
+                case -46:
+                    exceptionMessage = "Invalid kernel name, code -46, kernel " + kernelName + "\n" + buildLog;
+                    break;
+                default:
+                    exceptionMessage = "Something went wrong with clCreateKernel, OpenCL error code " + EasyCL::toString(error) + "\n" + buildLog;
+                    break;
+            }
+            cout << "kernel build error:\n" << exceptionMessage << endl;
+            throw std::runtime_error(exceptionMessage);
+        }
+    }
+    // CLKernel releases the program in its destructor
+    clRetainProgram(program);
+    CLKernel *newkernel = new CLKernel(cl, sourceFilename, kernelName, source, program, kernel);
+    newkernel->buildLog = buildLog;
+    return newkernel;
+}
+std::vector<CLKernel *> CLProgram::getAllKernels() {
+    createKernels();
+    vector<CLKernel *> kernels;
+    for(int i = 0; i < (int)kernelNames.size(); i++) {
+        kernels.push_back(getKernel(kernelNames[i]));
+    }
+    return kernels;
+}
+}
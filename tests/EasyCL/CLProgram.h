@@ -0,0 +1,68 @@
+// Copyright Hugh Perkins 2013, 2014, 2015, 2016, 2017 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, 
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can 
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "EasyCL_export.h"
+
+namespace easycl {
+
+class EasyCL;
+class CLKernel;
+
+// A built cl_program.  Build it once with EasyCL::buildProgram or
+// EasyCL::buildProgramFromString, then get a CLKernel for each entry point.
+//
+// Programs are cached per EasyCL object, keyed by (source, options), and
+// owned by the EasyCL object, so dont delete them
+class EasyCL_EXPORT CLProgram {
+    EasyCL *cl; // NOT owned by this object
+    cl_program program;
+#ifdef _WIN32
+#pragma warning(disable: 4251)
+#endif
+    std::string source;
+    std::string options;
+    std::string sourceFilename;
+    std::string buildLog;
+    std::vector<std::string> kernelNames;
+    // from clCreateKernelsInProgram, not yet handed out to a CLKernel
+    std::map< std::string, cl_kernel > unclaimedKernels;
+#ifdef _WIN32
+#pragma warning(default: 4251)
+#endif
+    bool kernelsCreated;
+
+    void createKernels();
+
+    CLProgram(const CLProgram &);
+    CLProgram &operator=(const CLProgram &);
+
+public:
+    // takes ownership of program, which must be built already
+    CLProgram(EasyCL *cl, cl_program program, std::string source, std::string options, std::string sourceFilename, std::string buildLog);
+    ~CLProgram();
+
+    cl_program getProgram() { return program; }
+    std::string getSource() { return source; }
+    std::string getOptions() { return options; }
+    std::string getSourceFilename() { return sourceFilename; }
+    std::string getBuildLog() { return buildLog; }
+
+    std::vector<std::string> getKernelNames();
+    bool hasKernel(std::string kernelName);
+
+    // you own the returned kernel, should delete it.  Each call returns a new
+    // CLKernel, with its own arguments
+    CLKernel *getKernel(std::string kernelName);
+    CLKernel *getKernel(std::string kernelName, std::string sourceFilename); // sourceFilename is used for profiling
+    std::vector<CLKernel *> getAllKernels(); // one per entry point; you own them
+};
+}
@@ -0,0 +1,79 @@
+// Copyright Hugh Perkins 2013, 2014, 2015, 2016, 2017 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, 
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can 
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <stdexcept>
+using namespace std;
+
+#include "EasyCL.h"
+#include "CLRunHandle.h"
+
+namespace easycl {
+
+CLRunHandle::CLRunHandle(EasyCL *cl) :
+        cl(cl),
+        done(false) {
+}
+CLRunHandle::~CLRunHandle() {
+    if(!done) {
+        try {
+            wait();
+        } catch(runtime_error &e) {
+            // dont throw from destructor
+            cout << "CLRunHandle: " << e.what() << endl;
+        }
+    }
+}
+void CLRunHandle::addEvent(cl_event event) {
+    events.push_back(event);
+}
+void CLRunHandle::addOutputPointer(void *pointer) {
+    outputPointers.push_back(pointer);
+}
+void CLRunHandle::wait() {
+    if(done) {
+        return;
+    }
+    done = true;
+    cl_int error = CL_SUCCESS;
+    if(events.size() > 0) {
+        error = clWaitForEvents((cl_uint)events.size(), &events[0]);
+    }
+    for(int i = 0; i < (int)events.size(); i++) {
+        clReleaseEvent(events[i]);
+    }
+    events.clear();
+    cl->checkError(error);
+}
+bool CLRunHandle::isComplete() {
+    if(done) {
+        return true;
+    }
+    for(int i = 0; i < (int)events.size(); i++) {
+        cl_int status = CL_COMPLETE;
+        cl->checkError(clGetEventInfo(events[i], CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, 0));
+        if(status < 0) {
+            throw runtime_error("CLRunHandle: command failed, code " + EasyCL::toString(status));
+        }
+        if(status != CL_COMPLETE) {
+            return false;
+        }
+    }
+    return true;
+}
+cl_event CLRunHandle::getEvent() {
+    if(done || events.size() == 0) {
+        return 0;
+    }
+    return events[events.size() - 1];
+}
+int CLRunHandle::numOutputs() {
+    return (int)outputPointers.size();
+}
+void *CLRunHandle::output(int index) {
+    wait();
+    return outputPointers[index];
+}
+}
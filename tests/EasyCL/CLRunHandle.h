@@ -0,0 +1,55 @@
+// Copyright Hugh Perkins 2013, 2014, 2015, 2016, 2017 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, 
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can 
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <vector>
+
+#include "EasyCL_export.h"
+
+namespace easycl {
+
+class EasyCL;
+
+// Returned by CLKernel::run_async.  The kernel and the reads of its `out`
+// and `inout` arguments are enqueued, but may not have finished yet.  Dont
+// touch the output pointers before calling wait() (or output(i), which waits
+// for you)
+//
+// Deleting the handle waits too, since the host pointers are still being
+// written to until then
+class EasyCL_EXPORT CLRunHandle {
+    EasyCL *cl; // NOT owned by this object
+#ifdef _WIN32
+#pragma warning(disable: 4251)
+#endif
+    std::vector<cl_event> events; // retained, released in wait()
+    std::vector<void *> outputPointers;
+#ifdef _WIN32
+#pragma warning(default: 4251)
+#endif
+    bool done;
+
+    CLRunHandle(const CLRunHandle &);
+    CLRunHandle &operator=(const CLRunHandle &);
+
+public:
+    CLRunHandle(EasyCL *cl);
+    ~CLRunHandle();
+
+    void addEvent(cl_event event); // takes ownership of event
+    void addOutputPointer(void *pointer);
+
+    void wait(); // blocks until the kernel and all reads have finished
+    bool isComplete(); // doesnt block
+    // event of the last enqueued command, eg to pass as a wait event to
+    // another queue. Still owned by this object. 0 after wait()
+    cl_event getEvent();
+
+    int numOutputs();
+    void *output(int index); // waits, then returns the host pointer passed to out/inout
+};
+}
@@ -0,0 +1,253 @@
+// Copyright Hugh Perkins 2013, 2014, 2015, 2016, 2017 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, 
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can 
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#include "EasyCL.h"
+#include "CLTrace.h"
+#include "util/Profiler.h"
+
+using namespace std;
+
+namespace easycl {
+
+namespace {
+
+struct TracedCommand {
+    string name;
+    const char *category;
+    const char *queueKind; // "queue", or eg "stream" for CUDA
+    const void *queue;
+    const void *clock; // the cl_device_id, or the external command's clock
+    cl_event event; // retained; 0 for an external command
+    function<bool(uint64_t *start, uint64_t *end)> timestamps; // external command
+    uint64_t hostTicks; // just after the enqueue; just before, for an external command
+};
+
+// never deleted, like Profiler's registry
+struct TraceState {
+    mutex lock;
+    vector<TracedCommand> commands;
+    vector<Profiler::TraceSpan> spans; // taken from Profiler so far
+};
+
+TraceState &traceState() {
+    static TraceState *instance = new TraceState();
+    return *instance;
+}
+
+atomic<bool> traceEnabled(false);
+
+string jsonString(const string &value) {
+    string result = "\"";
+    for(int i = 0; i < (int)value.size(); i++) {
+        char c = value[i];
+        if(c == '"' || c == '\\') {
+            result += '\\';
+            result += c;
+        } else if((unsigned char)c < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+            result += escaped;
+        } else {
+            result += c;
+        }
+    }
+    return result + "\"";
+}
+
+string formatMicroseconds(double us) {
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%.3f", us);
+    return buffer;
+}
+
+}
+
+void CLTrace::setEnabled(bool enabled) {
+    if(enabled) {
+        Profiler::setEnabled(true);
+    }
+    Profiler::setTracing(enabled);
+    traceEnabled.store(enabled);
+}
+bool CLTrace::isEnabled() {
+    return traceEnabled.load(memory_order_relaxed);
+}
+void CLTrace::addCommand(string name, const char *category, cl_command_queue queue, cl_event event) {
+    if(!isEnabled() || event == 0) {
+        return;
+    }
+    TracedCommand command;
+    command.hostTicks = Profiler::now();
+    command.name = name;
+    command.category = category;
+    command.queueKind = "queue";
+    command.queue = queue;
+    // now, since the queue might be gone by the time the trace is written
+    cl_device_id device = 0;
+    clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(device), &device, 0);
+    command.clock = device;
+    command.event = event;
+    clRetainEvent(event);
+    TraceState &state = traceState();
+    lock_guard<mutex> guard(state.lock);
+    state.commands.push_back(command);
+}
+void CLTrace::addExternalCommand(string name, const char *category, const char *queueKind, const void *queue,
+        const void *clock, uint64_t hostTicks, function<bool(uint64_t *start, uint64_t *end)> timestamps) {
+    if(!isEnabled()) {
+        return;
+    }
+    TracedCommand command;
+    command.hostTicks = hostTicks;
+    command.name = name;
+    command.category = category;
+    command.queueKind = queueKind;
+    command.queue = queue;
+    command.clock = clock;
+    command.event = 0;
+    command.timestamps = timestamps;
+    TraceState &state = traceState();
+    lock_guard<mutex> guard(state.lock);
+    state.commands.push_back(command);
+}
+int CLTrace::getNumCommands() {
+    TraceState &state = traceState();
+    lock_guard<mutex> guard(state.lock);
+    return (int)state.commands.size();
+}
+string CLTrace::toChromeTraceJson() {
+    vector<Profiler::TraceSpan> newSpans = Profiler::takeTraceSpans();
+    vector<string> threadNames = Profiler::getThreadNames();
+    double ticksPerMs = Profiler::ticksPerMillisecond();
+    TraceState &state = traceState();
+    lock_guard<mutex> guard(state.lock);
+    state.spans.insert(state.spans.end(), newSpans.begin(), newSpans.end());
+
+    bool haveBase = false;
+    uint64_t baseTicks = 0;
+    for(int i = 0; i < (int)state.spans.size(); i++) {
+        if(!haveBase || state.spans[i].start < baseTicks) {
+            baseTicks = state.spans[i].start;
+            haveBase = true;
+        }
+    }
+    for(int i = 0; i < (int)state.commands.size(); i++) {
+        if(!haveBase || state.commands[i].hostTicks < baseTicks) {
+            baseTicks = state.commands[i].hostTicks;
+            haveBase = true;
+        }
+    }
+    // nanoseconds since the first thing traced
+    double nsPerTick = 1e6 / ticksPerMs;
+    auto hostNs = [baseTicks, nsPerTick](uint64_t ticks) -> int64_t {
+        return (int64_t)((double)(int64_t)(ticks - baseTicks) * nsPerTick);
+    };
+
+    // device timestamps, and the offset to host time per device clock.  An
+    // OpenCL command was queued before the host time taken after its enqueue,
+    // so the smallest offset fits best; an external command started after
+    // the host time taken before its enqueue, so there the largest does
+    vector<uint64_t> queued(state.commands.size()), start(state.commands.size()), end(state.commands.size());
+    vector<bool> timed(state.commands.size());
+    map<const void *, int64_t> offsetByClock;
+    map<const void *, int> queueIndex;
+    for(int i = 0; i < (int)state.commands.size(); i++) {
+        TracedCommand &command = state.commands[i];
+        if(queueIndex.find(command.queue) == queueIndex.end()) {
+            int index = (int)queueIndex.size();
+            queueIndex[command.queue] = index;
+        }
+        bool external = command.event == 0;
+        if(external) {
+            timed[i] = command.timestamps(&start[i], &end[i]);
+            queued[i] = start[i];
+        } else {
+            clWaitForEvents(1, &command.event);
+            timed[i] = clGetEventProfilingInfo(command.event, CL_PROFILING_COMMAND_QUEUED, sizeof(uint64_t), &queued[i], 0) == CL_SUCCESS
+                && clGetEventProfilingInfo(command.event, CL_PROFILING_COMMAND_START, sizeof(uint64_t), &start[i], 0) == CL_SUCCESS
+                && clGetEventProfilingInfo(command.event, CL_PROFILING_COMMAND_END, sizeof(uint64_t), &end[i], 0) == CL_SUCCESS;
+        }
+        if(timed[i]) {
+            int64_t offset = hostNs(command.hostTicks) - (int64_t)queued[i];
+            map<const void *, int64_t>::iterator it = offsetByClock.find(command.clock);
+            if(it == offsetByClock.end() || (external ? offset > it->second : offset < it->second)) {
+                offsetByClock[command.clock] = offset;
+            }
+        }
+    }
+
+    string json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    json += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"host\"}},\n";
+    json += "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"device\"}}";
+    for(int t = 0; t < (int)threadNames.size(); t++) {
+        json += ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + to_string(t)
+            + ",\"args\":{\"name\":" + jsonString(threadNames[t]) + "}}";
+    }
+    map<const void *, const char *> queueKind;
+    for(int i = 0; i < (int)state.commands.size(); i++) {
+        queueKind[state.commands[i].queue] = state.commands[i].queueKind;
+    }
+    for(map<const void *, int>::iterator it = queueIndex.begin(); it != queueIndex.end(); it++) {
+        json += ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":2,\"tid\":" + to_string(it->second)
+            + ",\"args\":{\"name\":\"" + queueKind[it->first] + " " + to_string(it->second) + "\"}}";
+    }
+    for(int i = 0; i < (int)state.spans.size(); i++) {
+        const Profiler::TraceSpan &span = state.spans[i];
+        int64_t begin = hostNs(span.start);
+        int64_t finish = hostNs(span.end);
+        json += ",\n{\"name\":" + jsonString(Profiler::zoneName(span.zoneId)) + ",\"cat\":\"host\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+            + to_string(span.thread) + ",\"ts\":" + formatMicroseconds(begin / 1000.0)
+            + ",\"dur\":" + formatMicroseconds((finish - begin) / 1000.0) + "}";
+    }
+    for(int i = 0; i < (int)state.commands.size(); i++) {
+        const TracedCommand &command = state.commands[i];
+        string common = "{\"name\":" + jsonString(command.name) + ",\"cat\":" + jsonString(command.category)
+            + ",\"pid\":2,\"tid\":" + to_string(queueIndex[command.queue]);
+        if(timed[i]) {
+            int64_t offset = offsetByClock[command.clock];
+            json += ",\n" + common + ",\"ph\":\"X\",\"ts\":" + formatMicroseconds(((int64_t)start[i] + offset) / 1000.0)
+                + ",\"dur\":" + formatMicroseconds((double)(end[i] - start[i]) / 1000.0)
+                + ",\"args\":{\"queued_us\":" + formatMicroseconds((double)(start[i] - queued[i]) / 1000.0) + "}}";
+        } else {
+            json += ",\n" + common + ",\"ph\":\"i\",\"s\":\"t\",\"ts\":"
+                + formatMicroseconds(hostNs(command.hostTicks) / 1000.0) + "}";
+        }
+    }
+    json += "\n]}\n";
+    return json;
+}
+void CLTrace::writeChromeTrace(string filepath) {
+    string json = toChromeTraceJson();
+    ofstream f(filepath.c_str(), ios_base::out | ios_base::binary);
+    if(!f) {
+        throw runtime_error("CLTrace::writeChromeTrace(): couldnt open " + filepath);
+    }
+    f << json;
+}
+void CLTrace::clear() {
+    Profiler::takeTraceSpans();
+    TraceState &state = traceState();
+    lock_guard<mutex> guard(state.lock);
+    for(int i = 0; i < (int)state.commands.size(); i++) {
+        if(state.commands[i].event != 0) {
+            clReleaseEvent(state.commands[i].event);
+        }
+    }
+    state.commands.clear();
+    state.spans.clear();
+}
+
+}
+
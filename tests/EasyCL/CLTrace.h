@@ -0,0 +1,70 @@
+// Copyright Hugh Perkins 2013, 2014, 2015, 2016, 2017 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, 
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can 
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include "EasyCL_export.h"
+
+#include "mystdint.h"
+
+namespace easycl {
+
+// Timeline of builds, kernel launches and copies, for chrome://tracing or
+// https://ui.perfetto.dev:
+//
+//   cl->setProfiling(true);        // device timestamps, on the default queue
+//   CLTrace::setEnabled(true);
+//   ... run ...
+//   CLTrace::writeChromeTrace("trace.json");
+//
+// - host: every Profiler zone (builds, kernel enqueues, copies, and your own
+//   EASYCL_PROFILE_ZONEs), one track per thread, including the build threads
+// - device: kernels, uploads, downloads and copies, one track per queue
+//
+// CLTraceCLCudaAPI.h adds the commands of CLCudaAPI queues and streams, and
+// CLTraceLaunch.h spans for the worker threads of rainbowmist::LaunchKernel.
+//
+// Device timestamps are shifted to host time: for each device, the offset is
+// the smallest (host time just after an enqueue) - (CL_PROFILING_COMMAND_QUEUED),
+// (for external commands, the largest (host time just before) - (start)),
+// so overlap between queues, and gaps where the device waits for the host,
+// show up as they happened.  Commands on queues created without
+// CL_QUEUE_PROFILING_ENABLE only show as instants, at their enqueue time.
+//
+// Every traced command keeps its cl_event until the trace is written or
+// cleared, so dont leave tracing on forever.
+class EasyCL_EXPORT CLTrace {
+public:
+    // also turns on Profiler, and its tracing
+    static void setEnabled(bool enabled);
+    static bool isEnabled();
+
+    // records a command that was just enqueued, with `category` one of
+    // "kernel", "upload", "download", "copy", or your own.  Retains `event`.
+    // Does nothing unless enabled, or if event is 0
+    static void addCommand(std::string name, const char *category, cl_command_queue queue, cl_event event);
+    // records a command of another API, eg a CUDA stream, on the track of
+    // `queue`, labelled `queueKind`.  `hostTicks` is Profiler::now() from just
+    // before the enqueue.  `timestamps` gives the start and end, in
+    // nanoseconds on a clock shared by the commands with the same `clock`, or
+    // returns false; it is called each time the trace is written, and may
+    // wait.  Does nothing unless enabled
+    static void addExternalCommand(std::string name, const char *category, const char *queueKind,
+        const void *queue, const void *clock, uint64_t hostTicks,
+        std::function<bool(uint64_t *start, uint64_t *end)> timestamps);
+    static int getNumCommands();
+
+    // waits for the recorded commands; the trace keeps growing until clear()
+    static std::string toChromeTraceJson();
+    static void writeChromeTrace(std::string filepath);
+    static void clear();
+};
+
+}
+
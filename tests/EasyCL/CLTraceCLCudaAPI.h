@@ -0,0 +1,165 @@
+// Copyright Hugh Perkins 2013, 2014, 2015, 2016, 2017 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "CLTrace.h"
+#include "util/Profiler.h"
+
+// Puts the commands of CLCudaAPI (tests/CLCudaAPI/include) on the CLTrace
+// timeline.  Include after cupp11.h or clpp11.h, then, once:
+//
+//   traceCLCudaAPI();
+//   CLTrace::setEnabled(true);
+//
+// - clpp11.h: every command gets an event, which goes to CLTrace::addCommand
+//   as EasyCL's own do, so the queue needs CL_QUEUE_PROFILING_ENABLE for
+//   device times
+// - cupp11.h: while CLTrace is enabled, each command is bracketed by a pair
+//   of CUevents, and shows on a "stream" track.  Times are taken relative to
+//   an event recorded on the stream when it is first traced, in float
+//   milliseconds, so resolution drops below a microsecond after ~10 seconds
+//
+// Commands enqueued while CLTrace is disabled cost one atomic load, and
+// nothing is recorded.
+
+namespace easycl {
+
+#if defined(CLCUDAAPI_CUPP11_H_)
+
+class CLTraceCLCudaAPITracer : public CLCudaAPI::CommandTracer {
+public:
+    virtual void *Begin(const char *name, const char *category, const CUstream queue) {
+        if(!CLTrace::isEnabled()) {
+            return 0;
+        }
+        try {
+            CUevent reference = referenceEvent(queue);
+            std::unique_ptr<Command> command(new Command());
+            command->events.reset(new Events());
+            if(reference == 0 || !command->events->create()) {
+                return 0;
+            }
+            command->name = name;
+            command->category = category;
+            command->reference = reference;
+            command->hostTicks = Profiler::now();
+            if(cuEventRecord(command->events->start, queue) != CUDA_SUCCESS) {
+                return 0;
+            }
+            return command.release();
+        } catch(...) {
+            return 0;
+        }
+    }
+    virtual void End(void *token, const CUstream queue, const bool enqueued) {
+        std::unique_ptr<Command> command((Command *)token);
+        if(command.get() == 0 || !enqueued || cuEventRecord(command->events->end, queue) != CUDA_SUCCESS) {
+            return;
+        }
+        try {
+            std::shared_ptr<Events> events = command->events;
+            CUevent reference = command->reference;
+            CLTrace::addExternalCommand(command->name, command->category, "stream", queue, queue,
+                command->hostTicks, [events, reference](uint64_t *start, uint64_t *end) {
+                    return events->timestamps(reference, start, end);
+                });
+        } catch(...) {
+        }
+    }
+private:
+    // the start and end of one command, until the trace forgets it
+    struct Events {
+        CUevent start;
+        CUevent end;
+        Events() : start(0), end(0) {
+        }
+        ~Events() {
+            // errors ignored: the context might be gone already
+            if(start != 0) {
+                cuEventDestroy(start);
+            }
+            if(end != 0) {
+                cuEventDestroy(end);
+            }
+        }
+        bool create() {
+            return cuEventCreate(&start, CU_EVENT_DEFAULT) == CUDA_SUCCESS
+                && cuEventCreate(&end, CU_EVENT_DEFAULT) == CUDA_SUCCESS;
+        }
+        bool timestamps(CUevent reference, uint64_t *startNs, uint64_t *endNs) {
+            float startMs = 0;
+            float endMs = 0;
+            if(cuEventSynchronize(end) != CUDA_SUCCESS
+                    || cuEventElapsedTime(&startMs, reference, start) != CUDA_SUCCESS
+                    || cuEventElapsedTime(&endMs, reference, end) != CUDA_SUCCESS
+                    || startMs < 0 || endMs < startMs) {
+                return false;
+            }
+            *startNs = (uint64_t)((double)startMs * 1000000.0);
+            *endNs = (uint64_t)((double)endMs * 1000000.0);
+            return true;
+        }
+    };
+    struct Command {
+        std::string name;
+        const char *category;
+        CUevent reference;
+        uint64_t hostTicks;
+        std::shared_ptr<Events> events;
+    };
+
+    std::mutex lock;
+    std::map<CUstream, CUevent> references; // kept for good: later commands are timed against them
+
+    CUevent referenceEvent(CUstream queue) {
+        std::lock_guard<std::mutex> guard(lock);
+        std::map<CUstream, CUevent>::iterator it = references.find(queue);
+        if(it != references.end()) {
+            return it->second;
+        }
+        CUevent reference = 0;
+        if(cuEventCreate(&reference, CU_EVENT_DEFAULT) != CUDA_SUCCESS) {
+            return 0;
+        }
+        if(cuEventRecord(reference, queue) != CUDA_SUCCESS) {
+            cuEventDestroy(reference);
+            return 0;
+        }
+        references[queue] = reference;
+        return reference;
+    }
+};
+
+#elif defined(CLCUDAAPI_CLPP11_H_)
+
+class CLTraceCLCudaAPITracer : public CLCudaAPI::CommandTracer {
+public:
+    virtual void Command(const std::string &name, const char *category,
+            const cl_command_queue queue, const cl_event event) {
+        try {
+            CLTrace::addCommand(name, category, queue, event);
+        } catch(...) {
+        }
+    }
+};
+
+#else
+#error "include cupp11.h or clpp11.h before CLTraceCLCudaAPI.h"
+#endif
+
+// installs the tracer, for all threads
+inline void traceCLCudaAPI() {
+    static CLTraceCLCudaAPITracer tracer;
+    CLCudaAPI::SetCommandTracer(&tracer);
+}
+
+}
@@ -0,0 +1,67 @@
+// Copyright Hugh Perkins 2013, 2014, 2015, 2016, 2017 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License,
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <vector>
+
+#include "util/Profiler.h"
+
+// Puts the worker threads of rainbowmist::LaunchKernel (rainbowmist.h, the
+// C++11 host path) on the CLTrace timeline, and into the Profiler stats: one
+// zone per worker and launch, on the worker's own track.  Include after
+// rainbowmist.h:
+//
+//   CLTraceLaunchObserver observer("shade");
+//   {
+//       rainbowmist::ScopedLaunchObserver observe(&observer);
+//       rainbowmist::LaunchKernel(kernel, width, height);
+//   }
+//
+// Like any LaunchObserver, it only sees launches from the thread that
+// installed it.  Worker threads other than the launching one are named
+// "LaunchKernel worker".  A worker whose kernel throws gets a zone up to the
+// throw.
+
+namespace easycl {
+
+class CLTraceLaunchObserver : public rainbowmist::LaunchObserver {
+public:
+    explicit CLTraceLaunchObserver(const char *zoneName) : zone(Profiler::zoneId(zoneName)) {
+    }
+    virtual void WorkerBegin(unsigned int threadIndex) {
+        if(threadIndex > 0) {
+            static thread_local bool named = false;
+            if(!named) {
+                Profiler::setThreadName("LaunchKernel worker");
+                named = true;
+            }
+        }
+        workerStarts().push_back(Profiler::now());
+    }
+    virtual void WorkerEnd(unsigned int, unsigned int) {
+        std::vector<uint64_t> &starts = workerStarts();
+        if(starts.empty()) {
+            return;
+        }
+        uint64_t start = starts.back();
+        starts.pop_back();
+        if(Profiler::isEnabled()) {
+            Profiler::addZone(zone, start);
+        }
+    }
+private:
+    int zone;
+
+    // a stack per thread, since a kernel may launch again from inside, on
+    // its own thread
+    static std::vector<uint64_t> &workerStarts() {
+        static thread_local std::vector<uint64_t> starts;
+        return starts;
+    }
+};
+
+}
@@ -8,6 +8,7 @@
 
 #include "CLWrapper.h"
 #include "util/easycl_stringhelper.h"
+#include "util/Profiler.h"
 
 namespace easycl {
 
@@ -15,6 +16,7 @@ CLWrapper::CLWrapper(int N, EasyCL *cl) : N(N), onHost(true), cl(cl) {
     error = CL_SUCCESS;
     onDevice = false;
     deviceDirty = false;
+    deviceWrites = 0;
 }
 CLWrapper::CLWrapper(const CLWrapper &source) :
      N(0), onHost(true)
@@ -67,6 +69,7 @@ void CLWrapper::createOnDevice() {
 //        std::cout << "... created ok" << std::endl;
 }
 void CLWrapper::copyToHost() {
+    EASYCL_PROFILE_ZONE("CLWrapper::copyToHost");
     if(!onDevice) {
         throw std::runtime_error("copyToHost(): not on device");
     }
@@ -74,6 +77,7 @@ void CLWrapper::copyToHost() {
     cl_event event = NULL;
     error = clEnqueueReadBuffer(*(cl->queue), devicearray, CL_TRUE, 0, getElementSize() * N, getHostArray(), 0, NULL, &event);    
     cl->checkError(error);
+    CLTrace::addCommand("copyToHost", "download", *(cl->queue), event);
     cl_int err = clWaitForEvents(1, &event);
     clReleaseEvent(event);
     if (err != CL_SUCCESS) {
@@ -85,14 +89,21 @@ cl_mem CLWrapper::getBuffer() { // be careful!
     return devicearray;
 }
 void CLWrapper::copyToDevice() {
+    EASYCL_PROFILE_ZONE("CLWrapper::copyToDevice");
     if(!onHost) {
         throw std::runtime_error("copyToDevice(): not on host");
     }
     if(!onDevice) {
         createOnDevice();
     }
-    error = clEnqueueWriteBuffer(*(cl->queue), devicearray, CL_TRUE, 0, getElementSize() * N, getHostArrayConst(), 0, NULL, NULL);    
+    cl_event event = NULL;
+    bool traced = CLTrace::isEnabled();
+    error = clEnqueueWriteBuffer(*(cl->queue), devicearray, CL_TRUE, 0, getElementSize() * N, getHostArrayConst(), 0, NULL, traced ? &event : NULL);    
     cl->checkError(error);
+    if(traced) {
+        CLTrace::addCommand("copyToDevice", "upload", *(cl->queue), event);
+        clReleaseEvent(event);
+    }
     deviceDirty = false;
 }
 int CLWrapper::size() {
@@ -109,6 +120,7 @@ bool CLWrapper::isDeviceDirty() {
 }
 void CLWrapper::markDeviceDirty() {
     deviceDirty = true;
+    deviceWrites++;
 }
 void CLWrapper::copyTo(CLWrapper *target) {
     if(size() != target->size()) {
@@ -135,18 +147,18 @@ void CLWrapper::copyTo(CLWrapper *target, int srcOffset, int dstOffset, int coun
     // can assume that we have our data on the device now, because of if check
     // just now
     // we will also assume that destination CLWrapper* is valid
-//    cl_event event = NULL;
+    cl_event event = NULL;
+    bool traced = CLTrace::isEnabled();
     cl_int err = clEnqueueCopyBuffer(*(cl->queue), devicearray, target->devicearray, 
         srcOffset * getElementSize(), dstOffset * getElementSize(), count * getElementSize(),
-        0, NULL, 0);
+        0, NULL, traced ? &event : NULL);
     if (err != CL_SUCCESS) {
         throw std::runtime_error("copyTo failed with " + easycl::toString(err) );
     }
-    else {
-        /* Wait for calculations to be finished. */
-//        err = clWaitForEvents(1, &event);
+    if(traced) {
+        CLTrace::addCommand("copyTo", "copy", *(cl->queue), event);
+        clReleaseEvent(event);
     }
-//    clReleaseEvent(event);
     target->markDeviceDirty();
 }
 }
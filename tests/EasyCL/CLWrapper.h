@@ -14,14 +14,18 @@ namespace easycl {
 //class cl_mem;
 //class cl_int;
 class EasyCL;
+class CLCoherentBuffer;
 
 class EasyCL_EXPORT CLWrapper {
+    friend class CLCoherentBuffer;
 protected:
     const int N;
     const bool onHost;
     bool onDevice;
 
     bool deviceDirty; // have we updated the device copy, without copying to host?
+    int deviceWrites; // bumped by markDeviceDirty(), so a CLCoherentBuffer
+                      // notices kernels that wrote the wrapper directly
 
     cl_mem devicearray;
     EasyCL *cl; // NOT owned by this object, so dont free!
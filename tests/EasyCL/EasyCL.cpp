@@ -4,8 +4,11 @@
 // v. 2.0. If a copy of the MPL was not distributed with this file, You can 
 // obtain one at http://mozilla.org/MPL/2.0/.
 
+#include <cstdio>
 #include <cstring>
 #include <stdexcept>
+#include <functional>
+#include <memory>
 using namespace std;
 
 #ifdef USE_CLEW
@@ -26,7 +29,11 @@ using namespace std;
 #include "CLFloatWrapperConst.h"
 #include "CLWrapper.h"
 #include "CLKernel.h"
+#include "CLBufferPool.h"
+#include "CLProgram.h"
+#include "CLBuildQueue.h"
 #include "util/easycl_stringhelper.h"
+#include "util/Profiler.h"
 
 namespace easycl {
 
@@ -63,6 +70,11 @@ void EasyCL::commonConstructor(cl_platform_id platform_id, cl_device_id device,
     queue = 0;
     context = 0;
     profilingOn = false;
+    bufferPool = 0;
+    programCacheHits = 0;
+    programCacheMisses = 0;
+    buildQueue = 0;
+    buildThreads = 0;
 
     #ifdef USE_CLEW
         bool clpresent = 0 == clewInit();
@@ -94,6 +106,7 @@ void EasyCL::commonConstructor(cl_platform_id platform_id, cl_device_id device,
        throw std::runtime_error("Error creating OpenCL command queue, OpenCL errorcode: " + errorMessage(error));
     }
     default_queue = new CLQueue(this, *queue);
+    bufferPool = new CLBufferPool(this);
 }
 
 EasyCL::EasyCL(cl_platform_id platform_id, cl_device_id device, bool verbose) {
@@ -282,6 +295,11 @@ void EasyCL::init(int gpuIndex, bool verbose) {
 
     queue = 0;
     context = 0;
+    bufferPool = 0;
+    programCacheHits = 0;
+    programCacheMisses = 0;
+    buildQueue = 0;
+    buildThreads = 0;
 
     // Platform
     cl_uint num_platforms;
@@ -325,6 +343,7 @@ void EasyCL::init(int gpuIndex, bool verbose) {
     if (error != CL_SUCCESS) {
        throw std::runtime_error("Error creating OpenCL command queue, OpenCL errorcode: " + errorMessage(error));
     }
+    bufferPool = new CLBufferPool(this);
 }
 
 EasyCL::~EasyCL() {
@@ -339,6 +358,12 @@ EasyCL::~EasyCL() {
       delete *it;
     }
 
+    // pooled buffers and programs belong to our context, so free them before releasing it
+    delete bufferPool;
+    delete buildQueue; // waits for pending builds
+    buildQueue = 0;
+    clearProgramCache();
+
 //        clReleaseProgram(program);
     if(queue != 0) {
 //        cout << "releasing OpenCL command queue" << endl;
@@ -356,6 +381,10 @@ CLQueue *EasyCL::newQueue() {
     return new CLQueue(this);
 }
 
+CLBufferPool *EasyCL::getBufferPool() {
+    return bufferPool;
+}
+
 CLArrayFloat *EasyCL::arrayFloat(int N) {
     return new CLArrayFloat(N, this);
 }
@@ -391,6 +420,99 @@ CLKernel *EasyCL::buildKernel(string kernelfilepath, string kernelname, string o
 }
 
 CLKernel *EasyCL::buildKernelFromString(string source, string kernelname, string options, string sourcefilename, bool quiet) {
+    CLProgram *program = buildProgramFromString(source, options, sourcefilename, quiet);
+    if(!program->hasKernel(kernelname)) {
+        std::string exceptionMessage = "Invalid kernel name, code -46, kernel " + kernelname + "\n" + program->getBuildLog();
+        if(quiet) {
+            cout << program->getBuildLog() << std::endl;
+        }
+        cout << "kernel build error:\n" << exceptionMessage << endl;
+        std::string failedFile = saveFailedKernel(source, options);
+        cout << "storing failed kernel into: " << failedFile << endl;
+        exceptionMessage += "storing failed kernel into: " + failedFile + "\n";
+        throw std::runtime_error(exceptionMessage);
+    }
+    return program->getKernel(kernelname, sourcefilename);
+}
+
+CLProgram *EasyCL::buildProgram(string kernelfilepath, string options, bool quiet) {
+    std::string source = getFileContents(kernelfilepath);
+    return buildProgramFromString(source, options, kernelfilepath, quiet);
+}
+
+CLProgram *EasyCL::buildProgramFromString(string source, string options, string sourcefilename, bool quiet) {
+    return startProgramBuild(source, options, sourcefilename, quiet, false).get();
+}
+
+std::shared_future<CLProgram *> EasyCL::buildProgramAsync(string kernelfilepath, string options) {
+    std::string source = getFileContents(kernelfilepath);
+    return buildProgramFromStringAsync(source, options, kernelfilepath);
+}
+
+std::shared_future<CLProgram *> EasyCL::buildProgramFromStringAsync(string source, string options, string sourcefilename) {
+    return startProgramBuild(source, options, sourcefilename, false, true);
+}
+
+// returns the cached program, or the pending build, or starts a new build,
+// on the build queue if async, otherwise on this thread
+std::shared_future<CLProgram *> EasyCL::startProgramBuild(string source, string options, string sourcefilename, bool quiet, bool async) {
+    std::string key = options + '\0' + source;
+    std::shared_ptr< std::promise<CLProgram *> > promise(new std::promise<CLProgram *>());
+    std::shared_future<CLProgram *> future = promise->get_future().share();
+    {
+        std::lock_guard<std::mutex> lock(programCacheMutex);
+        map< string, CLProgram * >::iterator it = programBySourceAndOptions.find(key);
+        if(it != programBySourceAndOptions.end()) {
+            programCacheHits++;
+            promise->set_value(it->second);
+            return future;
+        }
+        map< string, std::shared_future<CLProgram *> >::iterator pendingIt = pendingProgramBySourceAndOptions.find(key);
+        if(pendingIt != pendingProgramBySourceAndOptions.end()) {
+            programCacheHits++;
+            return pendingIt->second;
+        }
+        programCacheMisses++;
+        pendingProgramBySourceAndOptions[key] = future;
+        if(async && buildQueue == 0) {
+            buildQueue = new CLBuildQueue(buildThreads);
+        }
+    }
+    std::function<void()> build = [this, promise, key, source, options, sourcefilename, quiet]() {
+        CLProgram *program = 0;
+        try {
+            program = compileProgram(source, options, sourcefilename, quiet);
+            program->getKernelNames(); // creates the kernels here too, off the calling thread
+        } catch(...) {
+            delete program;
+            {
+                std::lock_guard<std::mutex> lock(programCacheMutex);
+                pendingProgramBySourceAndOptions.erase(key);
+            }
+            promise->set_exception(std::current_exception());
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(programCacheMutex);
+            programBySourceAndOptions[key] = program;
+            pendingProgramBySourceAndOptions.erase(key);
+        }
+        promise->set_value(program);
+    };
+    if(async) {
+        buildQueue->push(build);
+    } else {
+        build();
+    }
+    return future;
+}
+
+// builds the program, without looking at the cache.  Might be called on a
+// build queue thread, so dont touch any EasyCL members other than
+// context and device
+CLProgram *EasyCL::compileProgram(string source, string options, string sourcefilename, bool quiet) {
+    EASYCL_PROFILE_ZONE("EasyCL::compileProgram");
+    cl_int error;
     size_t src_size = 0;
     const char *source_char = source.c_str();
     src_size = strlen(source_char);
@@ -400,7 +522,7 @@ CLKernel *EasyCL::buildKernelFromString(string source, string kernelname, string
 
 //    error = clBuildProgram(program, 1, &device, "-cl-opt-disable", NULL, NULL);
 //    std::cout << "options: [" << options.c_str() << "]" << std::endl;
-    error = clBuildProgram(program, 1, &device, options.c_str(), NULL, NULL);
+    cl_int buildError = clBuildProgram(program, 1, &device, options.c_str(), NULL, NULL);
 
     char* build_log;
     size_t log_size;
@@ -418,37 +540,79 @@ CLKernel *EasyCL::buildKernelFromString(string source, string kernelname, string
         }
     }
     delete[] build_log;
-    checkError(error);
 
-    cl_kernel kernel = clCreateKernel(program, kernelname.c_str(), &error);
-    if(error != CL_SUCCESS) {
-        std::string exceptionMessage = "";
-        switch(error) {
-            case -46:
-                exceptionMessage = "Invalid kernel name, code -46, kernel " + kernelname + "\n" + buildLogMessage;
-                break;
-            default:
-                exceptionMessage = "Something went wrong with clCreateKernel, OpenCL error code " + toString(error) + "\n" + buildLogMessage;
-                break;
-        }
+    if(buildError != CL_SUCCESS) {
+        clReleaseProgram(program);
+        std::string exceptionMessage = "Program build failure, OpenCL error code " + toString(buildError) + "\n" + buildLogMessage;
         if(quiet) {
             cout << buildLogMessage << std::endl;
         }
         cout << "kernel build error:\n" << exceptionMessage << endl;
-        cout << "storing failed kernel into: easycl-failedkernel.cl" << endl;
-        exceptionMessage += "storing failed kernel into: easycl-failedkernel.cl\n";
-
-        ofstream f;
-        f.open("easycl-failedkernel.cl", ios_base::out);
-        f << source << endl;
-        f.close();
+        std::string failedFile = saveFailedKernel(source, options);
+        cout << "storing failed kernel into: " << failedFile << endl;
+        exceptionMessage += "storing failed kernel into: " + failedFile + "\n";
         throw std::runtime_error(exceptionMessage);
     }
-    checkError(error);
-//    clReleaseProgram(program);
-    CLKernel *newkernel = new CLKernel(this, sourcefilename, kernelname, source, program, kernel);
-    newkernel->buildLog = buildLogMessage;
-    return newkernel;
+
+    return new CLProgram(this, program, source, options, sourcefilename, buildLogMessage);
+}
+
+int EasyCL::warmUp(string manifestfilepath) {
+    std::string manifest = getFileContents(manifestfilepath);
+    istringstream lines(manifest);
+    string line;
+    int numBuilds = 0;
+    while(getline(lines, line)) {
+        size_t start = line.find_first_not_of(" \t\r");
+        if(start == string::npos || line[start] == '#') {
+            continue;
+        }
+        size_t end = line.find_first_of(" \t\r", start);
+        string kernelfilepath = line.substr(start, end == string::npos ? string::npos : end - start);
+        string options = "";
+        if(end != string::npos) {
+            size_t optionsStart = line.find_first_not_of(" \t\r", end);
+            size_t optionsEnd = line.find_last_not_of(" \t\r");
+            if(optionsStart != string::npos) {
+                options = line.substr(optionsStart, optionsEnd + 1 - optionsStart);
+            }
+        }
+        buildProgramAsync(kernelfilepath, options);
+        numBuilds++;
+    }
+    return numBuilds;
+}
+
+void EasyCL::waitForBuilds() {
+    if(buildQueue != 0) {
+        buildQueue->waitAll();
+    }
+}
+
+void EasyCL::setBuildThreads(int numThreads) {
+    if(buildQueue != 0) {
+        throw std::runtime_error("setBuildThreads must be called before the first async build");
+    }
+    buildThreads = numThreads;
+}
+
+void EasyCL::clearProgramCache() {
+    waitForBuilds();
+    std::lock_guard<std::mutex> lock(programCacheMutex);
+    for(map< string, CLProgram * >::iterator it = programBySourceAndOptions.begin(); it != programBySourceAndOptions.end(); it++) {
+        delete it->second;
+    }
+    programBySourceAndOptions.clear();
+}
+
+int64_t EasyCL::getProgramCacheHits() {
+    std::lock_guard<std::mutex> lock(programCacheMutex);
+    return programCacheHits;
+}
+
+int64_t EasyCL::getProgramCacheMisses() {
+    std::lock_guard<std::mutex> lock(programCacheMutex);
+    return programCacheMisses;
 }
 
 bool EasyCL::isOpenCLAvailable() {
@@ -482,6 +646,11 @@ int EasyCL::getNextPower2(int value){
 } // eg pass in 320, it will return: 512
 
 void EasyCL::gpu(int gpuIndex) {
+    delete bufferPool;
+    bufferPool = 0;
+    delete buildQueue;
+    buildQueue = 0;
+    clearProgramCache();
     if(queue != 0) {
         clReleaseCommandQueue(*queue);
         delete queue;
@@ -581,6 +750,28 @@ void EasyCL::checkError(cl_int error) {
     }
 }
 
+std::string EasyCL::saveFailedKernel(std::string source, std::string options) {
+    // 64-bit FNV-1a, as for NativeTemplatedKernel
+    unsigned long long hash = 14695981039346656037ULL;
+    std::string key = options + "\n" + source;
+    for(size_t i = 0; i < key.size(); i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 1099511628211ULL;
+    }
+    char hashString[17];
+    snprintf(hashString, sizeof(hashString), "%016llx", hash);
+    std::string filename = std::string("easycl-failedkernel-") + hashString + ".cl";
+
+    // identical failures from several threads write the same file
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+    ofstream f;
+    f.open(filename.c_str(), ios_base::out);
+    f << source << endl;
+    f.close();
+    return filename;
+}
+
 std::string EasyCL::getFileContents(std::string filename) {
     std::ifstream t(filename.c_str());
     std::stringstream buffer;
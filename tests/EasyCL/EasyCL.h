@@ -27,6 +27,8 @@
 #include <fstream>
 #include <stdexcept>
 #include <map>
+#include <mutex>
+#include <future>
 
 #include "deviceinfo_helper.h"
 #include "platforminfo_helper.h"
@@ -43,6 +45,9 @@ class CLIntWrapper;
 class CLFloatWrapper;
 class CLFloatWrapperConst;
 class CLUCharWrapper;
+class CLBufferPool;
+class CLProgram;
+class CLBuildQueue;
 
 class EasyCL;
 
@@ -105,6 +110,10 @@ public:
     static EasyCL *createForPlatformDeviceIds(cl_platform_id platformId, cl_device_id deviceId);
     static std::string errorMessage(cl_int error);
     static void checkError(cl_int error);
+    // writes source to easycl-failedkernel-<hash>.cl, named after a hash of
+    // source and options, so concurrent failing builds dont share a file.
+    // Returns the filename
+    static std::string saveFailedKernel(std::string source, std::string options);
 
     void gpu(int gpuIndex);
     void init(int gpuIndex, bool verbose);
@@ -121,6 +130,10 @@ public:
     int getMaxAllocSizeMB();
 
     CLQueue *newQueue(); // you own this, should delete it
+
+    // pool used by CLKernel for input/output/inout(int N, T *data) buffers
+    // owned by this object, dont delete!
+    CLBufferPool *getBufferPool();
     // void destroyQueue()
 
     CLArrayFloat *arrayFloat(int N);
@@ -133,6 +146,30 @@ public:
     CLKernel *buildKernel(std::string kernelfilepath, std::string kernelname, std::string options, bool quiet=false);
     CLKernel *buildKernelFromString(std::string source, std::string kernelname, std::string options, std::string sourcefilename = "", bool quiet=false);
 
+    // builds each (source, options) combination only once per EasyCL object;
+    // then use CLProgram::getKernel for each entry point.  The returned
+    // program is owned by this object, dont delete it.  buildKernel and
+    // buildKernelFromString go through this cache too
+    CLProgram *buildProgram(std::string kernelfilepath, std::string options, bool quiet=false);
+    CLProgram *buildProgramFromString(std::string source, std::string options, std::string sourcefilename = "", bool quiet=false);
+    void clearProgramCache(); // CLKernels already created stay valid; waits for async builds first
+    int64_t getProgramCacheHits();
+    int64_t getProgramCacheMisses(); // ie, number of clBuildProgram calls
+
+    // same as buildProgram, but the build runs on a background thread pool,
+    // and this returns at once.  future.get() waits for it, and rethrows any
+    // build error.  Calling buildProgram/buildKernel for the same source and
+    // options meanwhile waits for this build, rather than starting another
+    std::shared_future<CLProgram *> buildProgramAsync(std::string kernelfilepath, std::string options);
+    std::shared_future<CLProgram *> buildProgramFromStringAsync(std::string source, std::string options, std::string sourcefilename = "");
+    // warm-up manifest: one kernel file per line, followed by its build
+    // options, eg "cl/blur.cl -DRADIUS=3"; blank lines and lines starting
+    // with '#' are ignored.  Starts an async build for each line, and returns
+    // the number of builds started.  Later buildKernel calls pick them up
+    int warmUp(std::string manifestfilepath);
+    void waitForBuilds();
+    void setBuildThreads(int numThreads); // default 0: one per hardware thread
+
     // simple associate-array of kernels, specific to each EasyCL object
     // so we can cache them easily, if we want
     // good to make the cache per-connection, ie per-EasyCL object
@@ -152,11 +189,21 @@ private:
     std::map< std::string, bool >kernelOwnedByName; // should we delete the kernel when we are deleted?
     std::vector< cl_event *> profilingEvents;
     std::vector< std::string > profilingNames;
+    CLBufferPool *bufferPool;
+    std::map< std::string, CLProgram * > programBySourceAndOptions;
+    std::map< std::string, std::shared_future<CLProgram *> > pendingProgramBySourceAndOptions;
+    std::mutex programCacheMutex; // guards the two maps and the two counters
+    int64_t programCacheHits;
+    int64_t programCacheMisses;
+    CLBuildQueue *buildQueue; // created on first async build
+    int buildThreads;
 #ifdef _WIN32
 #pragma warning(default: 4251)
 #endif
 
     static std::string getFileContents(std::string filename);
+    std::shared_future<CLProgram *> startProgramBuild(std::string source, std::string options, std::string sourcefilename, bool quiet, bool async);
+    CLProgram *compileProgram(std::string source, std::string options, std::string sourcefilename, bool quiet);
 //    long getDeviceInfoInt(cl_device_info name);
     int64_t getDeviceInfoInt64(cl_device_info name);
 };
@@ -168,4 +215,11 @@ private:
 #include "CLUCharWrapper.h"
 #include "CLWrapper.h"
 #include "CLKernel.h"
+#include "CLBufferPool.h"
+#include "CLRunHandle.h"
+#include "CLBoundKernel.h"
+#include "CLCoherentBuffer.h"
+#include "CLTrace.h"
+#include "CLProgram.h"
+#include "CLBuildQueue.h"
 #include "DevicesInfo.h"
@@ -0,0 +1,111 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, 
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can 
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+// renders a kernel template with NativeTemplater, so templated kernels can be
+// rendered at build time, and then embedded or stringified like any other
+// kernel:
+//
+//   easycl_rendertemplate <template> <output> [name=value ...]
+//
+// values are an int (`dim=16`), a float (`scale=0.5`), a list
+// (`sizes=[1,2,3]`), or else a string (`type=float`)
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "templates/NativeTemplater.h"
+
+using namespace std;
+using namespace easycl;
+
+static bool isInt(const string &value) {
+    char *end = 0;
+    strtol(value.c_str(), &end, 10);
+    return value != "" && *end == '\0';
+}
+static bool isFloat(const string &value) {
+    char *end = 0;
+    strtod(value.c_str(), &end);
+    return value != "" && *end == '\0';
+}
+static void setValue(NativeTemplater *templater, const string &name, const string &value) {
+    if(value.size() >= 2 && value[0] == '[' && value[value.size() - 1] == ']') {
+        vector<string> items;
+        istringstream ss(value.substr(1, value.size() - 2));
+        string item;
+        bool allInts = true;
+        bool allFloats = true;
+        while(getline(ss, item, ',')) {
+            items.push_back(item);
+            allInts = allInts && isInt(item);
+            allFloats = allFloats && isFloat(item);
+        }
+        if(allInts) {
+            vector<int> ints;
+            for(int i = 0; i < (int)items.size(); i++) {
+                ints.push_back(atoi(items[i].c_str()));
+            }
+            templater->set(name, ints);
+        } else if(allFloats) {
+            vector<float> floats;
+            for(int i = 0; i < (int)items.size(); i++) {
+                floats.push_back((float)atof(items[i].c_str()));
+            }
+            templater->set(name, floats);
+        } else {
+            templater->set(name, items);
+        }
+    } else if(isInt(value)) {
+        templater->set(name, atoi(value.c_str()));
+    } else if(isFloat(value)) {
+        templater->set(name, (float)atof(value.c_str()));
+    } else {
+        templater->set(name, value);
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if(argc < 3) {
+        cout << "Usage: " << argv[0] << " <template> <output> [name=value ...]" << endl;
+        return -1;
+    }
+    NativeTemplater templater;
+    for(int i = 3; i < argc; i++) {
+        string arg = argv[i];
+        size_t equalsPos = arg.find('=');
+        if(equalsPos == string::npos || equalsPos == 0) {
+            cout << "expected name=value, got: " << arg << endl;
+            return -1;
+        }
+        setValue(&templater, arg.substr(0, equalsPos), arg.substr(equalsPos + 1));
+    }
+    ifstream in(argv[1], ios::in | ios::binary);
+    if(!in) {
+        cout << "couldnt open " << argv[1] << endl;
+        return -1;
+    }
+    stringstream source;
+    source << in.rdbuf();
+    string rendered = "";
+    try {
+        rendered = templater.render(source.str());
+    } catch(runtime_error &e) {
+        cout << argv[1] << ": " << e.what() << endl;
+        return -1;
+    }
+    ofstream out(argv[2], ios::out | ios::binary);
+    out << rendered;
+    if(!out) {
+        cout << "couldnt write " << argv[2] << endl;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,89 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, 
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can 
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include "EasyCL.h"
+#include "templates/NativeTemplater.h"
+#include "NativeTemplatedKernel.h"
+
+using namespace std;
+
+namespace easycl {
+NativeTemplatedKernel::NativeTemplatedKernel(EasyCL *cl) :
+        cl(cl) {
+    templater = new NativeTemplater();
+}
+NativeTemplatedKernel::~NativeTemplatedKernel() {
+    delete templater;
+}
+NativeTemplatedKernel &NativeTemplatedKernel::set(std::string name, int value) {
+    templater->set(name, value);
+    return *this;
+}
+NativeTemplatedKernel &NativeTemplatedKernel::set(std::string name, float value) {
+    templater->set(name, value);
+    return *this;
+}
+NativeTemplatedKernel &NativeTemplatedKernel::set(std::string name, std::string value) {
+    templater->set(name, value);
+    return *this;
+}
+NativeTemplatedKernel &NativeTemplatedKernel::set(std::string name, std::vector< std::string > &value) {
+    templater->set(name, value);
+    return *this;
+}
+NativeTemplatedKernel &NativeTemplatedKernel::set(std::string name, std::vector< int > &value) {
+    templater->set(name, value);
+    return *this;
+}
+NativeTemplatedKernel &NativeTemplatedKernel::set(std::string name, std::vector< float > &value) {
+    templater->set(name, value);
+    return *this;
+}
+// 64-bit FNV-1a of the rendered source, so different parameters that render
+// to the same source share one kernel
+std::string NativeTemplatedKernel::getStoreName(std::string filename, std::string renderedSource, std::string kernelName) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for(size_t i = 0; i < renderedSource.size(); i++) {
+        hash ^= (unsigned char)renderedSource[i];
+        hash *= 1099511628211ULL;
+    }
+    char hashString[17];
+    snprintf(hashString, sizeof(hashString), "%016llx", hash);
+    return kernelName + "@" + filename + "#" + hashString;
+}
+CLKernel *NativeTemplatedKernel::buildKernel(std::string filename, std::string templateSource, std::string kernelName) {
+    string renderedKernel = templater->render(templateSource);
+    string storeName = getStoreName(filename, renderedKernel, kernelName);
+    if(cl->kernelExists(storeName)) {
+        return cl->getKernel(storeName);
+    }
+    CLKernel *kernel = cl->buildKernelFromString(renderedKernel, kernelName, "", filename);
+    cl->storeKernel(storeName, kernel, true);
+    return kernel;
+}
+CLKernel *NativeTemplatedKernel::buildKernel(std::string uniqueName, std::string filename, std::string templateSource, std::string kernelName) {
+    return buildKernel(uniqueName, filename, templateSource, kernelName, true);
+}
+// do NOT delete the returned kernel when useKernelStore is true, cl owns it
+CLKernel *NativeTemplatedKernel::buildKernel(std::string uniqueName, std::string filename, std::string templateSource, std::string kernelName, bool useKernelStore) {
+    if(useKernelStore && cl->kernelExists(uniqueName)) {
+        return cl->getKernel(uniqueName);
+    }
+    string renderedKernel = templater->render(templateSource);
+    CLKernel *kernel = cl->buildKernelFromString(renderedKernel, kernelName, "", filename);
+    if(useKernelStore) {
+        cl->storeKernel(uniqueName, kernel, true);
+    }
+    return kernel;
+}
+// this is mostly for debugging purposes really
+std::string NativeTemplatedKernel::getRenderedKernel(std::string templateSource) {
+    return templater->render(templateSource);
+}
+}
@@ -0,0 +1,54 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, 
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can 
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "EasyCL_export.h"
+
+namespace easycl {
+
+class EasyCL;
+class CLKernel;
+class NativeTemplater;
+
+// same as TemplatedKernel, but renders with NativeTemplater, so no Lua
+// interpreter is needed.
+// Built kernels go into the kernel store of `cl`, so building again with the
+// same template parameters returns the kernel that was already built.  Do
+// NOT delete the returned kernels, cl owns them.
+class EasyCL_EXPORT NativeTemplatedKernel {
+public:
+    EasyCL *cl;
+    NativeTemplater *templater;
+
+    NativeTemplatedKernel(EasyCL *cl);
+    ~NativeTemplatedKernel();
+    NativeTemplatedKernel &set(std::string name, int value);
+    NativeTemplatedKernel &set(std::string name, float value);
+    NativeTemplatedKernel &set(std::string name, std::string value);
+    NativeTemplatedKernel &set(std::string name, std::vector< std::string > &value);
+    NativeTemplatedKernel &set(std::string name, std::vector< int > &value);
+    NativeTemplatedKernel &set(std::string name, std::vector< float > &value);
+
+    // stores the kernel under a name made from kernelName, filename, and a
+    // hash of the rendered source, so no unique name is needed
+    CLKernel *buildKernel(std::string filename, std::string templateSource, std::string kernelName);
+    CLKernel *buildKernel(std::string uniqueName, std::string filename, std::string templateSource, std::string kernelName);
+    CLKernel *buildKernel(std::string uniqueName, std::string filename, std::string templateSource, std::string kernelName, bool useKernelStore);
+    std::string getRenderedKernel(std::string templateSource);
+
+    // name buildKernel(filename, templateSource, kernelName) stores a kernel under
+    static std::string getStoreName(std::string filename, std::string renderedSource, std::string kernelName);
+
+private:
+    NativeTemplatedKernel(const NativeTemplatedKernel &);
+    NativeTemplatedKernel &operator=(const NativeTemplatedKernel &);
+};
+}
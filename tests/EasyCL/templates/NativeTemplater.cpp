@@ -0,0 +1,933 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, 
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can 
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "NativeTemplater.h"
+
+using namespace std;
+
+namespace easycl {
+namespace nativetemplater {
+
+struct Value {
+    enum Type { NIL, BOOLEAN, NUMBER, STRING, LIST };
+    Type type;
+    bool boolean;
+    double number;
+    string str;
+    vector<Value> list;
+
+    Value() : type(NIL), boolean(false), number(0) {}
+    static Value fromBoolean(bool b) { Value v; v.type = BOOLEAN; v.boolean = b; return v; }
+    static Value fromNumber(double n) { Value v; v.type = NUMBER; v.number = n; return v; }
+    static Value fromString(const string &s) { Value v; v.type = STRING; v.str = s; return v; }
+
+    bool isTrue() const {
+        return !(type == NIL || (type == BOOLEAN && !boolean));
+    }
+};
+
+// same format as Lua 5.1 uses for numbers (LUAI_NUMFFORMAT)
+static string numberToString(double value) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.14g", value);
+    return buf;
+}
+static bool stringToNumber(const string &s, double *value) {
+    const char *start = s.c_str();
+    char *end = 0;
+    double result = strtod(start, &end);
+    if(end == start) {
+        return false;
+    }
+    while(*end == ' ' || *end == '\t' || *end == '\n' || *end == '\r') {
+        end++;
+    }
+    if(*end != '\0') {
+        return false;
+    }
+    *value = result;
+    return true;
+}
+static const char *typeName(const Value &value) {
+    switch(value.type) {
+        case Value::NIL: return "nil";
+        case Value::BOOLEAN: return "boolean";
+        case Value::NUMBER: return "number";
+        case Value::STRING: return "string";
+        case Value::LIST: return "table";
+    }
+    return "?";
+}
+
+// ---------------------------------------------------------------------
+// tokens
+//
+// The whole template becomes one token stream: text outside the blocks is
+// a TEXT token, `{{ expr }}` becomes EMIT_BEGIN, the expression tokens,
+// EMIT_END, and `{% code %}` just its tokens.  So a `for` can start in one
+// `{% %}` block and `end` in another, as in Lua.
+
+enum TokenType { TEXT, EMIT_BEGIN, EMIT_END, NAME, NUMBER, STRING, OP, END_OF_TEMPLATE };
+
+struct Token {
+    TokenType type;
+    string text;
+    double number;
+    Token(TokenType type, const string &text) : type(type), text(text), number(0) {}
+};
+
+static void tokenizeCode(const string &code, vector<Token> *tokens) {
+    size_t pos = 0;
+    const size_t n = code.size();
+    while(pos < n) {
+        char c = code[pos];
+        if(c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            pos++;
+        } else if(c == '-' && pos + 1 < n && code[pos + 1] == '-') {
+            if(pos + 2 < n && code[pos + 2] == '[') {
+                throw runtime_error("NativeTemplater: long comments not supported");
+            }
+            while(pos < n && code[pos] != '\n') {
+                pos++;
+            }
+        } else if(isalpha((unsigned char)c) || c == '_') {
+            size_t start = pos;
+            while(pos < n && (isalnum((unsigned char)code[pos]) || code[pos] == '_')) {
+                pos++;
+            }
+            tokens->push_back(Token(NAME, code.substr(start, pos - start)));
+        } else if(isdigit((unsigned char)c) || (c == '.' && pos + 1 < n && isdigit((unsigned char)code[pos + 1]))) {
+            const char *start = code.c_str() + pos;
+            char *end = 0;
+            double value = strtod(start, &end);
+            Token token(NUMBER, string(start, end - start));
+            token.number = value;
+            tokens->push_back(token);
+            pos += end - start;
+        } else if(c == '\'' || c == '"') {
+            string value = "";
+            pos++;
+            while(pos < n && code[pos] != c) {
+                if(code[pos] == '\\' && pos + 1 < n) {
+                    pos++;
+                    switch(code[pos]) {
+                        case 'n': value += '\n'; break;
+                        case 't': value += '\t'; break;
+                        case 'r': value += '\r'; break;
+                        default: value += code[pos]; break;
+                    }
+                } else {
+                    value += code[pos];
+                }
+                pos++;
+            }
+            if(pos >= n) {
+                throw runtime_error("NativeTemplater: unfinished string");
+            }
+            pos++;
+            tokens->push_back(Token(STRING, value));
+        } else {
+            static const char *ops[] = { "...", "==", "~=", "<=", ">=", "..", 0 };
+            string op = "";
+            for(int i = 0; ops[i] != 0; i++) {
+                if(code.compare(pos, strlen(ops[i]), ops[i]) == 0) {
+                    op = ops[i];
+                    break;
+                }
+            }
+            if(op == "") {
+                if(string("+-*/%^#<>=()[]{},;.:").find(c) == string::npos) {
+                    throw runtime_error(string("NativeTemplater: unexpected character '") + c + "'");
+                }
+                op = string(1, c);
+            }
+            if(op == "[" && pos + 1 < n && (code[pos + 1] == '[' || code[pos + 1] == '=')) {
+                throw runtime_error("NativeTemplater: long strings not supported");
+            }
+            tokens->push_back(Token(OP, op));
+            pos += op.size();
+        }
+    }
+}
+
+// same splitting as templater.lua: the earliest of `{{` and `{%` starts a
+// block, which ends at the next `}}` or `%}`
+static vector<Token> tokenizeTemplate(const string &source) {
+    vector<Token> tokens;
+    size_t pos = 0;
+    while(pos < source.size()) {
+        size_t exprPos = source.find("{{", pos);
+        size_t codePos = source.find("{%", pos);
+        size_t blockPos = exprPos < codePos ? exprPos : codePos;
+        if(blockPos == string::npos) {
+            break;
+        }
+        if(blockPos > pos) {
+            tokens.push_back(Token(TEXT, source.substr(pos, blockPos - pos)));
+        }
+        bool isExpr = blockPos == exprPos;
+        size_t endPos = source.find(isExpr ? "}}" : "%}", blockPos + 2);
+        if(endPos == string::npos) {
+            throw runtime_error(string("NativeTemplater: End tag ('") + (isExpr ? "}}" : "%}") + "') missing");
+        }
+        string code = source.substr(blockPos + 2, endPos - blockPos - 2);
+        if(isExpr) {
+            tokens.push_back(Token(EMIT_BEGIN, "{{"));
+            tokenizeCode(code, &tokens);
+            tokens.push_back(Token(EMIT_END, "}}"));
+        } else {
+            tokenizeCode(code, &tokens);
+        }
+        pos = endPos + 2;
+    }
+    if(pos < source.size()) {
+        tokens.push_back(Token(TEXT, source.substr(pos)));
+    }
+    tokens.push_back(Token(END_OF_TEMPLATE, "<end of template>"));
+    return tokens;
+}
+
+// ---------------------------------------------------------------------
+// syntax tree
+
+struct Node {
+    enum Kind {
+        // statements
+        BLOCK, TEXT_OUT, EMIT, ASSIGN, LOCAL_ASSIGN, NUMERIC_FOR, LIST_FOR, IF,
+        // expressions
+        LITERAL, VARIABLE, INDEX, UNARY, BINARY, AND, OR, CALL
+    };
+    Kind kind;
+    string text; // text, variable name, operator, or function name
+    string name2; // value name of `for k,v in ipairs()`
+    Value literal;
+    vector< shared_ptr<Node> > children;
+
+    Node(Kind kind) : kind(kind) {}
+};
+typedef shared_ptr<Node> NodePtr;
+
+class Parser {
+public:
+    Parser(const vector<Token> &tokens) : tokens(tokens), pos(0) {}
+
+    NodePtr parseTemplate() {
+        NodePtr block = parseBlock();
+        if(peek().type != END_OF_TEMPLATE) {
+            fail("unexpected '" + peek().text + "'");
+        }
+        return block;
+    }
+
+private:
+    const vector<Token> &tokens;
+    size_t pos;
+
+    const Token &peek() { return tokens[pos]; }
+    const Token &next() { return tokens[pos++]; }
+    bool isOp(const string &op) { return peek().type == OP && peek().text == op; }
+    bool isKeyword(const string &name) { return peek().type == NAME && peek().text == name; }
+    void fail(const string &message) {
+        throw runtime_error("NativeTemplater: " + message);
+    }
+    void expectOp(const string &op) {
+        if(!isOp(op)) {
+            fail("expected '" + op + "' near '" + peek().text + "'");
+        }
+        pos++;
+    }
+    void expectKeyword(const string &name) {
+        if(!isKeyword(name)) {
+            fail("expected '" + name + "' near '" + peek().text + "'");
+        }
+        pos++;
+    }
+    string expectName() {
+        if(peek().type != NAME) {
+            fail("expected a name near '" + peek().text + "'");
+        }
+        return next().text;
+    }
+    bool atBlockEnd() {
+        return peek().type == END_OF_TEMPLATE || isKeyword("end") || isKeyword("else") || isKeyword("elseif");
+    }
+
+    NodePtr parseBlock() {
+        NodePtr block(new Node(Node::BLOCK));
+        while(!atBlockEnd()) {
+            NodePtr statement = parseStatement();
+            if(statement) {
+                block->children.push_back(statement);
+            }
+        }
+        return block;
+    }
+
+    NodePtr parseStatement() {
+        const Token &token = peek();
+        if(token.type == TEXT) {
+            NodePtr node(new Node(Node::TEXT_OUT));
+            node->text = next().text;
+            return node;
+        }
+        if(token.type == EMIT_BEGIN) {
+            next();
+            NodePtr node(new Node(Node::EMIT));
+            node->children.push_back(parseExpression());
+            if(peek().type != EMIT_END) {
+                fail("expected '}}' near '" + peek().text + "'");
+            }
+            next();
+            return node;
+        }
+        if(isOp(";")) {
+            next();
+            return NodePtr();
+        }
+        if(isKeyword("for")) {
+            return parseFor();
+        }
+        if(isKeyword("if")) {
+            return parseIf();
+        }
+        bool isLocal = false;
+        if(isKeyword("local")) {
+            next();
+            isLocal = true;
+        }
+        if(token.type == NAME) {
+            string name = next().text;
+            if(isOp("=")) {
+                next();
+                NodePtr node(new Node(isLocal ? Node::LOCAL_ASSIGN : Node::ASSIGN));
+                node->text = name;
+                node->children.push_back(parseExpression());
+                return node;
+            }
+            fail("unsupported statement near '" + name + "' (only for, if and assignments are supported)");
+        }
+        fail("unexpected '" + token.text + "'");
+        return NodePtr();
+    }
+
+    NodePtr parseFor() {
+        expectKeyword("for");
+        string name = expectName();
+        if(isOp("=")) {
+            next();
+            NodePtr node(new Node(Node::NUMERIC_FOR));
+            node->text = name;
+            node->children.push_back(parseExpression());
+            expectOp(",");
+            node->children.push_back(parseExpression());
+            if(isOp(",")) {
+                next();
+                node->children.push_back(parseExpression());
+            }
+            expectKeyword("do");
+            node->children.push_back(parseBlock());
+            expectKeyword("end");
+            return node;
+        }
+        NodePtr node(new Node(Node::LIST_FOR));
+        node->text = name;
+        expectOp(",");
+        node->name2 = expectName();
+        expectKeyword("in");
+        string iterator = expectName();
+        if(iterator != "ipairs" && iterator != "pairs") {
+            fail("only ipairs and pairs are supported in for ... in");
+        }
+        expectOp("(");
+        node->children.push_back(parseExpression());
+        expectOp(")");
+        expectKeyword("do");
+        node->children.push_back(parseBlock());
+        expectKeyword("end");
+        return node;
+    }
+
+    // children: condition, block, condition, block, ..., [else block]
+    NodePtr parseIf() {
+        expectKeyword("if");
+        NodePtr node(new Node(Node::IF));
+        node->children.push_back(parseExpression());
+        expectKeyword("then");
+        node->children.push_back(parseBlock());
+        while(isKeyword("elseif")) {
+            next();
+            node->children.push_back(parseExpression());
+            expectKeyword("then");
+            node->children.push_back(parseBlock());
+        }
+        if(isKeyword("else")) {
+            next();
+            node->children.push_back(parseBlock());
+        }
+        expectKeyword("end");
+        return node;
+    }
+
+    NodePtr makeBinary(Node::Kind kind, const string &op, NodePtr left, NodePtr right) {
+        NodePtr node(new Node(kind));
+        node->text = op;
+        node->children.push_back(left);
+        node->children.push_back(right);
+        return node;
+    }
+
+    // precedence, lowest first, as in Lua 5.1:
+    // or; and; comparison; ..(right); + -; * / %; unary; ^(right)
+    NodePtr parseExpression() {
+        NodePtr left = parseAnd();
+        while(isKeyword("or")) {
+            next();
+            left = makeBinary(Node::OR, "or", left, parseAnd());
+        }
+        return left;
+    }
+    NodePtr parseAnd() {
+        NodePtr left = parseComparison();
+        while(isKeyword("and")) {
+            next();
+            left = makeBinary(Node::AND, "and", left, parseComparison());
+        }
+        return left;
+    }
+    NodePtr parseComparison() {
+        NodePtr left = parseConcat();
+        while(isOp("==") || isOp("~=") || isOp("<") || isOp(">") || isOp("<=") || isOp(">=")) {
+            string op = next().text;
+            left = makeBinary(Node::BINARY, op, left, parseConcat());
+        }
+        return left;
+    }
+    NodePtr parseConcat() {
+        NodePtr left = parseAdditive();
+        if(isOp("..")) {
+            next();
+            return makeBinary(Node::BINARY, "..", left, parseConcat());
+        }
+        return left;
+    }
+    NodePtr parseAdditive() {
+        NodePtr left = parseMultiplicative();
+        while(isOp("+") || isOp("-")) {
+            string op = next().text;
+            left = makeBinary(Node::BINARY, op, left, parseMultiplicative());
+        }
+        return left;
+    }
+    NodePtr parseMultiplicative() {
+        NodePtr left = parseUnary();
+        while(isOp("*") || isOp("/") || isOp("%")) {
+            string op = next().text;
+            left = makeBinary(Node::BINARY, op, left, parseUnary());
+        }
+        return left;
+    }
+    NodePtr parseUnary() {
+        if(isKeyword("not") || isOp("-") || isOp("#")) {
+            NodePtr node(new Node(Node::UNARY));
+            node->text = next().text;
+            node->children.push_back(parseUnary());
+            return node;
+        }
+        return parsePower();
+    }
+    NodePtr parsePower() {
+        NodePtr left = parsePrimary();
+        if(isOp("^")) {
+            next();
+            return makeBinary(Node::BINARY, "^", left, parseUnary());
+        }
+        return left;
+    }
+    NodePtr parsePrimary() {
+        const Token &token = peek();
+        if(token.type == NUMBER) {
+            NodePtr node(new Node(Node::LITERAL));
+            node->literal = Value::fromNumber(next().number);
+            return node;
+        }
+        if(token.type == STRING) {
+            NodePtr node(new Node(Node::LITERAL));
+            node->literal = Value::fromString(next().text);
+            return node;
+        }
+        if(isKeyword("true") || isKeyword("false") || isKeyword("nil")) {
+            NodePtr node(new Node(Node::LITERAL));
+            string name = next().text;
+            if(name != "nil") {
+                node->literal = Value::fromBoolean(name == "true");
+            }
+            return node;
+        }
+        if(isOp("(")) {
+            next();
+            NodePtr node = parseExpression();
+            expectOp(")");
+            return node;
+        }
+        if(token.type == NAME) {
+            string name = next().text;
+            if(isOp(".")) {
+                next();
+                name += "." + expectName();
+            }
+            NodePtr node;
+            if(isOp("(")) {
+                next();
+                node.reset(new Node(Node::CALL));
+                node->text = name;
+                if(!isOp(")")) {
+                    node->children.push_back(parseExpression());
+                    while(isOp(",")) {
+                        next();
+                        node->children.push_back(parseExpression());
+                    }
+                }
+                expectOp(")");
+            } else {
+                if(name.find('.') != string::npos) {
+                    fail("unsupported field access '" + name + "'");
+                }
+                node.reset(new Node(Node::VARIABLE));
+                node->text = name;
+            }
+            while(isOp("[")) {
+                next();
+                NodePtr index(new Node(Node::INDEX));
+                index->children.push_back(node);
+                index->children.push_back(parseExpression());
+                expectOp("]");
+                node = index;
+            }
+            return node;
+        }
+        fail("unexpected '" + token.text + "'");
+        return NodePtr();
+    }
+};
+
+// ---------------------------------------------------------------------
+// interpreter
+
+class Interpreter {
+public:
+    Interpreter(const map< string, shared_ptr<Value> > &variables) {
+        for(map< string, shared_ptr<Value> >::const_iterator it = variables.begin(); it != variables.end(); it++) {
+            globals[it->first] = *it->second;
+        }
+    }
+
+    string run(const NodePtr &root) {
+        output.clear();
+        execBlock(root);
+        return output;
+    }
+
+private:
+    map< string, Value > globals;
+    vector< map< string, Value > > scopes; // locals, innermost last
+    string output;
+
+    void fail(const string &message) {
+        throw runtime_error("NativeTemplater: " + message);
+    }
+
+    Value *lookup(const string &name) {
+        for(int i = (int)scopes.size() - 1; i >= 0; i--) {
+            map< string, Value >::iterator it = scopes[i].find(name);
+            if(it != scopes[i].end()) {
+                return &it->second;
+            }
+        }
+        map< string, Value >::iterator it = globals.find(name);
+        if(it != globals.end()) {
+            return &it->second;
+        }
+        return 0;
+    }
+
+    void execBlock(const NodePtr &block) {
+        scopes.push_back(map< string, Value >());
+        for(size_t i = 0; i < block->children.size(); i++) {
+            exec(block->children[i]);
+        }
+        scopes.pop_back();
+    }
+
+    void exec(const NodePtr &node) {
+        switch(node->kind) {
+            case Node::TEXT_OUT:
+                output += node->text;
+                break;
+            case Node::EMIT: {
+                Value value = eval(node->children[0]);
+                if(value.type == Value::NIL) {
+                    fail("value is nil in {{ }}");
+                }
+                output += toString(value);
+                break;
+            }
+            case Node::ASSIGN: {
+                Value value = eval(node->children[0]);
+                Value *existing = lookup(node->text);
+                if(existing != 0) {
+                    *existing = value;
+                } else {
+                    globals[node->text] = value;
+                }
+                break;
+            }
+            case Node::LOCAL_ASSIGN:
+                scopes.back()[node->text] = eval(node->children[0]);
+                break;
+            case Node::NUMERIC_FOR: {
+                double first = toNumber(eval(node->children[0]), "'for' initial value");
+                double last = toNumber(eval(node->children[1]), "'for' limit");
+                double step = 1;
+                if(node->children.size() == 4) {
+                    step = toNumber(eval(node->children[2]), "'for' step");
+                }
+                if(step == 0) {
+                    fail("'for' step is zero");
+                }
+                const NodePtr &body = node->children.back();
+                for(double i = first; step > 0 ? i <= last : i >= last; i += step) {
+                    scopes.push_back(map< string, Value >());
+                    scopes.back()[node->text] = Value::fromNumber(i);
+                    execBlock(body);
+                    scopes.pop_back();
+                }
+                break;
+            }
+            case Node::LIST_FOR: {
+                Value list = eval(node->children[0]);
+                if(list.type != Value::LIST) {
+                    fail(string("bad argument to 'ipairs' (table expected, got ") + typeName(list) + ")");
+                }
+                for(size_t i = 0; i < list.list.size(); i++) {
+                    scopes.push_back(map< string, Value >());
+                    scopes.back()[node->text] = Value::fromNumber((double)(i + 1));
+                    scopes.back()[node->name2] = list.list[i];
+                    execBlock(node->children[1]);
+                    scopes.pop_back();
+                }
+                break;
+            }
+            case Node::IF: {
+                size_t i = 0;
+                for(; i + 1 < node->children.size(); i += 2) {
+                    if(eval(node->children[i]).isTrue()) {
+                        execBlock(node->children[i + 1]);
+                        return;
+                    }
+                }
+                if(i < node->children.size()) {
+                    execBlock(node->children[i]);
+                }
+                break;
+            }
+            default:
+                fail("internal error: not a statement");
+        }
+    }
+
+    string toString(const Value &value) {
+        switch(value.type) {
+            case Value::NUMBER: return numberToString(value.number);
+            case Value::STRING: return value.str;
+            case Value::BOOLEAN: return value.boolean ? "true" : "false";
+            default:
+                fail(string("attempt to convert a ") + typeName(value) + " value to a string");
+        }
+        return "";
+    }
+
+    double toNumber(const Value &value, const string &what) {
+        double result = 0;
+        if(value.type == Value::NUMBER) {
+            return value.number;
+        }
+        if(value.type == Value::STRING && stringToNumber(value.str, &result)) {
+            return result;
+        }
+        fail(what + " must be a number, got " + typeName(value));
+        return 0;
+    }
+
+    Value eval(const NodePtr &node) {
+        switch(node->kind) {
+            case Node::LITERAL:
+                return node->literal;
+            case Node::VARIABLE: {
+                Value *value = lookup(node->text);
+                return value != 0 ? *value : Value();
+            }
+            case Node::INDEX: {
+                Value container = eval(node->children[0]);
+                Value index = eval(node->children[1]);
+                if(container.type != Value::LIST) {
+                    fail(string("attempt to index a ") + typeName(container) + " value");
+                }
+                double i = toNumber(index, "index");
+                if(i < 1 || i > (double)container.list.size() || i != floor(i)) {
+                    return Value();
+                }
+                return container.list[(size_t)i - 1];
+            }
+            case Node::AND: {
+                Value left = eval(node->children[0]);
+                return left.isTrue() ? eval(node->children[1]) : left;
+            }
+            case Node::OR: {
+                Value left = eval(node->children[0]);
+                return left.isTrue() ? left : eval(node->children[1]);
+            }
+            case Node::UNARY: {
+                Value operand = eval(node->children[0]);
+                if(node->text == "not") {
+                    return Value::fromBoolean(!operand.isTrue());
+                }
+                if(node->text == "-") {
+                    return Value::fromNumber(-toNumber(operand, "operand of '-'"));
+                }
+                if(operand.type == Value::LIST) {
+                    return Value::fromNumber((double)operand.list.size());
+                }
+                if(operand.type == Value::STRING) {
+                    return Value::fromNumber((double)operand.str.size());
+                }
+                fail(string("attempt to get length of a ") + typeName(operand) + " value");
+                return Value();
+            }
+            case Node::BINARY:
+                return evalBinary(node->text, eval(node->children[0]), eval(node->children[1]));
+            case Node::CALL:
+                return evalCall(node);
+            default:
+                fail("internal error: not an expression");
+        }
+        return Value();
+    }
+
+    Value evalBinary(const string &op, const Value &left, const Value &right) {
+        if(op == "==" || op == "~=") {
+            bool equal = left.type == right.type;
+            if(equal) {
+                switch(left.type) {
+                    case Value::NIL: break;
+                    case Value::BOOLEAN: equal = left.boolean == right.boolean; break;
+                    case Value::NUMBER: equal = left.number == right.number; break;
+                    case Value::STRING: equal = left.str == right.str; break;
+                    case Value::LIST: equal = false; break; // tables compare by reference in Lua
+                }
+            }
+            return Value::fromBoolean(op == "==" ? equal : !equal);
+        }
+        if(op == "<" || op == ">" || op == "<=" || op == ">=") {
+            int compare = 0;
+            if(left.type == Value::NUMBER && right.type == Value::NUMBER) {
+                compare = left.number < right.number ? -1 : (left.number > right.number ? 1 : 0);
+            } else if(left.type == Value::STRING && right.type == Value::STRING) {
+                compare = left.str.compare(right.str);
+            } else {
+                fail(string("attempt to compare ") + typeName(left) + " with " + typeName(right));
+            }
+            if(op == "<") return Value::fromBoolean(compare < 0);
+            if(op == ">") return Value::fromBoolean(compare > 0);
+            if(op == "<=") return Value::fromBoolean(compare <= 0);
+            return Value::fromBoolean(compare >= 0);
+        }
+        if(op == "..") {
+            if((left.type != Value::STRING && left.type != Value::NUMBER) ||
+                    (right.type != Value::STRING && right.type != Value::NUMBER)) {
+                fail(string("attempt to concatenate a ") +
+                    typeName(left.type != Value::STRING && left.type != Value::NUMBER ? left : right) + " value");
+            }
+            return Value::fromString(toString(left) + toString(right));
+        }
+        double a = toNumber(left, "left operand of '" + op + "'");
+        double b = toNumber(right, "right operand of '" + op + "'");
+        if(op == "+") return Value::fromNumber(a + b);
+        if(op == "-") return Value::fromNumber(a - b);
+        if(op == "*") return Value::fromNumber(a * b);
+        if(op == "/") return Value::fromNumber(a / b);
+        if(op == "%") return Value::fromNumber(a - floor(a / b) * b);
+        if(op == "^") return Value::fromNumber(pow(a, b));
+        fail("unsupported operator '" + op + "'");
+        return Value();
+    }
+
+    Value evalCall(const NodePtr &node) {
+        vector<Value> args;
+        for(size_t i = 0; i < node->children.size(); i++) {
+            args.push_back(eval(node->children[i]));
+        }
+        const string &name = node->text;
+        if(name == "tostring" && args.size() == 1) {
+            if(args[0].type == Value::NIL) {
+                return Value::fromString("nil");
+            }
+            return Value::fromString(toString(args[0]));
+        }
+        if(name == "tonumber" && args.size() == 1) {
+            double value = 0;
+            if(args[0].type == Value::NUMBER) {
+                return args[0];
+            }
+            if(args[0].type == Value::STRING && stringToNumber(args[0].str, &value)) {
+                return Value::fromNumber(value);
+            }
+            return Value();
+        }
+        if((name == "math.floor" || name == "math.ceil" || name == "math.abs") && args.size() == 1) {
+            double value = toNumber(args[0], "argument of '" + name + "'");
+            if(name == "math.floor") return Value::fromNumber(floor(value));
+            if(name == "math.ceil") return Value::fromNumber(ceil(value));
+            return Value::fromNumber(fabs(value));
+        }
+        if((name == "math.min" || name == "math.max") && args.size() >= 1) {
+            double result = toNumber(args[0], "argument of '" + name + "'");
+            for(size_t i = 1; i < args.size(); i++) {
+                double value = toNumber(args[i], "argument of '" + name + "'");
+                result = name == "math.min" ? (value < result ? value : result) : (value > result ? value : result);
+            }
+            return Value::fromNumber(result);
+        }
+        fail("unsupported function '" + name + "'");
+        return Value();
+    }
+};
+
+static string serialize(const Value &value) {
+    switch(value.type) {
+        case Value::NIL: return "nil";
+        case Value::BOOLEAN: return value.boolean ? "b:true" : "b:false";
+        case Value::NUMBER: {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "n:%.17g", value.number);
+            return buf;
+        }
+        case Value::STRING: {
+            ostringstream ss;
+            ss << "s" << value.str.size() << ":" << value.str;
+            return ss.str();
+        }
+        case Value::LIST: {
+            string result = "l{";
+            for(size_t i = 0; i < value.list.size(); i++) {
+                result += serialize(value.list[i]) + ",";
+            }
+            return result + "}";
+        }
+    }
+    return "";
+}
+
+} // namespace nativetemplater
+
+using namespace nativetemplater;
+
+NativeTemplater::NativeTemplater() :
+        renderCacheHits(0),
+        renderCacheMisses(0) {
+}
+NativeTemplater::~NativeTemplater() {
+}
+void NativeTemplater::set(std::string name, std::string value) {
+    variables[name].reset(new Value(Value::fromString(value)));
+}
+void NativeTemplater::set(std::string name, float value) {
+    variables[name].reset(new Value(Value::fromNumber(value)));
+}
+void NativeTemplater::set(std::string name, int value) {
+    variables[name].reset(new Value(Value::fromNumber(value)));
+}
+void NativeTemplater::set(std::string name, std::vector< std::string> &values) {
+    Value list;
+    list.type = Value::LIST;
+    for(int i = 0; i < (int)values.size(); i++) {
+        list.list.push_back(Value::fromString(values[i]));
+    }
+    variables[name].reset(new Value(list));
+}
+void NativeTemplater::set(std::string name, std::vector< int> &values) {
+    Value list;
+    list.type = Value::LIST;
+    for(int i = 0; i < (int)values.size(); i++) {
+        list.list.push_back(Value::fromNumber(values[i]));
+    }
+    variables[name].reset(new Value(list));
+}
+void NativeTemplater::set(std::string name, std::vector< float> &values) {
+    Value list;
+    list.type = Value::LIST;
+    for(int i = 0; i < (int)values.size(); i++) {
+        list.list.push_back(Value::fromNumber(values[i]));
+    }
+    variables[name].reset(new Value(list));
+}
+std::string NativeTemplater::getParametersKey() {
+    string key = "";
+    for(map< string, shared_ptr<Value> >::iterator it = variables.begin(); it != variables.end(); it++) {
+        key += it->first + "=" + serialize(*it->second) + ";";
+    }
+    return key;
+}
+// like templater.lua, renders again until nothing changes, so values can
+// contain templates themselves
+std::string NativeTemplater::render(std::string template_string) {
+    string key = getParametersKey() + '\0' + template_string;
+    map< string, string >::iterator it = renderedByKey.find(key);
+    if(it != renderedByKey.end()) {
+        renderCacheHits++;
+        return it->second;
+    }
+    renderCacheMisses++;
+    string last = "";
+    string rendered = template_string;
+    do {
+        last = rendered;
+        rendered = renderOnce(last);
+    } while(rendered != last);
+    renderedByKey[key] = rendered;
+    return rendered;
+}
+std::string NativeTemplater::renderOnce(const std::string &template_string) {
+    if(template_string.find("{{") == string::npos && template_string.find("{%") == string::npos) {
+        return template_string;
+    }
+    shared_ptr<Node> &parsed = parsedByTemplate[template_string];
+    if(!parsed) {
+        try {
+            vector<Token> tokens = tokenizeTemplate(template_string);
+            parsed = Parser(tokens).parseTemplate();
+        } catch(runtime_error &e) {
+            parsedByTemplate.erase(template_string);
+            throw;
+        }
+    }
+    Interpreter interpreter(variables);
+    return interpreter.run(parsed);
+}
+void NativeTemplater::clearCache() {
+    parsedByTemplate.clear();
+    renderedByKey.clear();
+}
+}
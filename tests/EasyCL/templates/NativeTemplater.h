@@ -0,0 +1,81 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, 
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can 
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "EasyCL_export.h"
+
+#include "mystdint.h"
+
+namespace easycl {
+
+namespace nativetemplater {
+struct Value;
+struct Node;
+}
+
+// Drop-in replacement for LuaTemplater, written in plain C++, so no Lua
+// interpreter is started.  Same `{{expression}}` and `{% code %}` syntax,
+// and same set(name, value) methods.
+//
+// The code inside `{% %}` is a subset of Lua:
+// - `for i=first,last[,step] do ... end`
+// - `for _,name in ipairs(list) do ... end` (also `pairs`)
+// - `if ... then ... elseif ... then ... else ... end`
+// - `name = expression`, `local name = expression`
+// - expressions: numbers, 'strings', true/false/nil, variables, list[index]
+//   (1-based), #list, + - * / % ^, .., == ~= < > <= >=, and/or/not,
+//   math.floor/ceil/min/max/abs, tostring, tonumber
+// Anything else (eg loadstring) throws runtime_error; use LuaTemplater for
+// those templates.
+//
+// Unlike LuaTemplater, variables assigned inside a template dont persist
+// into the next render(), so rendering only depends on the template and
+// the set() values.  Parsed templates and rendered results are cached.
+class EasyCL_EXPORT NativeTemplater {
+public:
+    NativeTemplater();
+    ~NativeTemplater();
+
+    void set(std::string name, std::string value);
+    void set(std::string name, float value);
+    void set(std::string name, int value);
+    void set(std::string name, std::vector< std::string> &values);
+    void set(std::string name, std::vector< int> &values);
+    void set(std::string name, std::vector< float> &values);
+    std::string render(std::string template_string);
+
+    // identifies the current set() values; equal values give equal keys
+    std::string getParametersKey();
+
+    int64_t getRenderCacheHits() { return renderCacheHits; }
+    int64_t getRenderCacheMisses() { return renderCacheMisses; }
+    void clearCache();
+
+private:
+#ifdef _WIN32
+#pragma warning(disable: 4251)
+#endif
+    std::map< std::string, std::shared_ptr< nativetemplater::Value > > variables;
+    std::map< std::string, std::shared_ptr< nativetemplater::Node > > parsedByTemplate;
+    std::map< std::string, std::string > renderedByKey;
+#ifdef _WIN32
+#pragma warning(default: 4251)
+#endif
+    int64_t renderCacheHits;
+    int64_t renderCacheMisses;
+
+    std::string renderOnce(const std::string &template_string);
+
+    NativeTemplater(const NativeTemplater &);
+    NativeTemplater &operator=(const NativeTemplater &);
+};
+}
@@ -0,0 +1,99 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, 
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can 
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "test/easycl_gtest_supp.h"
+
+#include "EasyCL.h"
+#include "templates/NativeTemplatedKernel.h"
+#include "templates/NativeTemplater.h"
+
+using namespace std;
+using namespace easycl;
+
+namespace {
+string kernelSource = "kernel void doStuff(int N, global {{type}} *out, global const {{type}} *in) {\n"
+    "   int globalId = get_global_id(0);\n"
+    "   if(globalId < N) {\n"
+    "       {{type}} value = in[globalId];\n"
+    "       out[globalId] = value;\n"
+    "   }\n"
+    "}\n";
+}
+
+TEST(testNativeTemplatedKernel, basic) {
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+
+    NativeTemplatedKernel kernelBuilder(cl);
+    kernelBuilder.set("type", "int");
+    CLKernel *kernel = kernelBuilder.buildKernel("doStuff_int", "testfile", kernelSource, "doStuff");
+    int a[2];
+    int b[2];
+    b[0] = 3;
+    b[1] = 2;
+    kernel->in(2)->out(2, a)->in(2, b)->run_1d(16, 16);
+    cl->finish();
+    EXPECT_EQ(3, a[0]);
+    EXPECT_EQ(2, a[1]);
+
+    kernelBuilder.set("type", "float");
+    kernel = kernelBuilder.buildKernel("doStuff_float", "testfile", kernelSource, "doStuff");
+    float ac[2];
+    float bc[2];
+    bc[0] = 3.2f;
+    bc[1] = 2.5f;
+    kernel->in(2)->out(2, ac)->in(2, bc)->run_1d(16, 16);
+    cl->finish();
+    EXPECT_EQ(3.2f, ac[0]);
+    EXPECT_EQ(2.5f, ac[1]);
+
+    delete cl;
+}
+
+TEST(testNativeTemplatedKernel, cachedbyparameters) {
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+
+    NativeTemplatedKernel kernelBuilder(cl);
+    kernelBuilder.set("type", "int");
+    CLKernel *intKernel = kernelBuilder.buildKernel("testfile", kernelSource, "doStuff");
+    kernelBuilder.set("type", "float");
+    CLKernel *floatKernel = kernelBuilder.buildKernel("testfile", kernelSource, "doStuff");
+    EXPECT_NE(intKernel, floatKernel);
+    kernelBuilder.set("type", "int");
+    EXPECT_EQ(intKernel, kernelBuilder.buildKernel("testfile", kernelSource, "doStuff"));
+    EXPECT_EQ(1, kernelBuilder.templater->getRenderCacheHits());
+    EXPECT_EQ(2, kernelBuilder.templater->getRenderCacheMisses());
+
+    int a[2];
+    int b[2];
+    b[0] = 7;
+    b[1] = 5;
+    intKernel->in(2)->out(2, a)->in(2, b)->run_1d(16, 16);
+    cl->finish();
+    EXPECT_EQ(7, a[0]);
+    EXPECT_EQ(5, a[1]);
+
+    delete cl;
+}
+
+TEST(testNativeTemplatedKernel, withtemplateerror) {
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+
+    NativeTemplatedKernel kernelBuilder(cl);
+    bool threw = false;
+    try {
+        kernelBuilder.buildKernel("testfile", "kernel void {{missing}}() {}", "doStuff");
+    } catch(runtime_error &e) {
+        threw = true;
+    }
+    EXPECT_TRUE(threw);
+
+    delete cl;
+}
@@ -0,0 +1,204 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, 
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can 
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "test/easycl_gtest_supp.h"
+
+#include "templates/NativeTemplater.h"
+
+using namespace std;
+using namespace easycl;
+
+TEST(testNativeTemplater, basicsubstitution) {
+    string source = "\n"
+"        This is my {{avalue}} template.  It's {{secondvalue}}...\n"
+"        Today's weather is {{weather}}.\n"
+"    \n";
+
+    NativeTemplater mytemplate;
+    mytemplate.set("avalue", 3);
+    mytemplate.set("secondvalue", 123);
+    mytemplate.set("weather", "rain");
+    string result = mytemplate.render(source);
+    string expectedResult = "\n"
+"        This is my 3 template.  It's 123...\n"
+"        Today's weather is rain.\n"
+"    \n";
+    EXPECT_EQ(expectedResult, result);
+    EXPECT_EQ(expectedResult, mytemplate.render(source));
+}
+TEST(testNativeTemplater, startandendofsection) {
+    NativeTemplater mytemplate;
+    mytemplate.set("avalue", 3);
+    EXPECT_EQ(string("3 template"), mytemplate.render("{{avalue}} template"));
+    EXPECT_EQ(string("template 3"), mytemplate.render("template {{avalue}}"));
+}
+TEST(testNativeTemplater, loop) {
+    string source = "\n"
+"        {% for i=0,its-1 do %}\n"
+"            a[{{i}}] = image[{{i}}];\n"
+"        {% end %}\n"
+"    \n";
+
+    NativeTemplater mytemplate;
+    mytemplate.set("its", 3);
+    string result = mytemplate.render(source);
+    string expectedResult = "\n"
+"        \n"
+"            a[0] = image[0];\n"
+"        \n"
+"            a[1] = image[1];\n"
+"        \n"
+"            a[2] = image[2];\n"
+"        \n"
+"    \n";
+    EXPECT_EQ(expectedResult, result);
+}
+TEST(testNativeTemplater, nestedloop) {
+    string source = "\n"
+"{% for i=0,its-1 do %}a[{{i}}] = image[{{i}}];\n"
+"{% for j=0,1 do %}b[{{j}}] = image[{{j}}];\n"
+"{% end %}{% end %}\n"
+"";
+
+    NativeTemplater mytemplate;
+    mytemplate.set("its", 3);
+    string result = mytemplate.render(source);
+    string expectedResult = "\n"
+"a[0] = image[0];\n"
+"b[0] = image[0];\n"
+"b[1] = image[1];\n"
+"a[1] = image[1];\n"
+"b[0] = image[0];\n"
+"b[1] = image[1];\n"
+"a[2] = image[2];\n"
+"b[0] = image[0];\n"
+"b[1] = image[1];\n"
+"\n"
+"";
+    EXPECT_EQ(expectedResult, result);
+}
+TEST(testNativeTemplater, foreachloop) {
+    string source = "\n"
+        "{% for _,name in ipairs(names) do %}{{name}}\n"
+        "{% end %}\n"
+        "";
+    NativeTemplater mytemplate;
+    vector<string> values;
+    values.push_back("blue");
+    values.push_back("green");
+    values.push_back("red");
+    mytemplate.set("names", values);
+    string result = mytemplate.render(source);
+    string expectedResult = "\n"
+"blue\n"
+"green\n"
+"red\n"
+"\n";
+    EXPECT_EQ(expectedResult, result);
+}
+TEST(testNativeTemplater, codesection) {
+    string source = "\n"
+        "{%\n"
+        "sum=0\n"
+        "for i=1,3 do\n"
+        "  if i <= 2 then \n"
+        "   sum = sum + 1\n"
+        "  end\n"
+        "end\n"
+        "%}\n"
+        "{{sum}}\n"
+        "";
+    NativeTemplater mytemplate;
+    string result = mytemplate.render(source);
+    string expectedResult = "\n\n2\n";
+    EXPECT_EQ(expectedResult, result);
+}
+TEST(testNativeTemplater, ifelse) {
+    string source = "{% if dim > 16 then %}big{% elseif dim == 16 then %}exact{% else %}small{% end %}"
+        " {{dim * 2 .. 'x'}} {{#sizes}} {{sizes[2] / 2}} {{math.max(dim, 20)}}";
+    NativeTemplater mytemplate;
+    vector<int> sizes;
+    sizes.push_back(4);
+    sizes.push_back(5);
+    mytemplate.set("sizes", sizes);
+    mytemplate.set("dim", 16);
+    EXPECT_EQ(string("exact 32x 2 2.5 20"), mytemplate.render(source));
+    mytemplate.set("dim", 32);
+    EXPECT_EQ(string("big 64x 2 2.5 32"), mytemplate.render(source));
+    mytemplate.set("dim", 1);
+    EXPECT_EQ(string("small 2x 2 2.5 20"), mytemplate.render(source));
+}
+TEST(testNativeTemplater, floats) {
+    NativeTemplater mytemplate;
+    mytemplate.set("scale", 0.5f);
+    EXPECT_EQ(string("0.5 1.5"), mytemplate.render("{{scale}} {{scale * 3}}"));
+}
+TEST(testNativeTemplater, codingerror) {
+    string source = "\n"
+        "{%\n"
+        "sum=foo.blah\n"
+        "%}\n"
+        "";
+    NativeTemplater mytemplate;
+    bool threw = false;
+    try {
+      string result = mytemplate.render(source);
+    } catch(runtime_error &e) {
+      threw = true;
+    }
+    EXPECT_TRUE(threw);
+}
+TEST(testNativeTemplater, unsupported) {
+    NativeTemplater mytemplate;
+    EXPECT_THROW(mytemplate.render("{% f = loadstring('return 1') %}"), runtime_error);
+    EXPECT_THROW(mytemplate.render("{% while true do end %}"), runtime_error);
+    EXPECT_THROW(mytemplate.render("{{missing}}"), runtime_error);
+    EXPECT_THROW(mytemplate.render("{{ 1 + 2"), runtime_error);
+}
+TEST(testNativeTemplater, include) {
+    string source = "\n"
+        "{{include_tensorinfocl}}\n"
+        "\n"
+        "";
+    string source2 = "var color = '{{color}}';\n"
+      "var {{foo}} = 0;\n";
+    NativeTemplater mytemplate;
+    mytemplate.set("include_tensorinfocl", source2);
+    mytemplate.set("color", "blue");
+    mytemplate.set("foo", "blah");
+    string result = mytemplate.render(source);
+    string expectedResult = "\nvar color = 'blue';\nvar blah = 0;\n\n\n";
+    EXPECT_EQ(expectedResult, result);
+}
+TEST(testNativeTemplater, cache) {
+    string source = "{% for i=1,n do %}{{i}}{% end %}";
+    NativeTemplater mytemplate;
+    mytemplate.set("n", 3);
+    string key3 = mytemplate.getParametersKey();
+    EXPECT_EQ(string("123"), mytemplate.render(source));
+    EXPECT_EQ(string("123"), mytemplate.render(source));
+    EXPECT_EQ(1, mytemplate.getRenderCacheMisses());
+    EXPECT_EQ(1, mytemplate.getRenderCacheHits());
+
+    mytemplate.set("n", 2);
+    EXPECT_NE(key3, mytemplate.getParametersKey());
+    EXPECT_EQ(string("12"), mytemplate.render(source));
+    EXPECT_EQ(2, mytemplate.getRenderCacheMisses());
+
+    mytemplate.set("n", 3);
+    EXPECT_EQ(key3, mytemplate.getParametersKey());
+    EXPECT_EQ(string("123"), mytemplate.render(source));
+    EXPECT_EQ(2, mytemplate.getRenderCacheHits());
+
+    mytemplate.clearCache();
+    EXPECT_EQ(string("123"), mytemplate.render(source));
+    EXPECT_EQ(3, mytemplate.getRenderCacheMisses());
+}
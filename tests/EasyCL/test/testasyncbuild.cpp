@@ -0,0 +1,104 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+using namespace std;
+
+#include "gtest/gtest.h"
+
+#include "EasyCL.h"
+#include "CLKernel.h"
+#include "CLProgram.h"
+
+using namespace easycl;
+
+static string makeSource(int multiplier) {
+    ostringstream source;
+    source << "kernel void mul(int N, global float *data) {\n";
+    source << "    const int globalid = get_global_id(0);\n";
+    source << "    if(globalid < N) {\n";
+    source << "        data[globalid] *= " << multiplier << ".0f;\n";
+    source << "    }\n";
+    source << "}\n";
+    return source.str();
+}
+
+TEST(testasyncbuild, parallel) {
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+    const int numPrograms = 8;
+    vector< std::shared_future<CLProgram *> > futures;
+    for(int i = 0; i < numPrograms; i++) {
+        futures.push_back(cl->buildProgramFromStringAsync(makeSource(i + 1), ""));
+    }
+    // same source again: joins the pending (or finished) build
+    std::shared_future<CLProgram *> again = cl->buildProgramFromStringAsync(makeSource(1), "");
+    EXPECT_EQ(numPrograms, cl->getProgramCacheMisses());
+    EXPECT_EQ(1, cl->getProgramCacheHits());
+    EXPECT_EQ(futures[0].get(), again.get());
+
+    const int N = 16;
+    for(int i = 0; i < numPrograms; i++) {
+        float data[N];
+        for(int j = 0; j < N; j++) {
+            data[j] = (float)j;
+        }
+        CLKernel *kernel = futures[i].get()->getKernel("mul");
+        kernel->in(N)->inout(N, data);
+        kernel->run_1d(N, N);
+        cl->finish();
+        for(int j = 0; j < N; j++) {
+            EXPECT_EQ(j * (i + 1.0f), data[j]);
+        }
+        delete kernel;
+    }
+    delete cl;
+}
+
+TEST(testasyncbuild, builderror) {
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+    std::shared_future<CLProgram *> future = cl->buildProgramFromStringAsync("kernel void foo( { }", "", "broken.cl");
+    bool threw = false;
+    try {
+        future.get();
+    } catch(runtime_error &e) {
+        threw = true;
+        EXPECT_TRUE(string(e.what()).find("broken.cl") != string::npos);
+    }
+    EXPECT_TRUE(threw);
+    // failed builds arent cached, so trying again builds again
+    EXPECT_THROW(cl->buildProgramFromString("kernel void foo( { }", "", "broken.cl", true), runtime_error);
+    EXPECT_EQ(2, cl->getProgramCacheMisses());
+    delete cl;
+}
+
+TEST(testasyncbuild, warmup) {
+    {
+        ofstream f("testasyncbuild_a.cl");
+        f << makeSource(3);
+        f.close();
+        ofstream manifest("testasyncbuild_manifest.txt");
+        manifest << "# kernels used by the first frame\n";
+        manifest << "testasyncbuild_a.cl\n";
+        manifest << "\n";
+        manifest << "testasyncbuild_a.cl   -DUNUSED=1 -cl-mad-enable  \n";
+        manifest.close();
+    }
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+    EXPECT_EQ(2, cl->warmUp("testasyncbuild_manifest.txt"));
+    cl->waitForBuilds();
+    EXPECT_EQ(2, cl->getProgramCacheMisses());
+
+    // already built, so no compile here
+    CLKernel *kernel = cl->buildKernel("testasyncbuild_a.cl", "mul", "-DUNUSED=1 -cl-mad-enable");
+    EXPECT_EQ(2, cl->getProgramCacheMisses());
+    EXPECT_EQ(1, cl->getProgramCacheHits());
+
+    const int N = 4;
+    float data[N] = {1, 2, 3, 4};
+    kernel->in(N)->inout(N, data);
+    kernel->run_1d(N, N);
+    cl->finish();
+    EXPECT_EQ(12.0f, data[3]);
+    delete kernel;
+    delete cl;
+}
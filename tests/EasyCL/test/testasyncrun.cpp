@@ -0,0 +1,126 @@
+#include <iostream>
+#include <cstdlib>
+using namespace std;
+
+#include "gtest/gtest.h"
+
+#include "EasyCL.h"
+#include "CLKernel.h"
+#include "CLRunHandle.h"
+#include "CLBufferPool.h"
+
+using namespace easycl;
+
+static const char *kernelSource = 
+"kernel void test(int N, global const float *in, global float *out) {\n"
+"    const int globalid = get_global_id(0);\n"
+"    if(globalid >= N) {\n"
+"        return;\n"
+"    }\n"
+"    out[globalid] = in[globalid] * 2.0f;\n"
+"}\n"
+;
+
+TEST(testasyncrun, basic) {
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+    CLKernel *kernel = cl->buildKernelFromString(kernelSource, "test", "");
+
+    const int N = 1024;
+    float *in = new float[N];
+    float *out = new float[N];
+    for(int i = 0; i < N; i++) {
+        in[i] = (float)i;
+        out[i] = -1;
+    }
+    kernel->in(N);
+    kernel->in(N, in);
+    kernel->out(N, out);
+    CLRunHandle *handle = kernel->run_1d_async(N, 64);
+    EXPECT_EQ(1, handle->numOutputs());
+    EXPECT_TRUE(handle->getEvent() != 0);
+
+    float *result = (float *)handle->output(0);
+    EXPECT_EQ(out, result);
+    EXPECT_TRUE(handle->isComplete());
+    EXPECT_EQ(0, handle->getEvent());
+    for(int i = 0; i < N; i++) {
+        EXPECT_EQ(i * 2.0f, out[i]);
+    }
+    delete handle;
+
+    delete[] out;
+    delete[] in;
+    delete kernel;
+    delete cl;
+}
+
+TEST(testasyncrun, overlap) {
+    // two frames in flight, each with its own output
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+    CLKernel *kernel = cl->buildKernelFromString(kernelSource, "test", "");
+
+    const int N = 4096;
+    float *in = new float[N];
+    float *out[2];
+    out[0] = new float[N];
+    out[1] = new float[N];
+    for(int i = 0; i < N; i++) {
+        in[i] = (float)i;
+    }
+    CLRunHandle *handles[2] = {0, 0};
+    for(int frame = 0; frame < 10; frame++) {
+        int slot = frame % 2;
+        if(handles[slot] != 0) {
+            handles[slot]->wait();
+            EXPECT_EQ((N - 1) * 2.0f, out[slot][N - 1]);
+            delete handles[slot];
+        }
+        kernel->in(N);
+        kernel->in(N, in);
+        kernel->out(N, out[slot]);
+        handles[slot] = kernel->run_1d_async(N, 64);
+    }
+    // deleting waits
+    delete handles[0];
+    delete handles[1];
+    EXPECT_EQ(6.0f, out[0][3]);
+    EXPECT_EQ(6.0f, out[1][3]);
+
+    delete[] out[0];
+    delete[] out[1];
+    delete[] in;
+    delete kernel;
+    delete cl;
+}
+
+TEST(testasyncrun, failedenqueue) {
+    // a failed launch gives its buffers back, and leaves the kernel usable
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+    CLKernel *kernel = cl->buildKernelFromString(kernelSource, "test", "");
+    CLBufferPool *pool = cl->getBufferPool();
+
+    const int N = 1024;
+    float *in = new float[N];
+    float *out = new float[N];
+    for(int i = 0; i < N; i++) {
+        in[i] = (float)i;
+    }
+    kernel->in(N);
+    kernel->in(N, in);
+    kernel->out(N, out);
+    // local size doesnt divide the global size
+    EXPECT_THROW(kernel->run_1d_async(N, 100), runtime_error);
+    EXPECT_EQ(0u, pool->getInUseBytes());
+
+    kernel->in(N);
+    kernel->in(N, in);
+    kernel->out(N, out);
+    kernel->run_1d(N, 64);
+    EXPECT_EQ(6.0f, out[3]);
+    EXPECT_EQ(0u, pool->getInUseBytes());
+
+    delete[] out;
+    delete[] in;
+    delete kernel;
+    delete cl;
+}
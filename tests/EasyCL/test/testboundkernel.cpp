@@ -0,0 +1,114 @@
+#include <iostream>
+#include <cstdlib>
+#include <stdexcept>
+using namespace std;
+
+#include "gtest/gtest.h"
+
+#include "EasyCL.h"
+#include "CLKernel.h"
+#include "CLBoundKernel.h"
+
+using namespace easycl;
+
+static const char *kernelSource = 
+"kernel void test(int N, global float *data, float offset) {\n"
+"    const int globalid = get_global_id(0);\n"
+"    if(globalid >= N) {\n"
+"        return;\n"
+"    }\n"
+"    data[globalid] += offset;\n"
+"}\n"
+;
+
+TEST(testboundkernel, basic) {
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+    CLKernel *kernel = cl->buildKernelFromString(kernelSource, "test", "");
+
+    const int N = 1024;
+    float *data = new float[N];
+    for(int i = 0; i < N; i++) {
+        data[i] = (float)i;
+    }
+    CLWrapper *wrapper = cl->wrap(N, data);
+    wrapper->copyToDevice();
+
+    CLBoundKernel bound(kernel);
+    EXPECT_EQ(3, bound.getNumArgs());
+    bound.in_int32(0, N)->inout(1, wrapper)->in_float(2, 1.0f);
+    bound.run_1d(N, 64);
+    EXPECT_EQ(3, bound.getNumSetArgCalls());
+
+    // same values again: nothing to set
+    bound.in_int32(0, N)->in_float(2, 1.0f);
+    bound.run_1d(N, 64);
+    EXPECT_EQ(3, bound.getNumSetArgCalls());
+
+    // only the changed argument is set
+    for(int it = 0; it < 10; it++) {
+        bound.in_float(2, 2.0f + it)->enqueue_1d(N, 64);
+    }
+    EXPECT_EQ(13, bound.getNumSetArgCalls());
+    EXPECT_EQ(12, bound.getNumLaunches());
+    cl->finish();
+    EXPECT_TRUE(wrapper->isDeviceDirty());
+
+    wrapper->copyToHost();
+    // 1 + 1 + (2 + 3 + ... + 11)
+    for(int i = 0; i < N; i++) {
+        EXPECT_EQ(i + 67.0f, data[i]);
+    }
+
+    delete wrapper;
+    delete[] data;
+    delete kernel;
+    delete cl;
+}
+
+TEST(testboundkernel, mixwithkernel) {
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+    CLKernel *kernel = cl->buildKernelFromString(kernelSource, "test", "");
+
+    const int N = 256;
+    float *data = new float[N];
+    for(int i = 0; i < N; i++) {
+        data[i] = 0;
+    }
+    CLWrapper *wrapper = cl->wrap(N, data);
+    wrapper->copyToDevice();
+
+    CLBoundKernel bound(kernel);
+    bound.in_int32(0, N)->inout(1, wrapper)->in_float(2, 1.0f);
+    bound.run_1d(N, 64);
+
+    // running the kernel directly overwrites the arguments...
+    kernel->in(N)->inout(wrapper)->in(100.0f);
+    kernel->run_1d(N, 64);
+
+    // ... so the binding sets all of them again
+    bound.run_1d(N, 64);
+    EXPECT_EQ(6, bound.getNumSetArgCalls());
+
+    wrapper->copyToHost();
+    EXPECT_EQ(102.0f, data[0]);
+    EXPECT_EQ(102.0f, data[N - 1]);
+
+    delete wrapper;
+    delete[] data;
+    delete kernel;
+    delete cl;
+}
+
+TEST(testboundkernel, errors) {
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+    CLKernel *kernel = cl->buildKernelFromString(kernelSource, "test", "");
+
+    CLBoundKernel bound(kernel);
+    bound.in_int32(0, 16);
+    EXPECT_THROW(bound.in_float(3, 1.0f), runtime_error);
+    EXPECT_THROW(bound.run_1d(16, 16), runtime_error); // arguments 1 and 2 not set
+    EXPECT_EQ(0, bound.getNumLaunches());
+
+    delete kernel;
+    delete cl;
+}
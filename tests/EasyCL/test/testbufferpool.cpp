@@ -0,0 +1,146 @@
+#include <iostream>
+#include <cstdlib>
+using namespace std;
+
+#include "gtest/gtest.h"
+
+#include "EasyCL.h"
+#include "CLKernel.h"
+#include "CLBufferPool.h"
+
+static const char *getKernel();
+
+using namespace easycl;
+
+TEST(testbufferpool, bucketsize) {
+    EXPECT_EQ(256u, CLBufferPool::getBucketSize(1));
+    EXPECT_EQ(256u, CLBufferPool::getBucketSize(256));
+    EXPECT_EQ(512u, CLBufferPool::getBucketSize(257));
+    EXPECT_EQ(4096u, CLBufferPool::getBucketSize(4000));
+}
+
+TEST(testbufferpool, reuse) {
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+    CLBufferPool *pool = cl->getBufferPool();
+
+    cl_mem a = pool->acquire(1000, CL_MEM_READ_WRITE);
+    EXPECT_EQ(0, pool->getHits());
+    EXPECT_EQ(1, pool->getMisses());
+    EXPECT_EQ(1024u, pool->getInUseBytes());
+    pool->release(a);
+    EXPECT_EQ(1024u, pool->getPooledBytes());
+    EXPECT_EQ(0u, pool->getInUseBytes());
+
+    // same bucket
+    cl_mem b = pool->acquire(900, CL_MEM_READ_WRITE);
+    EXPECT_EQ(a, b);
+    EXPECT_EQ(1, pool->getHits());
+
+    // different flags, different bucket
+    cl_mem c = pool->acquire(900, CL_MEM_READ_ONLY);
+    EXPECT_NE(b, c);
+    EXPECT_EQ(2, pool->getMisses());
+    EXPECT_EQ(2048u, pool->getHighWaterMarkBytes());
+
+    pool->release(b);
+    pool->release(c);
+    pool->clear();
+    EXPECT_EQ(0u, pool->getPooledBytes());
+
+    delete cl;
+}
+
+TEST(testbufferpool, limit) {
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+    CLBufferPool *pool = cl->getBufferPool();
+    pool->setMaxPooledBytes(1024);
+
+    cl_mem a = pool->acquire(1024, CL_MEM_READ_WRITE);
+    cl_mem b = pool->acquire(1024, CL_MEM_READ_WRITE);
+    pool->release(a);
+    pool->release(b); // over the limit, freed
+    EXPECT_EQ(1024u, pool->getPooledBytes());
+
+    // the limit covers buffers in use too, so a new allocation frees idle ones
+    cl_mem c = pool->acquire(1024, CL_MEM_READ_ONLY);
+    EXPECT_EQ(0u, pool->getPooledBytes());
+    EXPECT_EQ(1024u, pool->getInUseBytes());
+    pool->release(c);
+    EXPECT_EQ(1024u, pool->getPooledBytes());
+
+    pool->setMaxPooledBytes(0);
+    EXPECT_EQ(0u, pool->getPooledBytes());
+
+    delete cl;
+}
+
+TEST(testbufferpool, kernel) {
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+    CLKernel *kernel = cl->buildKernelFromString(getKernel(), "test", "");
+    CLBufferPool *pool = cl->getBufferPool();
+
+    float in[5];
+    float out[5];
+    float inout[5];
+    for(int it = 0; it < 100; it++) {
+        for(int i = 0; i < 5; i++) {
+            in[i] = i * 3 + it;
+            inout[i] = i * 3 + it;
+        }
+        kernel->in(5, in);
+        kernel->out(5, out);
+        kernel->inout(5, inout);
+        size_t global = 5;
+        size_t local = 5;
+        kernel->run(1, &global, &local);
+        EXPECT_EQ(5 + it, out[0]);
+        EXPECT_EQ(26, out[2]);
+        EXPECT_EQ(7 + it, inout[0]);
+        EXPECT_EQ(34, inout[2]);
+    }
+    // one allocation per argument, everything else comes from the pool
+    EXPECT_EQ(3, pool->getMisses());
+    EXPECT_EQ(297, pool->getHits());
+    EXPECT_EQ(0u, pool->getInUseBytes());
+
+    delete kernel;
+    delete cl;
+}
+
+TEST(testbufferpool, failedwrite) {
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+    CLKernel *kernel = cl->buildKernelFromString(getKernel(), "test", "");
+    CLBufferPool *pool = cl->getBufferPool();
+
+    // a null host pointer fails the upload: the buffer goes back to the pool
+    EXPECT_THROW(kernel->in(5, (const float *)0), runtime_error);
+    EXPECT_EQ(0u, pool->getInUseBytes());
+    EXPECT_THROW(kernel->inout(5, (float *)0), runtime_error);
+    EXPECT_EQ(0u, pool->getInUseBytes());
+    EXPECT_EQ(2, pool->getMisses() + pool->getHits());
+
+    delete kernel;
+    delete cl;
+}
+
+static const char *getKernel() {
+    // [[[cog
+    // import stringify
+    // stringify.stringify("source", "test/testfloatarray.cl")
+    // ]]]
+    // generated using cog, from test/testfloatarray.cl:
+    const char * source =  
+    "kernel void test(global float *in, global float *out, global float *inout) {\n" 
+    "    const int globalid = get_global_id(0);\n" 
+    "    inout[globalid] = inout[globalid] + 7;\n" 
+    "    out[globalid] = in[globalid] + 5;\n" 
+    "    if(globalid == 2) {\n" 
+    "        out[globalid] = 26;\n" 
+    "        inout[globalid] = 34;\n" 
+    "    }\n" 
+    "}\n" 
+    "\n" 
+    "";
+    // [[[end]]]
+    return source;
+}
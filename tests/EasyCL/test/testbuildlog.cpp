@@ -2,7 +2,10 @@
 
 #include "gtest/gtest.h"
 
+#include <cstdio>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <stdexcept>
 using namespace std;
 
@@ -21,6 +24,36 @@ TEST(testbuildlog, main) {
     delete cl;
 }
 
+TEST(testbuildlog, failedkernelfile) {
+    // each failing source gets its own file, so failures on several build
+    // threads dont overwrite each other
+    string a = EasyCL::saveFailedKernel("kernel void a() {}", "");
+    string b = EasyCL::saveFailedKernel("kernel void b() {}", "");
+    EXPECT_NE(a, b);
+    EXPECT_NE(a, EasyCL::saveFailedKernel("kernel void a() {}", "-DFOO"));
+    EXPECT_EQ(a, EasyCL::saveFailedKernel("kernel void a() {}", ""));
+    ifstream f(a.c_str());
+    stringstream contents;
+    contents << f.rdbuf();
+    f.close();
+    EXPECT_EQ("kernel void a() {}\n", contents.str());
+
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+    string message;
+    try {
+        cl->buildKernelFromString("kernel void foo() {}\n", "bar", "", "testbuildlog.cl");
+    } catch(std::runtime_error &err) {
+        message = err.what();
+    }
+    EXPECT_TRUE(message.find("easycl-failedkernel-") != string::npos);
+    delete cl;
+
+    remove(a.c_str());
+    remove(b.c_str());
+    remove(EasyCL::saveFailedKernel("kernel void a() {}", "-DFOO").c_str());
+    remove(EasyCL::saveFailedKernel("kernel void foo() {}\n", "").c_str());
+}
+
 static const char *getKernel() {
     // [[[cog
     // import stringify
@@ -0,0 +1,141 @@
+#include <iostream>
+#include <cstdlib>
+#include <stdexcept>
+using namespace std;
+
+#include "gtest/gtest.h"
+
+#include "EasyCL.h"
+#include "CLKernel.h"
+#include "CLCoherentBuffer.h"
+
+using namespace easycl;
+
+static const char *kernelSource = 
+"kernel void test(int N, global float *data) {\n"
+"    const int globalid = get_global_id(0);\n"
+"    if(globalid >= N) {\n"
+"        return;\n"
+"    }\n"
+"    data[globalid] += 1.0f;\n"
+"}\n"
+;
+
+TEST(testcoherentbuffer, onlystalecopied) {
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+    CLKernel *kernel = cl->buildKernelFromString(kernelSource, "test", "");
+
+    const int N = 4096; // 16KB, in 16 chunks of 1KB
+    float *data = new float[N];
+    for(int i = 0; i < N; i++) {
+        data[i] = (float)i;
+    }
+    CLWrapper *wrapper = cl->wrap(N, data);
+    CLCoherentBuffer coherent(wrapper, 1024);
+    EXPECT_EQ(16, coherent.getNumChunks());
+    EXPECT_TRUE(coherent.isHostValid());
+    EXPECT_FALSE(coherent.isDeviceValid());
+
+    // first run uploads everything
+    kernel->in(N)->inout(&coherent)->run_1d(N, 64);
+    EXPECT_EQ(N * 4, coherent.getBytesToDevice());
+    EXPECT_FALSE(coherent.isHostValid());
+    EXPECT_TRUE(wrapper->isDeviceDirty());
+
+    // second run: device copy is newest, nothing to upload
+    kernel->in(N)->inout(&coherent)->run_1d(N, 64);
+    EXPECT_EQ(N * 4, coherent.getBytesToDevice());
+    EXPECT_EQ(N * 4, coherent.getBytesSaved());
+
+    // reading a few elements only downloads their chunk
+    coherent.hostRead(300, 10);
+    EXPECT_EQ(1024, coherent.getBytesToHost());
+    EXPECT_EQ(302.0f, data[300]);
+    EXPECT_TRUE(coherent.isHostValid(256, 256));
+    EXPECT_FALSE(coherent.isHostValid(0, 256));
+
+    // writing on the host, then running, uploads only that chunk
+    data[300] = 1000.0f;
+    coherent.hostWrote(300, 1);
+    kernel->in(N)->inout(&coherent)->run_1d(N, 64);
+    EXPECT_EQ(N * 4 + 1024, coherent.getBytesToDevice());
+
+    coherent.hostRead();
+    EXPECT_EQ(1024 + N * 4, coherent.getBytesToHost()); // chunk read earlier was stale again
+    EXPECT_FALSE(wrapper->isDeviceDirty());
+    for(int i = 0; i < N; i++) {
+        EXPECT_EQ(i == 300 ? 1001.0f : i + 3.0f, data[i]);
+    }
+
+    delete wrapper;
+    delete[] data;
+    delete kernel;
+    delete cl;
+}
+
+TEST(testcoherentbuffer, plainwrapperwrite) {
+    // a kernel taking the wrapper itself makes the host copy stale too
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+    CLKernel *kernel = cl->buildKernelFromString(kernelSource, "test", "");
+
+    const int N = 4096;
+    float *data = new float[N];
+    for(int i = 0; i < N; i++) {
+        data[i] = (float)i;
+    }
+    CLWrapper *wrapper = cl->wrap(N, data);
+    CLCoherentBuffer coherent(wrapper, 1024);
+    kernel->in(N)->inout(&coherent)->run_1d(N, 64);
+    coherent.hostRead();
+    EXPECT_TRUE(coherent.isHostValid());
+    EXPECT_EQ(1.0f, data[0]);
+
+    kernel->in(N)->inout(wrapper)->run_1d(N, 64);
+    EXPECT_FALSE(coherent.isHostValid());
+    coherent.hostRead(300, 10);
+    EXPECT_EQ(302.0f, data[300]);
+
+    // also when part of the host copy was stale already
+    kernel->in(N)->inout(wrapper)->run_1d(N, 64);
+    coherent.hostRead(2000, 10);
+    EXPECT_EQ(2003.0f, data[2000]);
+    EXPECT_EQ(302.0f, data[300]); // not read yet
+    kernel->in(N)->inout(wrapper)->run_1d(N, 64);
+    coherent.hostRead();
+    EXPECT_EQ(304.0f, data[300]);
+    EXPECT_EQ(2004.0f, data[2000]);
+    EXPECT_FALSE(wrapper->isDeviceDirty());
+
+    delete wrapper;
+    delete[] data;
+    delete kernel;
+    delete cl;
+}
+
+TEST(testcoherentbuffer, partialwriteofstalechunk) {
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+
+    const int N = 1024;
+    float *data = new float[N];
+    for(int i = 0; i < N; i++) {
+        data[i] = 0;
+    }
+    CLWrapper *wrapper = cl->wrap(N, data);
+    CLCoherentBuffer coherent(wrapper, 1024);
+    coherent.deviceRead();
+    coherent.deviceWrote();
+
+    // the rest of chunk 0 would still be stale on the host
+    EXPECT_THROW(coherent.hostWrote(0, 1), runtime_error);
+    // a whole chunk is fine
+    coherent.hostWrote(0, 256);
+    EXPECT_TRUE(coherent.isHostValid(0, 256));
+    EXPECT_FALSE(coherent.isDeviceValid(0, 256));
+    EXPECT_TRUE(coherent.isDeviceValid(256, 768));
+
+    EXPECT_THROW(coherent.hostRead(1000, 100), runtime_error); // out of bounds
+
+    delete wrapper;
+    delete[] data;
+    delete cl;
+}
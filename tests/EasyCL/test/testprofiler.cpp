@@ -0,0 +1,206 @@
+#include "EasyCL.h"
+#include <algorithm>
+#include <iostream>
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+#include "util/Profiler.h"
+
+#include "gtest/gtest.h"
+#include "test/asserts.h"
+
+using namespace std;
+
+using namespace easycl;
+
+namespace {
+static const Profiler::ZoneStats *findZone(const vector<Profiler::ZoneStats> &stats, string path) {
+    for(int i = 0; i < (int)stats.size(); i++) {
+        if(stats[i].path == path) {
+            return &stats[i];
+        }
+    }
+    return 0;
+}
+
+static void spinFor(double milliseconds) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    while(chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() < milliseconds) {
+    }
+}
+
+static void inner() {
+    EASYCL_PROFILE_ZONE("testprofiler.inner");
+    spinFor(0.05);
+}
+}
+
+TEST(testprofiler, nesting) {
+    Profiler::reset();
+    Profiler::setEnabled(true);
+    for(int i = 0; i < 10; i++) {
+        EASYCL_PROFILE_ZONE("testprofiler.outer");
+        inner();
+        inner();
+    }
+    inner();
+    Profiler::setEnabled(false);
+
+    vector<Profiler::ZoneStats> stats = Profiler::getStats();
+    Profiler::dump(cout);
+    const Profiler::ZoneStats *outer = findZone(stats, "testprofiler.outer");
+    const Profiler::ZoneStats *nested = findZone(stats, "testprofiler.outer/testprofiler.inner");
+    const Profiler::ZoneStats *top = findZone(stats, "testprofiler.inner");
+    ASSERT_TRUE(outer != 0);
+    ASSERT_TRUE(nested != 0);
+    ASSERT_TRUE(top != 0);
+    EXPECT_EQ(10, outer->count);
+    EXPECT_EQ(20, nested->count);
+    EXPECT_EQ(1, top->count);
+    EXPECT_EQ(0, outer->depth);
+    EXPECT_EQ(1, nested->depth);
+    EXPECT_EQ("testprofiler.inner", nested->name);
+    EXPECT_GE(outer->totalMilliseconds, nested->totalMilliseconds);
+    EXPECT_GE(nested->minMilliseconds, 0.04);
+    // parents come before their children
+    EXPECT_LT(outer, nested);
+}
+
+TEST(testprofiler, percentiles) {
+    Profiler::reset();
+    Profiler::setEnabled(true);
+    int id = Profiler::zoneId("testprofiler.percentiles");
+    for(int i = 0; i < 100; i++) {
+        Profiler::begin(id);
+        spinFor(i < 95 ? 0.1 : 3.0);
+        Profiler::end();
+    }
+    Profiler::setEnabled(false);
+
+    const Profiler::ZoneStats *zone = findZone(Profiler::getStats(), "testprofiler.percentiles");
+    ASSERT_TRUE(zone != 0);
+    EXPECT_EQ(100, zone->count);
+    EXPECT_GE(zone->p50Milliseconds, 0.09);
+    EXPECT_LT(zone->p50Milliseconds, 1.0);
+    EXPECT_GE(zone->p99Milliseconds, 2.9);
+    EXPECT_LE(zone->p99Milliseconds, zone->maxMilliseconds);
+    EXPECT_NEAR(95 * 0.1 + 5 * 3.0, zone->totalMilliseconds, 5.0);
+    EXPECT_EQ("testprofiler.percentiles", Profiler::zoneName(id));
+}
+
+TEST(testprofiler, threads) {
+    Profiler::reset();
+    Profiler::setEnabled(true);
+    const int numThreads = 4;
+    const int its = 10000;
+    vector<thread> threads;
+    for(int t = 0; t < numThreads; t++) {
+        threads.push_back(thread([] {
+            for(int i = 0; i < its; i++) {
+                EASYCL_PROFILE_ZONE("testprofiler.thread");
+            }
+        }));
+    }
+    for(int t = 0; t < numThreads; t++) {
+        threads[t].join();
+    }
+
+    // overhead of an empty zone
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for(int i = 0; i < its; i++) {
+        EASYCL_PROFILE_ZONE("testprofiler.overhead");
+    }
+    double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / its;
+    cout << "zone overhead: " << ns << "ns" << endl;
+    Profiler::setEnabled(false);
+
+    vector<Profiler::ZoneStats> stats = Profiler::getStats();
+    const Profiler::ZoneStats *zone = findZone(stats, "testprofiler.thread");
+    ASSERT_TRUE(zone != 0);
+    EXPECT_EQ(numThreads * its, zone->count);
+
+    Profiler::reset();
+    EXPECT_TRUE(findZone(Profiler::getStats(), "testprofiler.thread") == 0);
+}
+
+TEST(testprofiler, threadsreused) {
+    // buffers of exited threads are reused, and their stats kept
+    Profiler::reset();
+    Profiler::setEnabled(true);
+    {
+        thread first([] {
+            EASYCL_PROFILE_ZONE("testprofiler.reused");
+        });
+        first.join();
+    }
+    size_t numBuffers = Profiler::getThreadNames().size();
+    const int numThreads = 20;
+    for(int t = 0; t < numThreads; t++) {
+        thread worker([t] {
+            if(t == numThreads - 1) {
+                Profiler::setThreadName("testprofiler last");
+            }
+            for(int i = 0; i < 10; i++) {
+                EASYCL_PROFILE_ZONE("testprofiler.reused");
+            }
+        });
+        worker.join();
+    }
+    Profiler::setEnabled(false);
+
+    EXPECT_EQ(numBuffers, Profiler::getThreadNames().size());
+    vector<string> names = Profiler::getThreadNames();
+    EXPECT_TRUE(find(names.begin(), names.end(), "testprofiler last") != names.end());
+    vector<Profiler::ZoneStats> stats = Profiler::getStats();
+    const Profiler::ZoneStats *zone = findZone(stats, "testprofiler.reused");
+    ASSERT_TRUE(zone != 0);
+    EXPECT_EQ(1 + numThreads * 10, zone->count);
+    Profiler::reset();
+}
+
+TEST(testprofiler, disabled) {
+    Profiler::reset();
+    for(int i = 0; i < 10; i++) {
+        EASYCL_PROFILE_ZONE("testprofiler.disabled");
+    }
+    EXPECT_TRUE(findZone(Profiler::getStats(), "testprofiler.disabled") == 0);
+    // unbalanced end() is ignored
+    Profiler::end();
+}
+
+TEST(testprofiler, kernel) {
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+    CLKernel *kernel = cl->buildKernelFromString(
+        "kernel void test(global float *in) { in[get_global_id(0)] += 1.0f; }", "test", "", "source1");
+    const int N = 1024;
+    float *in = new float[N];
+    for(int i = 0; i < N; i++) {
+        in[i] = i;
+    }
+    CLWrapper *inwrapper = cl->wrap(N, in);
+    inwrapper->copyToDevice();
+
+    Profiler::reset();
+    Profiler::setEnabled(true);
+    for(int i = 0; i < 4; i++) {
+        EASYCL_PROFILE_ZONE("testprofiler.frame");
+        kernel->inout(inwrapper);
+        kernel->run_1d(N, 64);
+    }
+    inwrapper->copyToHost();
+    Profiler::setEnabled(false);
+    Profiler::dump(cout);
+
+    vector<Profiler::ZoneStats> stats = Profiler::getStats();
+    const Profiler::ZoneStats *launch = findZone(stats, "testprofiler.frame/CLKernel::enqueue");
+    ASSERT_TRUE(launch != 0);
+    EXPECT_EQ(4, launch->count);
+    ASSERT_TRUE(findZone(stats, "CLWrapper::copyToHost") != 0);
+    EXPECT_EQ(4, in[0]);
+
+    delete inwrapper;
+    delete[] in;
+    delete kernel;
+    delete cl;
+}
+
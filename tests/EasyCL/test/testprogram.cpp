@@ -0,0 +1,125 @@
+#include <iostream>
+#include <algorithm>
+using namespace std;
+
+#include "gtest/gtest.h"
+
+#include "EasyCL.h"
+#include "CLKernel.h"
+#include "CLProgram.h"
+
+using namespace easycl;
+
+static const char *kernelSource = 
+"kernel void times2(int N, global float *data) {\n"
+"    const int globalid = get_global_id(0);\n"
+"    if(globalid < N) {\n"
+"        data[globalid] *= 2.0f;\n"
+"    }\n"
+"}\n"
+"kernel void plus1(int N, global float *data) {\n"
+"    const int globalid = get_global_id(0);\n"
+"    if(globalid < N) {\n"
+"        data[globalid] += 1.0f;\n"
+"    }\n"
+"}\n"
+;
+
+TEST(testprogram, kernelnames) {
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+    CLProgram *program = cl->buildProgramFromString(kernelSource, "");
+    vector<string> names = program->getKernelNames();
+    EXPECT_EQ(2u, names.size());
+    EXPECT_TRUE(std::find(names.begin(), names.end(), "times2") != names.end());
+    EXPECT_TRUE(std::find(names.begin(), names.end(), "plus1") != names.end());
+    EXPECT_TRUE(program->hasKernel("plus1"));
+    EXPECT_FALSE(program->hasKernel("foo"));
+    delete cl;
+}
+
+TEST(testprogram, buildonce) {
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+    CLKernel *times2 = cl->buildKernelFromString(kernelSource, "times2", "");
+    CLKernel *plus1 = cl->buildKernelFromString(kernelSource, "plus1", "");
+    EXPECT_EQ(1, cl->getProgramCacheMisses());
+    EXPECT_EQ(1, cl->getProgramCacheHits());
+
+    // different options means a different program
+    CLKernel *plus1b = cl->buildKernelFromString(kernelSource, "plus1", "-cl-fast-relaxed-math");
+    EXPECT_EQ(2, cl->getProgramCacheMisses());
+
+    const int N = 100;
+    float data[N];
+    for(int i = 0; i < N; i++) {
+        data[i] = (float)i;
+    }
+    times2->in(N)->inout(N, data);
+    times2->run_1d(N, 32);
+    plus1->in(N)->inout(N, data);
+    plus1->run_1d(N, 32);
+    plus1b->in(N)->inout(N, data);
+    plus1b->run_1d(N, 32);
+    cl->finish();
+    for(int i = 0; i < N; i++) {
+        EXPECT_EQ(i * 2.0f + 2.0f, data[i]);
+    }
+
+    // kernels outlive the cache
+    cl->clearProgramCache();
+    times2->in(N)->inout(N, data);
+    times2->run_1d(N, 32);
+    cl->finish();
+    EXPECT_EQ(4.0f, data[0]);
+    EXPECT_EQ(3 * 4.0f + 4.0f, data[3]);
+
+    delete plus1b;
+    delete plus1;
+    delete times2;
+    delete cl;
+}
+
+TEST(testprogram, getallkernels) {
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+    CLProgram *program = cl->buildProgramFromString(kernelSource, "");
+    vector<CLKernel *> kernels = program->getAllKernels();
+    EXPECT_EQ(2u, kernels.size());
+
+    // a second kernel for the same entry point has its own arguments
+    CLKernel *a = program->getKernel("times2");
+    CLKernel *b = program->getKernel("times2");
+    const int N = 10;
+    float dataA[N];
+    float dataB[N];
+    for(int i = 0; i < N; i++) {
+        dataA[i] = (float)i;
+        dataB[i] = (float)(i + 100);
+    }
+    a->in(N)->inout(N, dataA);
+    b->in(N)->inout(N, dataB);
+    a->run_1d(N, N);
+    b->run_1d(N, N);
+    cl->finish();
+    for(int i = 0; i < N; i++) {
+        EXPECT_EQ(i * 2.0f, dataA[i]);
+        EXPECT_EQ((i + 100) * 2.0f, dataB[i]);
+    }
+    delete b;
+    delete a;
+    for(int i = 0; i < (int)kernels.size(); i++) {
+        delete kernels[i];
+    }
+    delete cl;
+}
+
+TEST(testprogram, invalidname) {
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+    bool threw = false;
+    try {
+        delete cl->buildKernelFromString(kernelSource, "notakernel", "", "testprogram.cl");
+    } catch(runtime_error &e) {
+        threw = true;
+        EXPECT_TRUE(string(e.what()).find("notakernel") != string::npos);
+    }
+    EXPECT_TRUE(threw);
+    delete cl;
+}
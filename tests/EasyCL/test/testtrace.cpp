@@ -0,0 +1,138 @@
+#include "EasyCL.h"
+#include <iostream>
+#include <cstdlib>
+#include <thread>
+#include "util/Profiler.h"
+
+#include "gtest/gtest.h"
+#include "test/asserts.h"
+
+using namespace std;
+
+using namespace easycl;
+
+namespace {
+static int countOf(const string &haystack, const string &needle) {
+    int count = 0;
+    for(size_t pos = haystack.find(needle); pos != string::npos; pos = haystack.find(needle, pos + 1)) {
+        count++;
+    }
+    return count;
+}
+}
+
+TEST(testtrace, hostthreads) {
+    CLTrace::clear();
+    CLTrace::setEnabled(true);
+    {
+        EASYCL_PROFILE_ZONE("testtrace.main");
+        thread worker([] {
+            Profiler::setThreadName("testtrace worker");
+            for(int i = 0; i < 3; i++) {
+                EASYCL_PROFILE_ZONE("testtrace.work \"quoted\"");
+            }
+        });
+        worker.join();
+    }
+    CLTrace::setEnabled(false);
+    {
+        EASYCL_PROFILE_ZONE("testtrace.untraced");
+    }
+
+    string json = CLTrace::toChromeTraceJson();
+    EXPECT_EQ(1, countOf(json, "\"name\":\"testtrace.main\""));
+    EXPECT_EQ(3, countOf(json, "\"name\":\"testtrace.work \\\"quoted\\\"\""));
+    EXPECT_EQ(0, countOf(json, "testtrace.untraced"));
+    EXPECT_EQ(1, countOf(json, "\"args\":{\"name\":\"testtrace worker\"}"));
+    EXPECT_EQ((size_t)0, json.find("{\"displayTimeUnit\":\"ms\",\"traceEvents\":["));
+
+    // the trace keeps what it was given, until clear()
+    EXPECT_EQ(json, CLTrace::toChromeTraceJson());
+    CLTrace::clear();
+    EXPECT_EQ(0, countOf(CLTrace::toChromeTraceJson(), "testtrace.main"));
+    Profiler::setEnabled(false);
+}
+
+TEST(testtrace, commands) {
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+    cl->setProfiling(true);
+    CLKernel *kernel = cl->buildKernelFromString(
+        "kernel void test(global float *in) { in[get_global_id(0)] += 1.0f; }", "test", "", "source1");
+    const int N = 1024 * 1024;
+    float *in = new float[N];
+    for(int i = 0; i < N; i++) {
+        in[i] = (float)i;
+    }
+    CLWrapper *inwrapper = cl->wrap(N, in);
+
+    CLTrace::clear();
+    CLTrace::setEnabled(true);
+    inwrapper->copyToDevice();
+    for(int i = 0; i < 3; i++) {
+        kernel->inout(inwrapper);
+        kernel->run_1d(N, 64);
+    }
+    inwrapper->copyToHost();
+    CLTrace::setEnabled(false);
+    Profiler::setEnabled(false);
+
+    EXPECT_EQ(5, CLTrace::getNumCommands());
+    string json = CLTrace::toChromeTraceJson();
+    EXPECT_EQ(1, countOf(json, "\"cat\":\"upload\""));
+    EXPECT_EQ(3, countOf(json, "\"name\":\"test\",\"cat\":\"kernel\""));
+    EXPECT_EQ(1, countOf(json, "\"cat\":\"download\""));
+    EXPECT_EQ(3, countOf(json, "\"name\":\"CLKernel::enqueue\""));
+    EXPECT_EQ(1, countOf(json, "\"args\":{\"name\":\"queue 0\"}"));
+    CLTrace::writeChromeTrace("testtrace.json");
+    CLTrace::clear();
+    EXPECT_EQ(0, CLTrace::getNumCommands());
+    EXPECT_EQ(3, in[0]);
+
+    delete inwrapper;
+    delete[] in;
+    delete kernel;
+    delete cl;
+}
+
+
+TEST(testtrace, transfers) {
+    EasyCL *cl = EasyCL::createForFirstGpuOtherwiseCpu();
+    cl->setProfiling(true);
+    CLKernel *kernel = cl->buildKernelFromString(
+        "kernel void copy(global const float *in, global float *out) { out[get_global_id(0)] = in[get_global_id(0)]; }",
+        "copy", "", "source1");
+    const int N = 1024;
+    float *in = new float[N];
+    float *out = new float[N];
+    for(int i = 0; i < N; i++) {
+        in[i] = (float)i;
+    }
+    CLWrapper *inwrapper = cl->wrap(N, in);
+    CLWrapper *outwrapper = cl->wrap(N, out);
+    inwrapper->copyToDevice();
+    outwrapper->createOnDevice();
+
+    CLTrace::clear();
+    CLTrace::setEnabled(true);
+    kernel->in(N, in)->out(N, out);
+    kernel->run_1d(N, 64);
+    inwrapper->copyTo(outwrapper);
+    CLTrace::setEnabled(false);
+    Profiler::setEnabled(false);
+
+    EXPECT_EQ(4, CLTrace::getNumCommands());
+    string json = CLTrace::toChromeTraceJson();
+    EXPECT_EQ(1, countOf(json, "\"name\":\"copy input\",\"cat\":\"upload\""));
+    EXPECT_EQ(1, countOf(json, "\"name\":\"copy\",\"cat\":\"kernel\""));
+    EXPECT_EQ(1, countOf(json, "\"name\":\"copy output\",\"cat\":\"download\""));
+    EXPECT_EQ(1, countOf(json, "\"name\":\"copyTo\",\"cat\":\"copy\""));
+    CLTrace::clear();
+    EXPECT_EQ(N - 1, out[N - 1]);
+
+    delete outwrapper;
+    delete inwrapper;
+    delete[] out;
+    delete[] in;
+    delete kernel;
+    delete cl;
+}
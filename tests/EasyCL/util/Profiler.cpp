@@ -0,0 +1,511 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, 
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can 
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "Profiler.h"
+
+using namespace std;
+
+namespace easycl {
+
+namespace {
+
+const int MAX_NODES = 4096; // distinct zone paths
+const int MAX_DEPTH = 64;
+// durations below 16 ticks are exact; above, each power of two is split into
+// 16 buckets
+const int SUB_BUCKETS = 16;
+const int NUM_BUCKETS = SUB_BUCKETS + 60 * SUB_BUCKETS;
+
+struct NodeInfo {
+    int parent; // -1 for top-level zones
+    int zone;
+    int depth;
+};
+
+// written only by the owning thread, read by getStats() from any thread
+struct NodeStats {
+    atomic<uint64_t> count;
+    atomic<uint64_t> total;
+    atomic<uint64_t> min;
+    atomic<uint64_t> max;
+    atomic<uint32_t> buckets[NUM_BUCKETS];
+
+    void clear() {
+        count.store(0, memory_order_relaxed);
+        total.store(0, memory_order_relaxed);
+        min.store(~uint64_t(0), memory_order_relaxed);
+        max.store(0, memory_order_relaxed);
+        for(int i = 0; i < NUM_BUCKETS; i++) {
+            buckets[i].store(0, memory_order_relaxed);
+        }
+    }
+};
+
+struct ThreadBuffer {
+    atomic<NodeStats *> stats[MAX_NODES];
+    // owning thread only:
+    unordered_map<uint64_t, int> nodeByKey;
+    int stack[MAX_DEPTH];
+    int zones[MAX_DEPTH];
+    uint64_t starts[MAX_DEPTH];
+    int depth;
+    int index;
+    // only while tracing
+    mutex traceLock;
+    vector<Profiler::TraceSpan> trace;
+    string name;
+};
+
+// never deleted: threads can outlive static destructors
+struct Registry {
+    mutex lock;
+    map<string, int> idByName;
+    vector<string> names;
+    map<uint64_t, int> nodeByKey;
+    vector<NodeInfo> nodes;
+    vector<ThreadBuffer *> threads;
+    // buffers of threads that have exited.  The next new thread takes one
+    // over and keeps adding to its stats, so they still count, and there
+    // are only as many buffers as threads ever ran at once
+    vector<ThreadBuffer *> freeBuffers;
+};
+
+Registry &registry() {
+    static Registry *instance = new Registry();
+    return *instance;
+}
+
+thread_local ThreadBuffer *threadBuffer = 0;
+// set once the thread has given its buffer back; zones after that arent recorded
+thread_local bool threadExited = false;
+
+// owns the thread's buffer, and hands it back to the registry when the thread
+// exits
+struct ThreadBufferOwner {
+    ThreadBuffer *buffer;
+    string pendingName; // set before the thread's first zone
+
+    ThreadBufferOwner() : buffer(0) {}
+    ~ThreadBufferOwner() {
+        threadExited = true;
+        threadBuffer = 0;
+        if(buffer == 0) {
+            return;
+        }
+        buffer->depth = 0; // zones left open are dropped
+        Registry &r = registry();
+        lock_guard<mutex> guard(r.lock);
+        r.freeBuffers.push_back(buffer);
+    }
+};
+thread_local ThreadBufferOwner threadBufferOwner;
+
+// 0 while the thread is exiting
+ThreadBuffer *getThreadBuffer() {
+    if(threadBuffer == 0 && !threadExited) {
+        ThreadBufferOwner &owner = threadBufferOwner;
+        Registry &r = registry();
+        ThreadBuffer *buffer = 0;
+        {
+            lock_guard<mutex> guard(r.lock);
+            if(r.freeBuffers.size() > 0) {
+                buffer = r.freeBuffers.back();
+                r.freeBuffers.pop_back();
+            }
+        }
+        if(buffer == 0) {
+            buffer = new ThreadBuffer();
+            for(int i = 0; i < MAX_NODES; i++) {
+                buffer->stats[i].store(0, memory_order_relaxed);
+            }
+            buffer->depth = 0;
+            lock_guard<mutex> guard(r.lock);
+            buffer->index = (int)r.threads.size();
+            r.threads.push_back(buffer);
+        }
+        {
+            // spans the previous owner left show under this name too
+            lock_guard<mutex> guard(buffer->traceLock);
+            buffer->name = owner.pendingName;
+        }
+        owner.buffer = buffer;
+        threadBuffer = buffer;
+    }
+    return threadBuffer;
+}
+
+uint64_t nodeKey(int parent, int zone) {
+    return ((uint64_t)(uint32_t)(parent + 1) << 32) | (uint32_t)zone;
+}
+
+// -1 once MAX_NODES paths exist
+int internNode(int parent, int zone) {
+    Registry &r = registry();
+    lock_guard<mutex> guard(r.lock);
+    uint64_t key = nodeKey(parent, zone);
+    map<uint64_t, int>::iterator it = r.nodeByKey.find(key);
+    if(it != r.nodeByKey.end()) {
+        return it->second;
+    }
+    if((int)r.nodes.size() >= MAX_NODES) {
+        return -1;
+    }
+    NodeInfo info;
+    info.parent = parent;
+    info.zone = zone;
+    info.depth = parent < 0 ? 0 : r.nodes[parent].depth + 1;
+    int node = (int)r.nodes.size();
+    r.nodes.push_back(info);
+    r.nodeByKey[key] = node;
+    return node;
+}
+
+int highestBit(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(value);
+#else
+    int bit = 0;
+    while(value >>= 1) {
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+int bucketOf(uint64_t ticks) {
+    if(ticks < (uint64_t)SUB_BUCKETS) {
+        return (int)ticks;
+    }
+    int bit = highestBit(ticks); // >= 4
+    int sub = (int)(ticks >> (bit - 4)) - SUB_BUCKETS;
+    return min(SUB_BUCKETS + (bit - 4) * SUB_BUCKETS + sub, NUM_BUCKETS - 1);
+}
+
+// middle of the bucket, in ticks
+double bucketValue(int bucket) {
+    if(bucket < SUB_BUCKETS) {
+        return bucket;
+    }
+    int bit = (bucket - SUB_BUCKETS) / SUB_BUCKETS + 4;
+    int sub = (bucket - SUB_BUCKETS) % SUB_BUCKETS;
+    return ldexp(SUB_BUCKETS + sub + 0.5, bit - 4);
+}
+
+void record(ThreadBuffer *buffer, int node, uint64_t ticks) {
+    NodeStats *stats = buffer->stats[node].load(memory_order_relaxed);
+    if(stats == 0) {
+        stats = new NodeStats();
+        stats->clear();
+        buffer->stats[node].store(stats, memory_order_release);
+    }
+    // single writer, so no read-modify-write needed
+    stats->count.store(stats->count.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    stats->total.store(stats->total.load(memory_order_relaxed) + ticks, memory_order_relaxed);
+    if(ticks < stats->min.load(memory_order_relaxed)) {
+        stats->min.store(ticks, memory_order_relaxed);
+    }
+    if(ticks > stats->max.load(memory_order_relaxed)) {
+        stats->max.store(ticks, memory_order_relaxed);
+    }
+    atomic<uint32_t> &bucket = stats->buckets[bucketOf(ticks)];
+    bucket.store(bucket.load(memory_order_relaxed) + 1, memory_order_relaxed);
+}
+
+}
+
+atomic<bool> Profiler::enabledFlag(false);
+atomic<bool> Profiler::tracingFlag(false);
+
+void Profiler::setEnabled(bool enabled) {
+    if(enabled) {
+        ticksPerMillisecond(); // calibrate now, rather than in the first dump
+    }
+    enabledFlag.store(enabled);
+}
+
+int Profiler::zoneId(const char *name) {
+    Registry &r = registry();
+    lock_guard<mutex> guard(r.lock);
+    map<string, int>::iterator it = r.idByName.find(name);
+    if(it != r.idByName.end()) {
+        return it->second;
+    }
+    int id = (int)r.names.size();
+    r.names.push_back(name);
+    r.idByName[name] = id;
+    return id;
+}
+
+string Profiler::zoneName(int zoneId) {
+    Registry &r = registry();
+    lock_guard<mutex> guard(r.lock);
+    if(zoneId < 0 || zoneId >= (int)r.names.size()) {
+        throw runtime_error("Profiler::zoneName(): unknown zone id " + to_string(zoneId));
+    }
+    return r.names[zoneId];
+}
+
+void Profiler::begin(int zoneId) {
+    ThreadBuffer *buffer = getThreadBuffer();
+    if(buffer == 0) {
+        return;
+    }
+    int depth = buffer->depth++;
+    if(depth >= MAX_DEPTH) {
+        return;
+    }
+    int parent = depth > 0 ? buffer->stack[depth - 1] : -1;
+    int node = -1;
+    if(depth == 0 || parent >= 0) {
+        uint64_t key = nodeKey(parent, zoneId);
+        unordered_map<uint64_t, int>::iterator it = buffer->nodeByKey.find(key);
+        if(it != buffer->nodeByKey.end()) {
+            node = it->second;
+        } else {
+            node = internNode(parent, zoneId);
+            buffer->nodeByKey[key] = node;
+        }
+    }
+    buffer->stack[depth] = node;
+    buffer->zones[depth] = zoneId;
+    buffer->starts[depth] = now(); // last, so the above isnt timed
+}
+
+void Profiler::end() {
+    uint64_t end = now();
+    ThreadBuffer *buffer = threadBuffer;
+    if(buffer == 0 || buffer->depth == 0) {
+        return;
+    }
+    int depth = --buffer->depth;
+    if(depth >= MAX_DEPTH) {
+        return;
+    }
+    uint64_t start = buffer->starts[depth];
+    if(buffer->stack[depth] >= 0) {
+        record(buffer, buffer->stack[depth], end > start ? end - start : 0);
+    }
+    if(isTracing()) {
+        TraceSpan span;
+        span.zoneId = buffer->zones[depth];
+        span.thread = buffer->index;
+        span.start = start;
+        span.end = end;
+        lock_guard<mutex> guard(buffer->traceLock);
+        buffer->trace.push_back(span);
+    }
+}
+
+void Profiler::addZone(int zoneId, uint64_t start) {
+    begin(zoneId);
+    ThreadBuffer *buffer = threadBuffer;
+    if(buffer != 0 && buffer->depth <= MAX_DEPTH) {
+        buffer->starts[buffer->depth - 1] = start;
+    }
+    end();
+}
+
+void Profiler::setTracing(bool tracing) {
+    if(tracing) {
+        ticksPerMillisecond();
+    }
+    tracingFlag.store(tracing);
+}
+
+vector<Profiler::TraceSpan> Profiler::takeTraceSpans() {
+    Registry &r = registry();
+    lock_guard<mutex> guard(r.lock);
+    vector<TraceSpan> spans;
+    for(int t = 0; t < (int)r.threads.size(); t++) {
+        ThreadBuffer *buffer = r.threads[t];
+        lock_guard<mutex> traceGuard(buffer->traceLock);
+        spans.insert(spans.end(), buffer->trace.begin(), buffer->trace.end());
+        buffer->trace.clear();
+    }
+    return spans;
+}
+
+void Profiler::setThreadName(string name) {
+    // dont make buffers for threads that never open a zone
+    if(threadBuffer == 0) {
+        if(!threadExited) {
+            threadBufferOwner.pendingName = name;
+        }
+        return;
+    }
+    lock_guard<mutex> guard(threadBuffer->traceLock);
+    threadBuffer->name = name;
+}
+
+vector<string> Profiler::getThreadNames() {
+    Registry &r = registry();
+    lock_guard<mutex> guard(r.lock);
+    vector<string> names;
+    for(int t = 0; t < (int)r.threads.size(); t++) {
+        ThreadBuffer *buffer = r.threads[t];
+        lock_guard<mutex> traceGuard(buffer->traceLock);
+        names.push_back(buffer->name != "" ? buffer->name : "thread " + to_string(t));
+    }
+    return names;
+}
+
+uint64_t Profiler::now() {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    return __rdtsc();
+#elif defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+double Profiler::ticksPerMillisecond() {
+    static double ticks = -1;
+    static once_flag calibrated;
+    call_once(calibrated, [] {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+        // 20ms against steady_clock
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        uint64_t startTicks = now();
+        chrono::steady_clock::time_point end;
+        do {
+            end = chrono::steady_clock::now();
+        } while(end - start < chrono::milliseconds(20));
+        uint64_t endTicks = now();
+        double ms = chrono::duration<double, milli>(end - start).count();
+        ticks = (double)(endTicks - startTicks) / ms;
+#else
+        ticks = 1e6;
+#endif
+    });
+    return ticks;
+}
+
+vector<Profiler::ZoneStats> Profiler::getStats() {
+    double tickMs = 1.0 / ticksPerMillisecond();
+    Registry &r = registry();
+    lock_guard<mutex> guard(r.lock);
+
+    vector<ZoneStats> result;
+    vector< vector< string > > chains; // zone names from the top, to sort by
+    vector<uint64_t> buckets(NUM_BUCKETS);
+    for(int node = 0; node < (int)r.nodes.size(); node++) {
+        int64_t count = 0;
+        uint64_t total = 0;
+        uint64_t minTicks = ~uint64_t(0);
+        uint64_t maxTicks = 0;
+        fill(buckets.begin(), buckets.end(), 0);
+        for(int t = 0; t < (int)r.threads.size(); t++) {
+            NodeStats *stats = r.threads[t]->stats[node].load(memory_order_acquire);
+            if(stats == 0) {
+                continue;
+            }
+            count += (int64_t)stats->count.load(memory_order_relaxed);
+            total += stats->total.load(memory_order_relaxed);
+            minTicks = std::min(minTicks, stats->min.load(memory_order_relaxed));
+            maxTicks = std::max(maxTicks, stats->max.load(memory_order_relaxed));
+            for(int b = 0; b < NUM_BUCKETS; b++) {
+                buckets[b] += stats->buckets[b].load(memory_order_relaxed);
+            }
+        }
+        if(count == 0) {
+            continue;
+        }
+
+        ZoneStats zone;
+        vector<string> chain;
+        for(int n = node; n >= 0; n = r.nodes[n].parent) {
+            chain.insert(chain.begin(), r.names[r.nodes[n].zone]);
+        }
+        zone.name = chain.back();
+        zone.path = chain[0];
+        for(int i = 1; i < (int)chain.size(); i++) {
+            zone.path += "/" + chain[i];
+        }
+        zone.depth = r.nodes[node].depth;
+        zone.count = count;
+        zone.totalMilliseconds = total * tickMs;
+        zone.minMilliseconds = minTicks * tickMs;
+        zone.maxMilliseconds = maxTicks * tickMs;
+        double percentiles[2] = { 0.5, 0.99 };
+        double values[2] = { 0, 0 };
+        for(int p = 0; p < 2; p++) {
+            uint64_t rank = (uint64_t)ceil(percentiles[p] * count);
+            uint64_t seen = 0;
+            for(int b = 0; b < NUM_BUCKETS; b++) {
+                seen += buckets[b];
+                if(seen >= rank) {
+                    values[p] = bucketValue(b);
+                    break;
+                }
+            }
+            values[p] = std::min(std::max(values[p], (double)minTicks), (double)maxTicks);
+        }
+        zone.p50Milliseconds = values[0] * tickMs;
+        zone.p99Milliseconds = values[1] * tickMs;
+        result.push_back(zone);
+        chains.push_back(chain);
+    }
+
+    vector<int> order(result.size());
+    for(int i = 0; i < (int)order.size(); i++) {
+        order[i] = i;
+    }
+    sort(order.begin(), order.end(), [&chains](int a, int b) { return chains[a] < chains[b]; });
+    vector<ZoneStats> sorted;
+    for(int i = 0; i < (int)order.size(); i++) {
+        sorted.push_back(result[order[i]]);
+    }
+    return sorted;
+}
+
+void Profiler::dump(ostream &os) {
+    vector<ZoneStats> stats = getStats();
+    os << "Profiler readings (ms):" << endl;
+    char line[512];
+    snprintf(line, sizeof(line), "  %-40s %10s %12s %10s %10s %10s %10s", "zone", "count", "total", "min", "p50", "p99", "max");
+    os << line << endl;
+    for(int i = 0; i < (int)stats.size(); i++) {
+        const ZoneStats &z = stats[i];
+        string name = string(2 * z.depth, ' ') + z.name;
+        snprintf(line, sizeof(line), "  %-40s %10lld %12.3f %10.4f %10.4f %10.4f %10.4f", name.c_str(),
+            (long long)z.count, z.totalMilliseconds, z.minMilliseconds, z.p50Milliseconds,
+            z.p99Milliseconds, z.maxMilliseconds);
+        os << line << endl;
+    }
+}
+
+void Profiler::reset() {
+    Registry &r = registry();
+    lock_guard<mutex> guard(r.lock);
+    for(int t = 0; t < (int)r.threads.size(); t++) {
+        for(int node = 0; node < MAX_NODES; node++) {
+            NodeStats *stats = r.threads[t]->stats[node].load(memory_order_acquire);
+            if(stats != 0) {
+                stats->clear();
+            }
+        }
+    }
+}
+
+}
+
@@ -0,0 +1,146 @@
+// Copyright Hugh Perkins 2015 hughperkins at gmail
+//
+// This Source Code Form is subject to the terms of the Mozilla Public License, 
+// v. 2.0. If a copy of the MPL was not distributed with this file, You can 
+// obtain one at http://mozilla.org/MPL/2.0/.
+
+#pragma once
+
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "EasyCL_export.h"
+
+#include "mystdint.h"
+
+#define EASYCL_PROFILE_CONCAT2(a, b) a##b
+#define EASYCL_PROFILE_CONCAT(a, b) EASYCL_PROFILE_CONCAT2(a, b)
+
+// Times the rest of the enclosing scope as zone `name` (a string literal).
+#define EASYCL_PROFILE_ZONE(name) \
+    static const int EASYCL_PROFILE_CONCAT(easyclZoneId, __LINE__) = easycl::Profiler::zoneId(name); \
+    easycl::ProfileZone EASYCL_PROFILE_CONCAT(easyclZone, __LINE__)(EASYCL_PROFILE_CONCAT(easyclZoneId, __LINE__))
+
+namespace easycl {
+
+// Thread-safe, low overhead replacement for StatefulTimer:
+//
+//     void upload() {
+//         EASYCL_PROFILE_ZONE("upload");
+//         ...
+//     }
+//
+// - zone names are interned once per call site, into an int id
+// - each thread records into its own buffers, so recording takes no lock: a
+//   zone costs two TSC reads and a few relaxed atomic stores
+// - zones opened inside another zone are nested under it, and reported with
+//   their path, eg "frame/upload"
+// - per zone: count, total, min, max, and p50/p99 from a log-linear histogram
+//   (about 3% resolution)
+// - nothing is printed, unless you call dump()
+//
+// Disabled by default; a disabled zone costs one relaxed atomic load.
+// EasyCL itself has zones around kernel launches and buffer copies.
+//
+// The TSC is assumed invariant (constant rate, synchronized across cores), as
+// on x86 cpus of the last ten years; elsewhere steady_clock is used.
+class EasyCL_EXPORT Profiler {
+public:
+    struct ZoneStats {
+#ifdef _WIN32
+#pragma warning(disable: 4251)
+#endif
+        std::string path;
+        std::string name;
+#ifdef _WIN32
+#pragma warning(default: 4251)
+#endif
+        int depth; // 0 for top-level zones
+        int64_t count;
+        double totalMilliseconds;
+        double minMilliseconds;
+        double maxMilliseconds;
+        double p50Milliseconds;
+        double p99Milliseconds;
+    };
+
+    static void setEnabled(bool enabled);
+    static bool isEnabled() { return enabledFlag.load(std::memory_order_relaxed); }
+
+    // same name gives same id.  Takes a lock, so call once per call site, as
+    // EASYCL_PROFILE_ZONE does
+    static int zoneId(const char *name);
+    static std::string zoneName(int zoneId);
+
+    // for zones that dont match a scope.  Must be paired on the same thread
+    static void begin(int zoneId);
+    static void end();
+    // a zone from `start`, a now() taken earlier on this thread, until now.
+    // For zones whose end might never come, eg when the code in between
+    // throws, so a begin() would be left open
+    static void addZone(int zoneId, uint64_t start);
+
+    // ticks of the TSC, or steady_clock nanoseconds where there is no TSC
+    static uint64_t now();
+    static double ticksPerMillisecond();
+
+    // merged over all threads, parents before their children
+    static std::vector<ZoneStats> getStats();
+
+    // one closed zone, for timelines
+    struct TraceSpan {
+        int zoneId;
+        int thread; // index, in order of the threads' first zone
+        uint64_t start; // ticks
+        uint64_t end;
+    };
+    // while tracing (and enabled), each closed zone is also kept as a span,
+    // for CLTrace
+    static void setTracing(bool tracing);
+    static bool isTracing() { return tracingFlag.load(std::memory_order_relaxed); }
+    // returns and forgets the spans kept so far, from all threads
+    static std::vector<TraceSpan> takeTraceSpans();
+    // names the calling thread, in traces.  A thread that starts after
+    // another one exited reuses its buffer, so its track and index too
+    static void setThreadName(std::string name);
+    static std::vector<std::string> getThreadNames();
+
+    static void dump(std::ostream &os);
+    // call while no zones are running in other threads
+    static void reset();
+
+private:
+#ifdef _WIN32
+#pragma warning(disable: 4251)
+#endif
+    static std::atomic<bool> enabledFlag;
+    static std::atomic<bool> tracingFlag;
+#ifdef _WIN32
+#pragma warning(default: 4251)
+#endif
+};
+
+// RAII zone, see EASYCL_PROFILE_ZONE
+class ProfileZone {
+public:
+    explicit ProfileZone(int zoneId) : active(Profiler::isEnabled()) {
+        if(active) {
+            Profiler::begin(zoneId);
+        }
+    }
+    ~ProfileZone() {
+        if(active) {
+            Profiler::end();
+        }
+    }
+private:
+    bool active;
+
+    ProfileZone(const ProfileZone &);
+    ProfileZone &operator=(const ProfileZone &);
+};
+
+}
+
@@ -19,6 +19,7 @@
 
 namespace easycl {
 
+// Not thread-safe.  New code should use Profiler (util/Profiler.h)
 class EasyCL_EXPORT StatefulTimer {
 public:
 #ifdef _WIN32
@@ -0,0 +1,172 @@
+# Embed RainbowMist kernel files into the executable.
+#
+# Each `.kernel` file is flattened at build time: every `#include "..."` found
+# in the kernel or in the include directories is replaced by the file contents,
+# with `#line` markers so build logs still point to the original file.
+# `#include <...>` and includes that are not found are left as-is.
+# Preprocessor conditionals are not evaluated, so the same source can be handed
+# to OpenCL and NVRTC; this also means a header may be inlined more than once,
+# and relies on its include guard.
+#
+# The result is written to `<binary dir>/embedded/<name>_kernel.h` as
+#
+#   namespace rainbowmist_embedded {
+#   constexpr unsigned char <name>_kernel[] = { ..., 0x00 };
+#   constexpr unsigned long long <name>_kernel_size = ...; // without the NUL
+#   constexpr unsigned long long <name>_kernel_hash = 0x...ULL;
+#   inline std::string <name>_kernel_source();
+#   }
+#
+# where the hash is the first 64 bits of the SHA-256 of the flattened source,
+# usable as a key for binary caches.
+#
+# Usage:
+#
+#   include(EmbedKernel)
+#   rainbowmist_embed_kernels(<target>
+#       KERNELS simple_add.kernel alignment.kernel
+#       INCLUDE_DIRS ${CMAKE_SOURCE_DIR}/..)
+#
+# This file is also the generator script, run with `cmake -P`.
+
+if (CMAKE_SCRIPT_MODE_FILE)
+
+  # Replace each `#include "..."` of `path` by the flattened contents of the
+  # included file. `display_name` is used for the `#line` markers.
+  function(_rainbowmist_flatten path display_name out_var)
+    file(READ "${path}" content)
+    get_filename_component(dir "${path}" DIRECTORY)
+    set(result "")
+    set(line 1)
+    while (1)
+      string(REGEX MATCH "(^|\n)[ \t]*#[ \t]*include[ \t]*\"([^\"\n]+)\"[^\n]*" directive "${content}")
+      if (NOT directive)
+        break()
+      endif ()
+      set(name "${CMAKE_MATCH_2}")
+
+      string(FIND "${content}" "${directive}" pos)
+      string(SUBSTRING "${content}" 0 ${pos} before)
+      string(LENGTH "${directive}" directive_length)
+      math(EXPR after "${pos} + ${directive_length}")
+      string(SUBSTRING "${content}" ${after} -1 content)
+
+      # The line of the directive (the match may start with the previous newline)
+      string(REGEX MATCHALL "\n" newlines "${before}${directive}")
+      list(LENGTH newlines num_newlines)
+      math(EXPR line "${line} + ${num_newlines}")
+
+      set(found "")
+      foreach (search_dir ${dir} ${EMBED_INCLUDE_DIRS})
+        if (NOT found AND EXISTS "${search_dir}/${name}")
+          get_filename_component(found "${search_dir}/${name}" ABSOLUTE)
+        endif ()
+      endforeach ()
+
+      # Files being flattened right now; including one of them again would
+      # never end
+      get_property(include_stack GLOBAL PROPERTY RAINBOWMIST_EMBED_STACK)
+      list(FIND include_stack "${found}" stack_index)
+      if (NOT found)
+        set(result "${result}${before}${directive}")
+      elseif (NOT stack_index EQUAL -1)
+        message(FATAL_ERROR "${path}: recursive include of ${found}")
+      else ()
+        set_property(GLOBAL APPEND PROPERTY RAINBOWMIST_EMBED_STACK "${found}")
+        _rainbowmist_flatten("${found}" "${name}" included)
+        set_property(GLOBAL PROPERTY RAINBOWMIST_EMBED_STACK ${include_stack})
+        string(REGEX MATCH "^\n" leading_newline "${directive}")
+        math(EXPR next_line "${line} + 1")
+        set(result "${result}${before}${leading_newline}#line 1 \"${name}\"\n${included}\n#line ${next_line} \"${display_name}\"")
+      endif ()
+    endwhile ()
+    set(${out_var} "${result}${content}" PARENT_SCOPE)
+  endfunction ()
+
+  get_filename_component(kernel_name "${EMBED_INPUT}" NAME)
+  string(MAKE_C_IDENTIFIER "${kernel_name}" symbol)
+  string(TOUPPER "${symbol}" guard)
+
+  get_filename_component(input_path "${EMBED_INPUT}" ABSOLUTE)
+  set_property(GLOBAL PROPERTY RAINBOWMIST_EMBED_STACK "${input_path}")
+  _rainbowmist_flatten("${input_path}" "${kernel_name}" flattened)
+
+  # Keep the flattened source next to the header; handy when reading build logs
+  file(WRITE "${EMBED_OUTPUT}.flat" "${flattened}")
+  file(SHA256 "${EMBED_OUTPUT}.flat" sha256)
+  string(SUBSTRING "${sha256}" 0 16 hash)
+  file(SIZE "${EMBED_OUTPUT}.flat" size)
+
+  file(READ "${EMBED_OUTPUT}.flat" hex HEX)
+  string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," bytes "${hex}")
+  set(byte "0x[0-9a-f][0-9a-f],")
+  set(bytes_16 "${byte}${byte}${byte}${byte}${byte}${byte}${byte}${byte}")
+  string(REGEX REPLACE "(${bytes_16}${bytes_16})" "\\1\n    " bytes "${bytes}")
+
+  file(WRITE "${EMBED_OUTPUT}.tmp"
+"// Generated from ${kernel_name} by EmbedKernel.cmake. Do not edit.
+#ifndef RAINBOWMIST_EMBEDDED_${guard}_H_
+#define RAINBOWMIST_EMBEDDED_${guard}_H_
+
+#include <string>
+
+namespace rainbowmist_embedded {
+
+constexpr unsigned char ${symbol}[] = {
+    ${bytes}0x00};
+constexpr unsigned long long ${symbol}_size = ${size}ULL;
+constexpr unsigned long long ${symbol}_hash = 0x${hash}ULL;
+
+inline std::string ${symbol}_source() {
+  return std::string(reinterpret_cast<const char *>(${symbol}), ${symbol}_size);
+}
+
+}  // namespace rainbowmist_embedded
+
+#endif  // RAINBOWMIST_EMBEDDED_${guard}_H_
+")
+  # Only touch the header when the contents changed, to avoid needless rebuilds
+  execute_process(COMMAND ${CMAKE_COMMAND} -E copy_if_different
+                  "${EMBED_OUTPUT}.tmp" "${EMBED_OUTPUT}")
+  file(REMOVE "${EMBED_OUTPUT}.tmp")
+  return()
+endif ()
+
+set(RAINBOWMIST_EMBED_SCRIPT "${CMAKE_CURRENT_LIST_FILE}")
+
+function(rainbowmist_embed_kernels target)
+  cmake_parse_arguments(EMBED "" "" "KERNELS;INCLUDE_DIRS" ${ARGN})
+
+  set(output_dir "${CMAKE_CURRENT_BINARY_DIR}/embedded")
+  file(MAKE_DIRECTORY "${output_dir}")
+
+  # Any header in the include directories may be pulled in
+  set(header_depends "")
+  foreach (include_dir ${EMBED_INCLUDE_DIRS})
+    file(GLOB headers "${include_dir}/*.h")
+    list(APPEND header_depends ${headers})
+  endforeach ()
+  string(REPLACE ";" "\\;" include_dirs_arg "${EMBED_INCLUDE_DIRS}")
+
+  set(outputs "")
+  foreach (kernel ${EMBED_KERNELS})
+    get_filename_component(kernel_path "${kernel}" ABSOLUTE)
+    get_filename_component(kernel_name "${kernel}" NAME)
+    string(MAKE_C_IDENTIFIER "${kernel_name}" symbol)
+    set(output "${output_dir}/${symbol}.h")
+    add_custom_command(
+      OUTPUT "${output}"
+      COMMAND ${CMAKE_COMMAND}
+              "-DEMBED_INPUT=${kernel_path}"
+              "-DEMBED_OUTPUT=${output}"
+              "-DEMBED_INCLUDE_DIRS=${include_dirs_arg}"
+              -P "${RAINBOWMIST_EMBED_SCRIPT}"
+      DEPENDS "${kernel_path}" ${header_depends} "${RAINBOWMIST_EMBED_SCRIPT}"
+      COMMENT "Embedding kernel ${kernel_name}"
+      VERBATIM)
+    list(APPEND outputs "${output}")
+  endforeach ()
+
+  target_sources(${target} PRIVATE ${outputs})
+  target_include_directories(${target} PRIVATE "${output_dir}")
+endfunction ()
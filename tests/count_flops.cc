@@ -0,0 +1,105 @@
+// Tests of rainbowmist_flops.h. Built separately from main.cc, since
+// RAINBOWMIST_COUNT_FLOPS changes the vector types.
+
+#include <atomic>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+#include "catch.hpp"
+
+#define RAINBOWMIST_COUNT_FLOPS
+#include "rainbowmist_flops.h"
+
+// ------------
+static void saxpy(RM_GLOBAL_PTR(float) y, RM_GLOBAL_PTR(const float) x,
+                  RM_FLOAT a) {
+  unsigned int i = GlobalId().x;
+  y[i] = a * x[i] + y[i];
+}
+
+static void shade(RM_GLOBAL_PTR(float) out, RM_GLOBAL_PTR(const float) n) {
+  unsigned int i = GlobalId().x;
+  vec3 v = make_vec3(n[3 * i + 0], n[3 * i + 1], n[3 * i + 2]);
+  vec3 l = vec3(0.0f, 1.0f, 0.0f);
+  RM_FLOAT d = dot(normalize(v), l);
+  out[i] = max(d, 0.0f) + sqrtf(d * d);
+}
+// ------------
+
+TEST_CASE("flop counting", "[cpp11]") {
+  const unsigned int n = 1000;
+  std::vector<float> x(n, 2.0f), y(n, 1.0f);
+
+  rainbowmist::FlopProfiler prof;
+  for (int i = 0; i < 2; i++) {
+    prof.Launch("saxpy", n, 1, 1,
+                [&]() { saxpy(y.data(), x.data(), 3.0f); }, 4);
+  }
+  REQUIRE(y[5] == 13.0f);
+
+  std::vector<float> normals(3 * n, 1.0f), out(n);
+  prof.Launch("shade", n, 1, 1, [&]() { shade(out.data(), normals.data()); });
+  REQUIRE(out[7] == Approx(2.0f / std::sqrt(3.0f)));
+
+  // Not counted outside of FlopProfiler::Launch.
+  rainbowmist::LaunchKernel(n, 1, 1,
+                            [&]() { saxpy(y.data(), x.data(), 3.0f); });
+
+  // A launch that throws is not counted, and leaves no worker counting.
+  REQUIRE_THROWS(prof.Launch("fail", n, 1, 1, [&]() {
+    saxpy(y.data(), x.data(), 3.0f);
+    throw std::runtime_error("kernel failed");
+  }, 4));
+  REQUIRE(rainbowmist::CurrentLaunchObserver() == nullptr);
+  std::atomic<int> counting(0);
+  rainbowmist::LaunchKernel(n, 1, 1, [&]() {
+    if (rainbowmist::CurrentFlopCounts() != nullptr) {
+      counting++;
+    }
+  }, 4);
+  REQUIRE(counting == 0);
+
+  std::vector<rainbowmist::KernelFlops> kernels = prof.kernels();
+  REQUIRE(kernels.size() == 2);
+
+  const rainbowmist::KernelFlops &s = kernels[0];
+  REQUIRE(s.name == "saxpy");
+  REQUIRE(s.num_launches == 2);
+  REQUIRE(s.num_items == 2 * n);
+  REQUIRE(s.counts.ops[rainbowmist::kFlopMul] == 2 * n);
+  REQUIRE(s.counts.ops[rainbowmist::kFlopAdd] == 2 * n);
+  REQUIRE(s.counts.load_bytes == 2 * n * 8);
+  REQUIRE(s.counts.store_bytes == 2 * n * 4);
+  REQUIRE(s.FlopsPerItem() == Approx(2.0));
+  REQUIRE(s.BytesPerItem() == Approx(12.0));
+  REQUIRE(s.ArithmeticIntensity() == Approx(2.0 / 12.0));
+
+  // dot: 3 mul + 2 add, twice; length: 1 sqrt; normalize: 3 div; plus a max,
+  // a mul and a sqrtf in `shade`, and the final add.
+  const rainbowmist::KernelFlops &k = kernels[1];
+  REQUIRE(k.name == "shade");
+  REQUIRE(k.OpsPerItem(rainbowmist::kFlopMul) == Approx(7.0));
+  REQUIRE(k.OpsPerItem(rainbowmist::kFlopAdd) == Approx(5.0));
+  REQUIRE(k.OpsPerItem(rainbowmist::kFlopDiv) == Approx(3.0));
+  REQUIRE(k.OpsPerItem(rainbowmist::kFlopTranscendental) == Approx(2.0));
+  REQUIRE(k.OpsPerItem(rainbowmist::kFlopCompare) == Approx(1.0));
+  REQUIRE(k.BytesPerItem() == Approx(16.0));
+
+  prof.SetTime("saxpy", 1.0e-3);
+  REQUIRE(prof.kernels()[0].Gflops() == Approx(4.0 * n * 1.0e-9 / 2.0e-3));
+}
+
+TEST_CASE("roofline machine probes", "[cpp11]") {
+  double bandwidth = rainbowmist::MeasureBandwidth(size_t(3) << 20, 2, 2);
+  double gflops = rainbowmist::MeasurePeakGflops(1, 1 << 12);
+  REQUIRE(bandwidth > 0.0);
+  REQUIRE(gflops > 0.0);
+
+  rainbowmist::RooflineMachine machine;
+  machine.gflops = 100.0;
+  machine.gbytes_per_sec = 20.0;
+  REQUIRE(machine.Ridge() == Approx(5.0));
+  REQUIRE(machine.Attainable(1.0) == Approx(20.0));
+  REQUIRE(machine.Attainable(10.0) == Approx(100.0));
+}
@@ -1,5 +1,9 @@
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
+#include <mutex>
+#include <set>
+#include <thread>
 
 #define CATCH_CONFIG_RUNNER
 #include "catch.hpp"
@@ -22,6 +26,7 @@
 #include "EasyCL.h"
 
 #include "cupp11.h"
+#include "CLTraceCLCudaAPI.h"
 
 #ifdef __clang__
 #pragma clang diagnostic pop
@@ -35,6 +40,26 @@
 // ------------
 #include "alignment.kernel"
 #include "simple_add.kernel"
+#include "texture.kernel"
+#include "bvh.kernel"
+#include "spec.kernel"
+#include "rainbowmist_lbvh.h"
+#include "rainbowmist_dirty.h"
+#include "rainbowmist_staging.h"
+#include "rainbowmist_pipeline.h"
+#include "rainbowmist_perf.h"
+#include "rainbowmist_memtrace.h"
+#include "rainbowmist_divergence.h"
+#include "rainbowmist_capture.h"
+#include "CLTraceLaunch.h"
+
+#include "mock/mock_cuda.h"
+#include "mock/mock_opencl.h"
+
+// Flattened kernel sources, generated by cmake/EmbedKernel.cmake
+#include "alignment_kernel.h"
+#include "simple_add_kernel.h"
+#include "spec_kernel.h"
 // ------------
 
 using namespace Catch;
@@ -43,35 +68,29 @@ using namespace easycl;
 static bool hasCUDA = false;
 static bool hasOpenCL = false;
 
-static std::string kOpenCLCompileOptions = "-I ../ -I ../../ -D OPENCL";
+// Kernel sources are embedded with their includes resolved, so no include
+// paths are needed.
+static std::string kOpenCLCompileOptions = "-D OPENCL";
 
-static std::vector<std::string> kCUDACompileOptions = {"--include-path=../../"};
+static std::vector<std::string> kCUDACompileOptions = {};
 
-#if !defined(__APPLE__)
-static std::string LoadFile(const std::string &filename) {
-  std::ifstream ifs(filename);
-  if (!ifs) {
-    std::cerr << "failed to open file : " << filename << std::endl;
-  }
-
-  ifs.seekg(0, ifs.end);
-  int length = static_cast<int>(ifs.tellg());
-  if (length < 4) {
-    return std::string();
+// Occurrences of `sub` in `s`, for checking traces.
+static int CountOf(const std::string &s, const std::string &sub) {
+  int n = 0;
+  for (size_t pos = s.find(sub); pos != std::string::npos;
+       pos = s.find(sub, pos + 1)) {
+    n++;
   }
-
-  ifs.seekg(0, ifs.beg);
-
-  std::vector<unsigned char> buf;
-  buf.resize(length);
-
-  ifs.read(reinterpret_cast<char *>(buf.data()), length);
-
-  std::string s(buf.data(), buf.data() + length);
-
-  return s;
+  return n;
 }
 
+// Variants of spec.kernel for the [opencl] tests, matching their `-D` builds.
+RM_REGISTER_KERNEL_VARIANT(spec_tile_sum, "-D SQUARE=0 -D TILE=4",
+                           spec_tile_sum<4, false>)
+RM_REGISTER_KERNEL_VARIANT(spec_tile_sum, "-D SQUARE=1 -D TILE=4",
+                           spec_tile_sum<4, true>)
+
+#if !defined(__APPLE__)
 TEST_CASE("CUDA initialize", "[cuda]") {
   auto platform = CLCudaAPI::Platform(0);
   auto device = CLCudaAPI::Device(platform, 0);
@@ -79,8 +98,7 @@ TEST_CASE("CUDA initialize", "[cuda]") {
   auto queue = CLCudaAPI::Queue(context, device);
   auto event = CLCudaAPI::Event();
 
-  std::string program_string = LoadFile("../simple_add.kernel");
-  std::cout << program_string << std::endl;
+  std::string program_string = rainbowmist_embedded::simple_add_kernel_source();
   REQUIRE(!program_string.empty());
 
   auto program = CLCudaAPI::Program(context, std::move(program_string));
@@ -131,8 +149,7 @@ TEST_CASE("CUDA datasize", "[cuda]") {
   auto queue = CLCudaAPI::Queue(context, device);
   auto event = CLCudaAPI::Event();
 
-  std::string program_string = LoadFile("../alignment.kernel");
-  std::cout << program_string << std::endl;
+  std::string program_string = rainbowmist_embedded::alignment_kernel_source();
   REQUIRE(!program_string.empty());
 
   auto program = CLCudaAPI::Program(context, std::move(program_string));
@@ -165,14 +182,158 @@ TEST_CASE("CUDA datasize", "[cuda]") {
   REQUIRE(ret[1] == 24);
   REQUIRE(ret[2] == 32);
 }
+
+TEST_CASE("CUDA host overhead", "[cuda]") {
+  // Host side cost of a launch from a cached binary: module load, argument
+  // marshalling, the launch with its timing events, and the read back. On
+  // the mock driver the kernel itself is almost free, so this is nearly all
+  // of it.
+  auto platform = CLCudaAPI::Platform(0);
+  auto device = CLCudaAPI::Device(platform, 0);
+  auto context = CLCudaAPI::Context(device);
+  auto queue = CLCudaAPI::Queue(context, device);
+  auto event = CLCudaAPI::Event();
+
+  auto program = CLCudaAPI::Program(
+      context, rainbowmist_embedded::simple_add_kernel_source());
+  std::vector<std::string> compiler_options = kCUDACompileOptions;
+  REQUIRE(program.Build(device, compiler_options) ==
+          CLCudaAPI::BuildStatus::kSuccess);
+  const std::string ptx = program.GetIR();
+  REQUIRE(!ptx.empty());
+
+  float a[2] = {1, 2.1f};
+  float b[2] = {3, 4.5f};
+  float ret[2] = {0, 0};
+  auto dev_a = CLCudaAPI::Buffer<float>(context, queue, a, a + 2);
+  auto dev_b = CLCudaAPI::Buffer<float>(context, queue, b, b + 2);
+  auto dev_ret = CLCudaAPI::Buffer<float>(context, queue, ret, ret + 2);
+
+  std::vector<size_t> global(1, 1);
+  std::vector<size_t> local(1, 1);
+
+  const int kLaunches = 1000;
+  double kernel_ms = 0.0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kLaunches; i++) {
+    auto cached = CLCudaAPI::Program(device, context, ptx);
+    auto kernel = CLCudaAPI::Kernel(cached, "simple_add_vec2");
+    kernel.SetArguments(dev_ret, dev_a, dev_b);
+    kernel.Launch(queue, global, local, event.pointer());
+    queue.Finish(event);
+    kernel_ms += double(event.GetElapsedTime());
+    dev_ret.Read(queue, 2, ret);
+  }
+  auto end = std::chrono::steady_clock::now();
+  double us =
+      std::chrono::duration<double, std::micro>(end - start).count() /
+      kLaunches;
+  printf("CUDA host overhead: %.2f us/launch(%.2f us in kernel)\n", us,
+         1000.0 * kernel_ms / kLaunches);
+
+  REQUIRE(ret[0] == Approx(4));
+  REQUIRE(ret[1] == Approx(6.6f));
+  REQUIRE(kernel_ms >= 0.0);
+}
+
+TEST_CASE("CUDA trace", "[cuda]") {
+  auto platform = CLCudaAPI::Platform(0);
+  auto device = CLCudaAPI::Device(platform, 0);
+  auto context = CLCudaAPI::Context(device);
+  auto queue = CLCudaAPI::Queue(context, device);
+  auto event = CLCudaAPI::Event();
+
+  auto program = CLCudaAPI::Program(
+      context, rainbowmist_embedded::simple_add_kernel_source());
+  std::vector<std::string> compiler_options = kCUDACompileOptions;
+  REQUIRE(program.Build(device, compiler_options) ==
+          CLCudaAPI::BuildStatus::kSuccess);
+
+  float a[2] = {1, 2.1f};
+  float b[2] = {3, 4.5f};
+  float ret[2] = {0, 0};
+  auto dev_a = CLCudaAPI::Buffer<float>(context, queue, a, a + 2);
+  auto dev_b = CLCudaAPI::Buffer<float>(context, queue, b, b + 2);
+  auto dev_ret = CLCudaAPI::Buffer<float>(context, queue, ret, ret + 2);
+  auto kernel = CLCudaAPI::Kernel(program, "simple_add_vec2");
+  kernel.SetArguments(dev_ret, dev_a, dev_b);
+  REQUIRE(kernel.GetFunctionName() == "simple_add_vec2");
+
+  traceCLCudaAPI();
+  CLTrace::clear();
+  // Not recorded while disabled.
+  dev_a.Write(queue, 2, a);
+  CLTrace::setEnabled(true);
+  dev_a.Write(queue, 2, a);
+  kernel.Launch(queue, {1}, {1}, event.pointer());
+  dev_ret.CopyTo(queue, 2, dev_b);
+  dev_ret.Read(queue, 2, ret);
+  CLTrace::setEnabled(false);
+  Profiler::setEnabled(false);
+  CLCudaAPI::SetCommandTracer(nullptr);
+
+  REQUIRE(ret[0] == Approx(4));
+  REQUIRE(CLTrace::getNumCommands() == 4);
+  std::string json = CLTrace::toChromeTraceJson();
+  REQUIRE(CountOf(json, "\"name\":\"simple_add_vec2\",\"cat\":\"kernel\"") == 1);
+  REQUIRE(CountOf(json, "\"name\":\"Buffer::WriteAsync\",\"cat\":\"upload\"") == 1);
+  REQUIRE(CountOf(json, "\"name\":\"Buffer::CopyToAsync\",\"cat\":\"copy\"") == 1);
+  REQUIRE(CountOf(json, "\"name\":\"Buffer::ReadAsync\",\"cat\":\"download\"") == 1);
+  REQUIRE(CountOf(json, "\"args\":{\"name\":\"stream 0\"}") == 1);
+  // Timed on the stream, so they are spans rather than instants.
+  REQUIRE(CountOf(json, "\"pid\":2,\"tid\":0,\"ph\":\"X\"") == 4);
+  CLTrace::clear();
+}
+
+TEST_CASE("CUDA staging upload", "[cuda]") {
+  auto platform = CLCudaAPI::Platform(0);
+  auto device = CLCudaAPI::Device(platform, 0);
+  auto context = CLCudaAPI::Context(device);
+  auto queue = CLCudaAPI::Queue(context, device);
+
+  const size_t chunk_bytes = 1000, num_chunks = 3;
+  std::vector<unsigned char> staging(chunk_bytes * num_chunks);
+  rainbowmist::StagingRing ring(staging.data(), chunk_bytes, num_chunks);
+  std::vector<CUevent> events(num_chunks);
+  for (CUevent &event : events) {
+    REQUIRE(cuEventCreate(&event, CU_EVENT_DISABLE_TIMING) == CUDA_SUCCESS);
+  }
+
+  std::vector<unsigned char> src(10500), dst(src.size(), 0);
+  for (size_t i = 0; i < src.size(); i++) {
+    src[i] = static_cast<unsigned char>(i * 7 + 3);
+  }
+  auto buffer = CLCudaAPI::Buffer<unsigned char>(context, src.size());
+  CUstream stream = queue();
+  REQUIRE(rainbowmist::StagingUploadCUDA(&ring, events, stream, buffer(), 0,
+                                         src.data(),
+                                         src.size()) == CUDA_SUCCESS);
+  REQUIRE(rainbowmist::StagingUploadCUDA(&ring, events, stream, buffer(), 0,
+                                         nullptr, 0) == CUDA_SUCCESS);
+  buffer.Read(queue, dst.size(), dst.data());
+  REQUIRE(dst == src);
+
+  // The first failed copy stops the upload: the later chunks would go to
+  // 0 + offset.
+  REQUIRE(rainbowmist::StagingUploadCUDA(&ring, events, stream, 0, 0,
+                                         src.data(),
+                                         src.size()) != CUDA_SUCCESS);
+  REQUIRE(rainbowmist::StagingUploadCUDA(&ring, events, stream, buffer(), 0,
+                                         nullptr, 0) == CUDA_SUCCESS);
+
+  for (CUevent event : events) {
+    cuEventDestroy(event);
+  }
+}
 #endif
 
 // -----------------------------------------------
 
 TEST_CASE("OCL simple add vec2", "[opencl]") {
   EasyCL *cl = EasyCL::createForFirstGpu();
-  CLKernel *kernel = cl->buildKernel("../simple_add.kernel", "simple_add_vec2",
-                                     kOpenCLCompileOptions);
+  CLKernel *kernel = cl->buildKernelFromString(
+      rainbowmist_embedded::simple_add_kernel_source(), "simple_add_vec2",
+      kOpenCLCompileOptions, "simple_add.kernel");
   REQUIRE(kernel != nullptr);
 
   float ret[2];
@@ -194,10 +355,13 @@ TEST_CASE("OCL simple add vec2", "[opencl]") {
   REQUIRE(ret[1] == Approx(6.6f));
 }
 
-TEST_CASE("OCL datasize", "[opencl]") {
+// Sizes depend on the OpenCL C compiler, so this does not run on the mock
+// runtime(see RegisterMockCLKernels).
+TEST_CASE("OCL datasize", "[opencl][device]") {
   EasyCL *cl = EasyCL::createForFirstGpu();
-  CLKernel *kernel = cl->buildKernel("../alignment.kernel", "alignment_test",
-                                     kOpenCLCompileOptions);
+  CLKernel *kernel = cl->buildKernelFromString(
+      rainbowmist_embedded::alignment_kernel_source(), "alignment_test",
+      kOpenCLCompileOptions, "alignment.kernel");
   REQUIRE(kernel != nullptr);
 
   int ret[3];
@@ -211,6 +375,117 @@ TEST_CASE("OCL datasize", "[opencl]") {
   REQUIRE(ret[2] == 32);  // sizeof(Ray16)
 }
 
+TEST_CASE("OCL specialization constants", "[opencl]") {
+  EasyCL *cl = EasyCL::createForFirstGpu();
+  rainbowmist::VariantCache<CLKernel *> variants(
+      2, [](CLKernel *&kernel) { delete kernel; });
+
+  auto get_variant = [&](int tile, bool square) -> CLKernel * {
+    rainbowmist::SpecConstants spec;
+    spec.Set("TILE", tile).Set("SQUARE", square);
+    return variants.Get(spec.Key(), [&]() {
+      return cl->buildKernelFromString(
+          rainbowmist_embedded::spec_kernel_source(), "spec_tile_sum",
+          kOpenCLCompileOptions + " " + spec.Options(), "spec.kernel");
+    });
+  };
+
+  float in[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+  float out = 0.0f;
+
+  CLKernel *kernel = get_variant(4, false);
+  kernel->out(1, &out)->in(8, in);
+  kernel->run_1d(1, 1);
+  REQUIRE(out == Approx(10.0f));
+
+  kernel = get_variant(4, true);
+  kernel->out(1, &out)->in(8, in);
+  kernel->run_1d(1, 1);
+  REQUIRE(out == Approx(30.0f));
+
+  REQUIRE(get_variant(4, false) != nullptr);  // cached
+  REQUIRE(variants.misses() == 2);
+  REQUIRE(variants.hits() == 1);
+
+  variants.Clear();
+  delete cl;
+}
+
+TEST_CASE("OCL host overhead", "[opencl]") {
+  // Host side cost of a launch: program cache lookup, argument marshalling
+  // through the buffer pool, and the reads back. On the mock runtime the
+  // kernel itself is almost free, so this is nearly all of it.
+  EasyCL *cl = EasyCL::createForFirstGpu(false);
+  std::string source = rainbowmist_embedded::simple_add_kernel_source();
+
+  const int kLaunches = 1000;
+  float a[2] = {1, 2.1f};
+  float b[2] = {3, 4.5f};
+  float ret[2] = {0, 0};
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kLaunches; i++) {
+    CLKernel *kernel = cl->buildKernelFromString(
+        source, "simple_add_vec2", kOpenCLCompileOptions, "simple_add.kernel",
+        true);
+    kernel->out(2, ret)->in(2, a)->in(2, b);
+    kernel->run_1d(1, 1);
+    delete kernel;
+  }
+  auto end = std::chrono::steady_clock::now();
+  double us =
+      std::chrono::duration<double, std::micro>(end - start).count() /
+      kLaunches;
+  printf("OCL host overhead: %.2f us/launch\n", us);
+
+  REQUIRE(ret[0] == Approx(4));
+  REQUIRE(ret[1] == Approx(6.6f));
+  REQUIRE(cl->getProgramCacheMisses() == 1);
+  REQUIRE(cl->getProgramCacheHits() == kLaunches - 1);
+  // 3 buffers of the same size per launch, all from the pool after the first.
+  REQUIRE(cl->getBufferPool()->getMisses() == 3);
+  REQUIRE(cl->getBufferPool()->getHits() == 3 * (kLaunches - 1));
+
+  delete cl;
+}
+
+TEST_CASE("OCL staging upload", "[opencl]") {
+  EasyCL *cl = EasyCL::createForFirstGpu(false);
+  const size_t chunk_bytes = 1000, num_chunks = 3;
+  std::vector<unsigned char> staging(chunk_bytes * num_chunks);
+  rainbowmist::StagingRing ring(staging.data(), chunk_bytes, num_chunks);
+
+  std::vector<unsigned char> src(10500), dst(src.size(), 0);
+  for (size_t i = 0; i < src.size(); i++) {
+    src[i] = static_cast<unsigned char>(i * 7 + 3);
+  }
+  cl_int err = CL_SUCCESS;
+  cl_mem buffer = clCreateBuffer(*cl->context, CL_MEM_READ_WRITE, src.size(),
+                                 nullptr, &err);
+  REQUIRE(err == CL_SUCCESS);
+
+  std::vector<cl_event> events;
+  REQUIRE(rainbowmist::StagingUploadCL(&ring, &events, *cl->queue, buffer, 0,
+                                       src.data(), src.size()) == CL_SUCCESS);
+  REQUIRE(rainbowmist::StagingUploadCL(&ring, &events, *cl->queue, buffer, 0,
+                                       nullptr, 0) == CL_SUCCESS);
+  REQUIRE(clEnqueueReadBuffer(*cl->queue, buffer, CL_TRUE, 0, dst.size(),
+                              dst.data(), 0, nullptr, nullptr) == CL_SUCCESS);
+  REQUIRE(dst == src);
+
+  // The first failed copy stops the upload, and leaves no events behind.
+  REQUIRE(rainbowmist::StagingUploadCL(&ring, &events, *cl->queue, nullptr, 0,
+                                       src.data(), src.size()) != CL_SUCCESS);
+  REQUIRE(rainbowmist::StagingUploadCL(&ring, &events, *cl->queue, buffer, 0,
+                                       nullptr, 0) == CL_SUCCESS);
+  for (cl_event event : events) {
+    REQUIRE(event == nullptr);
+  }
+
+  clReleaseMemObject(buffer);
+  delete cl;
+}
+
 // -----------------------------------------------
 
 TEST_CASE("simple add vec2", "[cpp11]") {
@@ -238,11 +513,1547 @@ TEST_CASE("datasize", "[cpp11]") {
 
 }
 
+TEST_CASE("embedded kernel source", "[cpp11]") {
+  std::string source = rainbowmist_embedded::simple_add_kernel_source();
+
+  REQUIRE(source.size() == rainbowmist_embedded::simple_add_kernel_size);
+  REQUIRE(rainbowmist_embedded::simple_add_kernel_hash != 0);
+  REQUIRE(rainbowmist_embedded::simple_add_kernel_hash !=
+          rainbowmist_embedded::alignment_kernel_hash);
+
+  // rainbowmist.h is inlined, so nothing is read from disk at build time
+  REQUIRE(source.find("#include \"rainbowmist.h\"") == std::string::npos);
+  REQUIRE(source.find("#define RAINBOWMIST_H_") != std::string::npos);
+  REQUIRE(source.find("RM_KERNEL void simple_add_vec2") != std::string::npos);
+}
+
+TEST_CASE("specialization constants", "[cpp11]") {
+  float in[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+  float out = 0.0f;
+
+  spec_tile_sum<4, false>(&out, in);
+  REQUIRE(out == Approx(10.0f));
+  spec_tile_sum<4, true>(&out, in);
+  REQUIRE(out == Approx(30.0f));
+  spec_tile_sum<8, false>(&out, in);
+  REQUIRE(out == Approx(36.0f));
+
+  rainbowmist::SpecConstants spec;
+  spec.Set("TILE", 8).Set("SQUARE", true).Set("SCALE", 0.5f);
+  // Sorted by name.
+  REQUIRE(spec.Options() == "-D SCALE=0.5f -D SQUARE=1 -D TILE=8");
+  REQUIRE(spec.OptionList().size() == 3);
+  REQUIRE(spec.OptionList()[2] == "-DTILE=8");
+
+  // Float literals are valid C++11 and round-trip.
+  const float values[] = {1.0f, -3.0f, 0.1f, 1.0f / 3.0f, 1.0e-30f, 3.4e38f};
+  for (float v : values) {
+    rainbowmist::SpecConstants f;
+    f.Set("V", v);
+    std::string option = f.OptionList()[0];
+    std::string literal = option.substr(4);
+    REQUIRE(literal.back() == 'f');
+    REQUIRE(literal.find("0x") == std::string::npos);
+    REQUIRE(std::strtof(literal.c_str(), nullptr) == v);
+  }
+  rainbowmist::SpecConstants one;
+  one.Set("ONE", 1.0f);
+  REQUIRE(one.Options() == "-D ONE=1.0f");
+
+  rainbowmist::SpecConstants same;
+  same.Set("SCALE", 0.5f).Set("TILE", 8).Set("SQUARE", true);
+  REQUIRE(same.Key() == spec.Key());
+
+  std::vector<std::string> evicted;
+  rainbowmist::VariantCache<std::string> cache(
+      2, [&](std::string &value) { evicted.push_back(value); });
+  int builds = 0;
+  auto build = [&](const std::string &value) {
+    return [&builds, value]() {
+      builds++;
+      return value;
+    };
+  };
+
+  REQUIRE(cache.Get("a", build("A")) == "A");
+  REQUIRE(cache.Get("b", build("B")) == "B");
+  REQUIRE(cache.Get("a", build("X")) == "A");  // hit, `a` is now most recent
+  REQUIRE(builds == 2);
+
+  REQUIRE(cache.Get("c", build("C")) == "C");  // evicts `b`
+  REQUIRE(evicted.size() == 1);
+  REQUIRE(evicted[0] == "B");
+  REQUIRE(cache.Contains("a"));
+  REQUIRE(!cache.Contains("b"));
+  REQUIRE(cache.size() == 2);
+  REQUIRE(cache.hits() == 1);
+  REQUIRE(cache.misses() == 3);
+  REQUIRE(cache.evictions() == 1);
+}
+
+TEST_CASE("texture2d filtering", "[cpp11]") {
+  // 4x4 single channel ramp along x: texel(x, y) = x
+  float texels[16];
+  for (int y = 0; y < 4; y++) {
+    for (int x = 0; x < 4; x++) {
+      texels[y * 4 + x] = float(x);
+    }
+  }
+
+  rainbowmist::Texture2D tex(4, 4);
+  tex.SetTexels(texels, 1);
+
+  vec2 uv[3];
+  uv[0] = make_vec2(0.25f, 0.5f);    // between texel 0 and 1
+  uv[1] = make_vec2(0.375f, 0.5f);   // center of texel 1
+  uv[2] = make_vec2(-0.125f, 0.5f);  // center of texel -1
+
+  vec4 ret[3];
+
+  tex.SetSampler(rainbowmist::TextureSampler(RM_FILTER_LINEAR, RM_ADDRESS_REPEAT));
+  SetupGlobalId(3);
+  for (int i = 0; i < 3; i++) {
+    texture_sample_test(ret, &tex, uv);
+  }
+  REQUIRE(ret[0].x == Approx(0.5f));
+  REQUIRE(ret[1].x == Approx(1.0f));
+  REQUIRE(ret[2].x == Approx(3.0f));  // wraps around
+  REQUIRE(ret[0].w == Approx(1.0f));
+
+  tex.SetSampler(rainbowmist::TextureSampler(RM_FILTER_LINEAR, RM_ADDRESS_CLAMP));
+  SetupGlobalId(3);
+  for (int i = 0; i < 3; i++) {
+    texture_sample_test(ret, &tex, uv);
+  }
+  REQUIRE(ret[2].x == Approx(0.0f));
+
+  tex.SetSampler(rainbowmist::TextureSampler(RM_FILTER_NEAREST, RM_ADDRESS_MIRROR));
+  SetupGlobalId(3);
+  for (int i = 0; i < 3; i++) {
+    texture_sample_test(ret, &tex, uv);
+  }
+  REQUIRE(ret[0].x == Approx(1.0f));
+  REQUIRE(ret[2].x == Approx(0.0f));
+
+  // 2x2 footprint of a bilinear fetch at an even coordinate is one cache line.
+  const char *base = reinterpret_cast<const char *>(tex.TexelAddress(2, 2));
+  REQUIRE(reinterpret_cast<uintptr_t>(base) % 64 == 0);
+  REQUIRE(reinterpret_cast<const char *>(tex.TexelAddress(3, 2)) - base == 16);
+  REQUIRE(reinterpret_cast<const char *>(tex.TexelAddress(2, 3)) - base == 32);
+  REQUIRE(reinterpret_cast<const char *>(tex.TexelAddress(3, 3)) - base == 48);
+}
+
+TEST_CASE("texture2d trilinear", "[cpp11]") {
+  // 8x8 checker board. Level 0 alternates 0/1, coarser levels average to 0.5.
+  float texels[64];
+  for (int y = 0; y < 8; y++) {
+    for (int x = 0; x < 8; x++) {
+      texels[y * 8 + x] = float((x + y) & 1);
+    }
+  }
+
+  rainbowmist::Texture2D tex(8, 8,
+      rainbowmist::TextureSampler(RM_FILTER_NEAREST, RM_ADDRESS_REPEAT, RM_MIPFILTER_LINEAR));
+  tex.SetTexels(texels, 1);
+  tex.GenerateMipmaps();
+  REQUIRE(tex.num_levels() == 4);
+  REQUIRE(tex.width(3) == 1);
+
+  vec2 uv = make_vec2(0.0625f, 0.0625f);  // texel (0, 0) of level 0
+  vec4 ret;
+
+  SetupGlobalId(1);
+  texture_sample_lod_test(&ret, &tex, &uv, 0.0f);
+  REQUIRE(ret.x == Approx(0.0f));
+
+  SetupGlobalId(1);
+  texture_sample_lod_test(&ret, &tex, &uv, 0.5f);
+  REQUIRE(ret.x == Approx(0.25f));
+
+  SetupGlobalId(1);
+  texture_sample_lod_test(&ret, &tex, &uv, 3.0f);
+  REQUIRE(ret.x == Approx(0.5f));
+}
+
+TEST_CASE("texture3d trilinear", "[cpp11]") {
+  // 4x4x4 ramp along z
+  std::vector<float> texels(4 * 4 * 4);
+  for (size_t i = 0; i < texels.size(); i++) {
+    texels[i] = float(i / 16);
+  }
+
+  rainbowmist::Texture3D tex(4, 4, 4,
+      rainbowmist::TextureSampler(RM_FILTER_LINEAR, RM_ADDRESS_CLAMP));
+  tex.SetTexels(texels.data(), 1);
+
+  REQUIRE(tex.Sample(make_vec3(0.5f, 0.5f, 0.375f)).x == Approx(1.0f));
+  REQUIRE(tex.Sample(make_vec3(0.5f, 0.5f, 0.5f)).x == Approx(1.5f));
+  REQUIRE(tex.Sample(make_vec3(0.5f, 0.5f, 1.0f)).x == Approx(3.0f));
+}
+
+// Torus mesh in the xy plane with `nu * nv * 2` triangles.
+static void MakeTorus(int nu, int nv, float R, float r,
+                      std::vector<float> *vertices,
+                      std::vector<unsigned int> *faces) {
+  const float kPi = 3.14159265358979f;
+  for (int j = 0; j < nv; j++) {
+    for (int i = 0; i < nu; i++) {
+      float u = 2.0f * kPi * float(i) / float(nu);
+      float v = 2.0f * kPi * float(j) / float(nv);
+      vertices->push_back((R + r * std::cos(v)) * std::cos(u));
+      vertices->push_back((R + r * std::cos(v)) * std::sin(u));
+      vertices->push_back(r * std::sin(v));
+    }
+  }
+  for (int j = 0; j < nv; j++) {
+    for (int i = 0; i < nu; i++) {
+      unsigned int i0 = unsigned(j * nu + i);
+      unsigned int i1 = unsigned(j * nu + (i + 1) % nu);
+      unsigned int i2 = unsigned(((j + 1) % nv) * nu + i);
+      unsigned int i3 = unsigned(((j + 1) % nv) * nu + (i + 1) % nu);
+      faces->insert(faces->end(), {i0, i2, i1, i1, i2, i3});
+    }
+  }
+}
+
+// Primary rays looking at the origin from +z.
+static std::vector<RMRay> MakeCameraRays(int width, int height) {
+  std::vector<RMRay> rays;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      float px = 2.0f * (float(x) + 0.5f) / float(width) - 1.0f;
+      float py = 2.0f * (float(y) + 0.5f) / float(height) - 1.0f;
+      rays.push_back(rm_make_ray(make_vec3(0.0f, 0.0f, 3.0f),
+                                 vnormalize(make_vec3(px, py, -1.5f)), 0.0f,
+                                 RM_BVH_INF));
+    }
+  }
+  return rays;
+}
+
+TEST_CASE("watertight triangle", "[cpp11]") {
+  // Two triangles sharing the edge x = 0. Rays exactly on the edge and on the
+  // shared vertices must hit one of them.
+  vec3 a = make_vec3(0.0f, -1.0f, 0.0f);
+  vec3 b = make_vec3(0.0f, 1.0f, 0.0f);
+  vec3 c = make_vec3(-1.0f, 0.0f, 0.0f);
+  vec3 d = make_vec3(1.0f, 0.0f, 0.0f);
+
+  float ys[5] = {-1.0f, -0.5f, 0.0f, 0.3f, 1.0f};
+  for (int i = 0; i < 5; i++) {
+    RMRay ray = rm_make_ray(make_vec3(0.0f, ys[i], 1.0f),
+                            make_vec3(0.0f, 0.0f, -1.0f), 0.0f, RM_BVH_INF);
+    RMWatertightRay wr;
+    rm_setup_watertight_ray(&ray, &wr);
+
+    RMHit h0, h1;
+    h0.t = h1.t = RM_BVH_INF;
+    int hit0 = rm_intersect_triangle_watertight(&wr, a, b, c, 0.0f, &h0);
+    int hit1 = rm_intersect_triangle_watertight(&wr, a, d, b, 0.0f, &h1);
+    REQUIRE((hit0 || hit1));
+    if (hit0) {
+      REQUIRE(h0.t == Approx(1.0f));
+    }
+  }
+
+  // Barycentrics: p = (1 - u - v) * v0 + u * v1 + v * v2
+  RMRay ray = rm_make_ray(make_vec3(-0.25f, 0.25f, 1.0f),
+                          make_vec3(0.0f, 0.0f, -1.0f), 0.0f, RM_BVH_INF);
+  RMWatertightRay wr;
+  rm_setup_watertight_ray(&ray, &wr);
+  RMHit h;
+  h.t = RM_BVH_INF;
+  REQUIRE(rm_intersect_triangle_watertight(&wr, a, b, c, 0.0f, &h) == 1);
+  REQUIRE(h.u == Approx(0.5f));
+  REQUIRE(h.v == Approx(0.25f));
+}
+
+TEST_CASE("bvh traversal", "[cpp11]") {
+  std::vector<float> vertices;
+  std::vector<unsigned int> faces;
+  MakeTorus(256, 128, 1.0f, 0.4f, &vertices, &faces);
+  size_t num_faces = faces.size() / 3;
+
+  std::vector<RMBVHNode> nodes;
+  std::vector<RMBVH4Node> nodes4;
+  std::vector<unsigned int> prim_ids;
+  rainbowmist::BuildBVH(vertices.data(), faces.data(), num_faces, &nodes,
+                        &prim_ids);
+  rainbowmist::CollapseBVH4(nodes, &nodes4);
+  REQUIRE(nodes4.size() < nodes.size());
+
+  const int width = 256, height = 256;
+  std::vector<RMRay> rays = MakeCameraRays(width, height);
+  size_t num_rays = rays.size();
+
+  std::vector<RMHit> hits(num_rays), hits4(num_rays), hits_packet(num_rays);
+
+  auto t0 = std::chrono::high_resolution_clock::now();
+  SetupGlobalId(uint32_t(num_rays));
+  for (size_t i = 0; i < num_rays; i++) {
+    bvh_trace_test(hits.data(), rays.data(), nodes.data(), vertices.data(),
+                   faces.data(), prim_ids.data());
+  }
+  auto t1 = std::chrono::high_resolution_clock::now();
+  SetupGlobalId(uint32_t(num_rays));
+  for (size_t i = 0; i < num_rays; i++) {
+    bvh4_trace_test(hits4.data(), rays.data(), nodes4.data(), vertices.data(),
+                    faces.data(), prim_ids.data());
+  }
+  auto t2 = std::chrono::high_resolution_clock::now();
+  // 4x2 pixel blocks
+  for (int y = 0; y < height; y += 2) {
+    for (int x = 0; x < width; x += 4) {
+      rainbowmist::RayPacket8 packet;
+      size_t idx[8];
+      for (int k = 0; k < 8; k++) {
+        idx[k] = size_t((y + k / 4) * width + x + (k % 4));
+        const RMRay &r = rays[idx[k]];
+        for (int c = 0; c < 3; c++) {
+          packet.org[c][k] = r.org[c];
+          packet.dir[c][k] = r.dir[c];
+        }
+        packet.tmin[k] = r.tmin;
+        packet.tmax[k] = r.tmax;
+      }
+      rainbowmist::HitPacket8 hp;
+      rainbowmist::TraversePacket8(nodes.data(), vertices.data(), faces.data(),
+                                   prim_ids.data(), packet, &hp);
+      for (int k = 0; k < 8; k++) {
+        hits_packet[idx[k]].t = hp.t[k];
+        hits_packet[idx[k]].u = hp.u[k];
+        hits_packet[idx[k]].v = hp.v[k];
+        hits_packet[idx[k]].prim_id = hp.prim_id[k];
+      }
+    }
+  }
+  auto t3 = std::chrono::high_resolution_clock::now();
+
+  auto mrays = [num_rays](std::chrono::high_resolution_clock::time_point s,
+                          std::chrono::high_resolution_clock::time_point e) {
+    double sec = std::chrono::duration<double>(e - s).count();
+    return double(num_rays) / sec / 1.0e6;
+  };
+  std::cout << "BVH2 single ray : " << mrays(t0, t1) << " Mrays/s" << std::endl;
+  std::cout << "BVH4 single ray : " << mrays(t1, t2) << " Mrays/s" << std::endl;
+  std::cout << "BVH2 8 ray packet : " << mrays(t2, t3) << " Mrays/s"
+            << std::endl;
+
+  // NOTE(LTE): prim_id may differ when a ray hits a shared edge exactly, so
+  // compare hit/miss and distance.
+  size_t num_hits = 0;
+  for (size_t i = 0; i < num_rays; i++) {
+    bool hit = (hits[i].prim_id != RM_BVH_INVALID_PRIM);
+    REQUIRE((hits4[i].prim_id != RM_BVH_INVALID_PRIM) == hit);
+    REQUIRE((hits_packet[i].prim_id != RM_BVH_INVALID_PRIM) == hit);
+    if (hit) {
+      REQUIRE(hits4[i].t == Approx(hits[i].t));
+      REQUIRE(hits_packet[i].t == Approx(hits[i].t));
+      num_hits++;
+    }
+  }
+  REQUIRE(num_hits > num_rays / 4);
+  REQUIRE(num_hits < num_rays);
+
+  // Compare a subset against brute force.
+  for (size_t i = 0; i < num_rays; i += 97) {
+    RMWatertightRay wr;
+    rm_setup_watertight_ray(&rays[i], &wr);
+    RMHit ref;
+    ref.t = RM_BVH_INF;
+    ref.prim_id = RM_BVH_INVALID_PRIM;
+    rm_bvh_intersect_leaf(&wr, vertices.data(), faces.data(), nullptr, 0,
+                          int(num_faces), 0.0f, 0, &ref);
+    REQUIRE((hits[i].prim_id != RM_BVH_INVALID_PRIM) ==
+            (ref.prim_id != RM_BVH_INVALID_PRIM));
+    REQUIRE(hits[i].t == Approx(ref.t));
+  }
+
+  // An empty mesh gives no nodes; pass them as a null pointer.
+  std::vector<RMBVHNode> empty;
+  std::vector<RMBVH4Node> empty4;
+  std::vector<unsigned int> empty_ids;
+  rainbowmist::BuildBVH(vertices.data(), faces.data(), 0, &empty, &empty_ids);
+  rainbowmist::CollapseBVH4(empty, &empty4);
+  REQUIRE(empty.empty());
+  REQUIRE(empty4.empty());
+  const RMRay &ray = rays[num_rays / 2];
+  RMHit hit;
+  REQUIRE(rm_bvh_traverse(nullptr, vertices.data(), faces.data(), nullptr,
+                          &ray, 0, &hit) == 0);
+  REQUIRE(hit.prim_id == RM_BVH_INVALID_PRIM);
+  REQUIRE(hit.t == ray.tmax);
+  REQUIRE(rm_bvh_traverse(nullptr, vertices.data(), faces.data(), nullptr,
+                          &ray, 1, &hit) == 0);
+  REQUIRE(rm_bvh4_traverse(nullptr, vertices.data(), faces.data(), nullptr,
+                           &ray, &hit) == 0);
+  REQUIRE(hit.prim_id == RM_BVH_INVALID_PRIM);
+  rainbowmist::RayPacket8 packet;
+  for (int k = 0; k < 8; k++) {
+    for (int c = 0; c < 3; c++) {
+      packet.org[c][k] = ray.org[c];
+      packet.dir[c][k] = ray.dir[c];
+    }
+    packet.tmin[k] = ray.tmin;
+    packet.tmax[k] = ray.tmax;
+  }
+  rainbowmist::HitPacket8 hp;
+  rainbowmist::TraversePacket8(nullptr, vertices.data(), faces.data(), nullptr,
+                               packet, &hp);
+  for (int k = 0; k < 8; k++) {
+    REQUIRE(hp.prim_id[k] == RM_BVH_INVALID_PRIM);
+  }
+}
+
+TEST_CASE("deep bvh traversal", "[cpp11]") {
+  // A degenerate(caterpillar) tree of the largest supported depth: each
+  // interior node has one leaf and one interior child. Triangle i lies at
+  // z = i, so rays from +z visit the interior children first and leave a
+  // leaf on the stack at every level.
+  const int kDepth = RM_BVH_STACK_SIZE;
+  const int num_faces = kDepth + 1;
+  std::vector<float> vertices;
+  std::vector<unsigned int> faces;
+  for (int i = 0; i < num_faces; i++) {
+    float z = float(i);
+    vertices.insert(vertices.end(), {0, 0, z, 2, 0, z, 0, 2, z});
+    unsigned int v = unsigned(3 * i);
+    faces.insert(faces.end(), {v, v + 1, v + 2});
+  }
+  std::vector<unsigned int> prim_ids(static_cast<size_t>(num_faces));
+  for (size_t i = 0; i < prim_ids.size(); i++) {
+    prim_ids[i] = unsigned(i);
+  }
+
+  std::vector<RMBVHNode> nodes(static_cast<size_t>(2 * kDepth + 1));
+  for (int i = 0; i < num_faces; i++) {
+    RMBVHNode &leaf = nodes[size_t(i == kDepth ? 2 * i : 2 * i + 1)];
+    leaf.child0 = ~i;
+    leaf.child1 = 1;
+    for (int k = 0; k < 3; k++) {
+      leaf.bmin[k] = (k == 2) ? float(i) : 0.0f;
+      leaf.bmax[k] = (k == 2) ? float(i) : 2.0f;
+    }
+  }
+  for (int i = kDepth - 1; i >= 0; i--) {
+    RMBVHNode &node = nodes[size_t(2 * i)];
+    node.child0 = 2 * i + 1;
+    node.child1 = 2 * i + 2;
+    for (int k = 0; k < 3; k++) {
+      node.bmin[k] = std::min(nodes[size_t(node.child0)].bmin[k],
+                              nodes[size_t(node.child1)].bmin[k]);
+      node.bmax[k] = std::max(nodes[size_t(node.child0)].bmax[k],
+                              nodes[size_t(node.child1)].bmax[k]);
+    }
+  }
+  REQUIRE(rainbowmist::BVHDepth(nodes) == kDepth);
+  std::vector<RMBVH4Node> nodes4;
+  rainbowmist::CollapseBVH4(nodes, &nodes4);
+
+  // Straight down, straight up, and oblique rays through the stack of
+  // triangles.
+  std::vector<RMRay> rays;
+  for (int i = 0; i < 64; i++) {
+    float x = 0.05f + 0.9f * float(i % 8) / 8.0f;
+    float y = 0.05f + 0.9f * float(i / 8) / 8.0f;
+    float top = float(kDepth) + 10.0f;
+    rays.push_back(rm_make_ray(make_vec3(x, y, top),
+                               make_vec3(0.0f, 0.0f, -1.0f), 0.0f,
+                               RM_BVH_INF));
+    rays.push_back(rm_make_ray(make_vec3(x, y, -10.0f),
+                               make_vec3(0.0f, 0.0f, 1.0f), 0.0f, RM_BVH_INF));
+    rays.push_back(rm_make_ray(make_vec3(-1.0f, y, top - float(i)),
+                               vnormalize(make_vec3(1.0f, 0.1f, -1.5f)), 0.0f,
+                               RM_BVH_INF));
+    // Ends between two triangles, so the closest hit is in the middle.
+    rays.push_back(rm_make_ray(make_vec3(x, y, top),
+                               make_vec3(0.0f, 0.0f, -1.0f), 0.0f,
+                               top - float(i % kDepth) - 0.5f));
+  }
+
+  std::vector<RMHit> hits(rays.size()), hits4(rays.size());
+  SetupGlobalId(uint32_t(rays.size()));
+  for (size_t i = 0; i < rays.size(); i++) {
+    bvh_trace_test(hits.data(), rays.data(), nodes.data(), vertices.data(),
+                   faces.data(), prim_ids.data());
+  }
+  SetupGlobalId(uint32_t(rays.size()));
+  for (size_t i = 0; i < rays.size(); i++) {
+    bvh4_trace_test(hits4.data(), rays.data(), nodes4.data(), vertices.data(),
+                    faces.data(), prim_ids.data());
+  }
+
+  size_t num_hits = 0;
+  for (size_t i = 0; i < rays.size(); i += 8) {
+    rainbowmist::RayPacket8 packet;
+    for (size_t k = 0; k < 8; k++) {
+      const RMRay &r = rays[i + k];
+      for (int c = 0; c < 3; c++) {
+        packet.org[c][k] = r.org[c];
+        packet.dir[c][k] = r.dir[c];
+      }
+      packet.tmin[k] = r.tmin;
+      packet.tmax[k] = r.tmax;
+    }
+    rainbowmist::HitPacket8 hp;
+    rainbowmist::TraversePacket8(nodes.data(), vertices.data(), faces.data(),
+                                 prim_ids.data(), packet, &hp);
+
+    for (size_t k = 0; k < 8; k++) {
+      RMWatertightRay wr;
+      rm_setup_watertight_ray(&rays[i + k], &wr);
+      RMHit ref;
+      ref.t = rays[i + k].tmax;
+      ref.prim_id = RM_BVH_INVALID_PRIM;
+      rm_bvh_intersect_leaf(&wr, vertices.data(), faces.data(), nullptr, 0,
+                            num_faces, 0.0f, 0, &ref);
+      REQUIRE(hits[i + k].prim_id == ref.prim_id);
+      REQUIRE(hits4[i + k].prim_id == ref.prim_id);
+      REQUIRE(hp.prim_id[k] == ref.prim_id);
+      if (ref.prim_id != RM_BVH_INVALID_PRIM) {
+        REQUIRE(hits[i + k].t == Approx(ref.t));
+        num_hits++;
+      }
+    }
+  }
+  REQUIRE(num_hits > rays.size() / 2);
+
+  // The builder stays within the stack size.
+  std::vector<RMBVHNode> built;
+  std::vector<unsigned int> built_ids;
+  rainbowmist::BuildBVH(vertices.data(), faces.data(), size_t(num_faces),
+                        &built, &built_ids, 1);
+  REQUIRE(rainbowmist::BVHDepth(built) <= RM_BVH_STACK_SIZE);
+}
+
+TEST_CASE("launch kernel", "[cpp11]") {
+  const unsigned int xs = 1000, ys = 3, zs = 2;
+  std::vector<int> counts(xs * ys * zs, 0);
+  int *p = counts.data();
+
+  rainbowmist::LaunchKernel(xs, ys, zs, [=]() {
+    uvec3 gid = GlobalId();
+    RM_ATOMIC_ADD(&p[(gid.z * ys + gid.y) * xs + gid.x], 1);
+  }, 4);
+
+  for (size_t i = 0; i < counts.size(); i++) {
+    REQUIRE(counts[i] == 1);
+  }
+
+  // Exceptions from any worker are rethrown to the caller.
+  REQUIRE_THROWS_AS(rainbowmist::LaunchKernel(xs, ys, zs, [=]() {
+    if (GlobalId().x == 777) {
+      throw std::runtime_error("kernel failed");
+    }
+  }, 4), const std::runtime_error &);
+
+  // Launches nest; the outer kernel keeps its global id.
+  std::vector<unsigned int> outer(256, 0);
+  unsigned int *q = outer.data();
+  rainbowmist::LaunchKernel(256, 1, 1, [=]() {
+    unsigned int x = GlobalId().x;
+    rainbowmist::LaunchKernel(2, 1, 1, []() {});
+    rainbowmist::LaunchKernel(130, 1, 1, []() {}, 2);
+    q[GlobalId().x] = x + 1;
+  }, 4);
+  for (unsigned int i = 0; i < 256; i++) {
+    REQUIRE(outer[i] == i + 1);
+  }
+  rainbowmist::LaunchKernel(4, 1, 1, [=]() {
+    unsigned int x = GlobalId().x;
+    rainbowmist::LaunchKernel(2, 1, 1, []() {});
+    q[x] = GlobalId().x;
+  });
+  REQUIRE(outer[3] == 3);
+
+  // Workers come from a pool, and launches from several threads at once
+  // still run every item once.
+  std::mutex mutex;
+  std::set<std::thread::id> workers;
+  for (int i = 0; i < 10; i++) {
+    rainbowmist::LaunchKernel(4 * 64, 1, 1, [&]() {
+      std::lock_guard<std::mutex> lock(mutex);
+      workers.insert(std::this_thread::get_id());
+    }, 4);
+  }
+  REQUIRE(workers.size() <= 4);
+  std::vector<std::atomic<int>> hits(10000);
+  std::vector<std::thread> launchers;
+  for (int t = 0; t < 4; t++) {
+    launchers.emplace_back([&]() {
+      for (int i = 0; i < 10; i++) {
+        rainbowmist::LaunchKernel(1000, 1, 1, [&]() {
+          hits[GlobalId().x + 1000 * (i % 10)]++;
+        }, 3);
+      }
+    });
+  }
+  for (auto &th : launchers) {
+    th.join();
+  }
+  for (size_t i = 0; i < hits.size(); i++) {
+    REQUIRE(hits[i] == 4);
+  }
+
+  // Legacy loop style still works after a launch.
+  vec2 ret, a = make_vec2(1, 2), b = make_vec2(3, 4);
+  SetupGlobalId(1);
+  simple_add_vec2(&ret, &a, &b);
+  REQUIRE(ret.y == Approx(6.0f));
+}
+
+TEST_CASE("launch kernel trace", "[cpp11]") {
+  CLTrace::clear();
+  Profiler::reset();
+  CLTrace::setEnabled(true);
+  CLTraceLaunchObserver observer("launch.work");
+  {
+    rainbowmist::ScopedLaunchObserver observe(&observer);
+
+    // One zone per worker, on its own track.
+    rainbowmist::LaunchKernel(4 * 64, 1, 1, []() {}, 4);
+    // A worker whose kernel throws gets one too, and leaves nothing open.
+    REQUIRE_THROWS(rainbowmist::LaunchKernel(64, 1, 1, []() {
+      throw std::runtime_error("kernel failed");
+    }, 1));
+    rainbowmist::LaunchKernel(4 * 64, 1, 1, []() {}, 4);
+    // The launching thread is worker 0 of nested launches too.
+    rainbowmist::LaunchKernel(1, 1, 1, []() {
+      rainbowmist::LaunchKernel(1, 1, 1, []() {});
+    });
+  }
+  CLTrace::setEnabled(false);
+  Profiler::setEnabled(false);
+
+  std::string json = CLTrace::toChromeTraceJson();
+  REQUIRE(CountOf(json, "\"name\":\"launch.work\"") == 4 + 1 + 4 + 2);
+  REQUIRE(CountOf(json, "\"args\":{\"name\":\"LaunchKernel worker\"}") >= 1);
+  int64_t top = 0, nested = 0;
+  for (const Profiler::ZoneStats &stats : Profiler::getStats()) {
+    if (stats.path == "launch.work") {
+      top = stats.count;
+    } else if (stats.path == "launch.work/launch.work") {
+      nested = stats.count;
+    }
+  }
+  // Zones are recorded as workers end, so the nested one is not inside.
+  REQUIRE(top == 4 + 1 + 4 + 2);
+  REQUIRE(nested == 0);
+  CLTrace::clear();
+  Profiler::reset();
+}
+
+static void registry_scale(RM_GLOBAL float *out, RM_GLOBAL const float *in,
+                           float s) {
+  uvec3 gid = GlobalId();
+  out[gid.x] = in[gid.x] * s;
+}
+RM_REGISTER_KERNEL(registry_scale)
+
+TEST_CASE("kernel registry", "[cpp11]") {
+  rainbowmist::KernelRegistry &registry = rainbowmist::KernelRegistry::Get();
+  REQUIRE(registry.Find("no_such_kernel") == nullptr);
+
+  const rainbowmist::KernelInfo *add = registry.Find("simple_add_vec2");
+  REQUIRE(add != nullptr);
+  REQUIRE(add->args.size() == 3);
+  REQUIRE(add->args[0].kind == rainbowmist::kKernelArgBuffer);
+  REQUIRE(add->args[0].element_size == sizeof(vec2));
+  REQUIRE(!add->args[0].read_only);
+  REQUIRE(add->args[1].read_only);
+
+  vec2 ret, a = make_vec2(1, 2.1f), b = make_vec2(3, 4.5f);
+  vec2 *ret_p = &ret, *a_p = &a, *b_p = &b;
+  const void *add_args[] = {&ret_p, &a_p, &b_p};
+  add->Launch(add_args, 1);
+  REQUIRE(ret.x == Approx(4));
+  REQUIRE(ret.y == Approx(6.6f));
+
+  // Scalar parameters are copied from their value.
+  const rainbowmist::KernelInfo *scale = registry.Find("registry_scale");
+  REQUIRE(scale != nullptr);
+  REQUIRE(scale->args[2].kind == rainbowmist::kKernelArgScalar);
+  REQUIRE(scale->args[2].size == sizeof(float));
+  std::vector<float> in(1000), out(1000);
+  for (size_t i = 0; i < in.size(); i++) {
+    in[i] = float(i);
+  }
+  float *out_p = out.data();
+  const float *in_p = in.data();
+  float s = 0.5f;
+  const void *scale_args[] = {&out_p, &in_p, &s};
+  scale->Launch(scale_args, 1000, 1, 1, 4);
+  REQUIRE(out[999] == Approx(499.5f));
+
+  // Variants are picked by build options, in any order or spelling.
+  const rainbowmist::KernelInfo *squared =
+      registry.Find("spec_tile_sum", "-DTILE=4 -D OPENCL -DSQUARE=1");
+  REQUIRE(squared != nullptr);
+  REQUIRE(squared->options == "-D SQUARE=1 -D TILE=4");
+  REQUIRE(registry.Find("spec_tile_sum", "-D TILE=4") == nullptr);
+
+  float sum = 0.0f, values[4] = {1, 2, 3, 4};
+  float *sum_p = &sum;
+  const float *values_p = values;
+  const void *sum_args[] = {&sum_p, &values_p};
+  squared->Launch(sum_args, 1);
+  REQUIRE(sum == Approx(30.0f));
+
+  // Registering the same name and options again replaces the kernel.
+  size_t num_kernels = registry.size();
+  REQUIRE(rainbowmist::RegisterKernel("spec_tile_sum", "-DTILE=4 -DSQUARE=1",
+                                      spec_tile_sum<4, true>) == squared);
+  REQUIRE(registry.size() == num_kernels);
+}
+
+TEST_CASE("launch capture and replay", "[cpp11]") {
+  rainbowmist::KernelRegistry &registry = rainbowmist::KernelRegistry::Get();
+  const rainbowmist::KernelInfo *scale = registry.Find("registry_scale");
+  const rainbowmist::KernelInfo *add = registry.Find("simple_add_vec2");
+  REQUIRE(scale != nullptr);
+  REQUIRE(add != nullptr);
+  const std::string filename = "rainbowmist_capture_test.rmcap";
+
+  std::vector<float> in(1000), out(1000);
+  for (size_t i = 0; i < in.size(); i++) {
+    in[i] = float(i);
+  }
+  float *out_p = out.data();
+  const float *in_p = in.data();
+  float s = 2.0f;
+  const void *scale_args[] = {&out_p, &in_p, &s};
+  const size_t scale_sizes[] = {out.size() * sizeof(float),
+                                in.size() * sizeof(float), 0};
+
+  vec2 ret = make_vec2(0, 0), a = make_vec2(1, 2), b = make_vec2(1, 2);
+  vec2 *ret_p = &ret, *a_p = &a, *b_p = &b;
+  const void *add_args[] = {&ret_p, &a_p, &b_p};
+  const size_t add_sizes[] = {sizeof(vec2), sizeof(vec2), sizeof(vec2)};
+
+  {
+    rainbowmist::LaunchCapture capture;
+    REQUIRE(capture.Open(filename));
+    capture.Launch(*scale, scale_args, scale_sizes, 1000);
+    // `in` and the zeros of `out` are stored again only if changed.
+    capture.Launch(*scale, scale_args, scale_sizes, 1000);
+    s = 3.0f;
+    capture.Launch(*scale, scale_args, scale_sizes, 500);
+    capture.Launch(*add, add_args, add_sizes, 1);
+    REQUIRE(capture.num_launches() == 4);
+    // zeros, in, 2 * in, 2, 3, (0, 0), (1, 2)
+    REQUIRE(capture.num_blobs() == 7);
+    REQUIRE(capture.bytes_recorded() ==
+            3 * (scale_sizes[0] + scale_sizes[1] + sizeof(float)) +
+                3 * sizeof(vec2));
+    REQUIRE(capture.bytes_stored() ==
+            3 * scale_sizes[0] + 2 * sizeof(float) + 2 * sizeof(vec2));
+    REQUIRE(capture.Close());
+  }
+  REQUIRE(out[499] == Approx(1497.0f));
+  REQUIRE(ret.x == Approx(2.0f));
+
+  rainbowmist::CaptureFile file;
+  std::string err;
+  REQUIRE(file.Open(filename, &err));
+  REQUIRE(file.size() == 4);
+  REQUIRE(file.num_blobs() == 7);
+
+  rainbowmist::CapturedLaunch launch = file.launch(2);
+  REQUIRE(launch.name == "registry_scale");
+  REQUIRE(launch.global[0] == 500);
+  REQUIRE(launch.global[1] == 1);
+  REQUIRE(launch.local_x == 0);
+  REQUIRE(launch.args.size() == 3);
+  REQUIRE(launch.args[0].kind == rainbowmist::kKernelArgBuffer);
+  REQUIRE(launch.args[0].size == 1000 * sizeof(float));
+  REQUIRE(launch.args[0].element_size == sizeof(float));
+  REQUIRE(launch.args[1].kind == rainbowmist::kKernelArgBuffer);
+  REQUIRE(launch.arg_blobs[1] == file.launch(0).arg_blobs[1]);
+  REQUIRE(launch.args[2].kind == rainbowmist::kKernelArgScalar);
+  REQUIRE(*static_cast<const float *>(launch.args[2].data) == 3.0f);
+  // Captured before the launch.
+  REQUIRE(static_cast<const float *>(launch.args[0].data)[999] ==
+          Approx(1998.0f));
+
+  // Each launch runs from its own captured state.
+  rainbowmist::HostReplay replay;
+  REQUIRE(replay.Init(file, &err));
+  REQUIRE(replay.size() == 4);
+  for (int iter = 0; iter < 2; iter++) {
+    replay.Reset();
+    for (size_t i = 0; i < replay.size(); i++) {
+      replay.Run(i, 4);
+    }
+    const float *replayed = static_cast<const float *>(replay.buffer(2, 0));
+    REQUIRE(replayed[499] == Approx(1497.0f));
+    REQUIRE(replayed[999] == Approx(1998.0f));
+    REQUIRE(static_cast<const float *>(replay.buffer(0, 0))[999] ==
+            Approx(1998.0f));
+    REQUIRE(static_cast<const vec2 *>(replay.buffer(3, 0))->y ==
+            Approx(4.0f));
+  }
+  file.Close();
+
+  // Kernels are looked up by name, and files checked before use.
+  {
+    rainbowmist::LaunchCapture capture;
+    REQUIRE(capture.Open(filename));
+    REQUIRE(capture.Record("no_such_kernel", "",
+                           {rainbowmist::CaptureBuffer(in.data(), 4),
+                            rainbowmist::CaptureScalar(s)},
+                           4, 1, 1, 2));
+  }
+  REQUIRE(file.Open(filename, &err));
+  REQUIRE(file.launch(0).local_x == 2);
+  REQUIRE(!replay.Init(file, &err));
+  REQUIRE(err.find("no_such_kernel") != std::string::npos);
+  file.Close();
+
+  FILE *fp = fopen(filename.c_str(), "wb");
+  REQUIRE(fp != nullptr);
+  fwrite("RMCAPT01", 1, 8, fp);
+  fclose(fp);
+  REQUIRE(!file.Open(filename, &err));
+  remove(filename.c_str());
+}
+
+static void TraceAndCompare(const std::vector<RMBVHNode> &nodes,
+                            const std::vector<unsigned int> &prim_ids,
+                            const std::vector<float> &vertices,
+                            const std::vector<unsigned int> &faces,
+                            const std::vector<RMRay> &rays) {
+  size_t num_faces = faces.size() / 3;
+  size_t num_hits = 0;
+  for (size_t i = 0; i < rays.size(); i += 13) {
+    RMHit hit;
+    rm_bvh_traverse(nodes.data(), vertices.data(), faces.data(),
+                    prim_ids.data(), &rays[i], 0, &hit);
+
+    RMWatertightRay wr;
+    rm_setup_watertight_ray(&rays[i], &wr);
+    RMHit ref;
+    ref.t = RM_BVH_INF;
+    ref.prim_id = RM_BVH_INVALID_PRIM;
+    rm_bvh_intersect_leaf(&wr, vertices.data(), faces.data(), nullptr, 0,
+                          int(num_faces), 0.0f, 0, &ref);
+
+    REQUIRE((hit.prim_id != RM_BVH_INVALID_PRIM) ==
+            (ref.prim_id != RM_BVH_INVALID_PRIM));
+    if (ref.prim_id != RM_BVH_INVALID_PRIM) {
+      REQUIRE(hit.t == Approx(ref.t));
+      num_hits++;
+    }
+  }
+  REQUIRE(num_hits > 0);
+}
+
+TEST_CASE("lbvh build and refit", "[cpp11]") {
+  std::vector<float> vertices;
+  std::vector<unsigned int> faces;
+  MakeTorus(256, 128, 1.0f, 0.4f, &vertices, &faces);
+  size_t num_faces = faces.size() / 3;
+
+  rainbowmist::LBVH lbvh;
+
+  auto t0 = std::chrono::high_resolution_clock::now();
+  lbvh.Build(vertices.data(), faces.data(), num_faces);
+  auto t1 = std::chrono::high_resolution_clock::now();
+
+  REQUIRE(lbvh.nodes().size() == 2 * num_faces - 1);
+  const std::vector<unsigned int> &codes = lbvh.morton_codes();
+  REQUIRE(std::is_sorted(codes.begin(), codes.end()));
+
+  // Sorted primitive ids are a permutation.
+  std::vector<unsigned int> ids = lbvh.prim_ids();
+  std::sort(ids.begin(), ids.end());
+  for (size_t i = 0; i < num_faces; i++) {
+    REQUIRE(ids[i] == i);
+  }
+
+  // Root bounds contain the whole mesh.
+  const RMBVHNode &root = lbvh.nodes()[0];
+  REQUIRE(root.bmin[0] == Approx(-1.4f));
+  REQUIRE(root.bmax[0] == Approx(1.4f));
+  REQUIRE(root.bmin[2] == Approx(-0.4f));
+  REQUIRE(root.bmax[2] == Approx(0.4f));
+
+  std::vector<RMRay> rays = MakeCameraRays(128, 128);
+  TraceAndCompare(lbvh.nodes(), lbvh.prim_ids(), vertices, faces, rays);
+
+  // Deform(twist and scale) and refit.
+  for (size_t i = 0; i < vertices.size(); i += 3) {
+    float x = vertices[i], y = vertices[i + 1], z = vertices[i + 2];
+    float a = 0.5f * z;
+    vertices[i] = 0.8f * (std::cos(a) * x - std::sin(a) * y);
+    vertices[i + 1] = 0.8f * (std::sin(a) * x + std::cos(a) * y);
+    vertices[i + 2] = 1.5f * z;
+  }
+
+  auto t2 = std::chrono::high_resolution_clock::now();
+  lbvh.Refit(vertices.data(), faces.data());
+  auto t3 = std::chrono::high_resolution_clock::now();
+
+  REQUIRE(lbvh.nodes()[0].bmax[2] == Approx(0.6f));
+  TraceAndCompare(lbvh.nodes(), lbvh.prim_ids(), vertices, faces, rays);
+
+  std::cout << "LBVH build : "
+            << std::chrono::duration<double, std::milli>(t1 - t0).count()
+            << " ms, refit : "
+            << std::chrono::duration<double, std::milli>(t3 - t2).count()
+            << " ms(" << num_faces << " triangles)" << std::endl;
+
+  // Tiny inputs
+  rainbowmist::LBVH single;
+  single.Build(vertices.data(), faces.data(), 1);
+  REQUIRE(single.nodes().size() == 1);
+  REQUIRE(single.nodes()[0].child0 == ~0);
+  single.Build(vertices.data(), faces.data(), 2);
+  REQUIRE(single.nodes().size() == 3);
+
+  // Identical Morton codes are split by index, so the depth stays bounded.
+  std::vector<unsigned int> same_faces;
+  for (size_t i = 0; i < 5000; i++) {
+    same_faces.insert(same_faces.end(), {faces[0], faces[1], faces[2]});
+  }
+  single.Build(vertices.data(), same_faces.data(), 5000);
+  REQUIRE(rainbowmist::BVHDepth(single.nodes()) <= RM_BVH_STACK_SIZE);
+}
+
+TEST_CASE("dirty range tracking", "[cpp11]") {
+  // 10 blocks, the last one is partial.
+  rainbowmist::DirtyRangeTracker dirty(10000, 1024);
+  REQUIRE(dirty.num_blocks() == 10);
+  REQUIRE(dirty.Empty());
+
+  dirty.MarkDirty(100, 8);      // block 0
+  dirty.MarkDirty(1024, 2048);  // blocks 1, 2
+  dirty.MarkDirty(5000, 1);     // block 4
+  dirty.MarkDirty(9999, 100);   // block 9, clamped
+  dirty.MarkDirty(20000, 10);   // out of range
+
+  typedef std::pair<size_t, size_t> Range;
+  std::vector<Range> ranges;
+  dirty.Ranges(&ranges);
+  REQUIRE(ranges.size() == 3);
+  REQUIRE(ranges[0] == Range(0, 3072));
+  REQUIRE(ranges[1] == Range(4096, 1024));
+  REQUIRE(ranges[2] == Range(9216, 784));
+  REQUIRE(dirty.DirtyBytes() == 3072 + 1024 + 784);
+  REQUIRE(dirty.IsDirty(4500, 10));
+  REQUIRE(!dirty.IsDirty(3072, 1024));
+
+  // Merge across one clean block.
+  dirty.Ranges(&ranges, 1024);
+  REQUIRE(ranges.size() == 2);
+  REQUIRE(ranges[0] == Range(0, 5120));
+  dirty.Ranges(&ranges, 4096);
+  REQUIRE(ranges.size() == 1);
+  REQUIRE(ranges[0] == Range(0, 10000));
+
+  size_t num_uploads = 0;
+  size_t uploaded = dirty.Flush([&](size_t, size_t) { num_uploads++; });
+  REQUIRE(num_uploads == 3);
+  REQUIRE(uploaded == 3072 + 1024 + 784);
+  REQUIRE(dirty.Empty());
+
+  // Ranges crossing 64 block words, in a 1GB buffer.
+  rainbowmist::DirtyRangeTracker big(size_t(1) << 30);
+  big.MarkDirty(63 * 4096 + 10, 4096);  // blocks 63, 64
+  big.MarkDirty(1000 * 4096, 130 * 4096);
+  big.Ranges(&ranges);
+  REQUIRE(ranges.size() == 2);
+  REQUIRE(ranges[0] == Range(63 * 4096, 2 * 4096));
+  REQUIRE(ranges[1] == Range(1000 * 4096, 130 * 4096));
+  big.MarkAllDirty();
+  big.Ranges(&ranges);
+  REQUIRE(ranges.size() == 1);
+  REQUIRE(ranges[0] == Range(0, size_t(1) << 30));
+}
+
+#if defined(RAINBOWMIST_HAS_WRITE_WATCH)
+TEST_CASE("write watch", "[cpp11]") {
+  const size_t page = rainbowmist::WriteWatch::PageSize();
+  const size_t size = 16 * page;
+  char *data = static_cast<char *>(rainbowmist::WriteWatch::AllocatePages(size));
+  REQUIRE(data != nullptr);
+
+  typedef std::pair<size_t, size_t> Range;
+  std::vector<Range> ranges;
+  {
+    rainbowmist::WriteWatch watch(data, size);
+    REQUIRE(watch.Arm());
+
+    REQUIRE(data[5 * page] == 0);  // reads don't fault
+    data[3 * page] = 1;
+    data[3 * page + 1] = 2;
+    data[4 * page + 10] = 3;
+    data[11 * page - 1] = 4;
+
+    watch.Ranges(&ranges);
+    REQUIRE(ranges.size() == 2);
+    REQUIRE(ranges[0] == Range(3 * page, 2 * page));
+    REQUIRE(ranges[1] == Range(10 * page, page));
+    REQUIRE(data[4 * page + 10] == 3);
+
+    // Re-arm: only the new writes are reported.
+    REQUIRE(watch.Arm());
+    watch.Ranges(&ranges);
+    REQUIRE(ranges.empty());
+
+    // Writes from worker threads.
+    rainbowmist::LaunchKernel(16, 1, 1, [&]() {
+      size_t i = size_t(GlobalId().x);
+      if (i % 2 == 0) {
+        data[i * page + 8] = 5;
+      }
+    });
+    watch.Ranges(&ranges);
+    REQUIRE(ranges.size() == 8);
+    REQUIRE(watch.dirty().DirtyBytes() == 8 * page);
+
+    watch.Disarm();
+    data[15 * page] = 6;  // not tracked
+    REQUIRE(!watch.dirty().IsDirty(15 * page, 1));
+  }
+
+  rainbowmist::WriteWatch::FreePages(data, size);
+}
+#endif
+
+TEST_CASE("pinned allocator and staging ring", "[cpp11]") {
+  rainbowmist::HostPinnedSource source;
+  typedef rainbowmist::PinnedAllocator<float, rainbowmist::HostPinnedSource>
+      Allocator;
+  {
+    rainbowmist::PinnedVector<float, rainbowmist::HostPinnedSource> v{
+        Allocator(&source)};
+    for (int i = 0; i < 10000; i++) {
+      v.push_back(float(i));
+    }
+    REQUIRE(v[9999] == 9999.0f);
+    REQUIRE(reinterpret_cast<uintptr_t>(v.data()) % 4096 == 0);
+    REQUIRE(source.allocated_bytes() >= 10000 * sizeof(float));
+    REQUIRE(source.num_allocations() > 1);
+  }
+  REQUIRE(source.allocated_bytes() == 0);
+
+  // Fake device: each copy is only performed when its slot is waited for, as
+  // an asynchronous DMA would be. Reusing a chunk too early would corrupt
+  // the result.
+  const size_t chunk_bytes = 1000;
+  const size_t num_chunks = 3;
+  void *staging = source.Allocate(chunk_bytes * num_chunks);
+  rainbowmist::StagingRing ring(staging, chunk_bytes, num_chunks);
+
+  std::vector<unsigned char> src(10500), device(20000, 0);
+  for (size_t i = 0; i < src.size(); i++) {
+    src[i] = static_cast<unsigned char>(i * 7 + 3);
+  }
+
+  struct Pending {
+    const void *staging;
+    size_t offset;
+    size_t size;
+  };
+  std::vector<Pending> in_flight(num_chunks, Pending{nullptr, 0, 0});
+  auto copy = [&](const void *p, size_t offset, size_t size, size_t slot) {
+    REQUIRE(in_flight[slot].staging == nullptr);
+    in_flight[slot] = Pending{p, offset, size};
+  };
+  auto wait = [&](size_t slot) {
+    Pending &pending = in_flight[slot];
+    memcpy(device.data() + pending.offset, pending.staging, pending.size);
+    pending.staging = nullptr;
+  };
+
+  ring.Upload(src.data(), src.size(), 100, copy, wait);
+  REQUIRE(ring.num_chunks_copied() == 11);
+  REQUIRE(ring.num_waits() == 8);
+  REQUIRE(ring.num_pending() == 3);
+
+  // Continues around the ring.
+  ring.Upload(src.data(), 2500, 15000, copy, wait);
+  ring.Drain(wait);
+  REQUIRE(ring.num_pending() == 0);
+  REQUIRE(ring.bytes_staged() == 10500 + 2500);
+  REQUIRE(memcmp(device.data() + 100, src.data(), src.size()) == 0);
+  REQUIRE(memcmp(device.data() + 15000, src.data(), 2500) == 0);
+  REQUIRE(device[99] == 0);
+  REQUIRE(device[10600] == 0);
+
+  source.Deallocate(staging, chunk_bytes * num_chunks);
+  REQUIRE(source.allocated_bytes() == 0);
+}
+
+// Simulated device for `StreamPipeline`: each queue runs its commands in
+// order, but only when the host waits, and the upload queue runs as far
+// ahead as it can. A missing dependency shows up as corrupted data.
+struct FakePipelineQueues {
+  typedef int Queue;
+  typedef int Event;
+
+  std::vector<std::function<bool()>> commands[3];
+  size_t next[3] = {0, 0, 0};
+  std::vector<bool> signaled;
+  std::vector<bool> released;
+
+  void Enqueue(Queue q, std::function<void()> fn) {
+    commands[q].push_back([fn]() {
+      fn();
+      return true;
+    });
+  }
+
+  Queue Begin(int stage, const Event *deps, size_t n) {
+    std::vector<Event> wait(deps, deps + n);
+    commands[stage].push_back([this, wait]() {
+      for (Event e : wait) {
+        if (!signaled[size_t(e)]) {
+          return false;
+        }
+      }
+      return true;
+    });
+    return stage;
+  }
+
+  Event End(int stage) {
+    Event e = int(signaled.size());
+    signaled.push_back(false);
+    released.push_back(false);
+    commands[stage].push_back([this, e]() {
+      signaled[size_t(e)] = true;
+      return true;
+    });
+    return e;
+  }
+
+  void HostWait(Event e) {
+    while (!signaled[size_t(e)]) {
+      bool progress = false;
+      for (int q = 0; q < 3 && !progress; q++) {
+        if (next[q] < commands[q].size() && commands[q][next[q]]()) {
+          next[q]++;
+          progress = true;
+        }
+      }
+      REQUIRE(progress);  // deadlock
+    }
+  }
+
+  void Release(Event e) {
+    REQUIRE(!released[size_t(e)]);
+    released[size_t(e)] = true;
+  }
+};
+
+TEST_CASE("stream pipeline", "[cpp11]") {
+  const size_t chunk = 64;
+  const size_t num_chunks = 13;
+
+  for (size_t num_slots = 2; num_slots <= 3; num_slots++) {
+    FakePipelineQueues queues;
+    rainbowmist::StreamPipeline<FakePipelineQueues> pipeline(&queues,
+                                                             num_slots);
+
+    std::vector<std::vector<int>> host_in(num_slots), dev_in(num_slots),
+        dev_out(num_slots), host_out(num_slots);
+    for (size_t i = 0; i < num_slots; i++) {
+      host_in[i].resize(chunk);
+      dev_in[i].resize(chunk);
+      dev_out[i].resize(chunk);
+      host_out[i].resize(chunk);
+    }
+    std::vector<size_t> finished;
+
+    pipeline.Run(
+        num_chunks,
+        [&](size_t n, size_t slot) {
+          for (size_t i = 0; i < chunk; i++) {
+            host_in[slot][i] = int(n * chunk + i);
+          }
+        },
+        [&](size_t, size_t slot, int q) {
+          queues.Enqueue(q, [&, slot]() { dev_in[slot] = host_in[slot]; });
+        },
+        [&](size_t, size_t slot, int q) {
+          queues.Enqueue(q, [&, slot]() {
+            for (size_t i = 0; i < chunk; i++) {
+              dev_out[slot][i] = 2 * dev_in[slot][i] + 1;
+            }
+          });
+        },
+        [&](size_t, size_t slot, int q) {
+          queues.Enqueue(q, [&, slot]() { host_out[slot] = dev_out[slot]; });
+        },
+        [&](size_t n, size_t slot) {
+          for (size_t i = 0; i < chunk; i++) {
+            REQUIRE(host_out[slot][i] == 2 * int(n * chunk + i) + 1);
+          }
+          finished.push_back(n);
+        });
+
+    REQUIRE(finished.size() == num_chunks);
+    for (size_t n = 0; n < num_chunks; n++) {
+      REQUIRE(finished[n] == n);
+    }
+    for (size_t e = 0; e < queues.released.size(); e++) {
+      REQUIRE(queues.released[e]);
+    }
+  }
+}
+
+TEST_CASE("thread pipeline", "[cpp11]") {
+  const size_t num_chunks = 50;
+  const size_t num_slots = 3;
+  rainbowmist::ThreadPipeline pipeline(num_slots);
+
+  std::vector<std::vector<int>> slots(num_slots, std::vector<int>(256));
+  std::vector<long long> sums;
+  std::atomic<int> in_flight(0);
+  std::atomic<int> max_in_flight(0);
+
+  pipeline.Run(
+      num_chunks,
+      [&](size_t n, size_t slot) {
+        int v = ++in_flight;
+        int m = max_in_flight;
+        while (v > m && !max_in_flight.compare_exchange_weak(m, v)) {
+        }
+        for (size_t i = 0; i < slots[slot].size(); i++) {
+          slots[slot][i] = int(n + i);
+        }
+      },
+      [&](size_t, size_t slot) {
+        for (int &v : slots[slot]) {
+          v *= 3;
+        }
+      },
+      [&](size_t, size_t slot) {
+        long long sum = 0;
+        for (int v : slots[slot]) {
+          sum += v;
+        }
+        sums.push_back(sum);
+        --in_flight;
+      });
+
+  REQUIRE(sums.size() == num_chunks);
+  for (size_t n = 0; n < num_chunks; n++) {
+    REQUIRE(sums[n] == 3 * (256 * (long long)n + 255 * 256 / 2));
+  }
+  REQUIRE(max_in_flight <= int(num_slots));
+
+  // A throwing stage stops the pipeline.
+  size_t num_stored = 0;
+  REQUIRE_THROWS_AS(
+      pipeline.Run(
+          num_chunks, [](size_t, size_t) {},
+          [](size_t n, size_t) {
+            if (n == 7) {
+              throw std::runtime_error("compute failed");
+            }
+          },
+          [&](size_t, size_t) { num_stored++; }),
+      const std::runtime_error &);
+  REQUIRE(num_stored == 7);
+}
+
+namespace {
+
+class CountingObserver : public rainbowmist::LaunchObserver {
+ public:
+  void LaunchBegin(unsigned int items, unsigned int threads) {
+    num_launches++;
+    num_items = items;
+    num_threads = threads;
+  }
+  void WorkerBegin(unsigned int) { num_workers++; }
+  void WorkerEnd(unsigned int thread_index, unsigned int items) {
+    REQUIRE(thread_index < num_threads);
+    worker_items += items;
+  }
+  void LaunchEnd() { num_ends++; }
+
+  int num_launches = 0;
+  int num_ends = 0;
+  unsigned int num_items = 0;
+  unsigned int num_threads = 0;
+  std::atomic<unsigned int> num_workers{0};
+  std::atomic<unsigned int> worker_items{0};
+};
+
+}  // namespace
+
+TEST_CASE("launch observer", "[cpp11]") {
+  CountingObserver observer;
+  REQUIRE(rainbowmist::SetLaunchObserver(&observer) == nullptr);
+  rainbowmist::LaunchKernel(100, 10, 1, []() {}, 4);
+  REQUIRE(rainbowmist::SetLaunchObserver(nullptr) == &observer);
+
+  REQUIRE(observer.num_launches == 1);
+  REQUIRE(observer.num_ends == 1);
+  REQUIRE(observer.num_items == 1000);
+  REQUIRE(observer.num_threads == 4);
+  REQUIRE(observer.num_workers == 4);
+  REQUIRE(observer.worker_items == 1000);
+
+  // Only launches from the installing thread are observed.
+  rainbowmist::LaunchKernel(100, 1, 1, []() {}, 2);
+  REQUIRE(observer.num_launches == 1);
+
+  // The guard uninstalls it even when the launch throws, and the workers
+  // still end.
+  REQUIRE_THROWS([&]() {
+    rainbowmist::ScopedLaunchObserver observe(&observer);
+    rainbowmist::LaunchKernel(100, 1, 1, []() {
+      throw std::runtime_error("kernel failed");
+    }, 1);
+  }());
+  REQUIRE(rainbowmist::CurrentLaunchObserver() == nullptr);
+  REQUIRE(observer.num_launches == 2);
+  REQUIRE(observer.num_ends == 2);
+  REQUIRE(observer.num_workers == 4 + 1);
+}
+
+TEST_CASE("kernel perf counters", "[cpp11]") {
+  rainbowmist::KernelPerf perf;
+  std::vector<float> data(1 << 16);
+
+  for (int i = 0; i < 2; i++) {
+    perf.Launch("scale", unsigned(data.size()), 1, 1,
+                [&]() {
+                  unsigned int id = GlobalId().x;
+                  data[id] = float(id) * 0.5f;
+                },
+                4);
+  }
+  {
+    rainbowmist::KernelPerf::Scope scope(&perf, "sum");
+    std::atomic<unsigned int> count(0);
+    rainbowmist::LaunchKernel(1000, 1, 1, [&]() { count++; }, 2);
+    REQUIRE(count == 1000);
+  }
+  rainbowmist::LaunchKernel(10, 1, 1, []() {}, 1);  // Not sampled
+
+  std::vector<rainbowmist::KernelPerfLaunch> launches = perf.launches();
+  REQUIRE(launches.size() == 3);
+  REQUIRE(launches[0].name == "scale");
+  REQUIRE(launches[0].threads.size() == 4);
+  REQUIRE(launches[0].total.num_items == data.size());
+  REQUIRE(launches[2].name == "sum");
+  REQUIRE(launches[2].total.num_items == 1000);
+
+  std::vector<rainbowmist::KernelPerfSummary> summaries = perf.Summarize();
+  REQUIRE(summaries.size() == 2);
+  REQUIRE(summaries[0].name == "scale");
+  REQUIRE(summaries[0].num_launches == 2);
+  REQUIRE(summaries[0].total.num_items == 2 * data.size());
+  REQUIRE(summaries[1].num_launches == 1);
+
+  // Counters depend on the machine, but must be consistent when present.
+  const rainbowmist::PerfSample &total = summaries[0].total;
+  if (rainbowmist::KernelPerf::Available()) {
+    REQUIRE(total.valid[rainbowmist::kPerfCycles]);
+    REQUIRE(total.value[rainbowmist::kPerfInstructions] > data.size());
+    REQUIRE(total.Ipc() > 0.0);
+  } else {
+    REQUIRE(total.Ipc() == 0.0);
+  }
+  if (total.valid[rainbowmist::kPerfTaskClock]) {
+    REQUIRE(total.value[rainbowmist::kPerfTaskClock] > 0);
+  }
+
+  perf.Clear();
+  REQUIRE(perf.launches().empty());
+}
+
+static void strided_copy(rainbowmist::Traced<float> out,
+                         rainbowmist::Traced<const float> in,
+                         unsigned int stride) {
+  unsigned int i = GlobalId().x;
+  out[i] = in[i * stride];
+}
+
+TEST_CASE("memory access trace", "[cpp11]") {
+  static_assert(std::is_same<RM_GLOBAL_PTR(float), float *>::value,
+                "plain pointer without RAINBOWMIST_TRACE_MEMORY");
+
+  const unsigned int n = 256;
+  std::vector<float> in(n * 8), out(n);
+  for (size_t i = 0; i < in.size(); i++) {
+    in[i] = float(i);
+  }
+
+  for (unsigned int stride : {1u, 8u}) {
+    rainbowmist::MemoryTrace trace;
+    trace.Launch(n, 1, 1,
+                 [&]() {
+                   strided_copy(rainbowmist::Traced<float>(out.data(), "out"),
+                                rainbowmist::Traced<const float>(in.data(), "in"),
+                                stride);
+                 },
+                 4);
+    REQUIRE(out[3] == float(3 * stride));
+
+    const rainbowmist::MemoryAccessStats *s = trace.Find("in");
+    REQUIRE(s != nullptr);
+    REQUIRE(s->num_requests == n / 32);
+    REQUIRE(s->num_accesses == n);
+    REQUIRE(s->requested_bytes == n * sizeof(float));
+    if (stride == 1) {
+      // 32 lanes x 4 bytes: one line, 4 sectors.
+      REQUIRE(s->Efficiency() == Approx(1.0));
+      REQUIRE(s->SectorsPerRequest() == Approx(4.0));
+      REQUIRE(s->LinesPerRequest() == Approx(1.0));
+    } else {
+      // One sector per lane, 4 of its 32 bytes used.
+      REQUIRE(s->Efficiency() == Approx(0.125));
+      REQUIRE(s->SectorsPerRequest() == Approx(32.0));
+      REQUIRE(s->LinesPerRequest() == Approx(8.0));
+    }
+    REQUIRE(trace.Find("out")->Efficiency() == Approx(1.0));
+  }
+
+  // Local memory bank conflicts.
+  std::vector<float> tile(32 * 33);
+  for (unsigned int stride : {0u, 1u, 2u, 32u, 33u}) {
+    rainbowmist::MemoryTrace trace;
+    trace.Launch(64, 1, 1, [&]() {
+      rainbowmist::Traced<float> t(tile.data(), "tile",
+                                   rainbowmist::kLocalMemory);
+      t[GlobalId().x % 32 * stride] += 1.0f;
+    });
+    const rainbowmist::MemoryAccessStats *s = trace.Find("tile");
+    REQUIRE(s != nullptr);
+    REQUIRE(s->space == rainbowmist::kLocalMemory);
+    REQUIRE(s->num_requests == 2);
+    unsigned int expected = (stride == 2) ? 2 : (stride == 32) ? 32 : 1;
+    REQUIRE(s->max_conflict == expected);
+    REQUIRE(s->BankConflictsPerRequest() == Approx(expected - 1.0));
+  }
+
+  // A launch that throws still uninstalls the trace, on every worker.
+  {
+    rainbowmist::MemoryTrace trace;
+    REQUIRE_THROWS(trace.Launch(4 * 64, 1, 1, [&]() {
+      rainbowmist::Traced<float> t(tile.data(), "tile");
+      t[GlobalId().x % 32] += 1.0f;
+      throw std::runtime_error("kernel failed");
+    }, 4));
+    REQUIRE(rainbowmist::CurrentLaunchObserver() == nullptr);
+  }
+  std::atomic<int> still_traced(0);
+  rainbowmist::LaunchKernel(4 * 64, 1, 1, [&]() {
+    if (rainbowmist::CurrentMemoryTraceThread() != nullptr) {
+      still_traced++;
+    }
+  }, 4);
+  REQUIRE(still_traced == 0);
+
+  // Outside of a traced launch, it is just a pointer.
+  rainbowmist::Traced<float> p(out.data());
+  p[1] = 42.0f;
+  REQUIRE(*(p + 1) == 42.0f);
+}
+
+TEST_CASE("branch divergence", "[cpp11]") {
+  // RM_BRANCH() is the condition itself without
+  // RAINBOWMIST_PROFILE_DIVERGENCE; call what it expands to otherwise.
+  REQUIRE(RM_BRANCH(1 < 2));
+#define BRANCH(c) rainbowmist::RecordBranch(__FILE__, __LINE__, (c))
+
+  rainbowmist::DivergenceProfiler prof(32);
+  int uniform_line = __LINE__ + 3;
+  prof.Launch("uniform", 128, 1, 1,
+              [&]() {
+                if (BRANCH(GlobalId().x < 64)) {
+                }
+              },
+              4);
+  int odd_line = __LINE__ + 2;
+  prof.Launch("odd", 128, 1, 1, [&]() {
+    if (BRANCH(GlobalId().x % 2 == 0)) {
+    }
+  });
+  // Lane i runs i % 4 iterations; 40 items, so the second warp has 8 lanes.
+  int loop_line = __LINE__ + 3;
+  prof.Launch("loop", 40, 1, 1, [&]() {
+    unsigned int n = GlobalId().x % 4;
+    for (unsigned int k = 0; BRANCH(k < n); k++) {
+    }
+  });
+#undef BRANCH
+
+  std::vector<rainbowmist::KernelDivergence> kernels = prof.kernels();
+  REQUIRE(kernels.size() == 3);
+  REQUIRE(kernels[0].num_evaluations == 4);
+  REQUIRE(kernels[0].num_divergent == 0);
+  REQUIRE(kernels[0].SimtEfficiency() == Approx(1.0));
+  REQUIRE(kernels[1].num_divergent == 4);
+  REQUIRE(kernels[1].SimtEfficiency() == Approx(0.5));
+  // Each warp: k = 0..3 with 32(or 8) lanes at k = 0, 3/4, 1/2 and 1/4 of
+  // them later; divergent but for k = 3.
+  REQUIRE(kernels[2].num_evaluations == 8);
+  REQUIRE(kernels[2].num_divergent == 6);
+  REQUIRE(kernels[2].SimtEfficiency() ==
+          Approx((80.0 + 20.0) / (224.0 + 56.0)));
+
+  std::vector<rainbowmist::BranchSiteStats> sites = prof.WorstSites();
+  REQUIRE(sites.size() == 3);
+  REQUIRE(sites[0].kernel == "loop");
+  REQUIRE(sites[0].line == loop_line);
+  REQUIRE(sites[0].WastedLanes() == (224 - 80) + (56 - 20));
+  REQUIRE(sites[1].line == odd_line);
+  REQUIRE(sites[1].DivergenceRate() == Approx(1.0));
+  REQUIRE(sites[1].num_taken == 64);
+  REQUIRE(sites[2].line == uniform_line);
+  REQUIRE(sites[2].WastedLanes() == 0);
+
+  // Wavefronts of 64: the same divergence, in half as many evaluations.
+  rainbowmist::DivergenceProfiler wave(64);
+  wave.Launch("odd", 128, 1, 1, [&]() {
+    rainbowmist::RecordBranch(__FILE__, __LINE__, GlobalId().x % 2 == 0);
+  });
+  REQUIRE(wave.kernels()[0].num_evaluations == 2);
+  REQUIRE(wave.kernels()[0].SimtEfficiency() == Approx(0.5));
+
+  // One site, though its file name comes through two pointers.
+  static const char file_a[] = "site.cc";
+  static const char file_b[] = "site.cc";
+  rainbowmist::DivergenceProfiler files(32);
+  files.Launch("files", 128, 1, 1, [&]() {
+    const char *file = (GlobalId().x % 2) ? file_a : file_b;
+    rainbowmist::RecordBranch(file, 7, GlobalId().x % 2 == 0);
+  });
+  REQUIRE(files.kernels()[0].num_evaluations == 4);
+  REQUIRE(files.kernels()[0].num_divergent == 4);
+  REQUIRE(files.WorstSites().size() == 1);
+  REQUIRE(files.WorstSites()[0].num_evaluations == 4);
+
+  // A launch that throws is not profiled, and leaves no worker recording.
+  REQUIRE_THROWS(files.Launch("fail", 128, 1, 1, [&]() {
+    rainbowmist::RecordBranch(file_a, 7, GlobalId().x % 2 == 0);
+    throw std::runtime_error("kernel failed");
+  }, 4));
+  REQUIRE(rainbowmist::CurrentLaunchObserver() == nullptr);
+  std::atomic<int> recording(0);
+  rainbowmist::LaunchKernel(128, 1, 1, [&]() {
+    if (rainbowmist::CurrentBranchTraceThread() != nullptr) {
+      recording++;
+    }
+  }, 4);
+  REQUIRE(recording == 0);
+  REQUIRE(files.kernels().size() == 1);
+  REQUIRE(files.WorstSites()[0].num_evaluations == 4);
+}
+
 int main(int argc, char **argv) {
   std::vector<char *> local_argv;
 
   char *cuda_exclude_opt = nullptr;
   char *opencl_exclude_opt = nullptr;
+  char *mockcl_exclude_opt = nullptr;
 
   bool runCUDA = true;
   bool runOpenCL = true;
@@ -305,6 +2116,10 @@ int main(int argc, char **argv) {
             }
           }
 
+          if (!failed && rainbowmist::mockcuda::RegisterKernels()) {
+            std::cout << "Using the mock CUDA driver." << std::endl;
+          }
+
           if (failed) {
             cuda_exclude_opt = strdup("exclude:[cuda]");
             local_argv.push_back(cuda_exclude_opt);
@@ -329,6 +2144,12 @@ int main(int argc, char **argv) {
     hasOpenCL = EasyCL::isOpenCLAvailable();
 
     if (hasOpenCL) {
+      if (rainbowmist::mockcl::RegisterKernels()) {
+        std::cout << "Using the mock OpenCL runtime; skipping [device] tests."
+                  << std::endl;
+        mockcl_exclude_opt = strdup("exclude:[device]");
+        local_argv.push_back(mockcl_exclude_opt);
+      }
     } else {
       std::cerr << "OpenCL not available." << std::endl;
       opencl_exclude_opt = strdup("exclude:[opencl]");
@@ -350,5 +2171,9 @@ int main(int argc, char **argv) {
     free(opencl_exclude_opt);
   }
 
+  if (mockcl_exclude_opt) {
+    free(mockcl_exclude_opt);
+  }
+
   return (result < 0xff) ? result : 0xff;
 }
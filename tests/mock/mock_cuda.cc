@@ -0,0 +1,1226 @@
+//
+// CPU-backed stand-in for the CUDA driver(libcuda). See mock_cuda.h.
+//
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 - 2020 Light Transport Entertainment, Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Only for the CUDA types and constants. cuew.h declares every entry point as
+// a function pointer of the same name, which this file defines instead.
+#define cuGetErrorString rm_cuew_cuGetErrorString
+#define cuGetErrorName rm_cuew_cuGetErrorName
+#define cuInit rm_cuew_cuInit
+#define cuDriverGetVersion rm_cuew_cuDriverGetVersion
+#define cuDeviceGet rm_cuew_cuDeviceGet
+#define cuDeviceGetCount rm_cuew_cuDeviceGetCount
+#define cuDeviceGetName rm_cuew_cuDeviceGetName
+#define cuDeviceTotalMem_v2 rm_cuew_cuDeviceTotalMem_v2
+#define cuDeviceGetAttribute rm_cuew_cuDeviceGetAttribute
+#define cuDeviceComputeCapability rm_cuew_cuDeviceComputeCapability
+#define cuCtxCreate_v2 rm_cuew_cuCtxCreate_v2
+#define cuCtxDestroy_v2 rm_cuew_cuCtxDestroy_v2
+#define cuCtxPushCurrent_v2 rm_cuew_cuCtxPushCurrent_v2
+#define cuCtxPopCurrent_v2 rm_cuew_cuCtxPopCurrent_v2
+#define cuCtxSetCurrent rm_cuew_cuCtxSetCurrent
+#define cuCtxGetCurrent rm_cuew_cuCtxGetCurrent
+#define cuCtxGetDevice rm_cuew_cuCtxGetDevice
+#define cuCtxSynchronize rm_cuew_cuCtxSynchronize
+#define cuModuleLoadData rm_cuew_cuModuleLoadData
+#define cuModuleLoadDataEx rm_cuew_cuModuleLoadDataEx
+#define cuModuleUnload rm_cuew_cuModuleUnload
+#define cuModuleGetFunction rm_cuew_cuModuleGetFunction
+#define cuFuncGetAttribute rm_cuew_cuFuncGetAttribute
+#define cuMemGetInfo_v2 rm_cuew_cuMemGetInfo_v2
+#define cuMemAlloc_v2 rm_cuew_cuMemAlloc_v2
+#define cuMemFree_v2 rm_cuew_cuMemFree_v2
+#define cuMemGetAddressRange_v2 rm_cuew_cuMemGetAddressRange_v2
+#define cuMemAllocHost_v2 rm_cuew_cuMemAllocHost_v2
+#define cuMemFreeHost rm_cuew_cuMemFreeHost
+#define cuMemHostAlloc rm_cuew_cuMemHostAlloc
+#define cuMemHostGetDevicePointer_v2 rm_cuew_cuMemHostGetDevicePointer_v2
+#define cuMemcpy rm_cuew_cuMemcpy
+#define cuMemcpyAsync rm_cuew_cuMemcpyAsync
+#define cuMemcpyHtoD_v2 rm_cuew_cuMemcpyHtoD_v2
+#define cuMemcpyDtoH_v2 rm_cuew_cuMemcpyDtoH_v2
+#define cuMemcpyDtoD_v2 rm_cuew_cuMemcpyDtoD_v2
+#define cuMemcpyHtoDAsync_v2 rm_cuew_cuMemcpyHtoDAsync_v2
+#define cuMemcpyDtoHAsync_v2 rm_cuew_cuMemcpyDtoHAsync_v2
+#define cuMemcpyDtoDAsync_v2 rm_cuew_cuMemcpyDtoDAsync_v2
+#define cuMemsetD8_v2 rm_cuew_cuMemsetD8_v2
+#define cuMemsetD32_v2 rm_cuew_cuMemsetD32_v2
+#define cuStreamCreate rm_cuew_cuStreamCreate
+#define cuStreamDestroy_v2 rm_cuew_cuStreamDestroy_v2
+#define cuStreamQuery rm_cuew_cuStreamQuery
+#define cuStreamSynchronize rm_cuew_cuStreamSynchronize
+#define cuStreamWaitEvent rm_cuew_cuStreamWaitEvent
+#define cuEventCreate rm_cuew_cuEventCreate
+#define cuEventDestroy_v2 rm_cuew_cuEventDestroy_v2
+#define cuEventRecord rm_cuew_cuEventRecord
+#define cuEventQuery rm_cuew_cuEventQuery
+#define cuEventSynchronize rm_cuew_cuEventSynchronize
+#define cuEventElapsedTime rm_cuew_cuEventElapsedTime
+#define cuLaunchKernel rm_cuew_cuLaunchKernel
+#define cuGetExportTable rm_cuew_cuGetExportTable
+
+#include "cuew.h"
+
+#undef cuGetErrorString
+#undef cuGetErrorName
+#undef cuInit
+#undef cuDriverGetVersion
+#undef cuDeviceGet
+#undef cuDeviceGetCount
+#undef cuDeviceGetName
+#undef cuDeviceTotalMem_v2
+#undef cuDeviceGetAttribute
+#undef cuDeviceComputeCapability
+#undef cuCtxCreate_v2
+#undef cuCtxDestroy_v2
+#undef cuCtxPushCurrent_v2
+#undef cuCtxPopCurrent_v2
+#undef cuCtxSetCurrent
+#undef cuCtxGetCurrent
+#undef cuCtxGetDevice
+#undef cuCtxSynchronize
+#undef cuModuleLoadData
+#undef cuModuleLoadDataEx
+#undef cuModuleUnload
+#undef cuModuleGetFunction
+#undef cuFuncGetAttribute
+#undef cuMemGetInfo_v2
+#undef cuMemAlloc_v2
+#undef cuMemFree_v2
+#undef cuMemGetAddressRange_v2
+#undef cuMemAllocHost_v2
+#undef cuMemFreeHost
+#undef cuMemHostAlloc
+#undef cuMemHostGetDevicePointer_v2
+#undef cuMemcpy
+#undef cuMemcpyAsync
+#undef cuMemcpyHtoD_v2
+#undef cuMemcpyDtoH_v2
+#undef cuMemcpyDtoD_v2
+#undef cuMemcpyHtoDAsync_v2
+#undef cuMemcpyDtoHAsync_v2
+#undef cuMemcpyDtoDAsync_v2
+#undef cuMemsetD8_v2
+#undef cuMemsetD32_v2
+#undef cuStreamCreate
+#undef cuStreamDestroy_v2
+#undef cuStreamQuery
+#undef cuStreamSynchronize
+#undef cuStreamWaitEvent
+#undef cuEventCreate
+#undef cuEventDestroy_v2
+#undef cuEventRecord
+#undef cuEventQuery
+#undef cuEventSynchronize
+#undef cuEventElapsedTime
+#undef cuLaunchKernel
+#undef cuGetExportTable
+
+#include "mock_cuda.h"
+#include "mock_source.h"
+
+#if defined(_WIN32)
+#define RM_MOCKCUDA_API extern "C" __declspec(dllexport)
+#else
+#define RM_MOCKCUDA_API extern "C" __attribute__((visibility("default")))
+#endif
+
+struct HostKernelEntry {
+  std::vector<std::string> options;  // normalized
+  CUrmHostKernel kernel;
+  void *user_data;
+};
+
+// Driver objects. The handle types are pointers to these.
+struct CUctx_st {
+  CUdevice device;
+};
+
+struct CUfunc_st {
+  std::string name;
+  HostKernelEntry host;
+};
+
+struct CUmod_st {
+  std::vector<std::string> options;  // normalized
+  std::vector<std::string> entries;
+  std::unordered_map<std::string, CUfunc_st *> functions;
+};
+
+struct CUstream_st {
+  unsigned int flags;
+};
+
+struct CUevent_st {
+  unsigned int flags;
+  bool recorded = false;
+  std::chrono::steady_clock::time_point time;
+};
+
+namespace {
+
+using rainbowmist::mock::BestMatch;
+using rainbowmist::NormalizeBuildOptions;
+
+// Nominal device memory; allocations are only limited by the host.
+const size_t kTotalMemory = size_t(1) << 32;
+
+// Alignment of `cuMemAlloc`, as on the real driver.
+const size_t kDeviceAlignment = 256;
+
+struct Allocation {
+  void *raw;  // from malloc
+  size_t size;
+};
+
+// NOTE(LTE): Handles are not validated, like in the real driver, except
+// device pointers for `cuMemFree` and `cuMemGetAddressRange`.
+struct MockState {
+  std::mutex mutex;
+  std::atomic<bool> initialized{false};
+  std::map<CUdeviceptr, Allocation> allocations;  // by aligned address
+  size_t allocated_bytes = 0;
+  std::unordered_set<void *> host_allocations;
+  std::unordered_map<std::string, std::vector<HostKernelEntry>> kernels;
+};
+
+MockState &State() {
+  static MockState *state = new MockState();  // never destroyed
+  return *state;
+}
+
+// Context stack of the calling thread.
+std::vector<CUcontext> &ContextStack() {
+  static thread_local std::vector<CUcontext> stack;
+  return stack;
+}
+
+CUresult CheckContext() {
+  if (!State().initialized) {
+    return CUDA_ERROR_NOT_INITIALIZED;
+  }
+  return ContextStack().empty() ? CUDA_ERROR_INVALID_CONTEXT : CUDA_SUCCESS;
+}
+
+CUresult CUDAAPI RegisterHostKernel(const char *kernel_name,
+                                    const char *options, CUrmHostKernel kernel,
+                                    void *user_data) {
+  if (kernel_name == nullptr || kernel == nullptr) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  HostKernelEntry entry;
+  entry.options = NormalizeBuildOptions(options ? options : "");
+  entry.kernel = kernel;
+  entry.user_data = user_data;
+
+  MockState &state = State();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  std::vector<HostKernelEntry> &entries = state.kernels[kernel_name];
+  for (HostKernelEntry &e : entries) {
+    if (e.options == entry.options) {
+      e = entry;
+      return CUDA_SUCCESS;
+    }
+  }
+  entries.push_back(entry);
+  return CUDA_SUCCESS;
+}
+
+const CUrmHostKernelsTable g_host_kernels_table = {
+    sizeof(CUrmHostKernelsTable), RegisterHostKernel};
+
+bool FindHostKernel(const std::string &name,
+                    const std::vector<std::string> &module_options,
+                    HostKernelEntry *entry) {
+  MockState &state = State();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  auto it = state.kernels.find(name);
+  if (it == state.kernels.end()) {
+    return false;
+  }
+  const HostKernelEntry *best = BestMatch(it->second, module_options);
+  if (!best) {
+    return false;
+  }
+  *entry = *best;
+  return true;
+}
+
+// Aligned host memory standing in for `bytesize` bytes of device memory.
+CUresult Allocate(size_t bytesize, CUdeviceptr *dptr) {
+  if (dptr == nullptr || bytesize == 0) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  void *raw = malloc(bytesize + kDeviceAlignment - 1);
+  if (raw == nullptr) {
+    return CUDA_ERROR_OUT_OF_MEMORY;
+  }
+  uintptr_t addr = (reinterpret_cast<uintptr_t>(raw) + kDeviceAlignment - 1) &
+                   ~uintptr_t(kDeviceAlignment - 1);
+
+  MockState &state = State();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  state.allocations[CUdeviceptr(addr)] = Allocation{raw, bytesize};
+  state.allocated_bytes += bytesize;
+  *dptr = CUdeviceptr(addr);
+  return CUDA_SUCCESS;
+}
+
+void *HostPointer(CUdeviceptr dptr) {
+  return reinterpret_cast<void *>(static_cast<uintptr_t>(dptr));
+}
+
+// Streams run each command before returning, so a copy on any stream is a
+// plain memcpy.
+CUresult Copy(void *dst, const void *src, size_t bytes) {
+  if (bytes == 0) {
+    return CUDA_SUCCESS;
+  }
+  if (dst == nullptr || src == nullptr) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  memmove(dst, src, bytes);
+  return CUDA_SUCCESS;
+}
+
+}  // namespace
+
+// ----------------------------------------------------------------------------
+// Errors, initialization, devices
+
+#define RM_MOCKCUDA_ERROR(e) \
+  case e:                    \
+    *pStr = #e;              \
+    return CUDA_SUCCESS
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuGetErrorName(CUresult error,
+                                                const char **pStr) {
+  if (pStr == nullptr) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  switch (error) {
+    RM_MOCKCUDA_ERROR(CUDA_SUCCESS);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_INVALID_VALUE);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_OUT_OF_MEMORY);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_NOT_INITIALIZED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_DEINITIALIZED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_PROFILER_DISABLED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_PROFILER_NOT_INITIALIZED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_PROFILER_ALREADY_STARTED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_PROFILER_ALREADY_STOPPED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_NO_DEVICE);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_INVALID_DEVICE);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_INVALID_IMAGE);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_INVALID_CONTEXT);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_CONTEXT_ALREADY_CURRENT);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_MAP_FAILED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_UNMAP_FAILED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_ARRAY_IS_MAPPED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_ALREADY_MAPPED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_NO_BINARY_FOR_GPU);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_ALREADY_ACQUIRED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_NOT_MAPPED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_NOT_MAPPED_AS_ARRAY);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_NOT_MAPPED_AS_POINTER);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_ECC_UNCORRECTABLE);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_UNSUPPORTED_LIMIT);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_CONTEXT_ALREADY_IN_USE);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_PEER_ACCESS_UNSUPPORTED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_INVALID_PTX);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_INVALID_GRAPHICS_CONTEXT);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_NVLINK_UNCORRECTABLE);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_JIT_COMPILER_NOT_FOUND);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_INVALID_SOURCE);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_FILE_NOT_FOUND);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_SHARED_OBJECT_SYMBOL_NOT_FOUND);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_SHARED_OBJECT_INIT_FAILED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_OPERATING_SYSTEM);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_INVALID_HANDLE);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_ILLEGAL_STATE);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_NOT_FOUND);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_NOT_READY);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_ILLEGAL_ADDRESS);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_LAUNCH_OUT_OF_RESOURCES);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_LAUNCH_TIMEOUT);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_LAUNCH_INCOMPATIBLE_TEXTURING);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_PEER_ACCESS_ALREADY_ENABLED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_PEER_ACCESS_NOT_ENABLED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_PRIMARY_CONTEXT_ACTIVE);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_CONTEXT_IS_DESTROYED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_ASSERT);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_TOO_MANY_PEERS);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_HOST_MEMORY_ALREADY_REGISTERED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_HOST_MEMORY_NOT_REGISTERED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_HARDWARE_STACK_ERROR);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_ILLEGAL_INSTRUCTION);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_MISALIGNED_ADDRESS);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_INVALID_ADDRESS_SPACE);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_INVALID_PC);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_LAUNCH_FAILED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_COOPERATIVE_LAUNCH_TOO_LARGE);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_NOT_PERMITTED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_NOT_SUPPORTED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_SYSTEM_NOT_READY);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_SYSTEM_DRIVER_MISMATCH);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_COMPAT_NOT_SUPPORTED_ON_DEVICE);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_STREAM_CAPTURE_UNSUPPORTED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_STREAM_CAPTURE_INVALIDATED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_STREAM_CAPTURE_MERGE);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_STREAM_CAPTURE_UNMATCHED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_STREAM_CAPTURE_UNJOINED);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_STREAM_CAPTURE_ISOLATION);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_STREAM_CAPTURE_IMPLICIT);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_CAPTURED_EVENT);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_STREAM_CAPTURE_WRONG_THREAD);
+    RM_MOCKCUDA_ERROR(CUDA_ERROR_UNKNOWN);
+  }
+  *pStr = nullptr;
+  return CUDA_ERROR_INVALID_VALUE;
+}
+
+#undef RM_MOCKCUDA_ERROR
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuGetErrorString(CUresult error,
+                                                  const char **pStr) {
+  if (pStr == nullptr) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  // Descriptions of the errors the mock returns; the name for the others.
+  switch (error) {
+    case CUDA_SUCCESS:
+      *pStr = "no error";
+      return CUDA_SUCCESS;
+    case CUDA_ERROR_INVALID_VALUE:
+      *pStr = "invalid argument";
+      return CUDA_SUCCESS;
+    case CUDA_ERROR_OUT_OF_MEMORY:
+      *pStr = "out of memory";
+      return CUDA_SUCCESS;
+    case CUDA_ERROR_NOT_INITIALIZED:
+      *pStr = "initialization error";
+      return CUDA_SUCCESS;
+    case CUDA_ERROR_INVALID_DEVICE:
+      *pStr = "invalid device ordinal";
+      return CUDA_SUCCESS;
+    case CUDA_ERROR_INVALID_CONTEXT:
+      *pStr = "invalid device context";
+      return CUDA_SUCCESS;
+    case CUDA_ERROR_INVALID_PTX:
+      *pStr = "a PTX JIT compilation failed";
+      return CUDA_SUCCESS;
+    case CUDA_ERROR_INVALID_HANDLE:
+      *pStr = "invalid resource handle";
+      return CUDA_SUCCESS;
+    case CUDA_ERROR_NOT_FOUND:
+      *pStr = "named symbol not found";
+      return CUDA_SUCCESS;
+    case CUDA_ERROR_NOT_SUPPORTED:
+      *pStr = "operation not supported";
+      return CUDA_SUCCESS;
+    default:
+      return cuGetErrorName(error, pStr);
+  }
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuInit(unsigned int Flags) {
+  if (Flags != 0) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  State().initialized = true;
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuDriverGetVersion(int *driverVersion) {
+  if (driverVersion == nullptr) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  *driverVersion = CUDA_VERSION;
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuDeviceGetCount(int *count) {
+  if (!State().initialized) {
+    return CUDA_ERROR_NOT_INITIALIZED;
+  }
+  if (count == nullptr) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  *count = 1;
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuDeviceGet(CUdevice *device, int ordinal) {
+  if (!State().initialized) {
+    return CUDA_ERROR_NOT_INITIALIZED;
+  }
+  if (device == nullptr) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  if (ordinal != 0) {
+    return CUDA_ERROR_INVALID_DEVICE;
+  }
+  *device = 0;
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuDeviceGetName(char *name, int len,
+                                                 CUdevice dev) {
+  if (name == nullptr || len <= 0) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  if (dev != 0) {
+    return CUDA_ERROR_INVALID_DEVICE;
+  }
+  strncpy(name, "RainbowMist mock CUDA device", size_t(len));
+  name[len - 1] = '\0';
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuDeviceTotalMem_v2(size_t *bytes,
+                                                     CUdevice dev) {
+  if (bytes == nullptr) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  if (dev != 0) {
+    return CUDA_ERROR_INVALID_DEVICE;
+  }
+  *bytes = kTotalMemory;
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuDeviceGetAttribute(int *pi,
+                                                      CUdevice_attribute attrib,
+                                                      CUdevice dev) {
+  if (pi == nullptr) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  if (dev != 0) {
+    return CUDA_ERROR_INVALID_DEVICE;
+  }
+  switch (attrib) {
+    case CU_DEVICE_ATTRIBUTE_MAX_THREADS_PER_BLOCK:
+    case CU_DEVICE_ATTRIBUTE_MAX_BLOCK_DIM_X:
+    case CU_DEVICE_ATTRIBUTE_MAX_BLOCK_DIM_Y:
+      *pi = 1024;
+      break;
+    case CU_DEVICE_ATTRIBUTE_MAX_BLOCK_DIM_Z:
+      *pi = 64;
+      break;
+    case CU_DEVICE_ATTRIBUTE_MAX_GRID_DIM_X:
+      *pi = 2147483647;
+      break;
+    case CU_DEVICE_ATTRIBUTE_MAX_GRID_DIM_Y:
+    case CU_DEVICE_ATTRIBUTE_MAX_GRID_DIM_Z:
+      *pi = 65535;
+      break;
+    case CU_DEVICE_ATTRIBUTE_MAX_SHARED_MEMORY_PER_BLOCK:
+      *pi = 48 * 1024;
+      break;
+    case CU_DEVICE_ATTRIBUTE_TOTAL_CONSTANT_MEMORY:
+      *pi = 64 * 1024;
+      break;
+    case CU_DEVICE_ATTRIBUTE_WARP_SIZE:
+      *pi = 32;
+      break;
+    case CU_DEVICE_ATTRIBUTE_MAX_REGISTERS_PER_BLOCK:
+      *pi = 64 * 1024;
+      break;
+    case CU_DEVICE_ATTRIBUTE_CLOCK_RATE:
+    case CU_DEVICE_ATTRIBUTE_MEMORY_CLOCK_RATE:
+      *pi = 1000000;  // kHz
+      break;
+    case CU_DEVICE_ATTRIBUTE_GLOBAL_MEMORY_BUS_WIDTH:
+      *pi = 64;
+      break;
+    case CU_DEVICE_ATTRIBUTE_MULTIPROCESSOR_COUNT: {
+      unsigned int n = std::thread::hardware_concurrency();
+      *pi = n > 0 ? int(n) : 1;
+      break;
+    }
+    case CU_DEVICE_ATTRIBUTE_MAX_THREADS_PER_MULTIPROCESSOR:
+      *pi = 2048;
+      break;
+    case CU_DEVICE_ATTRIBUTE_INTEGRATED:
+    case CU_DEVICE_ATTRIBUTE_CAN_MAP_HOST_MEMORY:
+    case CU_DEVICE_ATTRIBUTE_UNIFIED_ADDRESSING:
+      *pi = 1;
+      break;
+    case CU_DEVICE_ATTRIBUTE_COMPUTE_CAPABILITY_MAJOR:
+      *pi = 3;
+      break;
+    default:
+      *pi = 0;
+      break;
+  }
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuDeviceComputeCapability(int *major,
+                                                           int *minor,
+                                                           CUdevice dev) {
+  if (major == nullptr || minor == nullptr) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  if (dev != 0) {
+    return CUDA_ERROR_INVALID_DEVICE;
+  }
+  *major = 3;
+  *minor = 0;
+  return CUDA_SUCCESS;
+}
+
+// ----------------------------------------------------------------------------
+// Contexts
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuCtxCreate_v2(CUcontext *pctx,
+                                                unsigned int flags,
+                                                CUdevice dev) {
+  (void)flags;
+  if (!State().initialized) {
+    return CUDA_ERROR_NOT_INITIALIZED;
+  }
+  if (pctx == nullptr) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  if (dev != 0) {
+    return CUDA_ERROR_INVALID_DEVICE;
+  }
+  CUcontext ctx = new CUctx_st();
+  ctx->device = dev;
+  ContextStack().push_back(ctx);
+  *pctx = ctx;
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuCtxDestroy_v2(CUcontext ctx) {
+  if (ctx == nullptr) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  // NOTE(LTE): Only the calling thread's stack is updated.
+  std::vector<CUcontext> &stack = ContextStack();
+  for (size_t i = stack.size(); i > 0; i--) {
+    if (stack[i - 1] == ctx) {
+      stack.erase(stack.begin() + std::ptrdiff_t(i - 1));
+    }
+  }
+  delete ctx;
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuCtxPushCurrent_v2(CUcontext ctx) {
+  if (ctx == nullptr) {
+    return CUDA_ERROR_INVALID_CONTEXT;
+  }
+  ContextStack().push_back(ctx);
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuCtxPopCurrent_v2(CUcontext *pctx) {
+  std::vector<CUcontext> &stack = ContextStack();
+  if (stack.empty()) {
+    return CUDA_ERROR_INVALID_CONTEXT;
+  }
+  if (pctx) {
+    *pctx = stack.back();
+  }
+  stack.pop_back();
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuCtxSetCurrent(CUcontext ctx) {
+  std::vector<CUcontext> &stack = ContextStack();
+  if (ctx == nullptr) {
+    if (!stack.empty()) {
+      stack.pop_back();
+    }
+  } else if (stack.empty()) {
+    stack.push_back(ctx);
+  } else {
+    stack.back() = ctx;
+  }
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuCtxGetCurrent(CUcontext *pctx) {
+  if (pctx == nullptr) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  std::vector<CUcontext> &stack = ContextStack();
+  *pctx = stack.empty() ? nullptr : stack.back();
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuCtxGetDevice(CUdevice *device) {
+  CUresult err = CheckContext();
+  if (err != CUDA_SUCCESS) {
+    return err;
+  }
+  if (device == nullptr) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  *device = ContextStack().back()->device;
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuCtxSynchronize() { return CheckContext(); }
+
+// ----------------------------------------------------------------------------
+// Modules and kernels
+
+// Loads the PTX emitted by mock_nvrtc.cc.
+RM_MOCKCUDA_API CUresult CUDAAPI cuModuleLoadDataEx(CUmodule *module,
+                                                    const void *image,
+                                                    unsigned int numOptions,
+                                                    CUjit_option *options,
+                                                    void **optionValues) {
+  (void)numOptions;
+  (void)options;
+  (void)optionValues;
+  CUresult err = CheckContext();
+  if (err != CUDA_SUCCESS) {
+    return err;
+  }
+  if (module == nullptr || image == nullptr) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  const char *ptx = static_cast<const char *>(image);
+  const size_t header_len = strlen(rainbowmist::mock::kPTXHeader);
+  if (strncmp(ptx, rainbowmist::mock::kPTXHeader, header_len) != 0) {
+    return CUDA_ERROR_INVALID_PTX;
+  }
+
+  CUmodule mod = new CUmod_st();
+  std::istringstream ss(ptx + header_len);
+  std::string line;
+  while (std::getline(ss, line)) {
+    std::istringstream words(line);
+    std::string directive, w;
+    words >> directive;
+    if (directive == ".rm_options") {
+      while (words >> w) {
+        mod->options.push_back(w);
+      }
+    } else if (directive == ".rm_entry" && (words >> w)) {
+      mod->entries.push_back(w);
+    }
+  }
+  // Written normalized, but the PTX may come from elsewhere(a cache).
+  std::sort(mod->options.begin(), mod->options.end());
+  *module = mod;
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuModuleLoadData(CUmodule *module,
+                                                  const void *image) {
+  return cuModuleLoadDataEx(module, image, 0, nullptr, nullptr);
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuModuleUnload(CUmodule hmod) {
+  if (hmod == nullptr) {
+    return CUDA_ERROR_INVALID_HANDLE;
+  }
+  for (auto &f : hmod->functions) {
+    delete f.second;
+  }
+  delete hmod;
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuModuleGetFunction(CUfunction *hfunc,
+                                                     CUmodule hmod,
+                                                     const char *name) {
+  if (hfunc == nullptr || name == nullptr) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  if (hmod == nullptr) {
+    return CUDA_ERROR_INVALID_HANDLE;
+  }
+  auto it = hmod->functions.find(name);
+  if (it != hmod->functions.end()) {
+    *hfunc = it->second;
+    return CUDA_SUCCESS;
+  }
+
+  HostKernelEntry entry;
+  if (std::find(hmod->entries.begin(), hmod->entries.end(), name) ==
+          hmod->entries.end() ||
+      !FindHostKernel(name, hmod->options, &entry)) {
+    return CUDA_ERROR_NOT_FOUND;
+  }
+  CUfunction f = new CUfunc_st();
+  f->name = name;
+  f->host = entry;
+  hmod->functions[name] = f;
+  *hfunc = f;
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuFuncGetAttribute(int *pi,
+                                                    CUfunction_attribute attrib,
+                                                    CUfunction hfunc) {
+  if (pi == nullptr) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  if (hfunc == nullptr) {
+    return CUDA_ERROR_INVALID_HANDLE;
+  }
+  switch (attrib) {
+    case CU_FUNC_ATTRIBUTE_MAX_THREADS_PER_BLOCK:
+      *pi = 1024;
+      break;
+    case CU_FUNC_ATTRIBUTE_PTX_VERSION:
+    case CU_FUNC_ATTRIBUTE_BINARY_VERSION:
+      *pi = 30;
+      break;
+    default:
+      *pi = 0;
+      break;
+  }
+  return CUDA_SUCCESS;
+}
+
+// Runs the kernel over the whole grid before returning.
+RM_MOCKCUDA_API CUresult CUDAAPI cuLaunchKernel(
+    CUfunction f, unsigned int gridDimX, unsigned int gridDimY,
+    unsigned int gridDimZ, unsigned int blockDimX, unsigned int blockDimY,
+    unsigned int blockDimZ, unsigned int sharedMemBytes, CUstream hStream,
+    void **kernelParams, void **extra) {
+  (void)hStream;
+  CUresult err = CheckContext();
+  if (err != CUDA_SUCCESS) {
+    return err;
+  }
+  if (f == nullptr) {
+    return CUDA_ERROR_INVALID_HANDLE;
+  }
+  if (sharedMemBytes != 0 || extra != nullptr) {
+    return CUDA_ERROR_NOT_SUPPORTED;
+  }
+  const unsigned int grid[3] = {gridDimX, gridDimY, gridDimZ};
+  const unsigned int block[3] = {blockDimX, blockDimY, blockDimZ};
+  if (uint64_t(blockDimX) * blockDimY * blockDimZ > 1024 || blockDimZ > 64) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  unsigned int global_size[3];
+  for (int i = 0; i < 3; i++) {
+    uint64_t n = uint64_t(grid[i]) * block[i];
+    if (n == 0 || n > 0xffffffffu) {
+      return CUDA_ERROR_INVALID_VALUE;
+    }
+    global_size[i] = static_cast<unsigned int>(n);
+  }
+  return f->host.kernel(f->host.user_data, kernelParams, global_size);
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuGetExportTable(const void **ppExportTable,
+                                                  const CUuuid *pExportTableId) {
+  if (ppExportTable == nullptr || pExportTableId == nullptr) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  const CUuuid id = CU_RM_HOST_KERNELS_TABLE_ID;
+  if (memcmp(pExportTableId->bytes, id.bytes, sizeof(id.bytes)) != 0) {
+    *ppExportTable = nullptr;
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  *ppExportTable = &g_host_kernels_table;
+  return CUDA_SUCCESS;
+}
+
+// ----------------------------------------------------------------------------
+// Memory
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuMemGetInfo_v2(size_t *free_bytes,
+                                                 size_t *total_bytes) {
+  CUresult err = CheckContext();
+  if (err != CUDA_SUCCESS) {
+    return err;
+  }
+  if (free_bytes == nullptr || total_bytes == nullptr) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  MockState &state = State();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  *total_bytes = kTotalMemory;
+  *free_bytes = state.allocated_bytes < kTotalMemory
+                    ? kTotalMemory - state.allocated_bytes
+                    : 0;
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuMemAlloc_v2(CUdeviceptr *dptr,
+                                               size_t bytesize) {
+  CUresult err = CheckContext();
+  if (err != CUDA_SUCCESS) {
+    return err;
+  }
+  return Allocate(bytesize, dptr);
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuMemFree_v2(CUdeviceptr dptr) {
+  MockState &state = State();
+  void *raw = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    auto it = state.allocations.find(dptr);
+    if (it == state.allocations.end()) {
+      return CUDA_ERROR_INVALID_VALUE;
+    }
+    raw = it->second.raw;
+    state.allocated_bytes -= it->second.size;
+    state.allocations.erase(it);
+  }
+  free(raw);
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuMemGetAddressRange_v2(CUdeviceptr *pbase,
+                                                         size_t *psize,
+                                                         CUdeviceptr dptr) {
+  MockState &state = State();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  auto it = state.allocations.upper_bound(dptr);
+  if (it == state.allocations.begin()) {
+    return CUDA_ERROR_NOT_FOUND;
+  }
+  --it;
+  if (dptr >= it->first + it->second.size) {
+    return CUDA_ERROR_NOT_FOUND;
+  }
+  if (pbase) {
+    *pbase = it->first;
+  }
+  if (psize) {
+    *psize = it->second.size;
+  }
+  return CUDA_SUCCESS;
+}
+
+// Page-locked host memory is ordinary host memory here.
+RM_MOCKCUDA_API CUresult CUDAAPI cuMemHostAlloc(void **pp, size_t bytesize,
+                                                unsigned int Flags) {
+  (void)Flags;
+  CUresult err = CheckContext();
+  if (err != CUDA_SUCCESS) {
+    return err;
+  }
+  if (pp == nullptr) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  void *p = malloc(bytesize > 0 ? bytesize : 1);
+  if (p == nullptr) {
+    return CUDA_ERROR_OUT_OF_MEMORY;
+  }
+  MockState &state = State();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  state.host_allocations.insert(p);
+  *pp = p;
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuMemAllocHost_v2(void **pp, size_t bytesize) {
+  return cuMemHostAlloc(pp, bytesize, 0);
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuMemFreeHost(void *p) {
+  MockState &state = State();
+  {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (state.host_allocations.erase(p) == 0) {
+      return CUDA_ERROR_INVALID_VALUE;
+    }
+  }
+  free(p);
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuMemHostGetDevicePointer_v2(
+    CUdeviceptr *pdptr, void *p, unsigned int Flags) {
+  if (pdptr == nullptr || p == nullptr || Flags != 0) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  *pdptr = CUdeviceptr(reinterpret_cast<uintptr_t>(p));
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuMemcpy(CUdeviceptr dst, CUdeviceptr src,
+                                          size_t ByteCount) {
+  return Copy(HostPointer(dst), HostPointer(src), ByteCount);
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuMemcpyAsync(CUdeviceptr dst,
+                                               CUdeviceptr src,
+                                               size_t ByteCount,
+                                               CUstream hStream) {
+  (void)hStream;
+  return Copy(HostPointer(dst), HostPointer(src), ByteCount);
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuMemcpyHtoD_v2(CUdeviceptr dstDevice,
+                                                 const void *srcHost,
+                                                 size_t ByteCount) {
+  return Copy(HostPointer(dstDevice), srcHost, ByteCount);
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuMemcpyDtoH_v2(void *dstHost,
+                                                 CUdeviceptr srcDevice,
+                                                 size_t ByteCount) {
+  return Copy(dstHost, HostPointer(srcDevice), ByteCount);
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuMemcpyDtoD_v2(CUdeviceptr dstDevice,
+                                                 CUdeviceptr srcDevice,
+                                                 size_t ByteCount) {
+  return Copy(HostPointer(dstDevice), HostPointer(srcDevice), ByteCount);
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuMemcpyHtoDAsync_v2(CUdeviceptr dstDevice,
+                                                      const void *srcHost,
+                                                      size_t ByteCount,
+                                                      CUstream hStream) {
+  (void)hStream;
+  return Copy(HostPointer(dstDevice), srcHost, ByteCount);
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuMemcpyDtoHAsync_v2(void *dstHost,
+                                                      CUdeviceptr srcDevice,
+                                                      size_t ByteCount,
+                                                      CUstream hStream) {
+  (void)hStream;
+  return Copy(dstHost, HostPointer(srcDevice), ByteCount);
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuMemcpyDtoDAsync_v2(CUdeviceptr dstDevice,
+                                                      CUdeviceptr srcDevice,
+                                                      size_t ByteCount,
+                                                      CUstream hStream) {
+  (void)hStream;
+  return Copy(HostPointer(dstDevice), HostPointer(srcDevice), ByteCount);
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuMemsetD8_v2(CUdeviceptr dstDevice,
+                                               unsigned char uc, size_t N) {
+  if (N > 0 && dstDevice == 0) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  memset(HostPointer(dstDevice), uc, N);
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuMemsetD32_v2(CUdeviceptr dstDevice,
+                                                unsigned int ui, size_t N) {
+  if ((N > 0 && dstDevice == 0) || dstDevice % 4 != 0) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  unsigned int *dst = static_cast<unsigned int *>(HostPointer(dstDevice));
+  for (size_t i = 0; i < N; i++) {
+    dst[i] = ui;
+  }
+  return CUDA_SUCCESS;
+}
+
+// ----------------------------------------------------------------------------
+// Streams and events
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuStreamCreate(CUstream *phStream,
+                                                unsigned int Flags) {
+  CUresult err = CheckContext();
+  if (err != CUDA_SUCCESS) {
+    return err;
+  }
+  if (phStream == nullptr) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  CUstream s = new CUstream_st();
+  s->flags = Flags;
+  *phStream = s;
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuStreamDestroy_v2(CUstream hStream) {
+  if (hStream == nullptr) {
+    return CUDA_ERROR_INVALID_HANDLE;
+  }
+  delete hStream;
+  return CUDA_SUCCESS;
+}
+
+// Every command has completed when its call returns.
+RM_MOCKCUDA_API CUresult CUDAAPI cuStreamQuery(CUstream hStream) {
+  (void)hStream;
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuStreamSynchronize(CUstream hStream) {
+  (void)hStream;
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuStreamWaitEvent(CUstream hStream,
+                                                   CUevent hEvent,
+                                                   unsigned int Flags) {
+  (void)hStream;
+  if (hEvent == nullptr || Flags != 0) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuEventCreate(CUevent *phEvent,
+                                               unsigned int Flags) {
+  CUresult err = CheckContext();
+  if (err != CUDA_SUCCESS) {
+    return err;
+  }
+  if (phEvent == nullptr) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  CUevent e = new CUevent_st();
+  e->flags = Flags;
+  *phEvent = e;
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuEventDestroy_v2(CUevent hEvent) {
+  if (hEvent == nullptr) {
+    return CUDA_ERROR_INVALID_HANDLE;
+  }
+  delete hEvent;
+  return CUDA_SUCCESS;
+}
+
+// The stream has run everything before, so the event completes now.
+RM_MOCKCUDA_API CUresult CUDAAPI cuEventRecord(CUevent hEvent,
+                                               CUstream hStream) {
+  (void)hStream;
+  if (hEvent == nullptr) {
+    return CUDA_ERROR_INVALID_HANDLE;
+  }
+  hEvent->time = std::chrono::steady_clock::now();
+  hEvent->recorded = true;
+  return CUDA_SUCCESS;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuEventQuery(CUevent hEvent) {
+  return hEvent ? CUDA_SUCCESS : CUDA_ERROR_INVALID_HANDLE;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuEventSynchronize(CUevent hEvent) {
+  return hEvent ? CUDA_SUCCESS : CUDA_ERROR_INVALID_HANDLE;
+}
+
+RM_MOCKCUDA_API CUresult CUDAAPI cuEventElapsedTime(float *pMilliseconds,
+                                                    CUevent hStart,
+                                                    CUevent hEnd) {
+  if (pMilliseconds == nullptr) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  if (hStart == nullptr || hEnd == nullptr || !hStart->recorded ||
+      !hEnd->recorded || (hStart->flags & CU_EVENT_DISABLE_TIMING) ||
+      (hEnd->flags & CU_EVENT_DISABLE_TIMING)) {
+    return CUDA_ERROR_INVALID_HANDLE;
+  }
+  *pMilliseconds =
+      std::chrono::duration<float, std::milli>(hEnd->time - hStart->time)
+          .count();
+  return CUDA_SUCCESS;
+}
+
+// The entry points must match cuew's prototypes.
+#define RM_MOCKCUDA_CHECK(fn) (void)static_cast<t##fn *>(&fn)
+
+struct PrototypeCheck {
+  static void Check() {
+    RM_MOCKCUDA_CHECK(cuGetErrorString);
+    RM_MOCKCUDA_CHECK(cuGetErrorName);
+    RM_MOCKCUDA_CHECK(cuInit);
+    RM_MOCKCUDA_CHECK(cuDriverGetVersion);
+    RM_MOCKCUDA_CHECK(cuDeviceGet);
+    RM_MOCKCUDA_CHECK(cuDeviceGetCount);
+    RM_MOCKCUDA_CHECK(cuDeviceGetName);
+    RM_MOCKCUDA_CHECK(cuDeviceTotalMem_v2);
+    RM_MOCKCUDA_CHECK(cuDeviceGetAttribute);
+    RM_MOCKCUDA_CHECK(cuDeviceComputeCapability);
+    RM_MOCKCUDA_CHECK(cuCtxCreate_v2);
+    RM_MOCKCUDA_CHECK(cuCtxDestroy_v2);
+    RM_MOCKCUDA_CHECK(cuCtxPushCurrent_v2);
+    RM_MOCKCUDA_CHECK(cuCtxPopCurrent_v2);
+    RM_MOCKCUDA_CHECK(cuCtxSetCurrent);
+    RM_MOCKCUDA_CHECK(cuCtxGetCurrent);
+    RM_MOCKCUDA_CHECK(cuCtxGetDevice);
+    RM_MOCKCUDA_CHECK(cuCtxSynchronize);
+    RM_MOCKCUDA_CHECK(cuModuleLoadData);
+    RM_MOCKCUDA_CHECK(cuModuleLoadDataEx);
+    RM_MOCKCUDA_CHECK(cuModuleUnload);
+    RM_MOCKCUDA_CHECK(cuModuleGetFunction);
+    RM_MOCKCUDA_CHECK(cuFuncGetAttribute);
+    RM_MOCKCUDA_CHECK(cuMemGetInfo_v2);
+    RM_MOCKCUDA_CHECK(cuMemAlloc_v2);
+    RM_MOCKCUDA_CHECK(cuMemFree_v2);
+    RM_MOCKCUDA_CHECK(cuMemGetAddressRange_v2);
+    RM_MOCKCUDA_CHECK(cuMemAllocHost_v2);
+    RM_MOCKCUDA_CHECK(cuMemFreeHost);
+    RM_MOCKCUDA_CHECK(cuMemHostAlloc);
+    RM_MOCKCUDA_CHECK(cuMemHostGetDevicePointer_v2);
+    RM_MOCKCUDA_CHECK(cuMemcpy);
+    RM_MOCKCUDA_CHECK(cuMemcpyAsync);
+    RM_MOCKCUDA_CHECK(cuMemcpyHtoD_v2);
+    RM_MOCKCUDA_CHECK(cuMemcpyDtoH_v2);
+    RM_MOCKCUDA_CHECK(cuMemcpyDtoD_v2);
+    RM_MOCKCUDA_CHECK(cuMemcpyHtoDAsync_v2);
+    RM_MOCKCUDA_CHECK(cuMemcpyDtoHAsync_v2);
+    RM_MOCKCUDA_CHECK(cuMemcpyDtoDAsync_v2);
+    RM_MOCKCUDA_CHECK(cuMemsetD8_v2);
+    RM_MOCKCUDA_CHECK(cuMemsetD32_v2);
+    RM_MOCKCUDA_CHECK(cuStreamCreate);
+    RM_MOCKCUDA_CHECK(cuStreamDestroy_v2);
+    RM_MOCKCUDA_CHECK(cuStreamQuery);
+    RM_MOCKCUDA_CHECK(cuStreamSynchronize);
+    RM_MOCKCUDA_CHECK(cuStreamWaitEvent);
+    RM_MOCKCUDA_CHECK(cuEventCreate);
+    RM_MOCKCUDA_CHECK(cuEventDestroy_v2);
+    RM_MOCKCUDA_CHECK(cuEventRecord);
+    RM_MOCKCUDA_CHECK(cuEventQuery);
+    RM_MOCKCUDA_CHECK(cuEventSynchronize);
+    RM_MOCKCUDA_CHECK(cuEventElapsedTime);
+    RM_MOCKCUDA_CHECK(cuLaunchKernel);
+    RM_MOCKCUDA_CHECK(cuGetExportTable);
+  }
+};
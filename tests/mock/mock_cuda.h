@@ -0,0 +1,159 @@
+#ifndef RAINBOWMIST_MOCK_CUDA_H_
+#define RAINBOWMIST_MOCK_CUDA_H_
+
+//
+// CPU-backed stand-in for the CUDA driver and NVRTC.
+//
+// mock_cuda.cc and mock_nvrtc.cc build into shared libraries named like the
+// real ones(libcuda.so / nvcuda.dll, libnvrtc.so / nvrtc64_92.dll), which
+// implement the driver API and NVRTC entry points used by cupp11.h: one
+// device, device memory in host memory(a CUdeviceptr is a host address), and
+// streams that run each command before returning. Events record timestamps,
+// so `cuEventElapsedTime` reports what the host spent in between. cuew loads
+// them from LD_LIBRARY_PATH like the real libraries.
+//
+// Neither compiles CUDA C++. `nvrtcCompileProgram` finds the kernel
+// declarations in the source and emits them, with the compile options, as
+// the "PTX"; `cuModuleLoadDataEx` accepts that PTX(e.g. one read back from a
+// binary cache), and `cuLaunchKernel` runs the host-compiled kernel of the
+// same name with the C++11 backend(`rainbowmist::LaunchKernel`). The host
+// hands over the kernels in `rainbowmist::KernelRegistry`
+// (rainbowmist_registry.h) through a driver export table:
+//
+//   #include "cuew.h"  // or cuda.h; the CUDA types must come first
+//   #include "simple_add.kernel"  // RM_REGISTER_KERNEL(simple_add_vec2)
+//   #include "mock/mock_cuda.h"
+//
+//   rainbowmist::mockcuda::RegisterKernels();
+//
+// Variants are picked by compile options as with mock_opencl.h.
+// `RegisterKernels` returns false(and does nothing) on the real driver, so
+// the same host code runs on both.
+//
+// Limitations: kernel parameters can't be checked against the registered
+// signature(`kernelParams` carries no sizes), and there are no arrays,
+// textures, dynamic shared memory or `extra` launch parameters.
+//
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 - 2020 Light Transport Entertainment, Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+// `cuGetExportTable` id of `CUrmHostKernelsTable`.
+#define CU_RM_HOST_KERNELS_TABLE_ID                                  \
+  {{'R', 'a', 'i', 'n', 'b', 'o', 'w', 'M', 'i', 's', 't', 'H', 'o', \
+    's', 't', 'K'}}
+
+// Runs a kernel over `global_size`(grid times block size, 3 entries).
+// `kernel_params` is the `kernelParams` array of `cuLaunchKernel`. Returns
+// CUDA_SUCCESS, or a driver error code(e.g. CUDA_ERROR_INVALID_VALUE).
+typedef CUresult(CUDA_CB *CUrmHostKernel)(void *user_data, void **kernel_params,
+                                          const unsigned int *global_size);
+
+typedef struct CUrmHostKernelsTable_st {
+  size_t size;  // sizeof(CUrmHostKernelsTable)
+
+  // Registers `kernel` for kernels named `kernel_name` in modules compiled
+  // with every option in `options`(e.g. "-D TILE=4"); with several matches
+  // the one with the most options wins. Registering the same name and
+  // options again replaces the kernel.
+  CUresult(CUDAAPI *RegisterHostKernel)(const char *kernel_name,
+                                        const char *options,
+                                        CUrmHostKernel kernel,
+                                        void *user_data);
+} CUrmHostKernelsTable;
+
+#if defined(__cplusplus) && defined(RAINBOWMIST_CPP11)
+
+#include "rainbowmist_registry.h"
+
+namespace rainbowmist {
+namespace mockcuda {
+
+namespace detail {
+
+// `CUrmHostKernel` for a registered kernel(`user_data`). A CUdeviceptr is a
+// host address on the mock, so `kernel_params` are the kernel's arguments as
+// they are.
+inline CUresult CUDA_CB RunRegisteredKernel(void *user_data,
+                                            void **kernel_params,
+                                            const unsigned int *global_size) {
+  static_assert(sizeof(CUdeviceptr) == sizeof(void *),
+                "device pointers must be host pointers");
+  const KernelInfo *info = static_cast<const KernelInfo *>(user_data);
+  if (!info->args.empty() && kernel_params == nullptr) {
+    return CUDA_ERROR_INVALID_VALUE;
+  }
+  info->Launch(kernel_params, global_size[0], global_size[1], global_size[2]);
+  return CUDA_SUCCESS;
+}
+
+inline const CUrmHostKernelsTable *Table() {
+  if (cuGetExportTable == nullptr) {
+    return nullptr;
+  }
+  const CUuuid id = CU_RM_HOST_KERNELS_TABLE_ID;
+  const void *table = nullptr;
+  if (cuGetExportTable(&table, &id) != CUDA_SUCCESS || table == nullptr) {
+    return nullptr;
+  }
+  const CUrmHostKernelsTable *t =
+      static_cast<const CUrmHostKernelsTable *>(table);
+  return (t->size >= sizeof(CUrmHostKernelsTable)) ? t : nullptr;
+}
+
+}  // namespace detail
+
+/// True when the loaded CUDA driver is the mock.
+inline bool Available() { return detail::Table() != nullptr; }
+
+///
+/// Registers the registered kernel `info` with the mock driver, under its
+/// name and options. Returns false when the driver is not the mock.
+///
+inline bool RegisterKernel(const KernelInfo &info) {
+  const CUrmHostKernelsTable *table = detail::Table();
+  return table != nullptr &&
+         table->RegisterHostKernel(info.name.c_str(), info.options.c_str(),
+                                   &detail::RunRegisteredKernel,
+                                   const_cast<KernelInfo *>(&info)) ==
+             CUDA_SUCCESS;
+}
+
+/// Registers every kernel in `KernelRegistry`. Returns false when the driver
+/// is not the mock.
+inline bool RegisterKernels() {
+  if (!Available()) {
+    return false;
+  }
+  for (const KernelInfo *info : KernelRegistry::Get().Kernels()) {
+    RegisterKernel(*info);
+  }
+  return true;
+}
+
+}  // namespace mockcuda
+}  // namespace rainbowmist
+
+#endif  // __cplusplus && RAINBOWMIST_CPP11
+
+#endif  // RAINBOWMIST_MOCK_CUDA_H_
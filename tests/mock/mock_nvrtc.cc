@@ -0,0 +1,289 @@
+//
+// CPU-backed stand-in for libnvrtc. See mock_cuda.h.
+//
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 - 2020 Light Transport Entertainment, Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Only for the NVRTC types. cuew.h declares every entry point as a function
+// pointer of the same name, which this file defines instead.
+#define nvrtcGetErrorString rm_cuew_nvrtcGetErrorString
+#define nvrtcVersion rm_cuew_nvrtcVersion
+#define nvrtcCreateProgram rm_cuew_nvrtcCreateProgram
+#define nvrtcDestroyProgram rm_cuew_nvrtcDestroyProgram
+#define nvrtcCompileProgram rm_cuew_nvrtcCompileProgram
+#define nvrtcGetPTXSize rm_cuew_nvrtcGetPTXSize
+#define nvrtcGetPTX rm_cuew_nvrtcGetPTX
+#define nvrtcGetProgramLogSize rm_cuew_nvrtcGetProgramLogSize
+#define nvrtcGetProgramLog rm_cuew_nvrtcGetProgramLog
+#define nvrtcAddNameExpression rm_cuew_nvrtcAddNameExpression
+#define nvrtcGetLoweredName rm_cuew_nvrtcGetLoweredName
+
+#include "cuew.h"
+
+#undef nvrtcGetErrorString
+#undef nvrtcVersion
+#undef nvrtcCreateProgram
+#undef nvrtcDestroyProgram
+#undef nvrtcCompileProgram
+#undef nvrtcGetPTXSize
+#undef nvrtcGetPTX
+#undef nvrtcGetProgramLogSize
+#undef nvrtcGetProgramLog
+#undef nvrtcAddNameExpression
+#undef nvrtcGetLoweredName
+
+#include "mock_source.h"
+
+#if defined(_WIN32)
+#define RM_MOCKCUDA_API extern "C" __declspec(dllexport)
+#else
+#define RM_MOCKCUDA_API extern "C" __attribute__((visibility("default")))
+#endif
+
+struct _nvrtcProgram {
+  std::string source;
+  bool compiled = false;
+  std::string ptx;
+  std::string log;
+  std::vector<std::string> name_expressions;
+};
+
+namespace {
+
+nvrtcResult Copy(const std::string &s, char *dst) {
+  if (dst == nullptr) {
+    return NVRTC_ERROR_INVALID_INPUT;
+  }
+  memcpy(dst, s.c_str(), s.size() + 1);
+  return NVRTC_SUCCESS;
+}
+
+}  // namespace
+
+RM_MOCKCUDA_API const char *CUDAAPI nvrtcGetErrorString(nvrtcResult result) {
+  switch (result) {
+    case NVRTC_SUCCESS:
+      return "NVRTC_SUCCESS";
+    case NVRTC_ERROR_OUT_OF_MEMORY:
+      return "NVRTC_ERROR_OUT_OF_MEMORY";
+    case NVRTC_ERROR_PROGRAM_CREATION_FAILURE:
+      return "NVRTC_ERROR_PROGRAM_CREATION_FAILURE";
+    case NVRTC_ERROR_INVALID_INPUT:
+      return "NVRTC_ERROR_INVALID_INPUT";
+    case NVRTC_ERROR_INVALID_PROGRAM:
+      return "NVRTC_ERROR_INVALID_PROGRAM";
+    case NVRTC_ERROR_INVALID_OPTION:
+      return "NVRTC_ERROR_INVALID_OPTION";
+    case NVRTC_ERROR_COMPILATION:
+      return "NVRTC_ERROR_COMPILATION";
+    case NVRTC_ERROR_BUILTIN_OPERATION_FAILURE:
+      return "NVRTC_ERROR_BUILTIN_OPERATION_FAILURE";
+    case NVRTC_ERROR_NO_NAME_EXPRESSIONS_AFTER_COMPILATION:
+      return "NVRTC_ERROR_NO_NAME_EXPRESSIONS_AFTER_COMPILATION";
+    case NVRTC_ERROR_NO_LOWERED_NAMES_BEFORE_COMPILATION:
+      return "NVRTC_ERROR_NO_LOWERED_NAMES_BEFORE_COMPILATION";
+    case NVRTC_ERROR_NAME_EXPRESSION_NOT_VALID:
+      return "NVRTC_ERROR_NAME_EXPRESSION_NOT_VALID";
+    case NVRTC_ERROR_INTERNAL_ERROR:
+      return "NVRTC_ERROR_INTERNAL_ERROR";
+  }
+  return "NVRTC_ERROR unknown";
+}
+
+RM_MOCKCUDA_API nvrtcResult CUDAAPI nvrtcVersion(int *major, int *minor) {
+  if (major == nullptr || minor == nullptr) {
+    return NVRTC_ERROR_INVALID_INPUT;
+  }
+  *major = CUDA_VERSION / 1000;
+  *minor = (CUDA_VERSION % 1000) / 10;
+  return NVRTC_SUCCESS;
+}
+
+RM_MOCKCUDA_API nvrtcResult CUDAAPI
+nvrtcCreateProgram(nvrtcProgram *prog, const char *src, const char *name,
+                   int numHeaders, const char **headers,
+                   const char **includeNames) {
+  (void)name;
+  (void)headers;
+  (void)includeNames;
+  if (prog == nullptr || src == nullptr || numHeaders < 0) {
+    return NVRTC_ERROR_INVALID_INPUT;
+  }
+  nvrtcProgram p = new _nvrtcProgram();
+  p->source = src;
+  *prog = p;
+  return NVRTC_SUCCESS;
+}
+
+RM_MOCKCUDA_API nvrtcResult CUDAAPI nvrtcDestroyProgram(nvrtcProgram *prog) {
+  if (prog == nullptr) {
+    return NVRTC_ERROR_INVALID_PROGRAM;
+  }
+  delete *prog;
+  *prog = nullptr;
+  return NVRTC_SUCCESS;
+}
+
+// Emits
+//
+//   // Generated by the RainbowMist mock NVRTC
+//   .rm_options -DNAME=1 ...(normalized)
+//   .rm_entry kernel_name
+//   ...
+//
+// as the PTX.
+RM_MOCKCUDA_API nvrtcResult CUDAAPI nvrtcCompileProgram(nvrtcProgram prog,
+                                                        int numOptions,
+                                                        const char **options) {
+  if (prog == nullptr) {
+    return NVRTC_ERROR_INVALID_PROGRAM;
+  }
+  if (numOptions < 0 || (numOptions > 0 && options == nullptr)) {
+    return NVRTC_ERROR_INVALID_INPUT;
+  }
+  std::string joined;
+  for (int i = 0; i < numOptions; i++) {
+    if (options[i] == nullptr) {
+      return NVRTC_ERROR_INVALID_OPTION;
+    }
+    joined += std::string(options[i]) + " ";
+  }
+
+  std::string ptx = rainbowmist::mock::kPTXHeader;
+  ptx += ".rm_options";
+  for (const std::string &o : rainbowmist::NormalizeBuildOptions(joined)) {
+    ptx += " " + o;
+  }
+  ptx += "\n";
+
+  std::vector<std::string> names =
+      rainbowmist::mock::KernelNamesInSource(prog->source);
+  for (const std::string &name : names) {
+    ptx += ".rm_entry " + name + "\n";
+  }
+
+  prog->ptx = ptx;
+  prog->log = names.empty() ? "warning: no kernels found in the source\n" : "";
+  prog->compiled = true;
+  return NVRTC_SUCCESS;
+}
+
+RM_MOCKCUDA_API nvrtcResult CUDAAPI nvrtcGetPTXSize(nvrtcProgram prog,
+                                                    size_t *ptxSizeRet) {
+  if (prog == nullptr) {
+    return NVRTC_ERROR_INVALID_PROGRAM;
+  }
+  if (ptxSizeRet == nullptr) {
+    return NVRTC_ERROR_INVALID_INPUT;
+  }
+  *ptxSizeRet = prog->ptx.size() + 1;
+  return NVRTC_SUCCESS;
+}
+
+RM_MOCKCUDA_API nvrtcResult CUDAAPI nvrtcGetPTX(nvrtcProgram prog, char *ptx) {
+  if (prog == nullptr) {
+    return NVRTC_ERROR_INVALID_PROGRAM;
+  }
+  return Copy(prog->ptx, ptx);
+}
+
+RM_MOCKCUDA_API nvrtcResult CUDAAPI nvrtcGetProgramLogSize(nvrtcProgram prog,
+                                                           size_t *logSizeRet) {
+  if (prog == nullptr) {
+    return NVRTC_ERROR_INVALID_PROGRAM;
+  }
+  if (logSizeRet == nullptr) {
+    return NVRTC_ERROR_INVALID_INPUT;
+  }
+  *logSizeRet = prog->log.size() + 1;
+  return NVRTC_SUCCESS;
+}
+
+RM_MOCKCUDA_API nvrtcResult CUDAAPI nvrtcGetProgramLog(nvrtcProgram prog,
+                                                       char *log) {
+  if (prog == nullptr) {
+    return NVRTC_ERROR_INVALID_PROGRAM;
+  }
+  return Copy(prog->log, log);
+}
+
+// Kernels are `extern "C"`, so a name expression is its own lowered name.
+RM_MOCKCUDA_API nvrtcResult CUDAAPI
+nvrtcAddNameExpression(nvrtcProgram prog, const char *name_expression) {
+  if (prog == nullptr) {
+    return NVRTC_ERROR_INVALID_PROGRAM;
+  }
+  if (name_expression == nullptr) {
+    return NVRTC_ERROR_INVALID_INPUT;
+  }
+  if (prog->compiled) {
+    return NVRTC_ERROR_NO_NAME_EXPRESSIONS_AFTER_COMPILATION;
+  }
+  prog->name_expressions.push_back(name_expression);
+  return NVRTC_SUCCESS;
+}
+
+RM_MOCKCUDA_API nvrtcResult CUDAAPI
+nvrtcGetLoweredName(nvrtcProgram prog, const char *name_expression,
+                    const char **lowered_name) {
+  if (prog == nullptr) {
+    return NVRTC_ERROR_INVALID_PROGRAM;
+  }
+  if (name_expression == nullptr || lowered_name == nullptr) {
+    return NVRTC_ERROR_INVALID_INPUT;
+  }
+  if (!prog->compiled) {
+    return NVRTC_ERROR_NO_LOWERED_NAMES_BEFORE_COMPILATION;
+  }
+  for (const std::string &e : prog->name_expressions) {
+    if (e == name_expression) {
+      *lowered_name = e.c_str();
+      return NVRTC_SUCCESS;
+    }
+  }
+  return NVRTC_ERROR_NAME_EXPRESSION_NOT_VALID;
+}
+
+// The entry points must match cuew's prototypes.
+#define RM_MOCKCUDA_CHECK(fn) (void)static_cast<t##fn *>(&fn)
+
+struct PrototypeCheck {
+  static void Check() {
+    RM_MOCKCUDA_CHECK(nvrtcGetErrorString);
+    RM_MOCKCUDA_CHECK(nvrtcVersion);
+    RM_MOCKCUDA_CHECK(nvrtcCreateProgram);
+    RM_MOCKCUDA_CHECK(nvrtcDestroyProgram);
+    RM_MOCKCUDA_CHECK(nvrtcCompileProgram);
+    RM_MOCKCUDA_CHECK(nvrtcGetPTXSize);
+    RM_MOCKCUDA_CHECK(nvrtcGetPTX);
+    RM_MOCKCUDA_CHECK(nvrtcGetProgramLogSize);
+    RM_MOCKCUDA_CHECK(nvrtcGetProgramLog);
+    RM_MOCKCUDA_CHECK(nvrtcAddNameExpression);
+    RM_MOCKCUDA_CHECK(nvrtcGetLoweredName);
+  }
+};
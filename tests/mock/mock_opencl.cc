@@ -0,0 +1,1804 @@
+//
+// CPU-backed stand-in for libOpenCL. See mock_opencl.h.
+//
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 - 2020 Light Transport Entertainment, Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+// Only for the OpenCL types and constants. clew.h also maps every entry point
+// to its function pointer, which this file defines instead.
+#include "clew.h"
+
+#include "mock_opencl.h"
+#include "mock_source.h"
+
+#undef clGetPlatformIDs
+#undef clGetPlatformInfo
+#undef clGetDeviceIDs
+#undef clGetDeviceInfo
+#undef clCreateContext
+#undef clCreateContextFromType
+#undef clRetainContext
+#undef clReleaseContext
+#undef clGetContextInfo
+#undef clCreateCommandQueue
+#undef clRetainCommandQueue
+#undef clReleaseCommandQueue
+#undef clGetCommandQueueInfo
+#undef clCreateBuffer
+#undef clCreateImage
+#undef clRetainMemObject
+#undef clReleaseMemObject
+#undef clGetMemObjectInfo
+#undef clCreateSampler
+#undef clRetainSampler
+#undef clReleaseSampler
+#undef clCreateProgramWithSource
+#undef clCreateProgramWithBinary
+#undef clRetainProgram
+#undef clReleaseProgram
+#undef clBuildProgram
+#undef clGetProgramInfo
+#undef clGetProgramBuildInfo
+#undef clCreateKernel
+#undef clCreateKernelsInProgram
+#undef clRetainKernel
+#undef clReleaseKernel
+#undef clSetKernelArg
+#undef clGetKernelInfo
+#undef clGetKernelWorkGroupInfo
+#undef clWaitForEvents
+#undef clGetEventInfo
+#undef clCreateUserEvent
+#undef clRetainEvent
+#undef clReleaseEvent
+#undef clSetUserEventStatus
+#undef clSetEventCallback
+#undef clGetEventProfilingInfo
+#undef clFlush
+#undef clFinish
+#undef clEnqueueReadBuffer
+#undef clEnqueueWriteBuffer
+#undef clEnqueueCopyBuffer
+#undef clEnqueueMapBuffer
+#undef clEnqueueUnmapMemObject
+#undef clEnqueueNDRangeKernel
+#undef clEnqueueTask
+#undef clGetExtensionFunctionAddressForPlatform
+#undef clGetExtensionFunctionAddress
+#undef clUnloadCompiler
+
+#if defined(_WIN32)
+#define RM_MOCKCL_API extern "C" __declspec(dllexport)
+#else
+#define RM_MOCKCL_API extern "C" __attribute__((visibility("default")))
+#endif
+
+// OpenCL objects. The handle types are pointers to these.
+struct _cl_platform_id {};
+
+struct _cl_device_id {
+  cl_device_type type;
+};
+
+struct MockObject {
+  std::atomic<unsigned int> refs{1};
+};
+
+struct _cl_context : MockObject {};
+
+struct _cl_command_queue : MockObject {
+  cl_context context;
+  cl_command_queue_properties properties;
+};
+
+struct _cl_mem : MockObject {
+  cl_context context;
+  cl_mem_flags flags;
+  size_t size;
+  char *data;
+  void *host_ptr;   // CL_MEM_USE_HOST_PTR
+  bool owns_data;
+  std::atomic<unsigned int> map_count{0};
+};
+
+struct _cl_sampler : MockObject {
+  cl_context context;
+  cl_bool normalized_coords;
+  cl_addressing_mode addressing_mode;
+  cl_filter_mode filter_mode;
+};
+
+struct _cl_program : MockObject {
+  cl_context context;
+  std::string source;
+  std::string options;
+  cl_build_status build_status = CL_BUILD_NONE;
+  std::string build_log;
+  std::vector<std::string> kernel_names;  // declared in `source`
+};
+
+struct HostKernelEntry {
+  std::vector<std::string> options;  // normalized
+  cl_uint num_args;
+  cl_rm_host_kernel kernel;
+  void *user_data;
+};
+
+struct MockKernelArg {
+  bool set = false;
+  std::vector<char> value;
+  cl_mem mem = nullptr;  // when the argument is a buffer
+};
+
+struct _cl_kernel : MockObject {
+  cl_program program;
+  std::string name;
+  HostKernelEntry host;
+  std::vector<MockKernelArg> args;
+};
+
+struct EventCallback {
+  cl_int type;
+  void(CL_CALLBACK *fn)(cl_event, cl_int, void *);
+  void *user_data;
+};
+
+struct _cl_event : MockObject {
+  cl_context context;
+  cl_command_queue queue;  // nullptr for user events
+  cl_command_type command_type;
+  cl_int status;
+  cl_ulong queued = 0, submit = 0, start = 0, end = 0;
+  std::vector<EventCallback> callbacks;
+};
+
+namespace {
+
+using rainbowmist::mock::BestMatch;
+using rainbowmist::mock::KernelNamesInSource;
+using rainbowmist::NormalizeBuildOptions;
+
+// NOTE(LTE): Objects are not validated, like in most OpenCL drivers, except
+// buffers, since `clSetKernelArg` has to tell them from other 8 byte values.
+struct MockState {
+  std::mutex mutex;
+  std::condition_variable event_cv;
+  std::unordered_set<cl_mem> buffers;
+  std::unordered_map<std::string, std::vector<HostKernelEntry>> kernels;
+};
+
+MockState &State() {
+  static MockState *state = new MockState();  // never destroyed
+  return *state;
+}
+
+_cl_platform_id g_platform;
+
+_cl_device_id &Device() {
+  static _cl_device_id device = []() {
+    _cl_device_id d;
+    const char *type = getenv("RAINBOWMIST_MOCKCL_DEVICE_TYPE");
+    d.type = (type && strcmp(type, "cpu") == 0) ? CL_DEVICE_TYPE_CPU
+                                                : CL_DEVICE_TYPE_GPU;
+    return d;
+  }();
+  return device;
+}
+
+const char *kPlatformExtensions = CL_RM_HOST_KERNELS_EXTENSION_NAME;
+const char *kDeviceExtensions = "cl_khr_byte_addressable_store";
+
+cl_ulong NowNs() {
+  return static_cast<cl_ulong>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+void SetError(cl_int *errcode_ret, cl_int err) {
+  if (errcode_ret) {
+    *errcode_ret = err;
+  }
+}
+
+// Answers a clGetXxxInfo query with `size` bytes at `src`.
+cl_int Info(const void *src, size_t size, size_t param_value_size,
+            void *param_value, size_t *param_value_size_ret) {
+  if (param_value) {
+    if (param_value_size < size) {
+      return CL_INVALID_VALUE;
+    }
+    memcpy(param_value, src, size);
+  }
+  if (param_value_size_ret) {
+    *param_value_size_ret = size;
+  }
+  return CL_SUCCESS;
+}
+
+template <class T>
+cl_int InfoValue(T value, size_t param_value_size, void *param_value,
+                 size_t *param_value_size_ret) {
+  return Info(&value, sizeof(T), param_value_size, param_value,
+              param_value_size_ret);
+}
+
+cl_int InfoString(const std::string &s, size_t param_value_size,
+                  void *param_value, size_t *param_value_size_ret) {
+  return Info(s.c_str(), s.size() + 1, param_value_size, param_value,
+              param_value_size_ret);
+}
+
+template <class T>
+void Retain(T *obj) {
+  obj->refs++;
+}
+
+// Returns true when that was the last reference.
+template <class T>
+bool Release(T *obj) {
+  return --obj->refs == 0;
+}
+
+// The registered kernel whose options are all in `program_options`, preferring
+// the most specific one.
+bool FindHostKernel(const std::string &name, const std::string &program_options,
+                    HostKernelEntry *entry) {
+  std::vector<std::string> have = NormalizeBuildOptions(program_options);
+
+  MockState &state = State();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  auto it = state.kernels.find(name);
+  if (it == state.kernels.end()) {
+    return false;
+  }
+  const HostKernelEntry *best = BestMatch(it->second, have);
+  if (!best) {
+    return false;
+  }
+  *entry = *best;
+  return true;
+}
+
+cl_event NewEvent(cl_context context, cl_command_queue queue,
+                  cl_command_type type, cl_int status) {
+  cl_event ev = new _cl_event();
+  ev->context = context;
+  ev->queue = queue;
+  ev->command_type = type;
+  ev->status = status;
+  return ev;
+}
+
+cl_int WaitList(cl_uint num_events, const cl_event *events) {
+  if ((num_events == 0) != (events == nullptr)) {
+    return CL_INVALID_EVENT_WAIT_LIST;
+  }
+  MockState &state = State();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  for (cl_uint i = 0; i < num_events; i++) {
+    if (events[i] == nullptr) {
+      return CL_INVALID_EVENT_WAIT_LIST;
+    }
+    if (events[i]->status < 0) {
+      return CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST;
+    }
+    // Commands run when they are enqueued, so they cannot wait for a user
+    // event to be set later.
+    if (events[i]->status != CL_COMPLETE) {
+      return CL_INVALID_OPERATION;
+    }
+  }
+  return CL_SUCCESS;
+}
+
+void RunCallbacks(cl_event ev, cl_int status) {
+  std::vector<EventCallback> due;
+  {
+    std::lock_guard<std::mutex> lock(State().mutex);
+    auto it = std::partition(ev->callbacks.begin(), ev->callbacks.end(),
+                             [status](const EventCallback &cb) {
+                               return status > cb.type;
+                             });
+    due.assign(it, ev->callbacks.end());
+    ev->callbacks.erase(it, ev->callbacks.end());
+  }
+  for (const EventCallback &cb : due) {
+    cb.fn(ev, status, cb.user_data);
+  }
+}
+
+///
+/// Runs one command of `queue`: checks the wait list, calls `command`, and
+/// returns a completed event with timestamps in `event`(if not NULL).
+///
+template <class F>
+cl_int RunCommand(cl_command_queue queue, cl_command_type type,
+                  cl_uint num_events, const cl_event *wait_list,
+                  cl_event *event, F command) {
+  if (queue == nullptr) {
+    return CL_INVALID_COMMAND_QUEUE;
+  }
+  cl_int err = WaitList(num_events, wait_list);
+  if (err != CL_SUCCESS) {
+    return err;
+  }
+  cl_ulong queued = NowNs();
+  err = command();
+  cl_ulong end = NowNs();
+  if (err != CL_SUCCESS) {
+    return err;
+  }
+  if (event) {
+    cl_event ev = NewEvent(queue->context, queue, type, CL_COMPLETE);
+    ev->queued = ev->submit = ev->start = queued;
+    ev->end = end;
+    *event = ev;
+  }
+  return CL_SUCCESS;
+}
+
+cl_int CheckRange(cl_mem buffer, size_t offset, size_t size) {
+  if (buffer == nullptr) {
+    return CL_INVALID_MEM_OBJECT;
+  }
+  if (offset > buffer->size || size > buffer->size - offset) {
+    return CL_INVALID_VALUE;
+  }
+  return CL_SUCCESS;
+}
+
+char *AllocateBuffer(size_t size) {
+  // 128 byte aligned, like CL_DEVICE_MEM_BASE_ADDR_ALIGN.
+  size = std::max<size_t>(size, 1);
+#if defined(_WIN32)
+  return static_cast<char *>(_aligned_malloc(size, 128));
+#else
+  void *p = nullptr;
+  return (posix_memalign(&p, 128, size) == 0) ? static_cast<char *>(p)
+                                              : nullptr;
+#endif
+}
+
+void FreeBuffer(char *p) {
+#if defined(_WIN32)
+  _aligned_free(p);
+#else
+  free(p);
+#endif
+}
+
+}  // namespace
+
+// ---------------------------------------------------------------------------
+// Platform and device
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clGetPlatformIDs(cl_uint num_entries, cl_platform_id *platforms,
+                 cl_uint *num_platforms) {
+  if ((num_entries == 0 && platforms) || (!platforms && !num_platforms)) {
+    return CL_INVALID_VALUE;
+  }
+  if (platforms) {
+    platforms[0] = &g_platform;
+  }
+  if (num_platforms) {
+    *num_platforms = 1;
+  }
+  return CL_SUCCESS;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clGetPlatformInfo(cl_platform_id platform, cl_platform_info param_name,
+                  size_t param_value_size, void *param_value,
+                  size_t *param_value_size_ret) {
+  if (platform != nullptr && platform != &g_platform) {
+    return CL_INVALID_PLATFORM;
+  }
+  const char *s = nullptr;
+  switch (param_name) {
+    case CL_PLATFORM_PROFILE:
+      s = "FULL_PROFILE";
+      break;
+    case CL_PLATFORM_VERSION:
+      s = "OpenCL 1.2 RainbowMist mock";
+      break;
+    case CL_PLATFORM_NAME:
+      s = "RainbowMist mock OpenCL";
+      break;
+    case CL_PLATFORM_VENDOR:
+      s = "RainbowMist";
+      break;
+    case CL_PLATFORM_EXTENSIONS:
+      s = kPlatformExtensions;
+      break;
+    default:
+      return CL_INVALID_VALUE;
+  }
+  return InfoString(s, param_value_size, param_value, param_value_size_ret);
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clGetDeviceIDs(cl_platform_id platform, cl_device_type device_type,
+               cl_uint num_entries, cl_device_id *devices,
+               cl_uint *num_devices) {
+  if (platform != nullptr && platform != &g_platform) {
+    return CL_INVALID_PLATFORM;
+  }
+  if ((num_entries == 0 && devices) || (!devices && !num_devices)) {
+    return CL_INVALID_VALUE;
+  }
+  bool match = device_type == CL_DEVICE_TYPE_DEFAULT ||
+               (device_type & Device().type) != 0;
+  if (num_devices) {
+    *num_devices = match ? 1 : 0;
+  }
+  if (!match) {
+    return CL_DEVICE_NOT_FOUND;
+  }
+  if (devices) {
+    devices[0] = &Device();
+  }
+  return CL_SUCCESS;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clGetDeviceInfo(cl_device_id device, cl_device_info param_name,
+                size_t param_value_size, void *param_value,
+                size_t *param_value_size_ret) {
+  if (device != &Device()) {
+    return CL_INVALID_DEVICE;
+  }
+  size_t ps = param_value_size;
+  void *pv = param_value;
+  size_t *pr = param_value_size_ret;
+  const cl_uint compute_units =
+      std::max(1u, std::thread::hardware_concurrency());
+
+  switch (param_name) {
+    case CL_DEVICE_TYPE:
+      return InfoValue<cl_device_type>(device->type, ps, pv, pr);
+    case CL_DEVICE_VENDOR_ID:
+      return InfoValue<cl_uint>(0, ps, pv, pr);
+    case CL_DEVICE_MAX_COMPUTE_UNITS:
+      return InfoValue<cl_uint>(compute_units, ps, pv, pr);
+    case CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS:
+      return InfoValue<cl_uint>(3, ps, pv, pr);
+    case CL_DEVICE_MAX_WORK_ITEM_SIZES: {
+      size_t sizes[3] = {1024, 1024, 1024};
+      return Info(sizes, sizeof(sizes), ps, pv, pr);
+    }
+    case CL_DEVICE_MAX_WORK_GROUP_SIZE:
+      return InfoValue<size_t>(1024, ps, pv, pr);
+    case CL_DEVICE_PREFERRED_VECTOR_WIDTH_CHAR:
+    case CL_DEVICE_PREFERRED_VECTOR_WIDTH_SHORT:
+    case CL_DEVICE_PREFERRED_VECTOR_WIDTH_INT:
+    case CL_DEVICE_PREFERRED_VECTOR_WIDTH_LONG:
+    case CL_DEVICE_PREFERRED_VECTOR_WIDTH_FLOAT:
+    case CL_DEVICE_PREFERRED_VECTOR_WIDTH_DOUBLE:
+    case CL_DEVICE_NATIVE_VECTOR_WIDTH_CHAR:
+    case CL_DEVICE_NATIVE_VECTOR_WIDTH_SHORT:
+    case CL_DEVICE_NATIVE_VECTOR_WIDTH_INT:
+    case CL_DEVICE_NATIVE_VECTOR_WIDTH_LONG:
+    case CL_DEVICE_NATIVE_VECTOR_WIDTH_FLOAT:
+    case CL_DEVICE_NATIVE_VECTOR_WIDTH_DOUBLE:
+      return InfoValue<cl_uint>(1, ps, pv, pr);
+    case CL_DEVICE_PREFERRED_VECTOR_WIDTH_HALF:
+    case CL_DEVICE_NATIVE_VECTOR_WIDTH_HALF:
+      return InfoValue<cl_uint>(0, ps, pv, pr);
+    case CL_DEVICE_MAX_CLOCK_FREQUENCY:
+      return InfoValue<cl_uint>(1000, ps, pv, pr);
+    case CL_DEVICE_ADDRESS_BITS:
+      return InfoValue<cl_uint>(sizeof(void *) * 8, ps, pv, pr);
+    case CL_DEVICE_MAX_MEM_ALLOC_SIZE:
+      return InfoValue<cl_ulong>(cl_ulong(1) << 30, ps, pv, pr);
+    case CL_DEVICE_GLOBAL_MEM_SIZE:
+      return InfoValue<cl_ulong>(cl_ulong(4) << 30, ps, pv, pr);
+    case CL_DEVICE_GLOBAL_MEM_CACHE_TYPE:
+      return InfoValue<cl_device_mem_cache_type>(CL_READ_WRITE_CACHE, ps, pv,
+                                                 pr);
+    case CL_DEVICE_GLOBAL_MEM_CACHELINE_SIZE:
+      return InfoValue<cl_uint>(64, ps, pv, pr);
+    case CL_DEVICE_GLOBAL_MEM_CACHE_SIZE:
+      return InfoValue<cl_ulong>(cl_ulong(1) << 20, ps, pv, pr);
+    case CL_DEVICE_MAX_CONSTANT_BUFFER_SIZE:
+      return InfoValue<cl_ulong>(65536, ps, pv, pr);
+    case CL_DEVICE_MAX_CONSTANT_ARGS:
+      return InfoValue<cl_uint>(8, ps, pv, pr);
+    case CL_DEVICE_LOCAL_MEM_TYPE:
+      return InfoValue<cl_device_local_mem_type>(CL_GLOBAL, ps, pv, pr);
+    case CL_DEVICE_LOCAL_MEM_SIZE:
+      return InfoValue<cl_ulong>(32768, ps, pv, pr);
+    case CL_DEVICE_IMAGE_SUPPORT:
+    case CL_DEVICE_ERROR_CORRECTION_SUPPORT:
+      return InfoValue<cl_bool>(CL_FALSE, ps, pv, pr);
+    case CL_DEVICE_MAX_READ_IMAGE_ARGS:
+    case CL_DEVICE_MAX_WRITE_IMAGE_ARGS:
+    case CL_DEVICE_MAX_SAMPLERS:
+      return InfoValue<cl_uint>(0, ps, pv, pr);
+    case CL_DEVICE_IMAGE2D_MAX_WIDTH:
+    case CL_DEVICE_IMAGE2D_MAX_HEIGHT:
+    case CL_DEVICE_IMAGE3D_MAX_WIDTH:
+    case CL_DEVICE_IMAGE3D_MAX_HEIGHT:
+    case CL_DEVICE_IMAGE3D_MAX_DEPTH:
+    case CL_DEVICE_IMAGE_MAX_BUFFER_SIZE:
+    case CL_DEVICE_IMAGE_MAX_ARRAY_SIZE:
+      return InfoValue<size_t>(0, ps, pv, pr);
+    case CL_DEVICE_MAX_PARAMETER_SIZE:
+      return InfoValue<size_t>(1024, ps, pv, pr);
+    case CL_DEVICE_MEM_BASE_ADDR_ALIGN:
+      return InfoValue<cl_uint>(1024, ps, pv, pr);  // in bits
+    case CL_DEVICE_MIN_DATA_TYPE_ALIGN_SIZE:
+      return InfoValue<cl_uint>(128, ps, pv, pr);
+    case CL_DEVICE_SINGLE_FP_CONFIG:
+    case CL_DEVICE_DOUBLE_FP_CONFIG:
+      return InfoValue<cl_device_fp_config>(
+          CL_FP_DENORM | CL_FP_INF_NAN | CL_FP_ROUND_TO_NEAREST | CL_FP_FMA,
+          ps, pv, pr);
+    case CL_DEVICE_PROFILING_TIMER_RESOLUTION:
+      return InfoValue<size_t>(1, ps, pv, pr);
+    case CL_DEVICE_ENDIAN_LITTLE:
+    case CL_DEVICE_AVAILABLE:
+    case CL_DEVICE_COMPILER_AVAILABLE:
+    case CL_DEVICE_LINKER_AVAILABLE:
+    case CL_DEVICE_HOST_UNIFIED_MEMORY:
+    case CL_DEVICE_PREFERRED_INTEROP_USER_SYNC:
+      return InfoValue<cl_bool>(CL_TRUE, ps, pv, pr);
+    case CL_DEVICE_EXECUTION_CAPABILITIES:
+      return InfoValue<cl_device_exec_capabilities>(CL_EXEC_KERNEL, ps, pv,
+                                                    pr);
+    case CL_DEVICE_QUEUE_PROPERTIES:
+      return InfoValue<cl_command_queue_properties>(
+          CL_QUEUE_PROFILING_ENABLE, ps, pv, pr);
+    case CL_DEVICE_PLATFORM:
+      return InfoValue<cl_platform_id>(&g_platform, ps, pv, pr);
+    case CL_DEVICE_PARENT_DEVICE:
+      return InfoValue<cl_device_id>(nullptr, ps, pv, pr);
+    case CL_DEVICE_PARTITION_MAX_SUB_DEVICES:
+      return InfoValue<cl_uint>(0, ps, pv, pr);
+    case CL_DEVICE_REFERENCE_COUNT:
+      return InfoValue<cl_uint>(1, ps, pv, pr);
+    case CL_DEVICE_PRINTF_BUFFER_SIZE:
+      return InfoValue<size_t>(1 << 20, ps, pv, pr);
+    case CL_DEVICE_NAME:
+      return InfoString("RainbowMist mock device", ps, pv, pr);
+    case CL_DEVICE_VENDOR:
+      return InfoString("RainbowMist", ps, pv, pr);
+    case CL_DEVICE_PROFILE:
+      return InfoString("FULL_PROFILE", ps, pv, pr);
+    case CL_DEVICE_VERSION:
+      return InfoString("OpenCL 1.2 RainbowMist mock", ps, pv, pr);
+    case CL_DRIVER_VERSION:
+      return InfoString("1.0", ps, pv, pr);
+    case CL_DEVICE_OPENCL_C_VERSION:
+      return InfoString("OpenCL C 1.2", ps, pv, pr);
+    case CL_DEVICE_EXTENSIONS:
+      return InfoString(kDeviceExtensions, ps, pv, pr);
+    case CL_DEVICE_BUILT_IN_KERNELS:
+      return InfoString("", ps, pv, pr);
+    default:
+      return CL_INVALID_VALUE;
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Context
+
+RM_MOCKCL_API CL_API_ENTRY cl_context CL_API_CALL clCreateContext(
+    const cl_context_properties * /* properties */, cl_uint num_devices,
+    const cl_device_id *devices,
+    void(CL_CALLBACK * /* pfn_notify */)(const char *, const void *, size_t,
+                                         void *),
+    void * /* user_data */, cl_int *errcode_ret) {
+  if (num_devices == 0 || devices == nullptr) {
+    SetError(errcode_ret, CL_INVALID_VALUE);
+    return nullptr;
+  }
+  for (cl_uint i = 0; i < num_devices; i++) {
+    if (devices[i] != &Device()) {
+      SetError(errcode_ret, CL_INVALID_DEVICE);
+      return nullptr;
+    }
+  }
+  SetError(errcode_ret, CL_SUCCESS);
+  return new _cl_context();
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_context CL_API_CALL clCreateContextFromType(
+    const cl_context_properties *properties, cl_device_type device_type,
+    void(CL_CALLBACK *pfn_notify)(const char *, const void *, size_t, void *),
+    void *user_data, cl_int *errcode_ret) {
+  if (device_type != CL_DEVICE_TYPE_DEFAULT &&
+      (device_type & Device().type) == 0) {
+    SetError(errcode_ret, CL_DEVICE_NOT_FOUND);
+    return nullptr;
+  }
+  cl_device_id device = &Device();
+  return clCreateContext(properties, 1, &device, pfn_notify, user_data,
+                         errcode_ret);
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clRetainContext(cl_context context) {
+  if (context == nullptr) {
+    return CL_INVALID_CONTEXT;
+  }
+  Retain(context);
+  return CL_SUCCESS;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clReleaseContext(cl_context context) {
+  if (context == nullptr) {
+    return CL_INVALID_CONTEXT;
+  }
+  if (Release(context)) {
+    delete context;
+  }
+  return CL_SUCCESS;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clGetContextInfo(cl_context context, cl_context_info param_name,
+                 size_t param_value_size, void *param_value,
+                 size_t *param_value_size_ret) {
+  if (context == nullptr) {
+    return CL_INVALID_CONTEXT;
+  }
+  switch (param_name) {
+    case CL_CONTEXT_REFERENCE_COUNT:
+      return InfoValue<cl_uint>(context->refs, param_value_size, param_value,
+                                param_value_size_ret);
+    case CL_CONTEXT_NUM_DEVICES:
+      return InfoValue<cl_uint>(1, param_value_size, param_value,
+                                param_value_size_ret);
+    case CL_CONTEXT_DEVICES:
+      return InfoValue<cl_device_id>(&Device(), param_value_size, param_value,
+                                     param_value_size_ret);
+    case CL_CONTEXT_PROPERTIES:
+      return Info(nullptr, 0, param_value_size, param_value,
+                  param_value_size_ret);
+    default:
+      return CL_INVALID_VALUE;
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Command queue
+
+RM_MOCKCL_API CL_API_ENTRY cl_command_queue CL_API_CALL
+clCreateCommandQueue(cl_context context, cl_device_id device,
+                     cl_command_queue_properties properties,
+                     cl_int *errcode_ret) {
+  if (context == nullptr) {
+    SetError(errcode_ret, CL_INVALID_CONTEXT);
+    return nullptr;
+  }
+  if (device != &Device()) {
+    SetError(errcode_ret, CL_INVALID_DEVICE);
+    return nullptr;
+  }
+  // NOTE(LTE): Out-of-order queues are accepted, and run in order.
+  if (properties & ~cl_command_queue_properties(
+                       CL_QUEUE_PROFILING_ENABLE |
+                       CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE)) {
+    SetError(errcode_ret, CL_INVALID_VALUE);
+    return nullptr;
+  }
+  cl_command_queue queue = new _cl_command_queue();
+  queue->context = context;
+  queue->properties = properties;
+  Retain(context);
+  SetError(errcode_ret, CL_SUCCESS);
+  return queue;
+}
+
+// OpenCL 2.0; clpp11.h uses it when built against 2.0 headers.
+RM_MOCKCL_API CL_API_ENTRY cl_command_queue CL_API_CALL
+clCreateCommandQueueWithProperties(cl_context context, cl_device_id device,
+                                   const cl_bitfield *properties,
+                                   cl_int *errcode_ret) {
+  cl_command_queue_properties props = 0;
+  for (const cl_bitfield *p = properties; p && p[0] != 0; p += 2) {
+    if (p[0] != CL_QUEUE_PROPERTIES) {
+      SetError(errcode_ret, CL_INVALID_VALUE);
+      return nullptr;
+    }
+    props = p[1];
+  }
+  return clCreateCommandQueue(context, device, props, errcode_ret);
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clRetainCommandQueue(cl_command_queue queue) {
+  if (queue == nullptr) {
+    return CL_INVALID_COMMAND_QUEUE;
+  }
+  Retain(queue);
+  return CL_SUCCESS;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clReleaseCommandQueue(cl_command_queue queue) {
+  if (queue == nullptr) {
+    return CL_INVALID_COMMAND_QUEUE;
+  }
+  if (Release(queue)) {
+    clReleaseContext(queue->context);
+    delete queue;
+  }
+  return CL_SUCCESS;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clGetCommandQueueInfo(cl_command_queue queue, cl_command_queue_info param_name,
+                      size_t param_value_size, void *param_value,
+                      size_t *param_value_size_ret) {
+  if (queue == nullptr) {
+    return CL_INVALID_COMMAND_QUEUE;
+  }
+  switch (param_name) {
+    case CL_QUEUE_CONTEXT:
+      return InfoValue<cl_context>(queue->context, param_value_size,
+                                   param_value, param_value_size_ret);
+    case CL_QUEUE_DEVICE:
+      return InfoValue<cl_device_id>(&Device(), param_value_size, param_value,
+                                     param_value_size_ret);
+    case CL_QUEUE_REFERENCE_COUNT:
+      return InfoValue<cl_uint>(queue->refs, param_value_size, param_value,
+                                param_value_size_ret);
+    case CL_QUEUE_PROPERTIES:
+      return InfoValue<cl_command_queue_properties>(
+          queue->properties, param_value_size, param_value,
+          param_value_size_ret);
+    default:
+      return CL_INVALID_VALUE;
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Memory objects
+
+RM_MOCKCL_API CL_API_ENTRY cl_mem CL_API_CALL
+clCreateBuffer(cl_context context, cl_mem_flags flags, size_t size,
+               void *host_ptr, cl_int *errcode_ret) {
+  if (context == nullptr) {
+    SetError(errcode_ret, CL_INVALID_CONTEXT);
+    return nullptr;
+  }
+  if (size == 0) {
+    SetError(errcode_ret, CL_INVALID_BUFFER_SIZE);
+    return nullptr;
+  }
+  bool use_host = (flags & CL_MEM_USE_HOST_PTR) != 0;
+  bool copy_host = (flags & CL_MEM_COPY_HOST_PTR) != 0;
+  if ((use_host || copy_host) != (host_ptr != nullptr) ||
+      (use_host && (copy_host || (flags & CL_MEM_ALLOC_HOST_PTR)))) {
+    SetError(errcode_ret, CL_INVALID_HOST_PTR);
+    return nullptr;
+  }
+
+  cl_mem mem = new _cl_mem();
+  mem->context = context;
+  mem->flags = flags;
+  mem->size = size;
+  mem->host_ptr = use_host ? host_ptr : nullptr;
+  mem->owns_data = !use_host;
+  mem->data = use_host ? static_cast<char *>(host_ptr) : AllocateBuffer(size);
+  if (mem->data == nullptr) {
+    delete mem;
+    SetError(errcode_ret, CL_MEM_OBJECT_ALLOCATION_FAILURE);
+    return nullptr;
+  }
+  if (copy_host) {
+    memcpy(mem->data, host_ptr, size);
+  }
+  Retain(context);
+  {
+    std::lock_guard<std::mutex> lock(State().mutex);
+    State().buffers.insert(mem);
+  }
+  SetError(errcode_ret, CL_SUCCESS);
+  return mem;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_mem CL_API_CALL
+clCreateImage(cl_context /* context */, cl_mem_flags /* flags */,
+              const cl_image_format * /* image_format */,
+              const cl_image_desc * /* image_desc */, void * /* host_ptr */,
+              cl_int *errcode_ret) {
+  SetError(errcode_ret, CL_INVALID_OPERATION);  // CL_DEVICE_IMAGE_SUPPORT
+  return nullptr;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL clRetainMemObject(cl_mem mem) {
+  if (mem == nullptr) {
+    return CL_INVALID_MEM_OBJECT;
+  }
+  Retain(mem);
+  return CL_SUCCESS;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL clReleaseMemObject(cl_mem mem) {
+  if (mem == nullptr) {
+    return CL_INVALID_MEM_OBJECT;
+  }
+  if (Release(mem)) {
+    {
+      std::lock_guard<std::mutex> lock(State().mutex);
+      State().buffers.erase(mem);
+    }
+    if (mem->owns_data) {
+      FreeBuffer(mem->data);
+    }
+    clReleaseContext(mem->context);
+    delete mem;
+  }
+  return CL_SUCCESS;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clGetMemObjectInfo(cl_mem mem, cl_mem_info param_name, size_t param_value_size,
+                   void *param_value, size_t *param_value_size_ret) {
+  if (mem == nullptr) {
+    return CL_INVALID_MEM_OBJECT;
+  }
+  size_t ps = param_value_size;
+  void *pv = param_value;
+  size_t *pr = param_value_size_ret;
+  switch (param_name) {
+    case CL_MEM_TYPE:
+      return InfoValue<cl_mem_object_type>(CL_MEM_OBJECT_BUFFER, ps, pv, pr);
+    case CL_MEM_FLAGS:
+      return InfoValue<cl_mem_flags>(mem->flags, ps, pv, pr);
+    case CL_MEM_SIZE:
+      return InfoValue<size_t>(mem->size, ps, pv, pr);
+    case CL_MEM_HOST_PTR:
+      return InfoValue<void *>(mem->host_ptr, ps, pv, pr);
+    case CL_MEM_MAP_COUNT:
+      return InfoValue<cl_uint>(mem->map_count, ps, pv, pr);
+    case CL_MEM_REFERENCE_COUNT:
+      return InfoValue<cl_uint>(mem->refs, ps, pv, pr);
+    case CL_MEM_CONTEXT:
+      return InfoValue<cl_context>(mem->context, ps, pv, pr);
+    case CL_MEM_ASSOCIATED_MEMOBJECT:
+      return InfoValue<cl_mem>(nullptr, ps, pv, pr);
+    case CL_MEM_OFFSET:
+      return InfoValue<size_t>(0, ps, pv, pr);
+    default:
+      return CL_INVALID_VALUE;
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Sampler(host code creates them up front; no kernel can use them)
+
+RM_MOCKCL_API CL_API_ENTRY cl_sampler CL_API_CALL
+clCreateSampler(cl_context context, cl_bool normalized_coords,
+                cl_addressing_mode addressing_mode, cl_filter_mode filter_mode,
+                cl_int *errcode_ret) {
+  if (context == nullptr) {
+    SetError(errcode_ret, CL_INVALID_CONTEXT);
+    return nullptr;
+  }
+  cl_sampler sampler = new _cl_sampler();
+  sampler->context = context;
+  sampler->normalized_coords = normalized_coords;
+  sampler->addressing_mode = addressing_mode;
+  sampler->filter_mode = filter_mode;
+  Retain(context);
+  SetError(errcode_ret, CL_SUCCESS);
+  return sampler;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clRetainSampler(cl_sampler sampler) {
+  if (sampler == nullptr) {
+    return CL_INVALID_SAMPLER;
+  }
+  Retain(sampler);
+  return CL_SUCCESS;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clReleaseSampler(cl_sampler sampler) {
+  if (sampler == nullptr) {
+    return CL_INVALID_SAMPLER;
+  }
+  if (Release(sampler)) {
+    clReleaseContext(sampler->context);
+    delete sampler;
+  }
+  return CL_SUCCESS;
+}
+
+// ---------------------------------------------------------------------------
+// Program
+
+RM_MOCKCL_API CL_API_ENTRY cl_program CL_API_CALL
+clCreateProgramWithSource(cl_context context, cl_uint count,
+                          const char **strings, const size_t *lengths,
+                          cl_int *errcode_ret) {
+  if (context == nullptr) {
+    SetError(errcode_ret, CL_INVALID_CONTEXT);
+    return nullptr;
+  }
+  if (count == 0 || strings == nullptr) {
+    SetError(errcode_ret, CL_INVALID_VALUE);
+    return nullptr;
+  }
+  cl_program program = new _cl_program();
+  program->context = context;
+  for (cl_uint i = 0; i < count; i++) {
+    if (strings[i] == nullptr) {
+      delete program;
+      SetError(errcode_ret, CL_INVALID_VALUE);
+      return nullptr;
+    }
+    if (lengths && lengths[i] != 0) {
+      program->source.append(strings[i], lengths[i]);
+    } else {
+      program->source.append(strings[i]);
+    }
+  }
+  Retain(context);
+  SetError(errcode_ret, CL_SUCCESS);
+  return program;
+}
+
+// The "binary" of a mock program is its source(see CL_PROGRAM_BINARIES).
+RM_MOCKCL_API CL_API_ENTRY cl_program CL_API_CALL clCreateProgramWithBinary(
+    cl_context context, cl_uint num_devices, const cl_device_id *device_list,
+    const size_t *lengths, const unsigned char **binaries,
+    cl_int *binary_status, cl_int *errcode_ret) {
+  if (num_devices != 1 || device_list == nullptr ||
+      device_list[0] != &Device()) {
+    SetError(errcode_ret, CL_INVALID_DEVICE);
+    return nullptr;
+  }
+  if (lengths == nullptr || binaries == nullptr || binaries[0] == nullptr ||
+      lengths[0] == 0) {
+    if (binary_status) {
+      binary_status[0] = CL_INVALID_VALUE;
+    }
+    SetError(errcode_ret, CL_INVALID_VALUE);
+    return nullptr;
+  }
+  const char *source = reinterpret_cast<const char *>(binaries[0]);
+  cl_program program =
+      clCreateProgramWithSource(context, 1, &source, lengths, errcode_ret);
+  if (binary_status) {
+    binary_status[0] = program ? CL_SUCCESS : CL_INVALID_BINARY;
+  }
+  return program;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clRetainProgram(cl_program program) {
+  if (program == nullptr) {
+    return CL_INVALID_PROGRAM;
+  }
+  Retain(program);
+  return CL_SUCCESS;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clReleaseProgram(cl_program program) {
+  if (program == nullptr) {
+    return CL_INVALID_PROGRAM;
+  }
+  if (Release(program)) {
+    clReleaseContext(program->context);
+    delete program;
+  }
+  return CL_SUCCESS;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL clBuildProgram(
+    cl_program program, cl_uint num_devices, const cl_device_id *device_list,
+    const char *options,
+    void(CL_CALLBACK *pfn_notify)(cl_program, void *), void *user_data) {
+  if (program == nullptr) {
+    return CL_INVALID_PROGRAM;
+  }
+  if ((num_devices == 0) != (device_list == nullptr)) {
+    return CL_INVALID_VALUE;
+  }
+  for (cl_uint i = 0; i < num_devices; i++) {
+    if (device_list[i] != &Device()) {
+      return CL_INVALID_DEVICE;
+    }
+  }
+
+  program->options = options ? options : "";
+  program->kernel_names = KernelNamesInSource(program->source);
+
+  std::ostringstream log;
+  for (const std::string &name : program->kernel_names) {
+    HostKernelEntry entry;
+    if (!FindHostKernel(name, program->options, &entry)) {
+      log << "warning: no host kernel registered for `" << name
+          << "` with options \"" << program->options << "\"\n";
+    }
+  }
+  program->build_log = log.str();
+  program->build_status = CL_BUILD_SUCCESS;
+
+  if (pfn_notify) {
+    pfn_notify(program, user_data);
+  }
+  return CL_SUCCESS;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clGetProgramInfo(cl_program program, cl_program_info param_name,
+                 size_t param_value_size, void *param_value,
+                 size_t *param_value_size_ret) {
+  if (program == nullptr) {
+    return CL_INVALID_PROGRAM;
+  }
+  size_t ps = param_value_size;
+  void *pv = param_value;
+  size_t *pr = param_value_size_ret;
+  switch (param_name) {
+    case CL_PROGRAM_REFERENCE_COUNT:
+      return InfoValue<cl_uint>(program->refs, ps, pv, pr);
+    case CL_PROGRAM_CONTEXT:
+      return InfoValue<cl_context>(program->context, ps, pv, pr);
+    case CL_PROGRAM_NUM_DEVICES:
+      return InfoValue<cl_uint>(1, ps, pv, pr);
+    case CL_PROGRAM_DEVICES:
+      return InfoValue<cl_device_id>(&Device(), ps, pv, pr);
+    case CL_PROGRAM_SOURCE:
+      return InfoString(program->source, ps, pv, pr);
+    case CL_PROGRAM_BINARY_SIZES:
+      return InfoValue<size_t>(program->source.size(), ps, pv, pr);
+    case CL_PROGRAM_BINARIES: {
+      if (pv) {
+        if (ps < sizeof(unsigned char *)) {
+          return CL_INVALID_VALUE;
+        }
+        unsigned char *dst = static_cast<unsigned char **>(pv)[0];
+        if (dst) {
+          memcpy(dst, program->source.data(), program->source.size());
+        }
+      }
+      if (pr) {
+        *pr = sizeof(unsigned char *);
+      }
+      return CL_SUCCESS;
+    }
+    case CL_PROGRAM_NUM_KERNELS:
+    case CL_PROGRAM_KERNEL_NAMES: {
+      if (program->build_status != CL_BUILD_SUCCESS) {
+        return CL_INVALID_PROGRAM_EXECUTABLE;
+      }
+      if (param_name == CL_PROGRAM_NUM_KERNELS) {
+        return InfoValue<size_t>(program->kernel_names.size(), ps, pv, pr);
+      }
+      std::string names;
+      for (const std::string &name : program->kernel_names) {
+        names += (names.empty() ? "" : ";") + name;
+      }
+      return InfoString(names, ps, pv, pr);
+    }
+    default:
+      return CL_INVALID_VALUE;
+  }
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL clGetProgramBuildInfo(
+    cl_program program, cl_device_id device, cl_program_build_info param_name,
+    size_t param_value_size, void *param_value, size_t *param_value_size_ret) {
+  if (program == nullptr) {
+    return CL_INVALID_PROGRAM;
+  }
+  if (device != &Device()) {
+    return CL_INVALID_DEVICE;
+  }
+  switch (param_name) {
+    case CL_PROGRAM_BUILD_STATUS:
+      return InfoValue<cl_build_status>(program->build_status,
+                                        param_value_size, param_value,
+                                        param_value_size_ret);
+    case CL_PROGRAM_BUILD_OPTIONS:
+      return InfoString(program->options, param_value_size, param_value,
+                        param_value_size_ret);
+    case CL_PROGRAM_BUILD_LOG:
+      return InfoString(program->build_log, param_value_size, param_value,
+                        param_value_size_ret);
+    default:
+      return CL_INVALID_VALUE;
+  }
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL clUnloadCompiler(void) {
+  return CL_SUCCESS;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clUnloadPlatformCompiler(cl_platform_id /* platform */) {
+  return CL_SUCCESS;
+}
+
+// ---------------------------------------------------------------------------
+// Kernel
+
+RM_MOCKCL_API CL_API_ENTRY cl_kernel CL_API_CALL
+clCreateKernel(cl_program program, const char *kernel_name,
+               cl_int *errcode_ret) {
+  if (program == nullptr) {
+    SetError(errcode_ret, CL_INVALID_PROGRAM);
+    return nullptr;
+  }
+  if (program->build_status != CL_BUILD_SUCCESS) {
+    SetError(errcode_ret, CL_INVALID_PROGRAM_EXECUTABLE);
+    return nullptr;
+  }
+  if (kernel_name == nullptr) {
+    SetError(errcode_ret, CL_INVALID_VALUE);
+    return nullptr;
+  }
+  HostKernelEntry entry;
+  if (std::find(program->kernel_names.begin(), program->kernel_names.end(),
+                kernel_name) == program->kernel_names.end() ||
+      !FindHostKernel(kernel_name, program->options, &entry)) {
+    SetError(errcode_ret, CL_INVALID_KERNEL_NAME);
+    return nullptr;
+  }
+
+  cl_kernel kernel = new _cl_kernel();
+  kernel->program = program;
+  kernel->name = kernel_name;
+  kernel->host = entry;
+  kernel->args.resize(entry.num_args);
+  Retain(program);
+  SetError(errcode_ret, CL_SUCCESS);
+  return kernel;
+}
+
+// Kernels without a registered host kernel are left out.
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clCreateKernelsInProgram(cl_program program, cl_uint num_kernels,
+                         cl_kernel *kernels, cl_uint *num_kernels_ret) {
+  if (program == nullptr) {
+    return CL_INVALID_PROGRAM;
+  }
+  if (program->build_status != CL_BUILD_SUCCESS) {
+    return CL_INVALID_PROGRAM_EXECUTABLE;
+  }
+  std::vector<std::string> names;
+  for (const std::string &name : program->kernel_names) {
+    HostKernelEntry entry;
+    if (FindHostKernel(name, program->options, &entry)) {
+      names.push_back(name);
+    }
+  }
+  if (kernels && num_kernels < names.size()) {
+    return CL_INVALID_VALUE;
+  }
+  if (kernels) {
+    for (size_t i = 0; i < names.size(); i++) {
+      kernels[i] = clCreateKernel(program, names[i].c_str(), nullptr);
+    }
+  }
+  if (num_kernels_ret) {
+    *num_kernels_ret = static_cast<cl_uint>(names.size());
+  }
+  return CL_SUCCESS;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clRetainKernel(cl_kernel kernel) {
+  if (kernel == nullptr) {
+    return CL_INVALID_KERNEL;
+  }
+  Retain(kernel);
+  return CL_SUCCESS;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clReleaseKernel(cl_kernel kernel) {
+  if (kernel == nullptr) {
+    return CL_INVALID_KERNEL;
+  }
+  if (Release(kernel)) {
+    clReleaseProgram(kernel->program);
+    delete kernel;
+  }
+  return CL_SUCCESS;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clSetKernelArg(cl_kernel kernel, cl_uint arg_index, size_t arg_size,
+               const void *arg_value) {
+  if (kernel == nullptr) {
+    return CL_INVALID_KERNEL;
+  }
+  if (arg_index >= kernel->args.size()) {
+    return CL_INVALID_ARG_INDEX;
+  }
+  // No `__local` arguments: there is no work-group shared memory on the host.
+  if (arg_value == nullptr) {
+    return CL_INVALID_ARG_VALUE;
+  }
+
+  MockKernelArg &arg = kernel->args[arg_index];
+  arg.mem = nullptr;
+  if (arg_size == sizeof(cl_mem)) {
+    cl_mem mem = *static_cast<const cl_mem *>(arg_value);
+    std::lock_guard<std::mutex> lock(State().mutex);
+    if (State().buffers.count(mem)) {
+      arg.mem = mem;
+    }
+  }
+  const char *p = static_cast<const char *>(arg_value);
+  arg.value.assign(p, p + arg_size);
+  arg.set = true;
+  return CL_SUCCESS;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clGetKernelInfo(cl_kernel kernel, cl_kernel_info param_name,
+                size_t param_value_size, void *param_value,
+                size_t *param_value_size_ret) {
+  if (kernel == nullptr) {
+    return CL_INVALID_KERNEL;
+  }
+  size_t ps = param_value_size;
+  void *pv = param_value;
+  size_t *pr = param_value_size_ret;
+  switch (param_name) {
+    case CL_KERNEL_FUNCTION_NAME:
+      return InfoString(kernel->name, ps, pv, pr);
+    case CL_KERNEL_NUM_ARGS:
+      return InfoValue<cl_uint>(static_cast<cl_uint>(kernel->args.size()), ps,
+                                pv, pr);
+    case CL_KERNEL_REFERENCE_COUNT:
+      return InfoValue<cl_uint>(kernel->refs, ps, pv, pr);
+    case CL_KERNEL_CONTEXT:
+      return InfoValue<cl_context>(kernel->program->context, ps, pv, pr);
+    case CL_KERNEL_PROGRAM:
+      return InfoValue<cl_program>(kernel->program, ps, pv, pr);
+    case CL_KERNEL_ATTRIBUTES:
+      return InfoString("", ps, pv, pr);
+    default:
+      return CL_INVALID_VALUE;
+  }
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL clGetKernelWorkGroupInfo(
+    cl_kernel kernel, cl_device_id device, cl_kernel_work_group_info param_name,
+    size_t param_value_size, void *param_value, size_t *param_value_size_ret) {
+  if (kernel == nullptr) {
+    return CL_INVALID_KERNEL;
+  }
+  if (device != nullptr && device != &Device()) {
+    return CL_INVALID_DEVICE;
+  }
+  size_t ps = param_value_size;
+  void *pv = param_value;
+  size_t *pr = param_value_size_ret;
+  switch (param_name) {
+    case CL_KERNEL_WORK_GROUP_SIZE:
+      return InfoValue<size_t>(1024, ps, pv, pr);
+    case CL_KERNEL_COMPILE_WORK_GROUP_SIZE: {
+      size_t sizes[3] = {0, 0, 0};
+      return Info(sizes, sizeof(sizes), ps, pv, pr);
+    }
+    case CL_KERNEL_LOCAL_MEM_SIZE:
+    case CL_KERNEL_PRIVATE_MEM_SIZE:
+      return InfoValue<cl_ulong>(0, ps, pv, pr);
+    case CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE:
+      return InfoValue<size_t>(1, ps, pv, pr);
+    default:
+      return CL_INVALID_VALUE;
+  }
+}
+
+// ---------------------------------------------------------------------------
+// Events
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clWaitForEvents(cl_uint num_events, const cl_event *event_list) {
+  if (num_events == 0 || event_list == nullptr) {
+    return CL_INVALID_VALUE;
+  }
+  MockState &state = State();
+  std::unique_lock<std::mutex> lock(state.mutex);
+  bool failed = false;
+  for (cl_uint i = 0; i < num_events; i++) {
+    cl_event ev = event_list[i];
+    if (ev == nullptr) {
+      return CL_INVALID_EVENT;
+    }
+    // Only user events can be pending.
+    state.event_cv.wait(lock, [ev]() { return ev->status <= CL_COMPLETE; });
+    failed |= ev->status < 0;
+  }
+  return failed ? CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST : CL_SUCCESS;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clGetEventInfo(cl_event event, cl_event_info param_name,
+               size_t param_value_size, void *param_value,
+               size_t *param_value_size_ret) {
+  if (event == nullptr) {
+    return CL_INVALID_EVENT;
+  }
+  size_t ps = param_value_size;
+  void *pv = param_value;
+  size_t *pr = param_value_size_ret;
+  switch (param_name) {
+    case CL_EVENT_COMMAND_QUEUE:
+      return InfoValue<cl_command_queue>(event->queue, ps, pv, pr);
+    case CL_EVENT_CONTEXT:
+      return InfoValue<cl_context>(event->context, ps, pv, pr);
+    case CL_EVENT_COMMAND_TYPE:
+      return InfoValue<cl_command_type>(event->command_type, ps, pv, pr);
+    case CL_EVENT_COMMAND_EXECUTION_STATUS: {
+      std::lock_guard<std::mutex> lock(State().mutex);
+      return InfoValue<cl_int>(event->status, ps, pv, pr);
+    }
+    case CL_EVENT_REFERENCE_COUNT:
+      return InfoValue<cl_uint>(event->refs, ps, pv, pr);
+    default:
+      return CL_INVALID_VALUE;
+  }
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_event CL_API_CALL
+clCreateUserEvent(cl_context context, cl_int *errcode_ret) {
+  if (context == nullptr) {
+    SetError(errcode_ret, CL_INVALID_CONTEXT);
+    return nullptr;
+  }
+  cl_event ev = NewEvent(context, nullptr, CL_COMMAND_USER, CL_SUBMITTED);
+  ev->queued = ev->submit = NowNs();
+  SetError(errcode_ret, CL_SUCCESS);
+  return ev;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL clRetainEvent(cl_event event) {
+  if (event == nullptr) {
+    return CL_INVALID_EVENT;
+  }
+  Retain(event);
+  return CL_SUCCESS;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL clReleaseEvent(cl_event event) {
+  if (event == nullptr) {
+    return CL_INVALID_EVENT;
+  }
+  if (Release(event)) {
+    delete event;
+  }
+  return CL_SUCCESS;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clSetUserEventStatus(cl_event event, cl_int execution_status) {
+  if (event == nullptr || event->command_type != CL_COMMAND_USER) {
+    return CL_INVALID_EVENT;
+  }
+  if (execution_status > CL_COMPLETE) {
+    return CL_INVALID_VALUE;
+  }
+  {
+    std::lock_guard<std::mutex> lock(State().mutex);
+    if (event->status <= CL_COMPLETE) {
+      return CL_INVALID_OPERATION;  // already set
+    }
+    event->status = execution_status;
+    event->start = event->end = NowNs();
+  }
+  State().event_cv.notify_all();
+  RunCallbacks(event, execution_status);
+  return CL_SUCCESS;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL clSetEventCallback(
+    cl_event event, cl_int command_exec_callback_type,
+    void(CL_CALLBACK *pfn_notify)(cl_event, cl_int, void *), void *user_data) {
+  if (event == nullptr) {
+    return CL_INVALID_EVENT;
+  }
+  if (pfn_notify == nullptr ||
+      (command_exec_callback_type != CL_SUBMITTED &&
+       command_exec_callback_type != CL_RUNNING &&
+       command_exec_callback_type != CL_COMPLETE)) {
+    return CL_INVALID_VALUE;
+  }
+  cl_int status;
+  {
+    std::lock_guard<std::mutex> lock(State().mutex);
+    EventCallback cb = {command_exec_callback_type, pfn_notify, user_data};
+    event->callbacks.push_back(cb);
+    status = event->status;
+  }
+  RunCallbacks(event, status);  // if already reached
+  return CL_SUCCESS;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL clGetEventProfilingInfo(
+    cl_event event, cl_profiling_info param_name, size_t param_value_size,
+    void *param_value, size_t *param_value_size_ret) {
+  if (event == nullptr) {
+    return CL_INVALID_EVENT;
+  }
+  if (event->queue == nullptr ||
+      !(event->queue->properties & CL_QUEUE_PROFILING_ENABLE)) {
+    return CL_PROFILING_INFO_NOT_AVAILABLE;
+  }
+  cl_ulong t;
+  switch (param_name) {
+    case CL_PROFILING_COMMAND_QUEUED:
+      t = event->queued;
+      break;
+    case CL_PROFILING_COMMAND_SUBMIT:
+      t = event->submit;
+      break;
+    case CL_PROFILING_COMMAND_START:
+      t = event->start;
+      break;
+    case CL_PROFILING_COMMAND_END:
+      t = event->end;
+      break;
+    default:
+      return CL_INVALID_VALUE;
+  }
+  return InfoValue<cl_ulong>(t, param_value_size, param_value,
+                             param_value_size_ret);
+}
+
+// ---------------------------------------------------------------------------
+// Commands. Each one has finished when its clEnqueueXxx returns.
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL clFlush(cl_command_queue queue) {
+  return queue ? CL_SUCCESS : CL_INVALID_COMMAND_QUEUE;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL
+clFinish(cl_command_queue queue) {
+  return queue ? CL_SUCCESS : CL_INVALID_COMMAND_QUEUE;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL clEnqueueReadBuffer(
+    cl_command_queue queue, cl_mem buffer, cl_bool /* blocking_read */,
+    size_t offset, size_t size, void *ptr, cl_uint num_events_in_wait_list,
+    const cl_event *event_wait_list, cl_event *event) {
+  return RunCommand(queue, CL_COMMAND_READ_BUFFER, num_events_in_wait_list,
+                    event_wait_list, event, [&]() {
+                      cl_int err = CheckRange(buffer, offset, size);
+                      if (err == CL_SUCCESS) {
+                        if (ptr == nullptr) {
+                          return CL_INVALID_VALUE;
+                        }
+                        memcpy(ptr, buffer->data + offset, size);
+                      }
+                      return err;
+                    });
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL clEnqueueWriteBuffer(
+    cl_command_queue queue, cl_mem buffer, cl_bool /* blocking_write */,
+    size_t offset, size_t size, const void *ptr,
+    cl_uint num_events_in_wait_list, const cl_event *event_wait_list,
+    cl_event *event) {
+  return RunCommand(queue, CL_COMMAND_WRITE_BUFFER, num_events_in_wait_list,
+                    event_wait_list, event, [&]() {
+                      cl_int err = CheckRange(buffer, offset, size);
+                      if (err == CL_SUCCESS) {
+                        if (ptr == nullptr) {
+                          return CL_INVALID_VALUE;
+                        }
+                        memcpy(buffer->data + offset, ptr, size);
+                      }
+                      return err;
+                    });
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL clEnqueueCopyBuffer(
+    cl_command_queue queue, cl_mem src_buffer, cl_mem dst_buffer,
+    size_t src_offset, size_t dst_offset, size_t size,
+    cl_uint num_events_in_wait_list, const cl_event *event_wait_list,
+    cl_event *event) {
+  return RunCommand(queue, CL_COMMAND_COPY_BUFFER, num_events_in_wait_list,
+                    event_wait_list, event, [&]() {
+                      cl_int err = CheckRange(src_buffer, src_offset, size);
+                      if (err == CL_SUCCESS) {
+                        err = CheckRange(dst_buffer, dst_offset, size);
+                      }
+                      if (err == CL_SUCCESS) {
+                        memmove(dst_buffer->data + dst_offset,
+                                src_buffer->data + src_offset, size);
+                      }
+                      return err;
+                    });
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL clEnqueueFillBuffer(
+    cl_command_queue queue, cl_mem buffer, const void *pattern,
+    size_t pattern_size, size_t offset, size_t size,
+    cl_uint num_events_in_wait_list, const cl_event *event_wait_list,
+    cl_event *event) {
+  return RunCommand(
+      queue, CL_COMMAND_FILL_BUFFER, num_events_in_wait_list, event_wait_list,
+      event, [&]() {
+        cl_int err = CheckRange(buffer, offset, size);
+        if (err != CL_SUCCESS) {
+          return err;
+        }
+        if (pattern == nullptr || pattern_size == 0 ||
+            offset % pattern_size != 0 || size % pattern_size != 0) {
+          return CL_INVALID_VALUE;
+        }
+        for (size_t i = 0; i < size; i += pattern_size) {
+          memcpy(buffer->data + offset + i, pattern, pattern_size);
+        }
+        return CL_SUCCESS;
+      });
+}
+
+// Buffers live in host memory, so mapping returns them directly.
+RM_MOCKCL_API CL_API_ENTRY void *CL_API_CALL clEnqueueMapBuffer(
+    cl_command_queue queue, cl_mem buffer, cl_bool /* blocking_map */,
+    cl_map_flags /* map_flags */, size_t offset, size_t size,
+    cl_uint num_events_in_wait_list, const cl_event *event_wait_list,
+    cl_event *event, cl_int *errcode_ret) {
+  void *mapped = nullptr;
+  cl_int err = RunCommand(queue, CL_COMMAND_MAP_BUFFER,
+                          num_events_in_wait_list, event_wait_list, event,
+                          [&]() {
+                            cl_int e = CheckRange(buffer, offset, size);
+                            if (e == CL_SUCCESS) {
+                              mapped = buffer->data + offset;
+                              buffer->map_count++;
+                            }
+                            return e;
+                          });
+  SetError(errcode_ret, err);
+  return mapped;
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL clEnqueueUnmapMemObject(
+    cl_command_queue queue, cl_mem memobj, void *mapped_ptr,
+    cl_uint num_events_in_wait_list, const cl_event *event_wait_list,
+    cl_event *event) {
+  return RunCommand(queue, CL_COMMAND_UNMAP_MEM_OBJECT,
+                    num_events_in_wait_list, event_wait_list, event, [&]() {
+                      if (memobj == nullptr) {
+                        return CL_INVALID_MEM_OBJECT;
+                      }
+                      char *p = static_cast<char *>(mapped_ptr);
+                      if (memobj->map_count == 0 || p < memobj->data ||
+                          p > memobj->data + memobj->size) {
+                        return CL_INVALID_VALUE;
+                      }
+                      memobj->map_count--;
+                      return CL_SUCCESS;
+                    });
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL clEnqueueNDRangeKernel(
+    cl_command_queue queue, cl_kernel kernel, cl_uint work_dim,
+    const size_t *global_work_offset, const size_t *global_work_size,
+    const size_t *local_work_size, cl_uint num_events_in_wait_list,
+    const cl_event *event_wait_list, cl_event *event) {
+  if (kernel == nullptr) {
+    return CL_INVALID_KERNEL;
+  }
+  if (work_dim < 1 || work_dim > 3) {
+    return CL_INVALID_WORK_DIMENSION;
+  }
+  if (global_work_size == nullptr) {
+    return CL_INVALID_GLOBAL_WORK_SIZE;
+  }
+  for (cl_uint d = 0; d < work_dim; d++) {
+    if (global_work_size[d] == 0) {
+      return CL_INVALID_GLOBAL_WORK_SIZE;
+    }
+    // `rainbowmist::LaunchKernel` has no global offset.
+    if (global_work_offset && global_work_offset[d] != 0) {
+      return CL_INVALID_GLOBAL_OFFSET;
+    }
+    if (local_work_size &&
+        (local_work_size[d] == 0 ||
+         global_work_size[d] % local_work_size[d] != 0)) {
+      return CL_INVALID_WORK_GROUP_SIZE;
+    }
+  }
+
+  std::vector<cl_rm_kernel_arg> args(kernel->args.size());
+  for (size_t i = 0; i < args.size(); i++) {
+    const MockKernelArg &a = kernel->args[i];
+    if (!a.set) {
+      return CL_INVALID_KERNEL_ARGS;
+    }
+    args[i].value = a.value.data();
+    args[i].size = a.value.size();
+    args[i].buffer = a.mem ? a.mem->data : nullptr;
+    args[i].buffer_size = a.mem ? a.mem->size : 0;
+  }
+
+  const HostKernelEntry &host = kernel->host;
+  return RunCommand(queue, CL_COMMAND_NDRANGE_KERNEL, num_events_in_wait_list,
+                    event_wait_list, event, [&]() {
+                      return host.kernel(host.user_data, args.data(),
+                                         static_cast<cl_uint>(args.size()),
+                                         work_dim, global_work_size);
+                    });
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL clEnqueueTask(
+    cl_command_queue queue, cl_kernel kernel, cl_uint num_events_in_wait_list,
+    const cl_event *event_wait_list, cl_event *event) {
+  size_t one = 1;
+  return clEnqueueNDRangeKernel(queue, kernel, 1, nullptr, &one, &one,
+                                num_events_in_wait_list, event_wait_list,
+                                event);
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL clEnqueueMarkerWithWaitList(
+    cl_command_queue queue, cl_uint num_events_in_wait_list,
+    const cl_event *event_wait_list, cl_event *event) {
+  return RunCommand(queue, CL_COMMAND_MARKER, num_events_in_wait_list,
+                    event_wait_list, event, []() { return CL_SUCCESS; });
+}
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL clEnqueueBarrierWithWaitList(
+    cl_command_queue queue, cl_uint num_events_in_wait_list,
+    const cl_event *event_wait_list, cl_event *event) {
+  return RunCommand(queue, CL_COMMAND_BARRIER, num_events_in_wait_list,
+                    event_wait_list, event, []() { return CL_SUCCESS; });
+}
+
+// ---------------------------------------------------------------------------
+// cl_rm_host_kernels
+
+RM_MOCKCL_API CL_API_ENTRY cl_int CL_API_CALL clRegisterHostKernelRM(
+    cl_platform_id platform, const char *kernel_name, const char *options,
+    cl_uint num_args, cl_rm_host_kernel kernel, void *user_data) {
+  if (platform != &g_platform) {
+    return CL_INVALID_PLATFORM;
+  }
+  if (kernel_name == nullptr || kernel_name[0] == '\0' || kernel == nullptr) {
+    return CL_INVALID_VALUE;
+  }
+  HostKernelEntry entry;
+  entry.options = NormalizeBuildOptions(options ? options : "");
+  entry.num_args = num_args;
+  entry.kernel = kernel;
+  entry.user_data = user_data;
+
+  MockState &state = State();
+  std::lock_guard<std::mutex> lock(state.mutex);
+  std::vector<HostKernelEntry> &entries = state.kernels[kernel_name];
+  for (HostKernelEntry &e : entries) {
+    if (e.options == entry.options) {
+      e = entry;
+      return CL_SUCCESS;
+    }
+  }
+  entries.push_back(entry);
+  return CL_SUCCESS;
+}
+
+RM_MOCKCL_API CL_API_ENTRY void *CL_API_CALL
+clGetExtensionFunctionAddressForPlatform(cl_platform_id platform,
+                                         const char *func_name) {
+  if (platform != &g_platform || func_name == nullptr) {
+    return nullptr;
+  }
+  if (strcmp(func_name, "clRegisterHostKernelRM") == 0) {
+    return reinterpret_cast<void *>(&clRegisterHostKernelRM);
+  }
+  return nullptr;
+}
+
+RM_MOCKCL_API CL_API_ENTRY void *CL_API_CALL
+clGetExtensionFunctionAddress(const char *func_name) {
+  return clGetExtensionFunctionAddressForPlatform(&g_platform, func_name);
+}
+
+// The entry points clew also knows must match its prototypes.
+#define RM_MOCKCL_CHECK(fn, pfn) (void)static_cast<pfn>(&fn)
+
+struct PrototypeCheck {
+  static void Check() {
+    RM_MOCKCL_CHECK(clGetPlatformIDs, PFNCLGETPLATFORMIDS);
+    RM_MOCKCL_CHECK(clGetPlatformInfo, PFNCLGETPLATFORMINFO);
+    RM_MOCKCL_CHECK(clGetDeviceIDs, PFNCLGETDEVICEIDS);
+    RM_MOCKCL_CHECK(clGetDeviceInfo, PFNCLGETDEVICEINFO);
+    RM_MOCKCL_CHECK(clCreateContext, PFNCLCREATECONTEXT);
+    RM_MOCKCL_CHECK(clCreateContextFromType, PFNCLCREATECONTEXTFROMTYPE);
+    RM_MOCKCL_CHECK(clRetainContext, PFNCLRETAINCONTEXT);
+    RM_MOCKCL_CHECK(clReleaseContext, PFNCLRELEASECONTEXT);
+    RM_MOCKCL_CHECK(clGetContextInfo, PFNCLGETCONTEXTINFO);
+    RM_MOCKCL_CHECK(clCreateCommandQueue, PFNCLCREATECOMMANDQUEUE);
+    RM_MOCKCL_CHECK(clRetainCommandQueue, PFNCLRETAINCOMMANDQUEUE);
+    RM_MOCKCL_CHECK(clReleaseCommandQueue, PFNCLRELEASECOMMANDQUEUE);
+    RM_MOCKCL_CHECK(clGetCommandQueueInfo, PFNCLGETCOMMANDQUEUEINFO);
+    RM_MOCKCL_CHECK(clCreateBuffer, PFNCLCREATEBUFFER);
+    RM_MOCKCL_CHECK(clCreateImage, PFNCLCREATEIMAGE);
+    RM_MOCKCL_CHECK(clRetainMemObject, PFNCLRETAINMEMOBJECT);
+    RM_MOCKCL_CHECK(clReleaseMemObject, PFNCLRELEASEMEMOBJECT);
+    RM_MOCKCL_CHECK(clGetMemObjectInfo, PFNCLGETMEMOBJECTINFO);
+    RM_MOCKCL_CHECK(clCreateSampler, PFNCLCREATESAMPLER);
+    RM_MOCKCL_CHECK(clRetainSampler, PFNCLRETAINSAMPLER);
+    RM_MOCKCL_CHECK(clReleaseSampler, PFNCLRELEASESAMPLER);
+    RM_MOCKCL_CHECK(clCreateProgramWithSource, PFNCLCREATEPROGRAMWITHSOURCE);
+    RM_MOCKCL_CHECK(clCreateProgramWithBinary, PFNCLCREATEPROGRAMWITHBINARY);
+    RM_MOCKCL_CHECK(clRetainProgram, PFNCLRETAINPROGRAM);
+    RM_MOCKCL_CHECK(clReleaseProgram, PFNCLRELEASEPROGRAM);
+    RM_MOCKCL_CHECK(clBuildProgram, PFNCLBUILDPROGRAM);
+    RM_MOCKCL_CHECK(clGetProgramInfo, PFNCLGETPROGRAMINFO);
+    RM_MOCKCL_CHECK(clGetProgramBuildInfo, PFNCLGETPROGRAMBUILDINFO);
+    RM_MOCKCL_CHECK(clCreateKernel, PFNCLCREATEKERNEL);
+    RM_MOCKCL_CHECK(clCreateKernelsInProgram, PFNCLCREATEKERNELSINPROGRAM);
+    RM_MOCKCL_CHECK(clRetainKernel, PFNCLRETAINKERNEL);
+    RM_MOCKCL_CHECK(clReleaseKernel, PFNCLRELEASEKERNEL);
+    RM_MOCKCL_CHECK(clSetKernelArg, PFNCLSETKERNELARG);
+    RM_MOCKCL_CHECK(clGetKernelInfo, PFNCLGETKERNELINFO);
+    RM_MOCKCL_CHECK(clGetKernelWorkGroupInfo, PFNCLGETKERNELWORKGROUPINFO);
+    RM_MOCKCL_CHECK(clWaitForEvents, PFNCLWAITFOREVENTS);
+    RM_MOCKCL_CHECK(clGetEventInfo, PFNCLGETEVENTINFO);
+    RM_MOCKCL_CHECK(clCreateUserEvent, PFNCLCREATEUSEREVENT);
+    RM_MOCKCL_CHECK(clRetainEvent, PFNCLRETAINEVENT);
+    RM_MOCKCL_CHECK(clReleaseEvent, PFNCLRELEASEEVENT);
+    RM_MOCKCL_CHECK(clSetUserEventStatus, PFNCLSETUSEREVENTSTATUS);
+    RM_MOCKCL_CHECK(clSetEventCallback, PFNCLSETEVENTCALLBACK);
+    RM_MOCKCL_CHECK(clGetEventProfilingInfo, PFNCLGETEVENTPROFILINGINFO);
+    RM_MOCKCL_CHECK(clFlush, PFNCLFLUSH);
+    RM_MOCKCL_CHECK(clFinish, PFNCLFINISH);
+    RM_MOCKCL_CHECK(clEnqueueReadBuffer, PFNCLENQUEUEREADBUFFER);
+    RM_MOCKCL_CHECK(clEnqueueWriteBuffer, PFNCLENQUEUEWRITEBUFFER);
+    RM_MOCKCL_CHECK(clEnqueueCopyBuffer, PFNCLENQUEUECOPYBUFFER);
+    RM_MOCKCL_CHECK(clEnqueueMapBuffer, PFNCLENQUEUEMAPBUFFER);
+    RM_MOCKCL_CHECK(clEnqueueUnmapMemObject, PFNCLENQUEUEUNMAPMEMOBJECT);
+    RM_MOCKCL_CHECK(clEnqueueNDRangeKernel, PFNCLENQUEUENDRANGEKERNEL);
+    RM_MOCKCL_CHECK(clEnqueueTask, PFNCLENQUEUETASK);
+    RM_MOCKCL_CHECK(clGetExtensionFunctionAddressForPlatform,
+                    PFNCLGETEXTENSIONFUNCTIONADDRESSFORPLATFORM);
+    RM_MOCKCL_CHECK(clRegisterHostKernelRM, clRegisterHostKernelRM_fn);
+  }
+};
@@ -0,0 +1,210 @@
+#ifndef RAINBOWMIST_MOCK_OPENCL_H_
+#define RAINBOWMIST_MOCK_OPENCL_H_
+
+//
+// CPU-backed stand-in for the OpenCL runtime.
+//
+// mock_opencl.cc builds into a shared library named like the real one
+// (libOpenCL.so / OpenCL.dll), which implements the OpenCL 1.2 entry points
+// used by EasyCL and clpp11.h: one platform with one device, buffers in host
+// memory, and in-order queues that run each command before returning, with
+// profiling timestamps. clew loads it from LD_LIBRARY_PATH like any other
+// libOpenCL, and clpp11.h programs can link against it.
+//
+// The mock does not compile OpenCL C. `clBuildProgram` only finds the kernel
+// declarations in the source, and `clEnqueueNDRangeKernel` runs the
+// host-compiled kernel of the same name with the C++11 backend
+// (`rainbowmist::LaunchKernel`). The host hands over the kernels in
+// `rainbowmist::KernelRegistry`(rainbowmist_registry.h) through the
+// `cl_rm_host_kernels` platform extension:
+//
+//   #include "EasyCL.h"  // or CL/cl.h; the OpenCL types must come first
+//   #include "simple_add.kernel"  // RM_REGISTER_KERNEL(simple_add_vec2)
+//   #include "mock/mock_opencl.h"
+//
+//   rainbowmist::mockcl::RegisterKernels();
+//
+// Variants registered with `RM_REGISTER_KERNEL_VARIANT` are picked by the
+// program build options. `RegisterKernels` returns false(and does nothing)
+// on a real OpenCL platform, so the same host code runs on both.
+//
+// Limitations: no images, no `__local` kernel arguments, no global work
+// offset, and a command waiting on an incomplete user event fails with
+// CL_INVALID_OPERATION instead of blocking the queue. The device reports
+// CL_DEVICE_TYPE_GPU, so `EasyCL::createForFirstGpu` finds it; set
+// RAINBOWMIST_MOCKCL_DEVICE_TYPE=cpu to make it a CPU device instead.
+//
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 - 2020 Light Transport Entertainment, Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#define CL_RM_HOST_KERNELS_EXTENSION_NAME "cl_rm_host_kernels"
+
+// One kernel argument, as set with `clSetKernelArg`.
+typedef struct _cl_rm_kernel_arg {
+  const void *value;   // Argument bytes(the cl_mem handle for a buffer).
+  size_t size;         // `arg_size`
+  void *buffer;        // Host storage of the buffer argument, or NULL.
+  size_t buffer_size;  // Size of `buffer` in bytes.
+} cl_rm_kernel_arg;
+
+// Runs a kernel over `global_work_size`(`work_dim` entries). Returns
+// CL_SUCCESS, or an OpenCL error code(e.g. CL_INVALID_KERNEL_ARGS).
+typedef cl_int(CL_CALLBACK *cl_rm_host_kernel)(void *user_data,
+                                               const cl_rm_kernel_arg *args,
+                                               cl_uint num_args,
+                                               cl_uint work_dim,
+                                               const size_t *global_work_size);
+
+// `clRegisterHostKernelRM`, from `clGetExtensionFunctionAddressForPlatform`.
+// Registers `kernel` for kernels named `kernel_name` in programs built with
+// every option in `options`(e.g. "-D TILE=4"); with several matches the one
+// with the most options wins. Registering the same name and options again
+// replaces the kernel.
+typedef CL_API_ENTRY cl_int(CL_API_CALL *clRegisterHostKernelRM_fn)(
+    cl_platform_id platform, const char *kernel_name, const char *options,
+    cl_uint num_args, cl_rm_host_kernel kernel, void *user_data);
+
+#if defined(__cplusplus) && defined(RAINBOWMIST_CPP11)
+
+#include <string>
+#include <vector>
+
+#include "rainbowmist_registry.h"
+
+namespace rainbowmist {
+namespace mockcl {
+
+namespace detail {
+
+// `cl_rm_host_kernel` for a registered kernel(`user_data`).
+inline cl_int CL_CALLBACK RunRegisteredKernel(void *user_data,
+                                              const cl_rm_kernel_arg *args,
+                                              cl_uint num_args,
+                                              cl_uint work_dim,
+                                              const size_t *global_work_size) {
+  const KernelInfo *info = static_cast<const KernelInfo *>(user_data);
+  if (num_args != info->args.size()) {
+    return CL_INVALID_KERNEL_ARGS;
+  }
+
+  // Buffer arguments are passed as their host pointers.
+  std::vector<void *> buffers(num_args);
+  std::vector<const void *> values(num_args);
+  for (cl_uint i = 0; i < num_args; i++) {
+    if (info->args[i].kind == kKernelArgBuffer) {
+      if (args[i].buffer == nullptr) {
+        return CL_INVALID_KERNEL_ARGS;
+      }
+      buffers[i] = args[i].buffer;
+      values[i] = &buffers[i];
+    } else {
+      if (args[i].buffer != nullptr || args[i].size != info->args[i].size) {
+        return CL_INVALID_KERNEL_ARGS;
+      }
+      values[i] = args[i].value;
+    }
+  }
+
+  unsigned int size[3] = {1, 1, 1};
+  for (cl_uint d = 0; d < work_dim; d++) {
+    size[d] = static_cast<unsigned int>(global_work_size[d]);
+    if (size[d] != global_work_size[d]) {
+      return CL_INVALID_GLOBAL_WORK_SIZE;
+    }
+  }
+
+  info->Launch(values.data(), size[0], size[1], size[2]);
+  return CL_SUCCESS;
+}
+
+inline std::vector<cl_platform_id> MockPlatforms() {
+  std::vector<cl_platform_id> mocks;
+  cl_uint num_platforms = 0;
+  if (clGetPlatformIDs(0, nullptr, &num_platforms) != CL_SUCCESS ||
+      num_platforms == 0) {
+    return mocks;
+  }
+  std::vector<cl_platform_id> platforms(num_platforms);
+  clGetPlatformIDs(num_platforms, platforms.data(), nullptr);
+
+  for (cl_platform_id platform : platforms) {
+    size_t size = 0;
+    if (clGetPlatformInfo(platform, CL_PLATFORM_EXTENSIONS, 0, nullptr,
+                          &size) != CL_SUCCESS) {
+      continue;
+    }
+    std::string extensions(size, '\0');
+    clGetPlatformInfo(platform, CL_PLATFORM_EXTENSIONS, size, &extensions[0],
+                      nullptr);
+    if (extensions.find(CL_RM_HOST_KERNELS_EXTENSION_NAME) !=
+        std::string::npos) {
+      mocks.push_back(platform);
+    }
+  }
+  return mocks;
+}
+
+}  // namespace detail
+
+/// True when an OpenCL platform is the mock runtime.
+inline bool Available() { return !detail::MockPlatforms().empty(); }
+
+///
+/// Registers the registered kernel `info` on every mock platform, under its
+/// name and options. Returns false when there is no mock platform.
+///
+inline bool RegisterKernel(const KernelInfo &info) {
+  bool registered = false;
+  for (cl_platform_id platform : detail::MockPlatforms()) {
+    clRegisterHostKernelRM_fn fn = reinterpret_cast<clRegisterHostKernelRM_fn>(
+        clGetExtensionFunctionAddressForPlatform(platform,
+                                                 "clRegisterHostKernelRM"));
+    if (fn != nullptr &&
+        fn(platform, info.name.c_str(), info.options.c_str(),
+           static_cast<cl_uint>(info.args.size()), &detail::RunRegisteredKernel,
+           const_cast<KernelInfo *>(&info)) == CL_SUCCESS) {
+      registered = true;
+    }
+  }
+  return registered;
+}
+
+/// Registers every kernel in `KernelRegistry`. Returns false when there is no
+/// mock platform.
+inline bool RegisterKernels() {
+  if (!Available()) {
+    return false;
+  }
+  for (const KernelInfo *info : KernelRegistry::Get().Kernels()) {
+    RegisterKernel(*info);
+  }
+  return true;
+}
+
+}  // namespace mockcl
+}  // namespace rainbowmist
+
+#endif  // __cplusplus && RAINBOWMIST_CPP11
+
+#endif  // RAINBOWMIST_MOCK_OPENCL_H_
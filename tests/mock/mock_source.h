@@ -0,0 +1,112 @@
+#ifndef RAINBOWMIST_MOCK_SOURCE_H_
+#define RAINBOWMIST_MOCK_SOURCE_H_
+
+//
+// Source and build option handling shared by the mock runtimes
+// (mock_opencl.cc, mock_cuda.cc, mock_nvrtc.cc). Internal; not for host code.
+// Build options are normalized like the kernel registry does
+// (rainbowmist_options.h), so variants match the same way on both sides.
+//
+/*
+The MIT License (MIT)
+
+Copyright (c) 2017 - 2020 Light Transport Entertainment, Inc.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#include <algorithm>
+#include <cctype>
+#include <string>
+#include <vector>
+
+#include "rainbowmist_options.h"
+
+namespace rainbowmist {
+namespace mock {
+
+// First line of the "PTX" emitted by mock_nvrtc.cc. mock_cuda.cc only loads
+// PTX that starts with it.
+const char kPTXHeader[] = "// Generated by the RainbowMist mock NVRTC\n";
+
+inline bool IsIdentChar(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '_';
+}
+
+// Finds `kernel void name(`, `__kernel void name(`, `__global__ void name(`
+// and `RM_KERNEL void name(`.
+inline std::vector<std::string> KernelNamesInSource(const std::string &source) {
+  std::vector<std::string> names;
+  std::vector<std::string> tokens;
+  size_t i = 0;
+  const size_t n = source.size();
+  while (i < n) {
+    char c = source[i];
+    if (c == '/' && i + 1 < n && source[i + 1] == '/') {
+      i = source.find('\n', i);
+      i = (i == std::string::npos) ? n : i;
+      continue;
+    }
+    if (c == '/' && i + 1 < n && source[i + 1] == '*') {
+      i = source.find("*/", i + 2);
+      i = (i == std::string::npos) ? n : i + 2;
+      continue;
+    }
+    if (IsIdentChar(c)) {
+      size_t begin = i;
+      while (i < n && IsIdentChar(source[i])) {
+        i++;
+      }
+      tokens.push_back(source.substr(begin, i - begin));
+      continue;
+    }
+    if (!isspace(static_cast<unsigned char>(c))) {
+      size_t t = tokens.size();
+      if (c == '(' && t >= 3 && tokens[t - 2] == "void" &&
+          (tokens[t - 3] == "kernel" || tokens[t - 3] == "__kernel" ||
+           tokens[t - 3] == "__global__" || tokens[t - 3] == "RM_KERNEL") &&
+          std::find(names.begin(), names.end(), tokens[t - 1]) ==
+              names.end()) {
+        names.push_back(tokens[t - 1]);
+      }
+      tokens.push_back(std::string(1, c));
+    }
+    i++;
+  }
+  return names;
+}
+
+// The entry of `entries` whose options are all in `have`(both normalized),
+// preferring the most specific one. nullptr when none matches.
+template <class Entry>
+inline const Entry *BestMatch(const std::vector<Entry> &entries,
+                              const std::vector<std::string> &have) {
+  auto best = BestMatchingBuildOptions(
+      entries.begin(), entries.end(), have,
+      [](const Entry &e) -> const std::vector<std::string> & {
+        return e.options;
+      });
+  return best == entries.end() ? nullptr : &*best;
+}
+
+}  // namespace mock
+}  // namespace rainbowmist
+
+#endif  // RAINBOWMIST_MOCK_SOURCE_H_
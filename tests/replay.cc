@@ -0,0 +1,548 @@
+// Replays a launch capture(rainbowmist_capture.h) in a loop and reports the
+// time of each launch.
+//
+//   replay [-b cpp11|opencl|cuda] [-s kernel_source] [-o build_options]
+//          [-n iterations] [-t threads] capture.rmcap
+//
+// cpp11 runs the kernels registered in this program(include yours below).
+// opencl and cuda build `kernel_source` with the captured options plus
+// `-o`(e.g. "-D OPENCL -I .."). The captured buffer contents are uploaded
+// before each iteration; only the launches are timed.
+//
+// Launches run in work-groups(blocks) of the captured width. Without one,
+// OpenCL picks its own, and CUDA uses the largest block(up to 256 threads)
+// that divides the range, since kernels are not expected to check it.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "clew.h"
+#include "cuew.h"
+
+// Kernels for the cpp11 backend(and the mock runtimes).
+#include "alignment.kernel"
+#include "simple_add.kernel"
+
+#include "rainbowmist_capture.h"
+
+#include "mock/mock_cuda.h"
+#include "mock/mock_opencl.h"
+
+namespace {
+
+struct Options {
+  std::string backend = "cpp11";
+  std::string source_file;
+  std::string build_options;
+  int iterations = 10;
+  unsigned int num_threads = 0;
+  std::string capture_file;
+};
+
+bool Fail(const std::string &message, std::string *err) {
+  *err = message;
+  return false;
+}
+
+bool ReadFile(const std::string &filename, std::string *out) {
+  std::ifstream ifs(filename.c_str(), std::ios::binary);
+  if (!ifs) {
+    return false;
+  }
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  *out = ss.str();
+  return true;
+}
+
+std::string BuildOptions(const rainbowmist::CapturedLaunch &launch,
+                         const Options &opts) {
+  if (opts.build_options.empty()) {
+    return launch.options;
+  }
+  return launch.options + " " + opts.build_options;
+}
+
+class Backend {
+ public:
+  virtual ~Backend() {}
+
+  // Prepares every launch of `file`(which outlives the backend).
+  virtual bool Init(const rainbowmist::CaptureFile &file, const Options &opts,
+                    std::string *err) = 0;
+
+  // Restores the captured buffer contents.
+  virtual bool Reset(std::string *err) = 0;
+
+  // Runs launch `i` and waits for it.
+  virtual bool Run(size_t i, std::string *err) = 0;
+};
+
+// ------------
+
+class HostBackend : public Backend {
+ public:
+  bool Init(const rainbowmist::CaptureFile &file, const Options &opts,
+            std::string *err) {
+    num_threads_ = opts.num_threads;
+    return replay_.Init(file, err);
+  }
+
+  bool Reset(std::string *) {
+    replay_.Reset();
+    return true;
+  }
+
+  bool Run(size_t i, std::string *) {
+    replay_.Run(i, num_threads_);
+    return true;
+  }
+
+ private:
+  rainbowmist::HostReplay replay_;
+  unsigned int num_threads_ = 0;
+};
+
+// ------------
+
+class OpenCLBackend : public Backend {
+ public:
+  ~OpenCLBackend() {
+    for (Launch &l : launches_) {
+      for (cl_mem mem : l.buffers) {
+        if (mem) {
+          clReleaseMemObject(mem);
+        }
+      }
+      clReleaseKernel(l.kernel);
+    }
+    for (auto &p : programs_) {
+      clReleaseProgram(p.second);
+    }
+    if (queue_) {
+      clReleaseCommandQueue(queue_);
+    }
+    if (context_) {
+      clReleaseContext(context_);
+    }
+  }
+
+  bool Init(const rainbowmist::CaptureFile &file, const Options &opts,
+            std::string *err) {
+    std::string source;
+    if (opts.source_file.empty() || !ReadFile(opts.source_file, &source)) {
+      return Fail("opencl needs a kernel source(-s)", err);
+    }
+    if (clewInit() != CLEW_SUCCESS) {
+      return Fail("OpenCL is not available", err);
+    }
+    cl_platform_id platform;
+    cl_device_id device;
+    cl_uint num_platforms = 0;
+    cl_int e = clGetPlatformIDs(1, &platform, &num_platforms);
+    if (e != CL_SUCCESS || num_platforms == 0 ||
+        clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 1, &device, nullptr) !=
+            CL_SUCCESS) {
+      return Fail("no OpenCL device", err);
+    }
+    context_ = clCreateContext(nullptr, 1, &device, nullptr, nullptr, &e);
+    if (e == CL_SUCCESS) {
+      queue_ = clCreateCommandQueue(context_, device, 0, &e);
+    }
+    if (e != CL_SUCCESS) {
+      return Fail("failed to create an OpenCL context", err);
+    }
+    if (rainbowmist::mockcl::RegisterKernels()) {
+      printf("Using the mock OpenCL runtime.\n");
+    }
+
+    const char *source_ptr = source.c_str();
+    for (size_t i = 0; i < file.size(); i++) {
+      Launch l;
+      l.captured = file.launch(i);
+      std::string options = BuildOptions(l.captured, opts);
+      cl_program &program = programs_[options];
+      if (!program) {
+        program = clCreateProgramWithSource(context_, 1, &source_ptr, nullptr,
+                                            &e);
+        if (e != CL_SUCCESS ||
+            clBuildProgram(program, 1, &device, options.c_str(), nullptr,
+                           nullptr) != CL_SUCCESS) {
+          size_t size = 0;
+          clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, 0,
+                                nullptr, &size);
+          std::string log(size, '\0');
+          clGetProgramBuildInfo(program, device, CL_PROGRAM_BUILD_LOG, size,
+                                &log[0], nullptr);
+          return Fail("failed to build " + opts.source_file + " with `" +
+                          options + "`:\n" + log,
+                      err);
+        }
+      }
+      l.kernel = clCreateKernel(program, l.captured.name.c_str(), &e);
+      if (e != CL_SUCCESS) {
+        return Fail("no kernel `" + l.captured.name + "`", err);
+      }
+      l.buffers.resize(l.captured.args.size(), nullptr);
+      for (size_t a = 0; a < l.captured.args.size(); a++) {
+        const rainbowmist::CaptureArg &arg = l.captured.args[a];
+        if (arg.kind == rainbowmist::kKernelArgBuffer) {
+          l.buffers[a] = clCreateBuffer(context_, CL_MEM_READ_WRITE,
+                                        std::max(arg.size, size_t(1)),
+                                        nullptr, &e);
+          if (e == CL_SUCCESS) {
+            e = clSetKernelArg(l.kernel, cl_uint(a), sizeof(cl_mem),
+                               &l.buffers[a]);
+          }
+        } else {
+          e = clSetKernelArg(l.kernel, cl_uint(a), arg.size, arg.data);
+        }
+        if (e != CL_SUCCESS) {
+          return Fail("failed to set argument " + std::to_string(a) + " of `" +
+                          l.captured.name + "`",
+                      err);
+        }
+      }
+      launches_.push_back(std::move(l));
+    }
+    return true;
+  }
+
+  bool Reset(std::string *err) {
+    for (Launch &l : launches_) {
+      for (size_t a = 0; a < l.buffers.size(); a++) {
+        const rainbowmist::CaptureArg &arg = l.captured.args[a];
+        if (l.buffers[a] && arg.size > 0 &&
+            clEnqueueWriteBuffer(queue_, l.buffers[a], CL_TRUE, 0, arg.size,
+                                 arg.data, 0, nullptr,
+                                 nullptr) != CL_SUCCESS) {
+          return Fail("failed to upload a buffer", err);
+        }
+      }
+    }
+    return true;
+  }
+
+  bool Run(size_t i, std::string *err) {
+    const Launch &l = launches_[i];
+    size_t global[3] = {l.captured.global[0], l.captured.global[1],
+                        l.captured.global[2]};
+    size_t local[3] = {l.captured.local_x, 1, 1};
+    cl_uint dims = global[2] > 1 ? 3 : (global[1] > 1 ? 2 : 1);
+    if (clEnqueueNDRangeKernel(queue_, l.kernel, dims, nullptr, global,
+                               l.captured.local_x ? local : nullptr, 0,
+                               nullptr, nullptr) != CL_SUCCESS ||
+        clFinish(queue_) != CL_SUCCESS) {
+      return Fail("failed to launch `" + l.captured.name + "`", err);
+    }
+    return true;
+  }
+
+ private:
+  struct Launch {
+    rainbowmist::CapturedLaunch captured;
+    cl_kernel kernel = nullptr;
+    std::vector<cl_mem> buffers;  // nullptr for scalars
+  };
+
+  cl_context context_ = nullptr;
+  cl_command_queue queue_ = nullptr;
+  std::map<std::string, cl_program> programs_;  // By build options
+  std::vector<Launch> launches_;
+};
+
+// ------------
+
+class CUDABackend : public Backend {
+ public:
+  ~CUDABackend() {
+    for (Launch &l : launches_) {
+      for (CUdeviceptr ptr : l.buffers) {
+        if (ptr) {
+          cuMemFree(ptr);
+        }
+      }
+    }
+    for (auto &m : modules_) {
+      cuModuleUnload(m.second);
+    }
+    if (context_) {
+      cuCtxDestroy(context_);
+    }
+  }
+
+  bool Init(const rainbowmist::CaptureFile &file, const Options &opts,
+            std::string *err) {
+    std::string source;
+    if (opts.source_file.empty() || !ReadFile(opts.source_file, &source)) {
+      return Fail("cuda needs a kernel source(-s)", err);
+    }
+    if (cuewInit(CUEW_INIT_CUDA | CUEW_INIT_NVRTC) != CUEW_SUCCESS ||
+        !nvrtcCreateProgram) {
+      return Fail("CUDA or NVRTC is not available", err);
+    }
+    CUdevice device;
+    if (cuInit(0) != CUDA_SUCCESS || cuDeviceGet(&device, 0) != CUDA_SUCCESS ||
+        cuCtxCreate(&context_, 0, device) != CUDA_SUCCESS) {
+      return Fail("no CUDA device", err);
+    }
+    if (rainbowmist::mockcuda::RegisterKernels()) {
+      printf("Using the mock CUDA driver.\n");
+    }
+
+    for (size_t i = 0; i < file.size(); i++) {
+      Launch l;
+      l.captured = file.launch(i);
+      std::string options = BuildOptions(l.captured, opts);
+      CUmodule &module = modules_[options];
+      if (!module && !Build(source, options, opts.source_file, &module, err)) {
+        return false;
+      }
+      if (cuModuleGetFunction(&l.function, module, l.captured.name.c_str()) !=
+          CUDA_SUCCESS) {
+        return Fail("no kernel `" + l.captured.name + "`", err);
+      }
+      // The grid has to cover the range exactly, so no thread runs outside
+      // of it.
+      if (l.captured.local_x) {
+        if (l.captured.global[0] % l.captured.local_x != 0) {
+          return Fail("the range of `" + l.captured.name +
+                          "` is not a multiple of its block",
+                      err);
+        }
+        l.block = l.captured.local_x;
+      } else {
+        l.block = 256;
+        while (l.captured.global[0] % l.block != 0) {
+          l.block--;
+        }
+        if (l.block < 32) {
+          fprintf(stderr,
+                  "replay: launch %zu(`%s`) runs in blocks of %u threads; "
+                  "capture its block size to replay it as launched.\n",
+                  i, l.captured.name.c_str(), l.block);
+        }
+      }
+      l.buffers.resize(l.captured.args.size(), 0);
+      for (size_t a = 0; a < l.captured.args.size(); a++) {
+        const rainbowmist::CaptureArg &arg = l.captured.args[a];
+        if (arg.kind == rainbowmist::kKernelArgBuffer &&
+            cuMemAlloc(&l.buffers[a], std::max(arg.size, size_t(1))) !=
+                CUDA_SUCCESS) {
+          return Fail("failed to allocate a buffer", err);
+        }
+      }
+      launches_.push_back(std::move(l));
+    }
+    // `buffers` do not move any more.
+    for (Launch &l : launches_) {
+      for (size_t a = 0; a < l.captured.args.size(); a++) {
+        l.params.push_back(
+            l.buffers[a] ? static_cast<void *>(&l.buffers[a])
+                         : const_cast<void *>(l.captured.args[a].data));
+      }
+    }
+    return true;
+  }
+
+  bool Reset(std::string *err) {
+    for (Launch &l : launches_) {
+      for (size_t a = 0; a < l.buffers.size(); a++) {
+        const rainbowmist::CaptureArg &arg = l.captured.args[a];
+        if (l.buffers[a] && arg.size > 0 &&
+            cuMemcpyHtoD(l.buffers[a], arg.data, arg.size) != CUDA_SUCCESS) {
+          return Fail("failed to upload a buffer", err);
+        }
+      }
+    }
+    return true;
+  }
+
+  bool Run(size_t i, std::string *err) {
+    Launch &l = launches_[i];
+    if (cuLaunchKernel(l.function, l.captured.global[0] / l.block,
+                       l.captured.global[1], l.captured.global[2], l.block, 1,
+                       1, 0, nullptr, l.params.data(),
+                       nullptr) != CUDA_SUCCESS ||
+        cuCtxSynchronize() != CUDA_SUCCESS) {
+      return Fail("failed to launch `" + l.captured.name + "`", err);
+    }
+    return true;
+  }
+
+ private:
+  struct Launch {
+    rainbowmist::CapturedLaunch captured;
+    CUfunction function = nullptr;
+    unsigned int block = 1;
+    std::vector<CUdeviceptr> buffers;  // 0 for scalars
+    std::vector<void *> params;
+  };
+
+  static bool Build(const std::string &source, const std::string &options,
+                    const std::string &filename, CUmodule *module,
+                    std::string *err) {
+    nvrtcProgram program;
+    if (nvrtcCreateProgram(&program, source.c_str(), filename.c_str(), 0,
+                           nullptr, nullptr) != NVRTC_SUCCESS) {
+      return Fail("failed to create an NVRTC program", err);
+    }
+    std::vector<std::string> words =
+        rainbowmist::NormalizeBuildOptions(options);
+    std::vector<const char *> raw_options;
+    for (const std::string &w : words) {
+      raw_options.push_back(w.c_str());
+    }
+    std::string ptx;
+    if (nvrtcCompileProgram(program, int(raw_options.size()),
+                            raw_options.data()) == NVRTC_SUCCESS) {
+      size_t size = 0;
+      nvrtcGetPTXSize(program, &size);
+      ptx.resize(size);
+      nvrtcGetPTX(program, &ptx[0]);
+    } else {
+      size_t size = 0;
+      nvrtcGetProgramLogSize(program, &size);
+      std::string log(size, '\0');
+      nvrtcGetProgramLog(program, &log[0]);
+      *err = "failed to build " + filename + " with `" + options + "`:\n" +
+             log;
+    }
+    nvrtcDestroyProgram(&program);
+    if (ptx.empty()) {
+      return false;
+    }
+    if (cuModuleLoadData(module, ptx.c_str()) != CUDA_SUCCESS) {
+      return Fail("failed to load the PTX of " + filename, err);
+    }
+    return true;
+  }
+
+  CUcontext context_ = nullptr;
+  std::map<std::string, CUmodule> modules_;  // By build options
+  std::vector<Launch> launches_;
+};
+
+// ------------
+
+void Usage() {
+  fprintf(stderr,
+          "usage: replay [-b cpp11|opencl|cuda] [-s kernel_source] "
+          "[-o build_options]\n"
+          "              [-n iterations] [-t threads] capture.rmcap\n");
+}
+
+bool ParseArgs(int argc, char **argv, Options *opts) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg.size() == 2 && arg[0] == '-' && i + 1 < argc) {
+      const char *value = argv[++i];
+      switch (arg[1]) {
+        case 'b':
+          opts->backend = value;
+          break;
+        case 's':
+          opts->source_file = value;
+          break;
+        case 'o':
+          opts->build_options = value;
+          break;
+        case 'n':
+          opts->iterations = atoi(value);
+          break;
+        case 't':
+          opts->num_threads = unsigned(atoi(value));
+          break;
+        default:
+          return false;
+      }
+    } else if (opts->capture_file.empty()) {
+      opts->capture_file = arg;
+    } else {
+      return false;
+    }
+  }
+  return !opts->capture_file.empty() && opts->iterations > 0;
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options opts;
+  if (!ParseArgs(argc, argv, &opts)) {
+    Usage();
+    return EXIT_FAILURE;
+  }
+
+  std::unique_ptr<Backend> backend;
+  if (opts.backend == "cpp11") {
+    backend.reset(new HostBackend());
+  } else if (opts.backend == "opencl") {
+    backend.reset(new OpenCLBackend());
+  } else if (opts.backend == "cuda") {
+    backend.reset(new CUDABackend());
+  } else {
+    Usage();
+    return EXIT_FAILURE;
+  }
+
+  rainbowmist::CaptureFile file;
+  std::string err;
+  if (!file.Open(opts.capture_file, &err) ||
+      !backend->Init(file, opts, &err)) {
+    fprintf(stderr, "replay: %s\n", err.c_str());
+    return EXIT_FAILURE;
+  }
+
+  // ms[i][iteration]
+  std::vector<std::vector<double>> ms(file.size());
+  for (int iter = 0; iter < opts.iterations; iter++) {
+    if (!backend->Reset(&err)) {
+      fprintf(stderr, "replay: %s\n", err.c_str());
+      return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < file.size(); i++) {
+      auto start = std::chrono::steady_clock::now();
+      if (!backend->Run(i, &err)) {
+        fprintf(stderr, "replay: %s\n", err.c_str());
+        return EXIT_FAILURE;
+      }
+      auto end = std::chrono::steady_clock::now();
+      ms[i].push_back(
+          std::chrono::duration<double, std::milli>(end - start).count());
+    }
+  }
+
+  printf("%zu launches, %d iterations on %s\n", file.size(), opts.iterations,
+         opts.backend.c_str());
+  printf("%5s %-24s %-20s %10s %10s %10s\n", "#", "kernel", "global", "min ms",
+         "median ms", "mean ms");
+  double total = 0.0;
+  for (size_t i = 0; i < file.size(); i++) {
+    rainbowmist::CapturedLaunch launch = file.launch(i);
+    std::vector<double> &t = ms[i];
+    std::sort(t.begin(), t.end());
+    double sum = 0.0;
+    for (double v : t) {
+      sum += v;
+    }
+    total += sum;
+    char global[64];
+    snprintf(global, sizeof(global), "%ux%ux%u", launch.global[0],
+             launch.global[1], launch.global[2]);
+    printf("%5zu %-24s %-20s %10.4f %10.4f %10.4f\n", i, launch.name.c_str(),
+           global, t.front(), t[t.size() / 2], sum / double(t.size()));
+  }
+  printf("total %.4f ms/iteration\n", total / opts.iterations);
+
+  return EXIT_SUCCESS;
+}